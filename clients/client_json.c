@@ -305,6 +305,13 @@ int client_volume(client_data_t *data, client_event_prototype_t proto, void *pro
 	return _client_generic(data, proto, protodata, "volume");
 }
 
+int client_seek(client_data_t *data, client_event_prototype_t proto, void *protodata, int position)
+{
+	data->params = json_object();
+	json_object_set_new(data->params, "position", json_integer(position));
+	return _client_generic(data, proto, protodata, "seek");
+}
+
 int client_setnext(client_data_t *data, client_event_prototype_t proto, void *protodata, int id)
 {
 	data->params = json_object();
@@ -64,6 +64,7 @@ int client_pause(client_data_t *data, client_event_prototype_t proto, void *prot
 int client_stop(client_data_t *data, client_event_prototype_t proto, void *protodata);
 int client_getposition(client_data_t *data, client_event_prototype_t proto, void *protodata);
 int client_volume(client_data_t *data, client_event_prototype_t proto, void *protodata, int step);
+int client_seek(client_data_t *data, client_event_prototype_t proto, void *protodata, int position);
 int client_status(client_data_t *data, client_event_prototype_t proto, void *protodata);
 int client_setnext(client_data_t *data, client_event_prototype_t proto, void *protodata, int id);
 
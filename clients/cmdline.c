@@ -99,6 +99,7 @@ static int method_pause(ctx_t *ctx, const char *arg);
 static int method_stop(ctx_t *ctx, const char *arg);
 static int method_next(ctx_t *ctx, const char *arg);
 static int method_volume(ctx_t *ctx, const char *arg);
+static int method_seek(ctx_t *ctx, const char *arg);
 static int method_repeat(ctx_t *ctx, const char *arg);
 static int method_shuffle(ctx_t *ctx, const char *arg);
 static int method_quit(ctx_t *ctx, const char *arg);
@@ -169,6 +170,10 @@ static const struct cmd_s cmds[] = {{
 		.shortkey = 0,
 		.name = "volume",
 		.method = method_volume,
+	},{
+		.shortkey = 0,
+		.name = "seek",
+		.method = method_seek,
 	},{
 		.shortkey = 0,
 		.name = "repeat",
@@ -265,6 +270,18 @@ static int method_volume(ctx_t *ctx, const char *arg)
 	return ret;
 }
 
+static int method_seek(ctx_t *ctx, const char *arg)
+{
+	int ret = -1;
+	if (arg != NULL)
+	{
+		int position = atoi(arg);
+		if (position >= 0)
+			ret = client_seek(ctx->client, NULL, ctx, position);
+	}
+	return ret;
+}
+
 static int method_media(ctx_t *ctx, const char *arg)
 {
 	int ret = -1;
@@ -538,6 +555,8 @@ static int method_help(ctx_t *ctx, const char *arg)
 	fprintf(stdout, "        <on|off>\n");
 	fprintf(stdout, " volume : request to change the level of volume on putv server\n");
 	fprintf(stdout, "        <0..100>\n");
+	fprintf(stdout, " seek   : request to play the current opus from a position\n");
+	fprintf(stdout, "        <seconds>\n");
 	fprintf(stdout, " media  : request to change the media\n");
 	fprintf(stdout, "        <media url>\n");
 	fprintf(stdout, " list   : display the opus from the media\n");
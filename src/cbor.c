@@ -0,0 +1,385 @@
+/*****************************************************************************
+ * cbor.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <jansson.h>
+
+#include "cbor.h"
+
+#define CBOR_MAXDEPTH 32
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+#define CBOR_NULL 22
+#define CBOR_HALF 25
+#define CBOR_FLOAT 26
+#define CBOR_DOUBLE 27
+
+typedef struct cbor_reader_s cbor_reader_t;
+struct cbor_reader_s
+{
+	const unsigned char *buffer;
+	size_t length;
+	size_t offset;
+};
+
+static int _cbor_head(cbor_reader_t *reader, int *major, uint64_t *argument)
+{
+	if (reader->offset >= reader->length)
+		return -1;
+	unsigned char initial = reader->buffer[reader->offset++];
+	*major = initial >> 5;
+	int info = initial & 0x1f;
+	if (info < 24)
+	{
+		*argument = info;
+		return info;
+	}
+	/// the indefinite lengths (31) are not supported
+	if (info > 27)
+		return -1;
+	size_t size = 1 << (info - 24);
+	if (reader->length - reader->offset < size)
+		return -1;
+	uint64_t value = 0;
+	size_t i;
+	for (i = 0; i < size; i++)
+		value = (value << 8) | reader->buffer[reader->offset++];
+	*argument = value;
+	return info;
+}
+
+static double _cbor_half(uint16_t half)
+{
+	int exponent = (half >> 10) & 0x1f;
+	int mantissa = half & 0x3ff;
+	double value;
+	if (exponent == 0)
+		value = mantissa / 16777216.0;
+	else if (exponent != 31)
+		value = (mantissa + 1024) * ((double)(1 << exponent) / 33554432.0);
+	else
+		value = (mantissa == 0)? __builtin_inf(): __builtin_nan("");
+	return (half & 0x8000)? -value: value;
+}
+
+static json_t *_cbor_load(cbor_reader_t *reader, int depth)
+{
+	int major;
+	uint64_t argument;
+	int info = _cbor_head(reader, &major, &argument);
+	if (info < 0 || depth > CBOR_MAXDEPTH)
+		return NULL;
+
+	json_t *value = NULL;
+	switch (major)
+	{
+	case CBOR_UNSIGNED:
+		if (argument > INT64_MAX)
+			return NULL;
+		value = json_integer(argument);
+	break;
+	case CBOR_NEGATIVE:
+		if (argument > INT64_MAX)
+			return NULL;
+		value = json_integer(-1 - (json_int_t)argument);
+	break;
+	case CBOR_BYTES:
+	case CBOR_TEXT:
+		if (reader->length - reader->offset < argument)
+			return NULL;
+		value = json_stringn((const char *)reader->buffer + reader->offset, argument);
+		reader->offset += argument;
+	break;
+	case CBOR_ARRAY:
+	{
+		/// each item needs at least one byte
+		if (reader->length - reader->offset < argument)
+			return NULL;
+		value = json_array();
+		uint64_t i;
+		for (i = 0; i < argument; i++)
+		{
+			json_t *item = _cbor_load(reader, depth + 1);
+			if (item == NULL)
+			{
+				json_decref(value);
+				return NULL;
+			}
+			json_array_append_new(value, item);
+		}
+	}
+	break;
+	case CBOR_MAP:
+	{
+		if ((reader->length - reader->offset) / 2 < argument)
+			return NULL;
+		value = json_object();
+		uint64_t i;
+		for (i = 0; i < argument; i++)
+		{
+			json_t *key = _cbor_load(reader, depth + 1);
+			json_t *item = NULL;
+			if (key != NULL && json_is_string(key))
+				item = _cbor_load(reader, depth + 1);
+			if (item == NULL)
+			{
+				json_decref(key);
+				json_decref(value);
+				return NULL;
+			}
+			json_object_set_new(value, json_string_value(key), item);
+			json_decref(key);
+		}
+	}
+	break;
+	case CBOR_TAG:
+		/// the tags are skipped, only the tagged item is kept
+		value = _cbor_load(reader, depth + 1);
+	break;
+	case CBOR_SIMPLE:
+		if (info <= 24)
+		{
+			if (argument == CBOR_FALSE)
+				value = json_false();
+			else if (argument == CBOR_TRUE)
+				value = json_true();
+			else if (argument == CBOR_NULL)
+				value = json_null();
+		}
+		else if (info == CBOR_HALF)
+			value = json_real(_cbor_half(argument));
+		else if (info == CBOR_FLOAT)
+		{
+			uint32_t bits = argument;
+			float real;
+			memcpy(&real, &bits, sizeof(real));
+			value = json_real(real);
+		}
+		else if (info == CBOR_DOUBLE)
+		{
+			double real;
+			memcpy(&real, &argument, sizeof(real));
+			value = json_real(real);
+		}
+	break;
+	}
+	return value;
+}
+
+json_t *cbor_loadb(const unsigned char *buffer, size_t length, size_t *used)
+{
+	cbor_reader_t reader = {
+		.buffer = buffer,
+		.length = length,
+		.offset = 0,
+	};
+	json_t *value = _cbor_load(&reader, 0);
+	if (used != NULL)
+		*used = reader.offset;
+	return value;
+}
+
+typedef struct cbor_writer_s cbor_writer_t;
+struct cbor_writer_s
+{
+	unsigned char *buffer;
+	size_t length;
+	size_t size;
+};
+
+static int _cbor_reserve(cbor_writer_t *writer, size_t length)
+{
+	if (writer->length + length <= writer->size)
+		return 0;
+	size_t size = writer->size * 2;
+	while (size < writer->length + length)
+		size *= 2;
+	unsigned char *buffer = realloc(writer->buffer, size);
+	if (buffer == NULL)
+		return -1;
+	writer->buffer = buffer;
+	writer->size = size;
+	return 0;
+}
+
+static int _cbor_writehead(cbor_writer_t *writer, int major, uint64_t argument)
+{
+	if (_cbor_reserve(writer, 9) < 0)
+		return -1;
+	unsigned char *out = writer->buffer + writer->length;
+	int size;
+	int info;
+	if (argument < 24)
+	{
+		size = 0;
+		info = argument;
+	}
+	else if (argument <= UINT8_MAX)
+	{
+		size = 1;
+		info = 24;
+	}
+	else if (argument <= UINT16_MAX)
+	{
+		size = 2;
+		info = 25;
+	}
+	else if (argument <= UINT32_MAX)
+	{
+		size = 4;
+		info = 26;
+	}
+	else
+	{
+		size = 8;
+		info = 27;
+	}
+	out[0] = (major << 5) | info;
+	int i;
+	for (i = 0; i < size; i++)
+		out[1 + i] = argument >> (8 * (size - 1 - i));
+	writer->length += 1 + size;
+	return 0;
+}
+
+static int _cbor_writebytes(cbor_writer_t *writer, const void *data, size_t length)
+{
+	if (_cbor_reserve(writer, length) < 0)
+		return -1;
+	memcpy(writer->buffer + writer->length, data, length);
+	writer->length += length;
+	return 0;
+}
+
+static int _cbor_dump(cbor_writer_t *writer, json_t *value)
+{
+	int ret = -1;
+	switch (json_typeof(value))
+	{
+	case JSON_INTEGER:
+	{
+		json_int_t integer = json_integer_value(value);
+		if (integer >= 0)
+			ret = _cbor_writehead(writer, CBOR_UNSIGNED, integer);
+		else
+			ret = _cbor_writehead(writer, CBOR_NEGATIVE, -1 - integer);
+	}
+	break;
+	case JSON_REAL:
+	{
+		double real = json_real_value(value);
+		uint64_t bits;
+		memcpy(&bits, &real, sizeof(bits));
+		/// _cbor_writehead would choose the shortest size
+		ret = _cbor_reserve(writer, 9);
+		if (ret == 0)
+		{
+			unsigned char *out = writer->buffer + writer->length;
+			out[0] = (CBOR_SIMPLE << 5) | CBOR_DOUBLE;
+			int i;
+			for (i = 0; i < 8; i++)
+				out[1 + i] = bits >> (8 * (7 - i));
+			writer->length += 9;
+		}
+	}
+	break;
+	case JSON_STRING:
+		ret = _cbor_writehead(writer, CBOR_TEXT, json_string_length(value));
+		if (ret == 0)
+			ret = _cbor_writebytes(writer, json_string_value(value), json_string_length(value));
+	break;
+	case JSON_ARRAY:
+	{
+		size_t index;
+		json_t *item;
+		ret = _cbor_writehead(writer, CBOR_ARRAY, json_array_size(value));
+		json_array_foreach(value, index, item)
+		{
+			if (ret == 0)
+				ret = _cbor_dump(writer, item);
+		}
+	}
+	break;
+	case JSON_OBJECT:
+	{
+		const char *key;
+		json_t *item;
+		ret = _cbor_writehead(writer, CBOR_MAP, json_object_size(value));
+		json_object_foreach(value, key, item)
+		{
+			if (ret == 0)
+				ret = _cbor_writehead(writer, CBOR_TEXT, strlen(key));
+			if (ret == 0)
+				ret = _cbor_writebytes(writer, key, strlen(key));
+			if (ret == 0)
+				ret = _cbor_dump(writer, item);
+		}
+	}
+	break;
+	case JSON_TRUE:
+		ret = _cbor_writehead(writer, CBOR_SIMPLE, CBOR_TRUE);
+	break;
+	case JSON_FALSE:
+		ret = _cbor_writehead(writer, CBOR_SIMPLE, CBOR_FALSE);
+	break;
+	case JSON_NULL:
+		ret = _cbor_writehead(writer, CBOR_SIMPLE, CBOR_NULL);
+	break;
+	}
+	return ret;
+}
+
+unsigned char *cbor_dumpb(json_t *value, size_t *length)
+{
+	cbor_writer_t writer = {
+		.buffer = malloc(64),
+		.length = 0,
+		.size = 64,
+	};
+	if (writer.buffer == NULL)
+		return NULL;
+	if (_cbor_dump(&writer, value) < 0)
+	{
+		free(writer.buffer);
+		return NULL;
+	}
+	*length = writer.length;
+	return writer.buffer;
+}
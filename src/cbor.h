@@ -0,0 +1,27 @@
+#ifndef __CBOR_H__
+#define __CBOR_H__
+
+#include <stddef.h>
+
+/**
+ * the self-describe tag of CBOR, sent by a client at the start
+ * of the connection to use the binary framing.
+ */
+#define CBOR_MAGIC "\xd9\xd9\xf7"
+#define CBOR_MAGICLENGTH 3
+
+typedef struct json_t json_t;
+
+/**
+ * decode one CBOR item into a new jansson value
+ * @param used	set with the length of the item
+ * @return NULL if the item is invalid, incomplete or not supported
+ */
+json_t *cbor_loadb(const unsigned char *buffer, size_t length, size_t *used);
+/**
+ * encode a jansson value
+ * @return the buffer to free, or NULL on error
+ */
+unsigned char *cbor_dumpb(json_t *value, size_t *length);
+
+#endif
@@ -26,4 +26,5 @@ extern cmds_ops_t *cmds_line;
 extern cmds_ops_t *cmds_json;
 extern cmds_ops_t *cmds_input;
 extern cmds_ops_t *cmds_tinysvcmdns;
+extern cmds_ops_t *cmds_status;
 #endif
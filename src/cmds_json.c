@@ -32,11 +32,16 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include <pthread.h>
 #include <jansson.h>
 
 #include "unix_server.h"
+#ifdef JSONRPC_CBOR
+#include "cbor.h"
+#endif
 #include "player.h"
 #include "jsonrpc.h"
 typedef struct json_request_list_s json_request_list_t;
@@ -44,10 +49,74 @@ struct json_request_list_s
 {
 	json_request_list_t *next;
 	json_t *request;
-	thread_info_t *info;
+	/** the id of the client, 0 when the client left */
+	unsigned int client;
 	int id;
 };
 
+/**
+ * a message is encoded once and shared by the outboxes of the clients
+ */
+typedef struct json_message_s json_message_t;
+struct json_message_s
+{
+	int refs;
+	/** the notifications may be replaced by a newer one */
+	int event;
+	size_t length;
+	char *data;
+};
+
+#define JSON_OUTBOX 16
+/// the largest binary frame accepted from a client
+#define JSON_MAXFRAME (1024 * 1024)
+
+typedef enum json_framing_e json_framing_t;
+enum json_framing_e
+{
+	FRAMING_TEXT,
+	/** length (32 bits big endian) and CBOR item */
+	FRAMING_CBOR,
+};
+
+typedef struct json_client_s json_client_t;
+struct json_client_s
+{
+	json_client_t *next;
+	thread_info_t *info;
+	/**
+	 * the requests refer to the client by its id, the thread_info
+	 * of a closed connection may be reused by the next one.
+	 */
+	unsigned int id;
+	int sock;
+	int error;
+	json_framing_t framing;
+	unsigned char *inbuffer;
+	size_t inlength;
+	size_t insize;
+	json_message_t *outbox[JSON_OUTBOX];
+	unsigned int first;
+	unsigned int count;
+	/** the length of the first message already sent */
+	size_t offset;
+	/** the requests queued and not answered yet */
+	unsigned int pending;
+	/** the socket is not read while too many requests are pending */
+	int paused;
+	/** a request is delayed, the next ones of the client wait too */
+	int delayed;
+	/** the client doesn't write anymore, it is closed after the last answer */
+	int hangup;
+#ifdef JSONRPC_CBOR
+	/** the first bytes may still be the CBOR tag */
+	int detect;
+	/** the bytes of the tag already received */
+	unsigned char magic[CBOR_MAGICLENGTH];
+	unsigned int magiclength;
+#endif
+};
+
 typedef enum eventsmask_e eventsmask_t;
 enum eventsmask_e
 {
@@ -62,11 +131,15 @@ struct cmds_ctx_s
 	const char *socketpath;
 	pthread_t threadrecv;
 	pthread_t threadsend;
-	pthread_cond_t cond;
 	pthread_mutex_t mutex;
-	thread_info_t *info;
+	thread_server_t *server;
+	json_client_t *clients;
 	json_request_list_t *requests;
+	json_request_list_t **lastrequest;
+	unsigned int lastclient;
 	unsigned int eventsmask;
+	int epollfd;
+	int wakeup;
 	int run;
 	int onchangeid;
 };
@@ -76,6 +149,7 @@ struct cmds_ctx_s
 #include "decoder.h"
 #include "src.h"
 #include "sink.h"
+#include "metrics.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -177,7 +251,7 @@ static int method_list(json_t *json_params, json_t **result, void *userdata)
 	int count = media->ops->count(media->ctx);
 	cmds_dbg("cmds: list");
 
-	if (media->ops->list == NULL)
+	if (media->ops->list == NULL && media->ops->listpage == NULL)
 	{
 		*result = jsonrpc_error_object(JSONRPC_INVALID_REQUEST, "Method not available", json_null());
 		return -1;
@@ -205,13 +279,57 @@ static int method_list(json_t *json_params, json_t **result, void *userdata)
 		entry.first = 0;
 
 	entry.count = 0;
-	media->ops->list(media->ctx, _append_entry, (void *)&entry);
+	if (media->ops->listpage != NULL)
+		media->ops->listpage(media->ctx, entry.first, entry.max, _append_entry, (void *)&entry);
+	else
+		media->ops->list(media->ctx, _append_entry, (void *)&entry);
 	*result = json_pack("{s:i,s:i,s:o}",
 		"count", count, "nbitems", entry.count, "playlist", entry.list);
 
 	return 0;
 }
 
+static int method_search(json_t *json_params, json_t **result, void *userdata)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)userdata;
+	media_t *media = player_media(ctx->player);
+	cmds_dbg("cmds: search");
+
+	if (media->ops->search == NULL)
+	{
+		*result = jsonrpc_error_object(JSONRPC_INVALID_REQUEST, "Method not available", json_null());
+		return -1;
+	}
+
+	json_t *keyword_js = json_object_get(json_params, "keyword");
+	if (!json_is_string(keyword_js))
+	{
+		*result = jsonrpc_error_object(JSONRPC_INVALID_REQUEST, "keyword not found", json_null());
+		return -1;
+	}
+
+	entry_t entry;
+	entry.list = json_array();
+	entry.max = MAX_ITEMS;
+	json_t *maxitems_js = json_object_get(json_params, "maxitems");
+	if (maxitems_js && json_integer_value(maxitems_js) > 0)
+		entry.max = json_integer_value(maxitems_js);
+	/**
+	 * first is the offset into the result and not an id
+	 */
+	int first = 0;
+	json_t *first_js = json_object_get(json_params, "first");
+	if (first_js)
+		first = json_integer_value(first_js);
+	entry.first = 0;
+	entry.count = 0;
+
+	media->ops->search(media->ctx, json_string_value(keyword_js), first, entry.max, _append_entry, (void *)&entry);
+	*result = json_pack("{s:i,s:o}", "nbitems", entry.count, "playlist", entry.list);
+
+	return 0;
+}
+
 static int method_info(json_t *json_params, json_t **result, void *userdata)
 {
 	int ret;
@@ -680,6 +798,110 @@ static int method_getposition(json_t *json_params, json_t **result, void *userda
 	return ret;
 }
 
+/**
+ * the stream is seekable if the source and its decoder support it.
+ */
+static int _cmds_seekable(const src_t *src)
+{
+	if (src == NULL || src->ops->seek == NULL)
+		return 0;
+	decoder_t *decoder = src->ops->estream(src->ctx, 0);
+	return (decoder != NULL && decoder->ops->seek != NULL);
+}
+
+static int method_seek(json_t *json_params, json_t **result, void *userdata)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)userdata;
+	const src_t *src = player_source(ctx->player);
+	if (!_cmds_seekable(src))
+	{
+		*result = jsonrpc_error_object(JSONRPC_INVALID_REQUEST, "Method not available", json_null());
+		return -1;
+	}
+	json_t *value = NULL;
+	if (json_is_object(json_params))
+		value = json_object_get(json_params, "position");
+	if (value == NULL || !json_is_integer(value) || json_integer_value(value) < 0)
+	{
+		*result = jsonrpc_error_object_predefined(JSONRPC_INVALID_PARAMS, json_string("position required"));
+		return -1;
+	}
+	uint32_t position = json_integer_value(value);
+	if (src->ops->seek(src->ctx, position) < 0)
+	{
+		*result = jsonrpc_error_object(JSONRPC_INVALID_REQUEST, "Stream not seekable", json_null());
+		return -1;
+	}
+	*result = json_pack("{s:i}", "position", position);
+	return 0;
+}
+
+#ifdef METRICS
+static int method_stats(json_t *json_params, json_t **result, void *userdata)
+{
+	metrics_t *metrics = metrics_get();
+	int i;
+
+	json_t *jitters = json_array();
+	for (i = 0; i < METRICS_MAXJITTERS; i++)
+	{
+		metrics_jitter_t *jitter = &metrics->jitters[i];
+		if (jitter->name[0] == '\0')
+			continue;
+		json_t *value = json_pack("{s:s,s:i,s:i,s:i,s:i,s:I,s:I,s:I,s:I,s:I,s:I}",
+			"name", jitter->name,
+			"count", METRICS_GET(jitter->count),
+			"size", METRICS_GET(jitter->size),
+			"level", METRICS_GET(jitter->level),
+			"levelmax", METRICS_GET(jitter->levelmax),
+			"push", (json_int_t)METRICS_GET(jitter->npush),
+			"pop", (json_int_t)METRICS_GET(jitter->npop),
+			"overflow", (json_int_t)METRICS_GET(jitter->overflow),
+			"pullwait", (json_int_t)METRICS_GET(jitter->pullwait),
+			"underrun", (json_int_t)METRICS_GET(jitter->underrun),
+			"peerwait", (json_int_t)METRICS_GET(jitter->peerwait));
+		json_array_append_new(jitters, value);
+	}
+	json_t *stages = json_array();
+	for (i = 0; i < METRICS_MAXSTAGES; i++)
+	{
+		metrics_stage_t *stage = &metrics->stages[i];
+		if (stage->name[0] == '\0')
+			continue;
+		json_t *value = json_pack("{s:s,s:I,s:I,s:I}",
+			"name", stage->name,
+			"runs", (json_int_t)METRICS_GET(stage->nruns),
+			"time", (json_int_t)METRICS_GET(stage->time),
+			"timemax", (json_int_t)METRICS_GET(stage->timemax));
+		json_array_append_new(stages, value);
+	}
+	json_t *ssrcs = json_array();
+	for (i = 0; i < METRICS_MAXSSRC; i++)
+	{
+		metrics_ssrc_t *ssrc = &metrics->ssrc[i];
+		if (!METRICS_GET(ssrc->used))
+			continue;
+		json_t *value = json_pack("{s:I,s:I,s:I}",
+			"ssrc", (json_int_t)ssrc->ssrc,
+			"received", (json_int_t)METRICS_GET(ssrc->received),
+			"missing", (json_int_t)METRICS_GET(ssrc->missing));
+		json_array_append_new(ssrcs, value);
+	}
+	metrics_heartbeat_t *heartbeat = &metrics->heartbeat;
+	*result = json_pack("{s:I,s:o,s:o,s:{s:I,s:I,s:I,s:I},s:o}",
+		"uptime", (json_int_t)(metrics_now() - metrics->start),
+		"jitters", jitters,
+		"stages", stages,
+		"heartbeat",
+			"beats", (json_int_t)METRICS_GET(heartbeat->nbeats),
+			"late", (json_int_t)METRICS_GET(heartbeat->late),
+			"lateness", (json_int_t)METRICS_GET(heartbeat->lateness),
+			"latemax", (json_int_t)METRICS_GET(heartbeat->latemax),
+		"rtp", ssrcs);
+	return 0;
+}
+#endif
+
 typedef struct _display_ctx_s _display_ctx_t;
 struct _display_ctx_s
 {
@@ -960,6 +1182,91 @@ static int method_volume(json_t *json_params, json_t **result, void *userdata)
 	return 0;
 }
 
+#ifdef FILTER_EQ
+/**
+ * {"bands":[{"type":"lowshelf","frequency":100,"gain":3,"q":0.7}, ...]}
+ * the type is "lowshelf", "highshelf" or "peaking" (default),
+ * an empty list sets a flat equalizer.
+ */
+static int method_equalizer(json_t *json_params, json_t **result, void *userdata)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)userdata;
+	json_t *bands = NULL;
+	if (json_is_object(json_params))
+		bands = json_object_get(json_params, "bands");
+	if (!json_is_array(bands) || json_array_size(bands) > EQ_MAXBANDS)
+	{
+		*result = jsonrpc_error_object_predefined(JSONRPC_INVALID_PARAMS, json_string("bands required"));
+		return -1;
+	}
+	char settings[3 + EQ_MAXBANDS * 48] = "eq=";
+	size_t length = 3;
+	size_t index;
+	json_t *band;
+	json_array_foreach(bands, index, band)
+	{
+		json_t *frequency = json_object_get(band, "frequency");
+		json_t *gain = json_object_get(band, "gain");
+		if (!json_is_number(frequency) || !json_is_number(gain))
+		{
+			*result = jsonrpc_error_object_predefined(JSONRPC_INVALID_PARAMS, json_string("frequency and gain required"));
+			return -1;
+		}
+		const char *type = json_string_value(json_object_get(band, "type"));
+		char prefix = 'p';
+		if (type != NULL && !strcmp(type, "lowshelf"))
+			prefix = 'l';
+		else if (type != NULL && !strcmp(type, "highshelf"))
+			prefix = 'h';
+		length += snprintf(settings + length, sizeof(settings) - length, "%s%c%g:%g",
+				(index > 0)? ",": "", prefix, json_number_value(frequency), json_number_value(gain));
+		json_t *q = json_object_get(band, "q");
+		if (json_is_number(q))
+			length += snprintf(settings + length, sizeof(settings) - length, ":%g", json_number_value(q));
+	}
+	if (player_filter(ctx->player, settings) < 0)
+	{
+		*result = jsonrpc_error_object(JSONRPC_INVALID_REQUEST, "Equalizer not installed", json_null());
+		return -1;
+	}
+	*result = json_pack("{s:s}", "settings", settings + 3);
+	return 0;
+}
+#endif
+
+#ifdef FILTER_DRC
+/**
+ * {"threshold":-20,"ratio":4,"attack":10,"release":200,"makeup":0}
+ * threshold and makeup in dB, attack and release in ms.
+ */
+static int method_compressor(json_t *json_params, json_t **result, void *userdata)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)userdata;
+	const char *keys[] = {"threshold", "ratio", "attack", "release", "makeup"};
+	double values[] = {-20, 4, 10, 200, 0};
+	int i;
+	for (i = 0; i < sizeof(keys) / sizeof(*keys); i++)
+	{
+		json_t *value = NULL;
+		if (json_is_object(json_params))
+			value = json_object_get(json_params, keys[i]);
+		if (json_is_number(value))
+			values[i] = json_number_value(value);
+	}
+	char settings[128];
+	snprintf(settings, sizeof(settings), "drc=%g:%g:%g:%g:%g",
+			values[0], values[1], values[2], values[3], values[4]);
+	if (player_filter(ctx->player, settings) < 0)
+	{
+		*result = jsonrpc_error_object(JSONRPC_INVALID_REQUEST, "Compressor not installed", json_null());
+		return -1;
+	}
+	*result = json_pack("{s:f,s:f,s:f,s:f,s:f}", keys[0], values[0], keys[1], values[1],
+			keys[2], values[2], keys[3], values[3], keys[4], values[4]);
+	return 0;
+}
+#endif
+
 static int method_capabilities(json_t *json_params, json_t **result, void *userdata)
 {
 	cmds_ctx_t *ctx = (cmds_ctx_t *)userdata;
@@ -1139,6 +1446,17 @@ static int method_capabilities(json_t *json_params, json_t **result, void *userd
 		json_object_set(action, "params", params);
 		json_array_append(actions, action);
 	}
+	if (media->ops->search != NULL)
+	{
+		action = json_object();
+		value = json_string("search");
+		json_object_set(action, "method", value);
+		params = json_array();
+		value = json_string("keyword");
+		json_array_append(params, value);
+		json_object_set(action, "params", params);
+		json_array_append(actions, action);
+	}
 	if (ctx->sink && ctx->sink->ops->getvolume != NULL)
 	{
 		action = json_object();
@@ -1167,6 +1485,48 @@ static int method_capabilities(json_t *json_params, json_t **result, void *userd
 		json_object_set(action, "params", params);
 		json_array_append(actions, action);
 	}
+	if (_cmds_seekable(src))
+	{
+		action = json_object();
+		value = json_string("seek");
+		json_object_set(action, "method", value);
+		params = json_array();
+		value = json_string("position");
+		json_array_append(params, value);
+		json_object_set(action, "params", params);
+		json_array_append(actions, action);
+	}
+#ifdef FILTER_EQ
+	action = json_object();
+	value = json_string("equalizer");
+	json_object_set(action, "method", value);
+	params = json_array();
+	value = json_string("bands");
+	json_array_append(params, value);
+	json_object_set(action, "params", params);
+	json_array_append(actions, action);
+#endif
+#ifdef FILTER_DRC
+	action = json_object();
+	value = json_string("compressor");
+	json_object_set(action, "method", value);
+	params = json_array();
+	json_array_append(params, json_string("threshold"));
+	json_array_append(params, json_string("ratio"));
+	json_array_append(params, json_string("attack"));
+	json_array_append(params, json_string("release"));
+	json_array_append(params, json_string("makeup"));
+	json_object_set(action, "params", params);
+	json_array_append(actions, action);
+#endif
+#ifdef METRICS
+	action = json_object();
+	value = json_string("stats");
+	json_object_set(action, "method", value);
+	params = json_null();
+	json_object_set(action, "params", params);
+	json_array_append(actions, action);
+#endif
 	json_object_set(*result, "actions", actions);
 
 	json_t *input;
@@ -1257,6 +1617,7 @@ static struct jsonrpc_method_entry_t method_table[] = {
 	{ 'r', "info", method_info, "o" },
 	{ 'r', "setinfo", method_setinfo, "o" },
 	{ 'r', "filter", method_filter, "o" },
+	{ 'r', "search", method_search, "o" },
 	{ 'r', "append", method_append, "[]" },
 	{ 'r', "remove", method_remove, "o" },
 	{ 'r', "status", method_status, "" },
@@ -1265,6 +1626,16 @@ static struct jsonrpc_method_entry_t method_table[] = {
 	{ 'r', "options", method_options, "o" },
 	{ 'r', "volume", method_volume, "o" },
 	{ 'r', "getposition", method_getposition, "" },
+	{ 'r', "seek", method_seek, "o" },
+#ifdef FILTER_EQ
+	{ 'r', "equalizer", method_equalizer, "o" },
+#endif
+#ifdef FILTER_DRC
+	{ 'r', "compressor", method_compressor, "o" },
+#endif
+#ifdef METRICS
+	{ 'r', "stats", method_stats, "" },
+#endif
 	{ 0, NULL },
 };
 
@@ -1295,18 +1666,19 @@ static int _cmds_send(const char *buff, size_t size, void *userctx)
 static size_t _cmds_recv(void *buff, size_t size, void *userctx)
 {
 	thread_info_t *info = (thread_info_t *)userctx;
-	cmds_ctx_t *ctx = info->userctx;
+	json_client_t *client = (json_client_t *)info->data;
 	int sock = info->sock;
 
-	size = recv(sock,
+	ssize_t ret = recv(sock,
 		buff, size, MSG_PEEK | MSG_DONTWAIT | MSG_NOSIGNAL);
-	if ((ssize_t)size <= 0)
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
 	{
 		err("cmds: json recv error %s", strerror(errno));
-		close(sock);
-		info->sock = -1;
-		return size;
+		client->error = 1;
 	}
+	if (ret <= 0)
+		return (size_t)-1;
+	size = ret;
 
 	size_t length = strlen(buff) + 1;
 	if (length < size)
@@ -1320,6 +1692,13 @@ static size_t _cmds_recv(void *buff, size_t size, void *userctx)
 	return size;
 }
 
+static void _cmds_json_wakeup(cmds_ctx_t *ctx)
+{
+	uint64_t value = 1;
+	if (write(ctx->wakeup, &value, sizeof(value)) < 0)
+		err("cmds: wakeup error %s", strerror(errno));
+}
+
 static void jsonrpc_onchange(void * userctx, event_t event, void *eventarg)
 {
 	cmds_ctx_t *ctx = (cmds_ctx_t *)userctx;
@@ -1330,85 +1709,307 @@ static void jsonrpc_onchange(void * userctx, event_t event, void *eventarg)
 			pthread_mutex_lock(&ctx->mutex);
 			ctx->eventsmask |= ONCHANGE;
 			pthread_mutex_unlock(&ctx->mutex);
-			pthread_cond_broadcast(&ctx->cond);
+			_cmds_json_wakeup(ctx);
 		break;
 	}
 }
 
-static int jsonrpc_sendevent(cmds_ctx_t *ctx, thread_info_t *info, const char *event)
+static json_message_t *_json_message(json_t *object, int event, json_framing_t framing)
 {
-	int ret = 0;
+	char *data = NULL;
+	size_t length = 0;
+#ifdef JSONRPC_CBOR
+	if (framing == FRAMING_CBOR)
+	{
+		unsigned char *item = cbor_dumpb(object, &length);
+		if (item != NULL)
+			data = malloc(length + 4);
+		if (data != NULL)
+		{
+			data[0] = length >> 24;
+			data[1] = length >> 16;
+			data[2] = length >> 8;
+			data[3] = length;
+			memcpy(data + 4, item, length);
+			length += 4;
+		}
+		free(item);
+	}
+	else
+#endif
+	{
+		data = json_dumps(object, JSONRPC_DEBUG_FORMAT);
+		if (data != NULL)
+			length = strlen(data);
+	}
+	if (data == NULL)
+		return NULL;
+	json_message_t *message = calloc(1, sizeof(*message));
+	message->refs = 1;
+	message->event = event;
+	message->data = data;
+	message->length = length;
+	return message;
+}
 
-	json_t *notification = jsonrpc_jrequest(event, method_table, (void *)ctx, NULL);
-	if (notification)
-	{
-		char *message = json_dumps(notification, JSONRPC_DEBUG_FORMAT);
-		int length = strlen(message);
-		int sock = info->sock;
-		cmds_dbg("cmds: send notification %d %*s", length, length, message);
-		ret = send(sock, message, length, MSG_DONTWAIT | MSG_NOSIGNAL);
-		dbg("cmds: send notification %d", ret);
-		fsync(sock);
+static void _json_messagerelease(json_message_t *message)
+{
+	if (__atomic_sub_fetch(&message->refs, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		free(message->data);
 		free(message);
-		json_decref(notification);
 	}
-	else
+}
+
+/**
+ * must be called with the lock
+ */
+static int _json_outboxpush(json_client_t *client, json_message_t *message)
+{
+	unsigned int i;
+	if (message->event)
+	{
+		/**
+		 * a slow client receives only the last state,
+		 * the first message may be partially sent and is kept.
+		 */
+		for (i = (client->offset > 0)?1:0; i < client->count; i++)
+		{
+			unsigned int index = (client->first + i) % JSON_OUTBOX;
+			json_message_t *old = client->outbox[index];
+			if (old->event == message->event)
+			{
+				__atomic_add_fetch(&message->refs, 1, __ATOMIC_RELAXED);
+				client->outbox[index] = message;
+				_json_messagerelease(old);
+				return 0;
+			}
+		}
+	}
+	if (client->count == JSON_OUTBOX)
+		return -1;
+	__atomic_add_fetch(&message->refs, 1, __ATOMIC_RELAXED);
+	client->outbox[(client->first + client->count) % JSON_OUTBOX] = message;
+	client->count++;
+	return 0;
+}
+
+/**
+ * must be called with the lock
+ * the socket is non blocking, the rest of the outbox
+ * is sent when epoll reports the socket writable.
+ */
+static int _json_outboxflush(json_client_t *client)
+{
+	while (client->count > 0)
 	{
-		err("cmds: unkonwn event %s", event);
+		json_message_t *message = client->outbox[client->first];
+		ssize_t ret = send(client->sock, message->data + client->offset,
+				message->length - client->offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (ret < 0)
+			return -1;
+		client->offset += ret;
+		if (client->offset < message->length)
+			continue;
+		dbg("cmds: send message %lu", message->length);
+		_json_messagerelease(message);
+		client->outbox[client->first] = NULL;
+		client->first = (client->first + 1) % JSON_OUTBOX;
+		client->count--;
+		client->offset = 0;
 	}
-	if (ret < 0)
-		err("cmd: json send error %s", strerror(errno));
-	return ret;
+	return 0;
 }
 
-static int _jsonrpc_sendresponse(thread_info_t *info, json_t *request)
+static json_client_t *_cmds_json_addclient(cmds_ctx_t *ctx, thread_info_t *info)
 {
-	int ret = 0;
-	int sock = info->sock;
-	cmds_ctx_t *ctx = info->userctx;
+	json_client_t *client = calloc(1, sizeof(*client));
+	client->info = info;
+	client->sock = info->sock;
+	/// a client which never writes, as a listener of events, stays on the text framing
+	client->framing = FRAMING_TEXT;
+#ifdef JSONRPC_CBOR
+	client->detect = 1;
+#endif
+	struct epoll_event event = {
+		.events = EPOLLOUT | EPOLLET,
+		.data.ptr = NULL,
+	};
+	if (epoll_ctl(ctx->epollfd, EPOLL_CTL_ADD, client->sock, &event) < 0)
+		err("cmds: epoll add error %s", strerror(errno));
+	pthread_mutex_lock(&ctx->mutex);
+	if (++ctx->lastclient == 0)
+		ctx->lastclient = 1;
+	client->id = ctx->lastclient;
+	client->next = ctx->clients;
+	ctx->clients = client;
+	pthread_mutex_unlock(&ctx->mutex);
+	info->data = client;
+	return client;
+}
 
-	json_t *response = jsonrpc_jresponse(request, method_table, ctx);
+/**
+ * must be called with the lock
+ */
+static json_client_t *_cmds_json_findclient(cmds_ctx_t *ctx, unsigned int id)
+{
+	json_client_t *client = ctx->clients;
+	while (client != NULL && client->id != id)
+		client = client->next;
+	return client;
+}
 
-	if (response != NULL)
+/**
+ * must be called with the lock
+ */
+static void _cmds_json_removeclient(cmds_ctx_t *ctx, json_client_t *client)
+{
+	json_client_t **pit = &ctx->clients;
+	while (*pit != NULL && *pit != client)
+		pit = &(*pit)->next;
+	if (*pit != NULL)
+		*pit = client->next;
+
+	json_request_list_t *it = ctx->requests;
+	for (; it != NULL; it = it->next)
 	{
-		char *buff = json_dumps(response, JSONRPC_DEBUG_FORMAT );
-		int length = strlen(buff);
-		cmds_dbg("cmds: send response %d %*s", length, length, buff);
-		ret = send(sock, buff, length, MSG_DONTWAIT | MSG_NOSIGNAL);
-		dbg("cmds: send response %d", ret);
-		fsync(sock);
-		free(buff);
+		/** disabled requests on this client **/
+		if (it->client == client->id)
+			it->client = 0;
 	}
-	else
+	epoll_ctl(ctx->epollfd, EPOLL_CTL_DEL, client->sock, NULL);
+	free(client->inbuffer);
+	while (client->count > 0)
 	{
-		err("cmds: no response for %s", json_dumps(request, JSONRPC_DEBUG_FORMAT ));
+		_json_messagerelease(client->outbox[client->first]);
+		client->first = (client->first + 1) % JSON_OUTBOX;
+		client->count--;
 	}
+	client->info->data = NULL;
+	free(client);
+}
+
+/**
+ * must be called with the lock
+ * the client is not removed here, the shutdown wakes up the
+ * server loop which releases it.
+ */
+static void _cmds_json_dropclient(json_client_t *client)
+{
+	err("cmds: client %d too slow or disconnected", client->sock);
+	shutdown(client->sock, SHUT_RDWR);
+}
+
+static void _jsonrpc_sendresponse(cmds_ctx_t *ctx, unsigned int id, json_t *request)
+{
+	json_framing_t framing = FRAMING_TEXT;
+	pthread_mutex_lock(&ctx->mutex);
+	json_client_t *client = _cmds_json_findclient(ctx, id);
+	if (client != NULL)
+		framing = client->framing;
+	pthread_mutex_unlock(&ctx->mutex);
+	if (client == NULL)
+		return;
+
+	json_t *response = jsonrpc_jresponse(request, method_table, ctx);
+	if (response == NULL)
+	{
+		err("cmds: no response for request");
+		return;
+	}
+	json_message_t *message = _json_message(response, 0, framing);
 	json_decref(response);
-	return ret;
+	if (message == NULL)
+		return;
+
+	pthread_mutex_lock(&ctx->mutex);
+	client = _cmds_json_findclient(ctx, id);
+	if (client != NULL && _json_outboxpush(client, message) < 0)
+		_cmds_json_dropclient(client);
+	pthread_mutex_unlock(&ctx->mutex);
+	_json_messagerelease(message);
+}
+
+/**
+ * must be called with the lock
+ * the requests of a client are delayed while its outbox is full.
+ * After a first delayed request, the next ones of the same client
+ * are delayed too, to keep the order of the requests.
+ */
+static int _cmds_json_clientfull(cmds_ctx_t *ctx, unsigned int id)
+{
+	json_client_t *client = _cmds_json_findclient(ctx, id);
+	if (client == NULL)
+		return 0;
+	if (client->delayed)
+		return 1;
+	if (client->count < JSON_OUTBOX)
+		return 0;
+	if (_json_outboxflush(client) < 0)
+	{
+		_cmds_json_dropclient(client);
+		return 0;
+	}
+	client->delayed = (client->count == JSON_OUTBOX);
+	return client->delayed;
 }
 
-static void _cmds_json_removeinfo(cmds_ctx_t *ctx, thread_info_t *info)
+/**
+ * must be called with the lock
+ * the reading of the client restarts when its requests are answered.
+ */
+static void _cmds_json_answered(cmds_ctx_t *ctx, unsigned int id)
 {
-	thread_info_t *it = ctx->info;
-	if (ctx->info == info)
+	json_client_t *client = _cmds_json_findclient(ctx, id);
+	if (client == NULL)
+		return;
+	client->pending--;
+	if (client->paused && !client->hangup && client->pending < JSON_OUTBOX)
 	{
-		ctx->info = ctx->info->next;
+		client->paused = 0;
+		unixserver_pause(client->info, 0);
 	}
-	else
+}
+
+static void jsonrpc_sendevent(cmds_ctx_t *ctx, const char *event, eventsmask_t mask)
+{
+	json_t *notification = jsonrpc_jrequest(event, method_table, (void *)ctx, NULL);
+	if (notification == NULL)
 	{
-		while (it != NULL && it->next != NULL && it->next != info)
-		{
-			it = it->next;
-		}
-		if (it != NULL)
-			it->next = info->next;
+		err("cmds: unkonwn event %s", event);
+		return;
 	}
+	/// the notification is the same for all clients and is encoded once per framing
+	json_message_t *messages[FRAMING_CBOR + 1] = {0};
 
-	unixserver_remove(info);
+	pthread_mutex_lock(&ctx->mutex);
+	json_client_t *client;
+	for (client = ctx->clients; client != NULL; client = client->next)
+	{
+		json_framing_t framing = client->framing;
+		if (messages[framing] == NULL)
+			messages[framing] = _json_message(notification, mask, framing);
+		if (messages[framing] != NULL && _json_outboxpush(client, messages[framing]) < 0)
+			_cmds_json_dropclient(client);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	json_decref(notification);
+	int i;
+	for (i = 0; i <= FRAMING_CBOR; i++)
+	{
+		if (messages[i] != NULL)
+			_json_messagerelease(messages[i]);
+	}
 }
+
 /**
  * this is the main loop for the sending
- * There is only one lopp for all clients
+ * There is only one lopp for all clients:
+ * the requests and the events are encoded out of the lock,
+ * then queued into the outboxes, which are flushed when
+ * the sockets are writable.
  */
 static void *_cmds_json_pthreadsend(void *arg)
 {
@@ -1417,83 +2018,87 @@ static void *_cmds_json_pthreadsend(void *arg)
 	pthread_mutex_lock(&ctx->mutex);
 	ctx->run = 1;
 	pthread_mutex_unlock(&ctx->mutex);
-	pthread_cond_broadcast(&ctx->cond);
 	while (ctx->run)
 	{
-		int wait = 0;
-		pthread_mutex_lock(&ctx->mutex);
-		while (ctx->requests == NULL && ctx->eventsmask == 0)
+		struct epoll_event events[16];
+		int nevents = epoll_wait(ctx->epollfd, events, 16, -1);
+		if (nevents < 0 && errno != EINTR)
 		{
-			pthread_cond_wait(&ctx->cond, &ctx->mutex);
-			cmds_dbg("cmds: send new message");
+			err("cmds: epoll error %s", strerror(errno));
+			break;
 		}
-		while (ctx->requests != NULL)
+		int i;
+		for (i = 0; i < nevents; i++)
+		{
+			uint64_t value;
+			if (events[i].data.ptr == ctx &&
+				read(ctx->wakeup, &value, sizeof(value)) < 0)
+				err("cmds: wakeup read error %s", strerror(errno));
+		}
+
+		pthread_mutex_lock(&ctx->mutex);
+		json_request_list_t *requests = ctx->requests;
+		ctx->requests = NULL;
+		ctx->lastrequest = &ctx->requests;
+		unsigned int eventsmask = ctx->eventsmask;
+		ctx->eventsmask = 0;
+		pthread_mutex_unlock(&ctx->mutex);
+
+		json_request_list_t *delayed = NULL;
+		json_request_list_t **lastdelayed = &delayed;
+		while (requests != NULL)
 		{
 			cmds_dbg("cmds: send request");
-			json_request_list_t *request = ctx->requests;
-			ctx->requests = ctx->requests->next;
-			int ret = -1;
-			/** run only request not disabled by a previous request **/
-			if (request->info != NULL)
+			json_request_list_t *request = requests;
+			requests = requests->next;
+			request->next = NULL;
+			pthread_mutex_lock(&ctx->mutex);
+			int full = (request->client != 0) && _cmds_json_clientfull(ctx, request->client);
+			pthread_mutex_unlock(&ctx->mutex);
+			if (full)
 			{
-				if (wait) sched_yield();
-				ret = _jsonrpc_sendresponse(request->info, request->request);
-				wait = 1;
+				/// a pipelining client gets the next responses when it reads the previous ones
+				*lastdelayed = request;
+				lastdelayed = &request->next;
+				continue;
 			}
-			if (ret < 0)
+			/** run only request not disabled by a previous request **/
+			if (request->client != 0)
 			{
-				err("cmds: sendresponse error %d", ret);
-				/**
-				 * remove all requests on this client threads
-				 */
-				json_request_list_t *it = ctx->requests;
-				for (; it != NULL; it = it->next)
-				{
-					if (request->info == it->info)
-					{
-						/** disabled requests on this client **/
-						it->info = NULL;
-					}
-				}
-
-				/** free the client **/
-				if (request->info != NULL)
-				{
-					pthread_mutex_lock(&ctx->mutex);
-					_cmds_json_removeinfo(ctx, request->info);
-					pthread_mutex_unlock(&ctx->mutex);
-				}
-				/** free the request **/
-				json_decref(request->request);
-				free(request);
-				continue;
+				_jsonrpc_sendresponse(ctx, request->client, request->request);
+				pthread_mutex_lock(&ctx->mutex);
+				_cmds_json_answered(ctx, request->client);
+				pthread_mutex_unlock(&ctx->mutex);
 			}
 			json_decref(request->request);
 			free(request);
 		}
-		while (ctx->eventsmask != 0)
+		pthread_mutex_lock(&ctx->mutex);
+		if (delayed != NULL)
+		{
+			*lastdelayed = ctx->requests;
+			if (ctx->requests == NULL)
+				ctx->lastrequest = lastdelayed;
+			ctx->requests = delayed;
+		}
+		json_client_t *client;
+		for (client = ctx->clients; client != NULL; client = client->next)
+			client->delayed = 0;
+		pthread_mutex_unlock(&ctx->mutex);
+		if ((eventsmask & ONCHANGE) == ONCHANGE)
 		{
 			cmds_dbg("cmds: send event");
-			if ((ctx->eventsmask & ONCHANGE) == ONCHANGE)
-			{
-				thread_info_t *info = ctx->info;
-				while (info)
-				{
-					thread_info_t *next = info->next;
-					if (wait) sched_yield();
-					int ret = jsonrpc_sendevent(ctx, info, "onchange");
-					wait = 1;
-					if (ret < 0)
-					{
-						pthread_mutex_lock(&ctx->mutex);
-						err("cmds: sendevent error %d", ret);
-						_cmds_json_removeinfo(ctx, info);
-						pthread_mutex_unlock(&ctx->mutex);
-					}
-					info = next;
-				}
-				ctx->eventsmask &= ~ONCHANGE;
-			}
+			jsonrpc_sendevent(ctx, "onchange", ONCHANGE);
+		}
+
+		pthread_mutex_lock(&ctx->mutex);
+		for (client = ctx->clients; client != NULL; client = client->next)
+		{
+			if (_json_outboxflush(client) < 0)
+				_cmds_json_dropclient(client);
+			else if (client->hangup && client->pending == 0 && client->count == 0)
+				/// the server loop releases the client on the shutdown
+				shutdown(client->sock, SHUT_RDWR);
 		}
 		pthread_mutex_unlock(&ctx->mutex);
 	}
@@ -1501,102 +2106,281 @@ static void *_cmds_json_pthreadsend(void *arg)
 	return NULL;
 }
 
-/**
- * this is the main loop of the client socket
- * There is one loop for each client
- */
-static int jsonrpc_command(thread_info_t *info)
+static void _cmds_json_sendstate(cmds_ctx_t *ctx)
+{
+	event_player_state_t event = {.playerctx = ctx->player};
+	event.state = player_state(ctx->player, STATE_UNKNOWN);
+	jsonrpc_onchange(ctx, PLAYER_EVENT_CHANGE, &event);
+}
+
+static int jsonrpc_connect(thread_info_t *info)
 {
-	int ret = 0;
-	int sock = info->sock;
 	cmds_ctx_t *ctx = info->userctx;
-	if (ctx->info == NULL)
-		ctx->info = info;
 
-	/**
-	 * wait that the sending loop is ready
-	 */
+	warn("cmds: json socket connection");
+	_cmds_json_addclient(ctx, info);
+	_cmds_json_sendstate(ctx);
+	return 0;
+}
+
+/**
+ * the client is not read anymore while the outbox may not receive
+ * the responses of its pending requests.
+ */
+static void _cmds_json_queue(cmds_ctx_t *ctx, thread_info_t *info, json_t *request)
+{
+	json_client_t *client = (json_client_t *)info->data;
+	json_request_list_t *entry = calloc(1, sizeof(*entry));
+	entry->client = client->id;
+	entry->request = request;
 	pthread_mutex_lock(&ctx->mutex);
-	while (ctx->run == 0)
+	*ctx->lastrequest = entry;
+	ctx->lastrequest = &entry->next;
+	client->pending++;
+	if (!client->paused && client->pending >= JSON_OUTBOX)
 	{
-		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+		client->paused = 1;
+		unixserver_pause(info, 1);
 	}
 	pthread_mutex_unlock(&ctx->mutex);
+}
 
-	warn("cmds: json socket connection");
-	event_player_state_t event = {.playerctx = ctx->player};
-	event.state = player_state(ctx->player, STATE_UNKNOWN);
-	jsonrpc_onchange(ctx, PLAYER_EVENT_CHANGE, &event);
-	errno = 0;
-	int run = 1;
-
-	struct pollfd poll_set[1];
-	memset(poll_set, 0, sizeof(poll_set));
-	int numfds = 0;
-	poll_set[0].fd = sock;
-	poll_set[0].events = POLLIN | POLLHUP;
-	numfds++;
-	while (run)
-	{
-		if (ctx->info == NULL)
-			break;
-
-		cmds_dbg("cmds: recv wait");
-		ret = poll(poll_set, numfds, -1);
-		if (poll_set[0].revents & POLLHUP)
+#ifdef JSONRPC_CBOR
+/**
+ * read all the available frames, a client may send several requests
+ * without waiting the responses.
+ */
+static int _cmds_json_recvframes(cmds_ctx_t *ctx, thread_info_t *info, json_client_t *client)
+{
+	if (client->insize - client->inlength < 4096)
+	{
+		size_t size = (client->insize)? client->insize * 2: 8192;
+		if (size > JSON_MAXFRAME + 4)
+			size = JSON_MAXFRAME + 4;
+		if (size <= client->inlength)
 		{
-			err("cmds: client hangup");
-			run = 0;
-			break;
+			err("cmds: frame too large");
+			return -1;
 		}
-		cmds_dbg("cmds: recv ready");
-		poll_set[0].revents = 0;
+		unsigned char *buffer = realloc(client->inbuffer, size);
+		if (buffer == NULL)
+			return -1;
+		client->inbuffer = buffer;
+		client->insize = size;
+	}
+	ssize_t ret = recv(info->sock, client->inbuffer + client->inlength,
+			client->insize - client->inlength, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+		return -1;
+	if (ret < 0)
+		return 0;
+	client->inlength += ret;
 
-		json_t *request = NULL;
-		json_error_t error;
-		int flags = JSON_DISABLE_EOF_CHECK;
-		//int flags = 0;
-		request = json_load_callback(_cmds_recv, info, flags, &error);
-		if (request != NULL)
+	int nrequests = 0;
+	size_t offset = 0;
+	while (client->inlength - offset >= 4)
+	{
+		const unsigned char *frame = client->inbuffer + offset;
+		size_t length = ((size_t)frame[0] << 24) | (frame[1] << 16) | (frame[2] << 8) | frame[3];
+		if (length > JSON_MAXFRAME)
 		{
-			cmds_dbg("cmds: new request %s", json_dumps(request, JSONRPC_DEBUG_FORMAT ));
-			json_request_list_t *entry = calloc(1, sizeof(*entry));
-			entry->info = info;
-			entry->request = request;
-			pthread_mutex_lock(&ctx->mutex);
-			if (ctx->requests == NULL)
-				ctx->requests = entry;
-			else
-			{
-				json_request_list_t *it = ctx->requests;
-				while (it->next != NULL) it = it->next;
-				it->next = entry;
-			}
-			pthread_mutex_unlock(&ctx->mutex);
-			pthread_cond_broadcast(&ctx->cond);
+			err("cmds: frame too large %lu", length);
+			return -1;
 		}
-		else
+		if (client->inlength - offset - 4 < length)
+			break;
+		size_t used = 0;
+		json_t *request = cbor_loadb(frame + 4, length, &used);
+		if (request == NULL || used != length)
 		{
-			cmds_dbg("cmds: recv nothing");
-			if (info->sock == -1)
-				run = 0;
+			err("cmds: bad frame");
+			json_decref(request);
+			return -1;
 		}
+		_cmds_json_queue(ctx, info, request);
+		nrequests++;
+		offset += 4 + length;
+	}
+	if (offset > 0)
+	{
+		memmove(client->inbuffer, client->inbuffer + offset, client->inlength - offset);
+		client->inlength -= offset;
 	}
+	if (nrequests > 0)
+		_cmds_json_wakeup(ctx);
+	return 0;
+}
+
+/**
+ * the framing is chosen by the first bytes of the connection.
+ * The client is on the text framing until the CBOR tag, the server
+ * answers the tag with the same tag and the client ignores all
+ * the data before it.
+ */
+static int _cmds_json_framing(cmds_ctx_t *ctx, thread_info_t *info, json_client_t *client)
+{
+	ssize_t ret;
+	if (client->magiclength == 0)
+	{
+		unsigned char first;
+		ret = recv(info->sock, &first, 1, MSG_PEEK | MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret <= 0)
+			return (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))? -1: 0;
+		/// a text request is left into the socket for the parser
+		if (first != (unsigned char)CBOR_MAGIC[0])
+		{
+			client->detect = 0;
+			return 0;
+		}
+	}
+	/**
+	 * the tag is consumed as it arrives, otherwise a partial tag
+	 * keeps the socket readable and the loop spins.
+	 */
+	ret = recv(info->sock, client->magic + client->magiclength,
+			CBOR_MAGICLENGTH - client->magiclength, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret <= 0)
+		return (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))? -1: 0;
+	client->magiclength += ret;
+	if (client->magiclength < CBOR_MAGICLENGTH)
+		return 0;
+	client->detect = 0;
+	if (memcmp(client->magic, CBOR_MAGIC, CBOR_MAGICLENGTH))
+	{
+		err("cmds: framing tag error");
+		return -1;
+	}
+	dbg("cmds: binary framing");
+
+	json_message_t *tag = calloc(1, sizeof(*tag));
+	tag->refs = 1;
+	tag->data = malloc(CBOR_MAGICLENGTH);
+	memcpy(tag->data, CBOR_MAGIC, CBOR_MAGICLENGTH);
+	tag->length = CBOR_MAGICLENGTH;
+	pthread_mutex_lock(&ctx->mutex);
+	client->framing = FRAMING_CBOR;
+	/// the text messages not started are useless now
+	unsigned int keep = (client->offset > 0)? 1: 0;
+	while (client->count > keep)
+	{
+		client->count--;
+		unsigned int index = (client->first + client->count) % JSON_OUTBOX;
+		_json_messagerelease(client->outbox[index]);
+		client->outbox[index] = NULL;
+	}
+	_json_outboxpush(client, tag);
+	pthread_mutex_unlock(&ctx->mutex);
+	_json_messagerelease(tag);
+	_cmds_json_sendstate(ctx);
+	return 0;
+}
+#endif
+
+/**
+ * the socket is readable, the request is queued for the sending loop
+ */
+static int jsonrpc_command(thread_info_t *info)
+{
+	cmds_ctx_t *ctx = info->userctx;
+	json_client_t *client = (json_client_t *)info->data;
+
+#ifdef JSONRPC_CBOR
+	if (client->detect)
+	{
+		if (_cmds_json_framing(ctx, info, client) < 0)
+			return -1;
+		if (client->detect)
+			return 0;
+	}
+	if (client->framing == FRAMING_CBOR)
+		return _cmds_json_recvframes(ctx, info, client);
+#endif
+
+	json_t *request = NULL;
+	json_error_t error;
+	int flags = JSON_DISABLE_EOF_CHECK;
+	request = json_load_callback(_cmds_recv, info, flags, &error);
+	if (request != NULL)
+	{
+		cmds_dbg("cmds: new request %s", json_dumps(request, JSONRPC_DEBUG_FORMAT ));
+		_cmds_json_queue(ctx, info, request);
+		_cmds_json_wakeup(ctx);
+	}
+	else
+	{
+		cmds_dbg("cmds: recv nothing");
+		if (client->error)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * the client is kept until its requests are answered and sent.
+ */
+static int jsonrpc_hangup(thread_info_t *info)
+{
+	cmds_ctx_t *ctx = info->userctx;
+	json_client_t *client = (json_client_t *)info->data;
+	int keep = 0;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (client != NULL && (client->pending > 0 || client->count > 0))
+	{
+		client->hangup = 1;
+		keep = 1;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	if (keep)
+		_cmds_json_wakeup(ctx);
+	return keep;
+}
+
+static void jsonrpc_disconnect(thread_info_t *info)
+{
+	cmds_ctx_t *ctx = info->userctx;
+	json_client_t *client = (json_client_t *)info->data;
+
 	pthread_mutex_lock(&ctx->mutex);
 	warn("cmds: json socket %d leave", info->sock);
-	_cmds_json_removeinfo(ctx, info);
+	if (client != NULL)
+		_cmds_json_removeclient(ctx, client);
 	pthread_mutex_unlock(&ctx->mutex);
-	return ret;
 }
 
+static const unixserver_ops_t jsonrpc_server = {
+	.connect = jsonrpc_connect,
+	.recv = jsonrpc_command,
+	.hangup = jsonrpc_hangup,
+	.disconnect = jsonrpc_disconnect,
+};
+
 static cmds_ctx_t *cmds_json_init(player_ctx_t *player, void *arg)
 {
 	cmds_ctx_t *ctx = NULL;
 	ctx = calloc(1, sizeof(*ctx));
 	ctx->player = player;
 	ctx->socketpath = (const char *)arg;
-	pthread_cond_init(&ctx->cond, NULL);
 	pthread_mutex_init(&ctx->mutex, NULL);
+	ctx->lastrequest = &ctx->requests;
+	ctx->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	ctx->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = ctx,
+	};
+	if (ctx->epollfd < 0 || ctx->wakeup < 0 ||
+		epoll_ctl(ctx->epollfd, EPOLL_CTL_ADD, ctx->wakeup, &event) < 0)
+	{
+		err("cmds: json event loop error %s", strerror(errno));
+		if (ctx->epollfd >= 0)
+			close(ctx->epollfd);
+		if (ctx->wakeup >= 0)
+			close(ctx->wakeup);
+		pthread_mutex_destroy(&ctx->mutex);
+		free(ctx);
+		return NULL;
+	}
 	ctx->onchangeid = player_eventlistener(ctx->player, jsonrpc_onchange, (void *)ctx, "jsonrpc");
 	return ctx;
 }
@@ -1605,7 +2389,7 @@ static void *_cmds_json_pthreadrecv(void *arg)
 {
 	cmds_ctx_t *ctx = (cmds_ctx_t *)arg;
 
-	unixserver_run(jsonrpc_command, (void *)ctx, ctx->socketpath);
+	unixserver_run(ctx->server);
 	warn("cmds: leave thread recv");
 	return NULL;
 }
@@ -1613,6 +2397,9 @@ static void *_cmds_json_pthreadrecv(void *arg)
 static int cmds_json_run(cmds_ctx_t *ctx, sink_t *sink)
 {
 	ctx->sink = sink;
+	ctx->server = unixserver_init(&jsonrpc_server, (void *)ctx, ctx->socketpath);
+	if (ctx->server == NULL)
+		return -1;
 	pthread_create(&ctx->threadrecv, NULL, _cmds_json_pthreadrecv, (void *)ctx);
 	pthread_create(&ctx->threadsend, NULL, _cmds_json_pthreadsend, (void *)ctx);
 	return 0;
@@ -1620,16 +2407,19 @@ static int cmds_json_run(cmds_ctx_t *ctx, sink_t *sink)
 
 static void cmds_json_destroy(cmds_ctx_t *ctx)
 {
-	if (ctx->info)
-		unixserver_kill(ctx->info);
 	player_removeevent(ctx->player, ctx->onchangeid);
 	ctx->onchangeid = 0;
-	ctx->info = NULL;
-	pthread_join(ctx->threadrecv, NULL);
+	if (ctx->server)
+	{
+		unixserver_kill(ctx->server);
+		pthread_join(ctx->threadrecv, NULL);
+		unixserver_destroy(ctx->server);
+	}
 	ctx->run = 0;
-	pthread_cond_broadcast(&ctx->cond);
+	_cmds_json_wakeup(ctx);
 	pthread_join(ctx->threadsend, NULL);
-	pthread_cond_destroy(&ctx->cond);
+	close(ctx->wakeup);
+	close(ctx->epollfd);
 	pthread_mutex_destroy(&ctx->mutex);
 	free(ctx);
 }
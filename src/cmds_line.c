@@ -199,27 +199,13 @@ static int method_media(cmds_ctx_t *ctx, const char *arg)
 	return player_change(ctx->player, arg, 0, 0, 1);
 }
 
-static int _import_entry(void *arg, int id, const char *url,
-		const char *info, const char *mime)
-{
-	cmds_ctx_t *ctx = (cmds_ctx_t *)arg;
-	media_t *media = player_media(ctx->player);
-	media->ops->insert(media->ctx, url, info, mime);
-	return 0;
-}
-
 static int method_import(cmds_ctx_t *ctx, const char *arg)
 {
 	media_t *media = player_media(ctx->player);
 	if (media->ops->insert == NULL)
 		return -1;
 #ifdef MEDIA_IMPORT
-	media_ctx_t *media_ctx = media_dir->init(ctx->player, arg);
-	if (media_ctx)
-	{
-		media_dir->list(media_ctx, _import_entry, (void *)ctx);
-		media_dir->destroy(media_ctx);
-	}
+	media_import(media, arg);
 #endif
 	return 0;
 }
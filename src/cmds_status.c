@@ -0,0 +1,355 @@
+/*****************************************************************************
+ * cmds_status.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "player.h"
+#include "status.h"
+
+#define STATUS_MAXCLIENTS 8
+/// period of the refresh of the position and the volume in ms
+#define STATUS_PERIOD 250
+
+typedef struct status_client_s status_client_t;
+struct status_client_s
+{
+	int sock;
+	int efd;
+};
+
+typedef struct cmds_ctx_s cmds_ctx_t;
+struct cmds_ctx_s
+{
+	player_ctx_t *player;
+	sink_t *sink;
+	status_t *page;
+	char *path;
+	int sock;
+	int eventid;
+	int run;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	status_client_t clients[STATUS_MAXCLIENTS];
+};
+#define CMDS_CTX
+#include "cmds.h"
+#include "sink.h"
+#include "realtime.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define STATUS_SET(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+/**
+ * the writers are serialized by the mutex,
+ * the readers only check the sequence.
+ */
+static void _status_begin(cmds_ctx_t *ctx)
+{
+	pthread_mutex_lock(&ctx->mutex);
+	__atomic_add_fetch(&ctx->page->sequence, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void _status_end(cmds_ctx_t *ctx)
+{
+	__atomic_add_fetch(&ctx->page->sequence, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+static void _status_notify(cmds_ctx_t *ctx)
+{
+	uint64_t value = 1;
+	int i;
+	for (i = 0; i < STATUS_MAXCLIENTS; i++)
+	{
+		if (ctx->clients[i].efd > 0 &&
+			write(ctx->clients[i].efd, &value, sizeof(value)) < 0)
+			warn("status: notify error %s", strerror(errno));
+	}
+}
+
+static void _status_onchange(void *arg, event_t event, void *eventarg)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)arg;
+	if (event != PLAYER_EVENT_CHANGE)
+		return;
+	event_player_state_t *data = (event_player_state_t *)eventarg;
+	int mediaid = player_mediaid(ctx->player);
+
+	/// the player sends the event on each loop, only the changes are published
+	if (ctx->page->state == data->state && ctx->page->mediaid == mediaid)
+		return;
+	_status_begin(ctx);
+	STATUS_SET(ctx->page->state, data->state);
+	STATUS_SET(ctx->page->mediaid, mediaid);
+	STATUS_SET(ctx->page->position, 0);
+	STATUS_SET(ctx->page->changes, ctx->page->changes + 1);
+	_status_end(ctx);
+	pthread_mutex_lock(&ctx->mutex);
+	_status_notify(ctx);
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+static void _status_refresh(cmds_ctx_t *ctx)
+{
+	unsigned int position = 0;
+	unsigned int duration = 0;
+	uint32_t volume = ctx->page->volume;
+
+	player_position(ctx->player, &position, &duration);
+	if (ctx->sink != NULL && ctx->sink->ops->getvolume != NULL)
+		volume = ctx->sink->ops->getvolume(ctx->sink->ctx);
+
+	if (ctx->page->position == position && ctx->page->duration == duration &&
+		ctx->page->volume == volume)
+		return;
+	_status_begin(ctx);
+	STATUS_SET(ctx->page->position, position);
+	STATUS_SET(ctx->page->duration, duration);
+	STATUS_SET(ctx->page->volume, volume);
+	_status_end(ctx);
+}
+
+static int _status_sendfd(int sock, int fd)
+{
+	char data = 0;
+	struct iovec iov = { .iov_base = &data, .iov_len = sizeof(data) };
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	return sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+
+static void _status_accept(cmds_ctx_t *ctx)
+{
+	int sock = accept(ctx->sock, NULL, NULL);
+	if (sock < 0)
+		return;
+	pthread_mutex_lock(&ctx->mutex);
+	int i;
+	for (i = 0; i < STATUS_MAXCLIENTS; i++)
+	{
+		if (ctx->clients[i].sock <= 0)
+			break;
+	}
+	int efd = -1;
+	if (i < STATUS_MAXCLIENTS)
+		efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0 || _status_sendfd(sock, efd) < 0)
+	{
+		warn("status: client refused");
+		if (efd >= 0)
+			close(efd);
+		close(sock);
+	}
+	else
+	{
+		ctx->clients[i].sock = sock;
+		ctx->clients[i].efd = efd;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+static void _status_release(cmds_ctx_t *ctx, status_client_t *client)
+{
+	pthread_mutex_lock(&ctx->mutex);
+	close(client->efd);
+	close(client->sock);
+	client->efd = 0;
+	client->sock = 0;
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+static void *_status_pthread(void *arg)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)arg;
+	struct pollfd fds[STATUS_MAXCLIENTS + 1];
+	status_client_t *clients[STATUS_MAXCLIENTS + 1];
+
+	while (ctx->run)
+	{
+		int nfds = 0;
+		fds[nfds].fd = ctx->sock;
+		fds[nfds].events = POLLIN;
+		clients[nfds] = NULL;
+		nfds++;
+		int i;
+		for (i = 0; i < STATUS_MAXCLIENTS; i++)
+		{
+			if (ctx->clients[i].sock <= 0)
+				continue;
+			/// the clients never write, a readable socket is a hangup
+			fds[nfds].fd = ctx->clients[i].sock;
+			fds[nfds].events = POLLIN;
+			clients[nfds] = &ctx->clients[i];
+			nfds++;
+		}
+		int ret = poll(fds, nfds, STATUS_PERIOD);
+		if (ret > 0)
+		{
+			if (fds[0].revents & POLLIN)
+				_status_accept(ctx);
+			for (i = 1; i < nfds; i++)
+			{
+				if (fds[i].revents)
+					_status_release(ctx, clients[i]);
+			}
+		}
+		else if (ret < 0 && errno != EINTR)
+		{
+			err("status: poll error %s", strerror(errno));
+			break;
+		}
+		_status_refresh(ctx);
+	}
+	return NULL;
+}
+
+static int _status_listen(const char *path)
+{
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.event", path);
+	unlink(addr.sun_path);
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+		listen(sock, STATUS_MAXCLIENTS) < 0)
+	{
+		err("status: socket %s error %s", addr.sun_path, strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+static int cmds_status_run(cmds_ctx_t *ctx, sink_t *sink)
+{
+	ctx->sink = sink;
+	ctx->sock = _status_listen(ctx->path);
+	if (ctx->sock < 0)
+		return -1;
+	ctx->run = 1;
+	realtime_thread(&ctx->thread, NULL, "server", _status_pthread, (void *)ctx);
+	return 0;
+}
+
+static cmds_ctx_t *cmds_status_init(player_ctx_t *player, void *arg)
+{
+	const char *path = (const char *)arg;
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		err("status: unable to open %s %s", path, strerror(errno));
+		return NULL;
+	}
+	status_t *page = MAP_FAILED;
+	if (ftruncate(fd, sizeof(status_t)) == 0)
+		page = mmap(NULL, sizeof(status_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+	{
+		err("status: unable to map %s %s", path, strerror(errno));
+		return NULL;
+	}
+	page->magic = STATUS_MAGIC;
+	page->version = STATUS_VERSION;
+	page->state = STATE_UNKNOWN;
+	page->mediaid = -1;
+
+	cmds_ctx_t *ctx = calloc(1, sizeof(*ctx));
+	ctx->player = player;
+	ctx->page = page;
+	ctx->path = strdup(path);
+	ctx->sock = -1;
+	pthread_mutex_init(&ctx->mutex, NULL);
+	ctx->eventid = player_eventlistener(player, _status_onchange, (void *)ctx, "status");
+	return ctx;
+}
+
+static void cmds_status_destroy(cmds_ctx_t *ctx)
+{
+	player_removeevent(ctx->player, ctx->eventid);
+	if (ctx->run)
+	{
+		ctx->run = 0;
+		pthread_join(ctx->thread, NULL);
+	}
+	int i;
+	for (i = 0; i < STATUS_MAXCLIENTS; i++)
+	{
+		if (ctx->clients[i].sock > 0)
+			_status_release(ctx, &ctx->clients[i]);
+	}
+	if (ctx->sock >= 0)
+		close(ctx->sock);
+	munmap(ctx->page, sizeof(status_t));
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx->path);
+	free(ctx);
+}
+
+cmds_ops_t *cmds_status = &(cmds_ops_t)
+{
+	.init = cmds_status_init,
+	.run = cmds_status_run,
+	.destroy = cmds_status_destroy,
+};
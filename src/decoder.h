@@ -6,6 +6,7 @@
 typedef struct player_ctx_s player_ctx_t;
 typedef struct jitter_s jitter_t;
 typedef struct filter_s filter_t;
+typedef struct media_info_s media_info_t;
 
 #ifndef DECODER_CTX
 typedef void decoder_ctx_t;
@@ -17,11 +18,17 @@ struct decoder_ops_s
 	int (*check)(const char *path);
 	decoder_ctx_t *(*init)(player_ctx_t *);
 	jitter_t *(*jitter)(decoder_ctx_t *decoder, jitte_t jitte);
-	int (*prepare)(decoder_ctx_t *, filter_t *, const char *info);
+	int (*prepare)(decoder_ctx_t *, filter_t *, const media_info_t *info);
 	int (*run)(decoder_ctx_t *, jitter_t *);
 	const char *(*mime)(decoder_ctx_t *ctx);
 	uint32_t (*position)(decoder_ctx_t *ctx);
 	uint32_t (*duration)(decoder_ctx_t *ctx);
+	/**
+	 * optional: request to continue the decoding at position (in seconds).
+	 * The seek is done later inside the decoder thread, the source
+	 * must be able to reposition its stream (see seek_t of the jitter).
+	 */
+	int (*seek)(decoder_ctx_t *ctx, uint32_t position);
 	void (*destroy)(decoder_ctx_t *);
 };
 
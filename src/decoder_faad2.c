@@ -42,6 +42,7 @@
 #include "jitter.h"
 #include "heartbeat.h"
 #include "filter.h"
+#include "seekindex.h"
 typedef struct decoder_s decoder_t;
 typedef struct decoder_ops_s decoder_ops_t;
 typedef struct decoder_ctx_s decoder_ctx_t;
@@ -55,8 +56,6 @@ struct decoder_ctx_s
 	unsigned char *inbuffer;
 
 	jitter_t *out;
-	unsigned char *outbuffer;
-	size_t outbufferlen;
 
 	filter_t *filter;
 	rescale_t rescale;
@@ -65,6 +64,17 @@ struct decoder_ctx_s
 	heartbeat_t heartbeat;
 	unsigned int nloops;
 	int bitspersample;
+	uint32_t position;
+	uint32_t nsamples;
+
+	/** the offset into the stream of inbuffer */
+	long offset;
+	seekindex_t index;
+	uint32_t seekposition;
+	int seeking;
+#ifdef METRICS
+	metrics_stage_t *metrics;
+#endif
 
 #ifdef DECODER_DUMP
 	int dumpfd;
@@ -76,6 +86,7 @@ struct decoder_ctx_s
 #include "media.h"
 #include "event.h"
 #include "src.h"
+#include "realtime.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -137,6 +148,66 @@ static int _faad_output(decoder_ctx_t *ctx, NeAACDecFrameInfo *frameInfo, void *
 	return 0;
 }
 
+static void _faad_position(decoder_ctx_t *ctx, uint32_t nsamples, uint32_t samplerate)
+{
+	if (samplerate == 0)
+		return;
+	ctx->nsamples += nsamples;
+	while (ctx->nsamples >= samplerate)
+	{
+		ctx->position++;
+		ctx->nsamples -= samplerate;
+	}
+}
+
+static const uint32_t _faad_samplerates[16] =
+{
+	96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+	16000, 12000, 11025, 8000, 7350, 0, 0, 0,
+};
+
+/**
+ * The index contains the offset of the ADTS frames already decoded.
+ * After the indexed position the seek reads only the ADTS headers
+ * until the requested position.
+ */
+static void _faad_seek(decoder_ctx_t *ctx)
+{
+	long offset = 0;
+	uint32_t seekposition = __atomic_load_n(&ctx->seekposition, __ATOMIC_RELAXED);
+	uint32_t position = seekindex_find(&ctx->index, seekposition, &offset);
+
+	if (ctx->index.length == 0)
+	{
+		warn("decoder faad: seek available only on ADTS stream");
+		return;
+	}
+	ctx->in->ops->reset(ctx->in->ctx);
+	if (ctx->in->ctx->seek(ctx->in->ctx->producter, offset, SEEK_SET) < 0)
+		return;
+	ctx->offset = offset;
+	ctx->position = position;
+	ctx->nsamples = 0;
+	while (ctx->position < seekposition)
+	{
+		unsigned char *frame = ctx->in->ops->peer(ctx->in->ctx, NULL);
+		if (frame == NULL || ctx->in->ops->length(ctx->in->ctx) < 7)
+			break;
+		if (frame[0] != 0xFF || (frame[1] & 0xF6) != 0xF0)
+			break;
+		size_t length = ((frame[3] & 0x03) << 11) | (frame[4] << 3) | (frame[5] >> 5);
+		uint32_t samplerate = _faad_samplerates[(frame[2] >> 2) & 0x0F];
+		uint32_t nblocks = (frame[6] & 0x03) + 1;
+		if (length < 7)
+			break;
+		seekindex_add(&ctx->index, ctx->position, ctx->offset);
+		ctx->in->ops->pop(ctx->in->ctx, length);
+		ctx->offset += length;
+		_faad_position(ctx, 1024 * nblocks, samplerate);
+	}
+	NeAACDecPostSeekReset(ctx->decoder, -1);
+}
+
 static int _faad_parsetags(char *buffer, size_t len)
 {
 	size_t offset = 0;
@@ -159,6 +230,7 @@ static int _faad_loop(decoder_ctx_t *ctx)
 		len += 10;
 	}
 	ctx->in->ops->pop(ctx->in->ctx, len);
+	ctx->offset += len;
 
 	ctx->inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
 	len = ctx->in->ops->length(ctx->in->ctx);
@@ -166,6 +238,7 @@ static int _faad_loop(decoder_ctx_t *ctx)
 		len = _faad_parsetags(ctx->inbuffer, len);
 	}
 	ctx->in->ops->pop(ctx->in->ctx, len);
+	ctx->offset += len;
 
 	ctx->inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
 	len = ctx->in->ops->length(ctx->in->ctx);
@@ -180,9 +253,16 @@ static int _faad_loop(decoder_ctx_t *ctx)
 	}
 	decoder_dbg("decoder faad: samplerate %lu fps, channels %d", samplerate, channels);
 	ctx->in->ops->pop(ctx->in->ctx, len);
+	ctx->offset += len;
 
+	/**
+	 * the decoder is initialized, the next allocations are forbidden
+	 */
+	realtime_enter();
 	do
 	{
+		if (__atomic_exchange_n(&ctx->seeking, 0, __ATOMIC_ACQUIRE))
+			_faad_seek(ctx);
 		ctx->inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
 		if (ctx->inbuffer == NULL)
 		{
@@ -191,9 +271,15 @@ static int _faad_loop(decoder_ctx_t *ctx)
 			break;
 		}
 		len = ctx->in->ops->length(ctx->in->ctx);
+		if (len > 1 && ctx->inbuffer[0] == 0xFF && (ctx->inbuffer[1] & 0xF6) == 0xF0)
+			seekindex_add(&ctx->index, ctx->position, ctx->offset);
 
 		NeAACDecFrameInfo frameInfo;
+#ifdef METRICS
+		uint64_t start = metrics_now();
+#endif
 		void *samples = NeAACDecDecode(ctx->decoder, &frameInfo, ctx->inbuffer, len);
+		metrics_stagerun(ctx->metrics, start);
 		decoder_dbg("decoder faad: decode %ld samples", frameInfo.samples);
 		if (frameInfo.error > 0)
 		{
@@ -210,8 +296,12 @@ static int _faad_loop(decoder_ctx_t *ctx)
 		{
 			dbg("frame type %d", frameInfo.header_type);
 		}
+		if (frameInfo.channels > 0)
+			_faad_position(ctx, frameInfo.samples / frameInfo.channels, frameInfo.samplerate);
 		ctx->in->ops->pop(ctx->in->ctx, frameInfo.bytesconsumed);
+		ctx->offset += frameInfo.bytesconsumed;
 	} while(ret == 0);
+	realtime_leave();
 
 	return ret;
 }
@@ -226,6 +316,9 @@ static decoder_ctx_t *_decoder_init(player_ctx_t *player)
 	decoder_ctx_t *ctx = calloc(1, sizeof(*ctx));
 	ctx->ops = decoder_mad;
 	ctx->player = player;
+#ifdef METRICS
+	ctx->metrics = metrics_stage("decoder_faad2");
+#endif
 
 	ctx->decoder = NeAACDecOpen();
 	return ctx;
@@ -247,7 +340,7 @@ static void _decoder_listener(void *arg, const src_t *src, event_t event, void *
 }
 #endif
 
-static int _decoder_prepare(decoder_ctx_t *ctx, filter_t *filter, const char *info)
+static int _decoder_prepare(decoder_ctx_t *ctx, filter_t *filter, const media_info_t *info)
 {
 	decoder_dbg("decoder: prepare");
 	ctx->filter = filter;
@@ -306,9 +399,9 @@ static void *_decoder_thread(void *arg)
 	 * push the last buffer to the encoder, otherwise the next
 	 * decoder will begins with a pull buffer
 	 */
-	if (ctx->outbufferlen > 0)
+	if (ctx->filter && ctx->filter->outbufferlen > 0)
 	{
-		ctx->out->ops->push(ctx->out->ctx, ctx->outbufferlen, NULL);
+		ctx->out->ops->push(ctx->out->ctx, ctx->filter->outbufferlen, NULL);
 	}
 	dbg("decoder: stop running");
 	player_state(ctx->player, STATE_CHANGE);
@@ -368,7 +461,7 @@ static int _decoder_run(decoder_ctx_t *ctx, jitter_t *jitter)
 	}
 #endif
 	if (ret == 0)
-		pthread_create(&ctx->thread, NULL, _decoder_thread, ctx);
+		realtime_thread(&ctx->thread, NULL, "decoder", _decoder_thread, ctx);
 	return ret;
 }
 
@@ -387,6 +480,26 @@ static const char *_decoder_mime(decoder_ctx_t *ctx)
 	return mime_audioaac;
 }
 
+static uint32_t _decoder_position(decoder_ctx_t *ctx)
+{
+	return ctx->position;
+}
+
+static uint32_t _decoder_duration(decoder_ctx_t *ctx)
+{
+	return 0;
+}
+
+static int _decoder_seek(decoder_ctx_t *ctx, uint32_t position)
+{
+	if (ctx->in == NULL || ctx->in->ctx->seek == NULL)
+		return -1;
+	/// the decoder thread reads the position after the seeking flag
+	__atomic_store_n(&ctx->seekposition, position, __ATOMIC_RELAXED);
+	__atomic_store_n(&ctx->seeking, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
 static void _decoder_destroy(decoder_ctx_t *ctx)
 {
 	if (ctx->out)
@@ -415,6 +528,9 @@ const decoder_ops_t _decoder_faad2 =
 	.prepare = _decoder_prepare,
 	.jitter = _decoder_jitter,
 	.run = _decoder_run,
+	.position = _decoder_position,
+	.duration = _decoder_duration,
+	.seek = _decoder_seek,
 	.destroy = _decoder_destroy,
 	.mime = _decoder_mime,
 };
@@ -49,20 +49,28 @@ struct decoder_ctx_s
 	jitter_t *in;
 	unsigned char *inbuffer;
 	jitter_t *out;
-	unsigned char *outbuffer;
-	size_t outbufferlen;
 	filter_t *filter;
 	player_ctx_t *player;
 	uint32_t nsamples;
 	uint32_t position;
 	uint32_t duration;
 	rescale_t rescale;
+	/** the offset into the stream of the next input */
+	long offset;
+	int eof;
+	uint32_t seekposition;
+	int seeking;
+#ifdef METRICS
+	metrics_stage_t *metrics;
+	uint64_t mark;
+#endif
 };
 #define DECODER_CTX
 #include "decoder.h"
 #include "media.h"
 #include "jitter.h"
 #include "filter.h"
+#include "realtime.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -86,6 +94,9 @@ static decoder_ctx_t *_decoder_init(player_ctx_t *player)
 	ctx->nchannels = 2;
 	ctx->samplerate = DEFAULT_SAMPLERATE;
 	ctx->player = player;
+#ifdef METRICS
+	ctx->metrics = metrics_stage("decoder_flac");
+#endif
 
 	ctx->decoder = FLAC__stream_decoder_new();
 	if (ctx->decoder == NULL)
@@ -124,6 +135,7 @@ input_cb(const FLAC__StreamDecoder *decoder,
 	if (ctx->inbuffer == NULL)
 	{
 		*bytes = 0;
+		ctx->eof = 1;
 		decoder_dbg("decoder flac: end of file");
 		return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
 	}
@@ -134,6 +146,10 @@ input_cb(const FLAC__StreamDecoder *decoder,
 		*bytes = len;
 	memcpy(buffer, ctx->inbuffer, len);
 	ctx->in->ops->pop(ctx->in->ctx, len);
+	ctx->offset += len;
+#ifdef METRICS
+	ctx->mark = metrics_now();
+#endif
 
 	return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
 }
@@ -148,6 +164,10 @@ output_cb(const FLAC__StreamDecoder *decoder,
 
 	/* pcm->samplerate contains the sampling frequency */
 
+#ifdef METRICS
+	if (ctx->mark > 0)
+		metrics_stagerun(ctx->metrics, ctx->mark);
+#endif
 	audio.samplerate = FLAC__stream_decoder_get_sample_rate(decoder);
 	audio.nchannels = FLAC__stream_decoder_get_channels(decoder);
 	audio.nsamples = frame->header.blocksize;
@@ -163,10 +183,10 @@ output_cb(const FLAC__StreamDecoder *decoder,
 		audio.samples[1] = audio.samples[0];
 
 	ctx->nsamples += audio.nsamples;
-	if (ctx->nsamples == ctx->samplerate)
+	while (ctx->nsamples >= ctx->samplerate)
 	{
 		ctx->position++;
-		ctx->nsamples = 0;
+		ctx->nsamples -= ctx->samplerate;
 	}
 	while (audio.nsamples > 0)
 	{
@@ -180,14 +200,64 @@ output_cb(const FLAC__StreamDecoder *decoder,
 			return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 		}
 	}
+#ifdef METRICS
+	ctx->mark = metrics_now();
+#endif
 
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
+/**
+ * The seek callbacks are called inside the decoder thread.
+ * libFLAC seeks with the SEEKTABLE of the stream if it exists,
+ * otherwise with a binary search of the frame headers.
+ */
+static FLAC__StreamDecoderSeekStatus
+seek_cb(const FLAC__StreamDecoder *decoder, FLAC__uint64 offset, void *data)
+{
+	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
+	if (ctx->in->ctx->seek == NULL)
+		return FLAC__STREAM_DECODER_SEEK_STATUS_UNSUPPORTED;
+	ctx->in->ops->reset(ctx->in->ctx);
+	if (ctx->in->ctx->seek(ctx->in->ctx->producter, offset, SEEK_SET) < 0)
+		return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+	ctx->offset = offset;
+	ctx->eof = 0;
+	return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
+}
+
+static FLAC__StreamDecoderTellStatus
+tell_cb(const FLAC__StreamDecoder *decoder, FLAC__uint64 *offset, void *data)
+{
+	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
+	if (ctx->in->ctx->seek == NULL)
+		return FLAC__STREAM_DECODER_TELL_STATUS_UNSUPPORTED;
+	*offset = ctx->offset;
+	return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
 static FLAC__StreamDecoderLengthStatus
-length_cb(const FLAC__StreamDecoder *decoder, FLAC__uint64 *stream_length, void *client_data)
+length_cb(const FLAC__StreamDecoder *decoder, FLAC__uint64 *stream_length, void *data)
 {
-	return FLAC__STREAM_DECODER_LENGTH_STATUS_UNSUPPORTED;
+	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
+	seek_t seek = ctx->in->ctx->seek;
+	void *producter = ctx->in->ctx->producter;
+	if (seek == NULL)
+		return FLAC__STREAM_DECODER_LENGTH_STATUS_UNSUPPORTED;
+	/// the producer must continue to read from the same place
+	long current = seek(producter, 0, SEEK_CUR);
+	long length = seek(producter, 0, SEEK_END);
+	if (current < 0 || length < 0 || seek(producter, current, SEEK_SET) < 0)
+		return FLAC__STREAM_DECODER_LENGTH_STATUS_ERROR;
+	*stream_length = length;
+	return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
+static FLAC__bool
+eof_cb(const FLAC__StreamDecoder *decoder, void *data)
+{
+	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
+	return ctx->eof;
 }
 
 static void
@@ -195,6 +265,13 @@ metadata_cb(const FLAC__StreamDecoder *decoder,
 	const FLAC__StreamMetadata *metadata,
 	void *data)
 {
+	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
+	if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO &&
+		metadata->data.stream_info.sample_rate > 0)
+	{
+		ctx->samplerate = metadata->data.stream_info.sample_rate;
+		ctx->duration = metadata->data.stream_info.total_samples / ctx->samplerate;
+	}
 }
 
 static void
@@ -204,22 +281,50 @@ error_cb(const FLAC__StreamDecoder *decoder,
 {
 }
 
+static void _flac_seek(decoder_ctx_t *ctx)
+{
+	uint32_t position = ctx->position;
+	uint32_t nsamples = ctx->nsamples;
+	uint32_t seekposition = __atomic_load_n(&ctx->seekposition, __ATOMIC_RELAXED);
+	FLAC__uint64 sample = (FLAC__uint64)seekposition * ctx->samplerate;
+
+	/// the target frame is sent to output_cb during the seek
+	ctx->position = seekposition;
+	ctx->nsamples = 0;
+	if (!FLAC__stream_decoder_seek_absolute(ctx->decoder, sample))
+	{
+		warn("decoder flac: seek %u error", seekposition);
+		ctx->position = position;
+		ctx->nsamples = nsamples;
+		if (FLAC__stream_decoder_get_state(ctx->decoder) == FLAC__STREAM_DECODER_SEEK_ERROR)
+			FLAC__stream_decoder_flush(ctx->decoder);
+	}
+}
+
 static void *_decoder_thread(void *arg)
 {
 	int result = 0;
 	decoder_ctx_t *ctx = (decoder_ctx_t *)arg;
 	dbg("decoder: start running");
-	result = FLAC__stream_decoder_process_until_end_of_stream(ctx->decoder);
+	realtime_enter();
+	do
+	{
+		if (__atomic_exchange_n(&ctx->seeking, 0, __ATOMIC_ACQUIRE))
+			_flac_seek(ctx);
+		result = FLAC__stream_decoder_process_single(ctx->decoder);
+	} while (result &&
+		FLAC__stream_decoder_get_state(ctx->decoder) != FLAC__STREAM_DECODER_END_OF_STREAM);
 	/**
 	 * push the last buffer to the encoder, otherwise the next
 	 * decoder will begins with a pull buffer
 	 */
-	if (ctx->outbufferlen > 0)
+	if (ctx->filter && ctx->filter->outbufferlen > 0)
 	{
-		ctx->out->ops->push(ctx->out->ctx, ctx->outbufferlen, NULL);
+		ctx->out->ops->push(ctx->out->ctx, ctx->filter->outbufferlen, NULL);
 	}
 
 	dbg("decoder: stop running");
+	realtime_leave();
 	player_state(ctx->player, STATE_CHANGE);
 
 	return (void *)(intptr_t)result;
@@ -233,7 +338,7 @@ static int _decoder_check(const char *path)
 	return 0;
 }
 
-static int _decoder_prepare(decoder_ctx_t *ctx, filter_t *filter, const char *info)
+static int _decoder_prepare(decoder_ctx_t *ctx, filter_t *filter, const media_info_t *info)
 {
 	decoder_dbg("decoder: prepare");
 	ctx->filter = filter;
@@ -245,10 +350,10 @@ static int _decoder_prepare(decoder_ctx_t *ctx, filter_t *filter, const char *in
 	FLAC__stream_decoder_set_metadata_ignore(ctx->decoder, FLAC__METADATA_TYPE_PICTURE);
 	ret = FLAC__stream_decoder_init_stream(ctx->decoder,
 		input_cb,
-		NULL,
-		NULL,
+		seek_cb,
+		tell_cb,
 		length_cb,
-		NULL,
+		eof_cb,
 		output_cb,
 		metadata_cb,
 		error_cb,
@@ -281,7 +386,7 @@ static int _decoder_run(decoder_ctx_t *ctx, jitter_t *jitter)
 		ret = ctx->filter->ops->set(ctx->filter->ctx, FILTER_FORMAT, jitter->format, FILTER_SAMPLERATE, jitter_samplerate(jitter), 0);
 	}
 	if (ret == 0)
-		pthread_create(&ctx->thread, NULL, _decoder_thread, ctx);
+		realtime_thread(&ctx->thread, NULL, "decoder", _decoder_thread, ctx);
 	return ret;
 }
 
@@ -300,6 +405,18 @@ static uint32_t _decoder_duration(decoder_ctx_t *ctx)
 	return ctx->duration;
 }
 
+static int _decoder_seek(decoder_ctx_t *ctx, uint32_t position)
+{
+	if (ctx->in == NULL || ctx->in->ctx->seek == NULL)
+		return -1;
+	if (ctx->duration > 0 && position >= ctx->duration)
+		return -1;
+	/// the decoder thread reads the position after the seeking flag
+	__atomic_store_n(&ctx->seekposition, position, __ATOMIC_RELAXED);
+	__atomic_store_n(&ctx->seeking, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
 static void _decoder_destroy(decoder_ctx_t *ctx)
 {
 	if (ctx->out)
@@ -328,6 +445,7 @@ static const decoder_ops_t _decoder_flac =
 	.mime = _decoder_mime,
 	.position = _decoder_position,
 	.duration = _decoder_duration,
+	.seek = _decoder_seek,
 	.destroy = _decoder_destroy,
 };
 
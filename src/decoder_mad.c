@@ -41,6 +41,7 @@
 #include "jitter.h"
 #include "heartbeat.h"
 #include "filter.h"
+#include "seekindex.h"
 typedef struct decoder_s decoder_t;
 typedef struct decoder_ops_s decoder_ops_t;
 typedef struct decoder_ctx_s decoder_ctx_t;
@@ -54,8 +55,6 @@ struct decoder_ctx_s
 	unsigned char *inbuffer;
 
 	jitter_t *out;
-	unsigned char *outbuffer;
-	size_t outbufferlen;
 
 	filter_t *filter;
 	rescale_t rescale;
@@ -64,13 +63,34 @@ struct decoder_ctx_s
 	heartbeat_t heartbeat;
 	beat_samples_t beat;
 	mad_timer_t position;
+	uint32_t duration;
 	unsigned int nloops;
+	unsigned int nframes;
+	/** the samples to drop at the beginning (encoder and decoder delays) */
+	uint64_t skip;
+	/** the sample where the encoder padding begins (0 if unknown) */
+	uint64_t last;
+	/** the number of samples synthesized by the decoder */
+	uint64_t nsamples;
+
+	/** the offset into the stream of inbuffer */
+	long offset;
+	seekindex_t index;
+	uint32_t seekposition;
+	int seeking;
+	/** the thread entered the realtime section */
+	int realtime;
+#ifdef METRICS
+	metrics_stage_t *metrics;
+	uint64_t mark;
+#endif
 };
 #define DECODER_CTX
 #include "decoder.h"
 #include "media.h"
 #include "event.h"
 #include "src.h"
+#include "realtime.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -90,10 +110,46 @@ struct decoder_ctx_s
  * FRACBITS value comes from mad decoder
  */
 #define FRACBITS		28
+/**
+ * the synthesis of libmad delays the samples
+ */
+#define DECODER_DELAY	529
 #define JITTER_TYPE JITTER_TYPE_RING
 
 static jitter_t *_decoder_jitter(decoder_ctx_t *ctx, jitte_t jitte);
 
+/**
+ * The seek restarts the stream from the indexed position before
+ * the requested one, the header callback skips the frames until
+ * the requested position.
+ */
+static void _mad_seek(decoder_ctx_t *ctx, struct mad_stream *stream)
+{
+	long offset = 0;
+	uint32_t seekposition = __atomic_load_n(&ctx->seekposition, __ATOMIC_RELAXED);
+	uint32_t position = seekindex_find(&ctx->index, seekposition, &offset);
+
+	dbg("decoder mad: seek %u from %u at %ld", seekposition, position, offset);
+	ctx->in->ops->reset(ctx->in->ctx);
+	if (ctx->in->ctx->seek(ctx->in->ctx->producter, offset, SEEK_SET) < 0)
+	{
+		/// a new request keeps its position
+		__atomic_compare_exchange_n(&ctx->seekposition, &seekposition, 0, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+	else
+	{
+		ctx->offset = offset;
+		mad_timer_set(&ctx->position, position, 0, 0);
+	}
+	ctx->inbuffer = NULL;
+	/// the bit reservoir of the previous frames is lost
+	stream->md_len = 0;
+	/// the position is not sample exact, the padding is kept
+	ctx->skip = 0;
+	ctx->last = 0;
+}
+
 static
 enum mad_flow input(void *data,
 		    struct mad_stream *stream)
@@ -105,10 +161,18 @@ enum mad_flow input(void *data,
 		return MAD_FLOW_BREAK;
 	}
 	size_t len = ctx->in->ctx->size;
+	int seeking = __atomic_exchange_n(&ctx->seeking, 0, __ATOMIC_ACQUIRE);
 
-	if (stream->next_frame)
-		len = stream->next_frame - ctx->inbuffer;
-	ctx->in->ops->pop(ctx->in->ctx, len);
+	if (seeking)
+		_mad_seek(ctx, stream);
+	else
+	{
+		if (stream->next_frame)
+			len = stream->next_frame - ctx->inbuffer;
+		ctx->in->ops->pop(ctx->in->ctx, len);
+		if (ctx->inbuffer != NULL)
+			ctx->offset += len;
+	}
 
 	ctx->inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
 
@@ -117,6 +181,9 @@ enum mad_flow input(void *data,
 	{
 		return MAD_FLOW_STOP;
 	}
+#ifdef METRICS
+	ctx->mark = metrics_now();
+#endif
 	//input is called for each frame when there is
 	// not enought data to decode the "next frame"
 	if (stream->next_frame)
@@ -124,6 +191,9 @@ enum mad_flow input(void *data,
 
 	decoder_dbg("decoder mad: data len %ld", len);
 	mad_stream_buffer(stream, ctx->inbuffer, len);
+	if (seeking)
+		/// the offset may be inside a frame, the next one must be found
+		stream->sync = 0;
 
 	return MAD_FLOW_CONTINUE;
 }
@@ -141,8 +211,26 @@ enum mad_flow output(void *data,
 	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
 	filter_audio_t audio;
 
+	/**
+	 * libmad allocates its buffers at the start of the decoding and
+	 * during the decoding of the first frame, the thread enters
+	 * realtime with the first synthesized frame.
+	 */
+	if (!ctx->realtime)
+	{
+		realtime_enter();
+		ctx->realtime = 1;
+	}
 	/* pcm->samplerate contains the sampling frequency */
 
+#ifdef METRICS
+	/**
+	 * the decoding runs between the return of the previous callback
+	 * and this one.
+	 */
+	if (ctx->mark > 0)
+		metrics_stagerun(ctx->metrics, ctx->mark);
+#endif
 #ifdef DEBUG
 	if (start.tv_nsec == 0)
 	{
@@ -158,15 +246,29 @@ enum mad_flow output(void *data,
 	decoder_dbg("duration 2 %lu.%02lums", duration / 100, duration % 100);
 #endif
 
+	/**
+	 * the gapless playback removes the delay and the padding
+	 * of the encoder.
+	 */
+	unsigned int first = 0;
+	unsigned int length = pcm->length;
+	if (ctx->nsamples < ctx->skip)
+		first = (ctx->skip - ctx->nsamples < length)? ctx->skip - ctx->nsamples: length;
+	if (ctx->last > 0 && ctx->nsamples + length > ctx->last)
+		length = (ctx->last > ctx->nsamples)? ctx->last - ctx->nsamples: 0;
+	if (length < first)
+		length = first;
+	ctx->nsamples += pcm->length;
+
 	audio.samplerate = pcm->samplerate;
 	audio.nchannels = pcm->channels;
-	audio.nsamples = pcm->length;
+	audio.nsamples = length - first;
 	audio.bitspersample = FRACBITS;
 	audio.mode = 0;
 	int i;
 	for (i = 0; i < audio.nchannels && i < MAXCHANNELS; i++)
 	{
-		audio.samples[i] = pcm->samples[i];
+		audio.samples[i] = pcm->samples[i] + first;
 	}
 	decoder_dbg("decoder mad: audio frame %d Hz, %d channels, %d samples", audio.samplerate, audio.nchannels, audio.nsamples);
 
@@ -184,17 +286,65 @@ enum mad_flow output(void *data,
 			return MAD_FLOW_STOP;
 		}
 	}
+#ifdef METRICS
+	ctx->mark = metrics_now();
+#endif
 
 	return MAD_FLOW_CONTINUE;
 }
 
+/**
+ * iTunes stores the delay and the padding of the encoder into
+ * a comment of the ID3v2 tag:
+ * "iTunSMPB" " 00000000 <delay> <padding> <number of samples> ..."
+ * The text may be encoded in UTF-16, the null bytes are ignored.
+ */
+static void _mad_itunsmpb(decoder_ctx_t *ctx, const unsigned char *data, size_t length)
+{
+	if (length < 10 || memcmp(data, "ID3", 3))
+		return;
+	size_t tagsize = 10 + ((data[6] & 0x7F) << 21) + ((data[7] & 0x7F) << 14) +
+			((data[8] & 0x7F) << 7) + (data[9] & 0x7F);
+	if (tagsize < length)
+		length = tagsize;
+	const unsigned char *end = data + length;
+	const unsigned char *smpb = data + 10;
+	while (smpb + 8 <= end && memcmp(smpb, "iTunSMPB", 8))
+		smpb++;
+	if (smpb + 8 > end)
+		return;
+	smpb += 8;
+	char text[128];
+	size_t i = 0;
+	for (; smpb < end && i < sizeof(text) - 1; smpb++)
+	{
+		if (*smpb == ' ' || (*smpb >= '0' && *smpb <= '9') ||
+			(*smpb >= 'A' && *smpb <= 'F') || (*smpb >= 'a' && *smpb <= 'f'))
+			text[i++] = *smpb;
+		else if (*smpb != 0 && *smpb != 0xFF && *smpb != 0xFE && i > 0)
+			break;
+	}
+	text[i] = 0;
+	unsigned int zero, delay, padding;
+	unsigned long long nsamples;
+	if (sscanf(text, "%x %x %x %llx", &zero, &delay, &padding, &nsamples) == 4 && nsamples > 0)
+	{
+		dbg("decoder mad: iTunes delay %u padding %u", delay, padding);
+		ctx->skip = delay + DECODER_DELAY;
+		ctx->last = ctx->skip + nsamples;
+	}
+}
+
 static
 enum mad_flow error(void *data,
 		    struct mad_stream *stream,
 		    struct mad_frame *frame)
 {
+	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
 	if (MAD_RECOVERABLE(stream->error))
 	{
+		if (stream->error == MAD_ERROR_LOSTSYNC && ctx->nframes == 0)
+			_mad_itunsmpb(ctx, stream->this_frame, stream->bufend - stream->this_frame);
 #ifdef USE_ID3TAG
 		if (stream->error == MAD_ERROR_LOSTSYNC)
 		{
@@ -231,12 +381,179 @@ enum mad_flow error(void *data,
 		return MAD_FLOW_BREAK;
 	}
 }
+static uint32_t _mad_be32(const unsigned char *data)
+{
+	return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static uint32_t _mad_be16(const unsigned char *data)
+{
+	return (data[0] << 8) | data[1];
+}
+
+/**
+ * The LAME tag follows the Xing header and gives the delay and
+ * the padding of the encoder in samples.
+ */
+static void _mad_parselame(decoder_ctx_t *ctx, const unsigned char *lame,
+			const unsigned char *end, uint32_t nframes, uint32_t samplesperframe)
+{
+	if (lame + 24 > end)
+		return;
+	if (memcmp(lame, "LAME", 4) && memcmp(lame, "Lavf", 4) && memcmp(lame, "Lavc", 4))
+		return;
+	unsigned int delay = (lame[21] << 4) | (lame[22] >> 4);
+	unsigned int padding = ((lame[22] & 0x0F) << 8) | lame[23];
+	uint64_t nsamples = (uint64_t)nframes * samplesperframe;
+	if (nframes == 0 || delay + padding >= nsamples)
+		return;
+	dbg("decoder mad: encoder delay %u padding %u", delay, padding);
+	ctx->skip = delay + DECODER_DELAY;
+	ctx->last = nsamples - padding + DECODER_DELAY;
+}
+
+/**
+ * The first frame of a VBR stream may be a Xing (or Info) frame or
+ * a VBRI frame. Both give the duration and a table of contents
+ * to fill the whole index before the decoding.
+ * This frame doesn't contain audio, the function returns 1 to skip it.
+ */
+static int _mad_parsetoc(decoder_ctx_t *ctx, struct mad_stream *stream,
+			struct mad_header const *header, long offset)
+{
+	const unsigned char *frame = stream->this_frame;
+	const unsigned char *end = stream->bufend;
+	size_t sideinfo = 4;
+	if (header->flags & MAD_FLAG_PROTECTION)
+		sideinfo += 2;
+	if (header->flags & MAD_FLAG_LSF_EXT)
+		sideinfo += (header->mode == MAD_MODE_SINGLE_CHANNEL)? 9: 17;
+	else
+		sideinfo += (header->mode == MAD_MODE_SINGLE_CHANNEL)? 17: 32;
+
+	uint32_t nframes = 0;
+	uint32_t nbytes = 0;
+	const unsigned char *toc = NULL;
+	const unsigned char *vbri = NULL;
+	int tag = 0;
+	if (frame + sideinfo + 8 <= end &&
+		(!memcmp(frame + sideinfo, "Xing", 4) || !memcmp(frame + sideinfo, "Info", 4)))
+	{
+		const unsigned char *data = frame + sideinfo + 4;
+		tag = 1;
+		uint32_t flags = _mad_be32(data);
+		data += 4;
+		if ((flags & 0x01) && data + 4 <= end)
+		{
+			nframes = _mad_be32(data);
+			data += 4;
+		}
+		if ((flags & 0x02) && data + 4 <= end)
+		{
+			nbytes = _mad_be32(data);
+			data += 4;
+		}
+		if ((flags & 0x04) && data + 100 <= end)
+		{
+			toc = data;
+			data += 100;
+		}
+		if (flags & 0x08)
+			data += 4;
+		_mad_parselame(ctx, data, end, nframes, 32 * MAD_NSBSAMPLES(header));
+	}
+	else if (frame + 36 + 26 <= end && !memcmp(frame + 36, "VBRI", 4))
+	{
+		vbri = frame + 36;
+		tag = 1;
+		nbytes = _mad_be32(vbri + 10);
+		nframes = _mad_be32(vbri + 14);
+	}
+	if (!tag)
+		return 0;
+	if (nframes == 0 || header->samplerate == 0)
+		return 1;
+
+	uint32_t samplesperframe = 32 * MAD_NSBSAMPLES(header);
+	ctx->duration = (uint64_t)nframes * samplesperframe / header->samplerate;
+	dbg("decoder mad: %u frames, duration %u", nframes, ctx->duration);
+
+	uint32_t position;
+	if (toc != NULL && nbytes > 0)
+	{
+		/// the TOC gives the offset of each percent of the duration
+		for (position = 0; position < ctx->duration; position++)
+		{
+			double percent = position * 100.0 / ctx->duration;
+			int i = percent;
+			double a = toc[i];
+			double b = (i < 99)? toc[i + 1]: 256;
+			double ratio = (a + (b - a) * (percent - i)) / 256;
+			seekindex_add(&ctx->index, position, offset + (long)(ratio * nbytes));
+		}
+	}
+	else if (vbri != NULL)
+	{
+		/// the VBRI table gives the size of each group of frames
+		unsigned int nentries = _mad_be16(vbri + 18);
+		unsigned int scale = _mad_be16(vbri + 20);
+		unsigned int entrysize = _mad_be16(vbri + 22);
+		unsigned int framesperentry = _mad_be16(vbri + 24);
+		const unsigned char *table = vbri + 26;
+		if (entrysize == 0 || entrysize > 4 || framesperentry == 0 ||
+			table + nentries * entrysize > end)
+			return 1;
+
+		unsigned int k = 0;
+		for (position = 0; position < ctx->duration && k < nentries; position++)
+		{
+			double entry = (double)position * header->samplerate /
+					((double)framesperentry * samplesperframe);
+			unsigned long size = 0;
+			while (k < nentries)
+			{
+				int i;
+				size = 0;
+				for (i = 0; i < entrysize; i++)
+					size = (size << 8) | table[k * entrysize + i];
+				size *= scale;
+				if (k + 1 > entry)
+					break;
+				offset += size;
+				k++;
+			}
+			seekindex_add(&ctx->index, position, offset + (long)(size * (entry - k)));
+		}
+	}
+	return 1;
+}
+
 enum mad_flow header(void *data, struct mad_header const *header)
 {
 	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
+	struct mad_stream *stream = &ctx->decoder.sync->stream;
 	decoder_dbg("decoder mad: audio header mpeg1layer%d, flag 0x%x", header->layer, header->flags);
 	decoder_dbg("decoder mad: bitrate %d , samplerate %d", header->bitrate, header->samplerate);
+
+	if (__atomic_load_n(&ctx->seeking, __ATOMIC_ACQUIRE))
+	{
+		/**
+		 * drop the end of the buffer to force the call of input
+		 * which seeks into the stream.
+		 */
+		stream->next_frame = stream->bufend;
+		return MAD_FLOW_IGNORE;
+	}
+	long offset = ctx->offset + (stream->this_frame - ctx->inbuffer);
+	uint32_t position = mad_timer_count(ctx->position, MAD_UNITS_SECONDS);
+	if (ctx->nframes++ == 0 && _mad_parsetoc(ctx, stream, header, offset))
+		return MAD_FLOW_IGNORE;
+	seekindex_add(&ctx->index, position, offset);
+
 	mad_timer_add(&ctx->position, header->duration);
+	/// the frames are skipped without synthesis until the seek position
+	if (position < __atomic_load_n(&ctx->seekposition, __ATOMIC_RELAXED))
+		return MAD_FLOW_IGNORE;
 	return MAD_FLOW_CONTINUE;
 }
 
@@ -254,6 +571,9 @@ static decoder_ctx_t *_decoder_init(player_ctx_t *player)
 	decoder_ctx_t *ctx = calloc(1, sizeof(*ctx));
 	ctx->ops = decoder_mad;
 	ctx->player = player;
+#ifdef METRICS
+	ctx->metrics = metrics_stage("decoder_mad");
+#endif
 
 	mad_decoder_init(&ctx->decoder, ctx,
 			input, header /* header */, 0 /* filter */, output,
@@ -277,7 +597,7 @@ static void _decoder_listener(void *arg, const src_t *src, event_t event, void *
 }
 #endif
 
-static int _decoder_prepare(decoder_ctx_t *ctx, filter_t *filter, const char *info)
+static int _decoder_prepare(decoder_ctx_t *ctx, filter_t *filter, const media_info_t *info)
 {
 	decoder_dbg("decoder: prepare");
 	ctx->filter = filter;
@@ -329,11 +649,13 @@ static void *mad_thread(void *arg)
 	 * push the last buffer to the encoder, otherwise the next
 	 * decoder will begins with a pull buffer
 	 */
-	if (ctx->outbufferlen > 0)
+	if (ctx->filter && ctx->filter->outbufferlen > 0)
 	{
-		ctx->out->ops->push(ctx->out->ctx, ctx->outbufferlen, NULL);
+		ctx->out->ops->push(ctx->out->ctx, ctx->filter->outbufferlen, NULL);
 	}
 	dbg("decoder: stop running");
+	realtime_leave();
+	ctx->realtime = 0;
 	player_state(ctx->player, STATE_CHANGE);
 
 	return (void *)(intptr_t)result;
@@ -368,7 +690,7 @@ static int _decoder_run(decoder_ctx_t *ctx, jitter_t *jitter)
 	}
 #endif
 	if (ret == 0)
-		pthread_create(&ctx->thread, NULL, mad_thread, ctx);
+		realtime_thread(&ctx->thread, NULL, "decoder", mad_thread, ctx);
 	return ret;
 }
 
@@ -393,6 +715,18 @@ static uint32_t _decoder_position(decoder_ctx_t *ctx)
 
 static uint32_t _decoder_duration(decoder_ctx_t *ctx)
 {
+	return ctx->duration;
+}
+
+static int _decoder_seek(decoder_ctx_t *ctx, uint32_t position)
+{
+	if (ctx->in == NULL || ctx->in->ctx->seek == NULL)
+		return -1;
+	if (ctx->duration > 0 && position >= ctx->duration)
+		return -1;
+	/// the decoder thread reads the position after the seeking flag
+	__atomic_store_n(&ctx->seekposition, position, __ATOMIC_RELAXED);
+	__atomic_store_n(&ctx->seeking, 1, __ATOMIC_RELEASE);
 	return 0;
 }
 
@@ -426,6 +760,7 @@ const decoder_ops_t _decoder_mad =
 	.run = _decoder_run,
 	.position = _decoder_position,
 	.duration = _decoder_duration,
+	.seek = _decoder_seek,
 	.destroy = _decoder_destroy,
 	.mime = _decoder_mime,
 };
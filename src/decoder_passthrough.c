@@ -31,21 +31,59 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "player.h"
+#include "filter.h"
 typedef struct decoder_s decoder_t;
 typedef struct decoder_ops_s decoder_ops_t;
 typedef struct decoder_ctx_s decoder_ctx_t;
 struct decoder_ctx_s
 {
 	const decoder_ops_t *ops;
-	jitter_t *inout;
+	player_ctx_t *player;
+	pthread_t thread;
+	jitter_t *in;
+	unsigned char *inbuffer;
+	size_t inlength;
+	size_t inoffset;
+	jitter_t *out;
+	filter_t *filter;
+	rescale_t rescale;
+	/** the description of the container */
+	jitter_format_t format;
+	unsigned int samplerate;
+	unsigned int nchannels;
+	unsigned int samplesize;
+	unsigned int blockalign;
+	int bigendian;
+	int unsignedsample;
+	/** the bytes of the data chunk not yet read */
+	uint64_t remaining;
+	/** the bytes read before the detection of the container */
+	unsigned char pending[12];
+	size_t pendinglength;
+	/** the conversion buffers */
+	unsigned char *staging;
+	sample_t *samples[MAXCHANNELS];
+	uint32_t nbytes;
+	uint32_t position;
+	uint32_t duration;
+	/** the filter lets the samples unchanged, the stream may be copied */
+	int copy;
+	int end;
+	/** the decoder is destroyed before the end of the stream */
+	int stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
 };
 #define DECODER_CTX
 #include "decoder.h"
 #include "media.h"
 #include "jitter.h"
+#include "realtime.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -55,25 +93,607 @@ struct decoder_ctx_s
 #define dbg(...)
 #endif
 
+#define decoder_dbg(...)
+
+#define BUFFERSIZE 9000
+#define NBUFFER 4
+/** the number of frames converted at once */
+#define NFRAMES 1152
+
+static const char *jitter_name = "pcm decoder";
+
 static decoder_ctx_t *_decoder_init(player_ctx_t *player)
 {
 	decoder_ctx_t *ctx = calloc(1, sizeof(*ctx));
 	ctx->ops = decoder_passthrough;
+	ctx->player = player;
+	ctx->remaining = UINT64_MAX;
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
 
 	return ctx;
 }
 
 static jitter_t *_decoder_jitter(decoder_ctx_t *ctx, jitte_t jitte)
 {
-	return ctx->inout;
+	if (ctx->in == NULL)
+	{
+		int factor = jitte;
+		int nbbuffer = NBUFFER << factor;
+		jitter_t *jitter = jitter_init(JITTER_TYPE_RING, jitter_name, nbbuffer, BUFFERSIZE);
+		jitter->ctx->thredhold = nbbuffer / 2;
+		ctx->in = jitter;
+	}
+	return ctx->in;
 }
 
-static int _decoder_run(decoder_ctx_t *ctx, jitter_t *jitter)
+static int _decoder_prepare(decoder_ctx_t *ctx, filter_t *filter, const media_info_t *info)
+{
+	ctx->filter = filter;
+	return 0;
+}
+
+/**
+ * The source may be a producer (src_file), then the reading is exact
+ * and the source is never read ahead. Otherwise the source pushes
+ * its buffers into the input jitter.
+ */
+static size_t _decoder_read(decoder_ctx_t *ctx, unsigned char *buffer, size_t length)
+{
+	size_t len = 0;
+	while (len < length)
+	{
+		int ret = 0;
+		if (ctx->in->ctx->produce != NULL)
+			ret = ctx->in->ctx->produce(ctx->in->ctx->producter, buffer + len, length - len);
+		else
+		{
+			if (ctx->inbuffer == NULL)
+			{
+				ctx->inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
+				if (ctx->inbuffer == NULL)
+					break;
+				ctx->inlength = ctx->in->ops->length(ctx->in->ctx);
+				ctx->inoffset = 0;
+			}
+			ret = ctx->inlength - ctx->inoffset;
+			if (ret > length - len)
+				ret = length - len;
+			memcpy(buffer + len, ctx->inbuffer + ctx->inoffset, ret);
+			ctx->inoffset += ret;
+			if (ctx->inoffset == ctx->inlength)
+			{
+				ctx->in->ops->pop(ctx->in->ctx, ctx->inlength);
+				ctx->inbuffer = NULL;
+			}
+		}
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+	return len;
+}
+
+static int _decoder_skip(decoder_ctx_t *ctx, uint64_t length)
 {
-	ctx->inout = jitter;
+	unsigned char trash[256];
+	while (length > 0)
+	{
+		size_t len = (length > sizeof(trash))? sizeof(trash): length;
+		if (_decoder_read(ctx, trash, len) < len)
+			return -1;
+		length -= len;
+	}
 	return 0;
 }
 
+static uint16_t _le16(const unsigned char *data)
+{
+	return data[0] | (data[1] << 8);
+}
+
+static uint32_t _le32(const unsigned char *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t _be16(const unsigned char *data)
+{
+	return (data[0] << 8) | data[1];
+}
+
+static uint32_t _be32(const unsigned char *data)
+{
+	return ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/**
+ * the data chunk of RF64 is larger than 4GB, its size is into ds64.
+ */
+static int _decoder_wav(decoder_ctx_t *ctx, int rf64)
+{
+	unsigned char chunk[8];
+	uint64_t ds64size = UINT64_MAX;
+	int fmt = 0;
+	while (_decoder_read(ctx, chunk, 8) == 8)
+	{
+		uint32_t size = _le32(chunk + 4);
+		uint32_t len = 0;
+		if (!memcmp(chunk, "fmt ", 4))
+		{
+			unsigned char data[40];
+			len = (size > sizeof(data))? sizeof(data): size;
+			if (len < 16 || _decoder_read(ctx, data, len) < len)
+				return -1;
+			uint16_t tag = _le16(data);
+			/// WAVE_FORMAT_EXTENSIBLE stores the format into the subformat
+			if (tag == 0xFFFE && len >= 26)
+				tag = _le16(data + 24);
+			if (tag != 1)
+			{
+				err("decoder: wav format %#x not supported", tag);
+				return -1;
+			}
+			ctx->nchannels = _le16(data + 2);
+			ctx->samplerate = _le32(data + 4);
+			ctx->blockalign = _le16(data + 12);
+			ctx->unsignedsample = (_le16(data + 14) <= 8);
+			fmt = 1;
+		}
+		else if (rf64 && !memcmp(chunk, "ds64", 4))
+		{
+			unsigned char data[16];
+			len = (size > sizeof(data))? sizeof(data): size;
+			if (len < 16 || _decoder_read(ctx, data, len) < len)
+				return -1;
+			ds64size = _le32(data + 8) | ((uint64_t)_le32(data + 12) << 32);
+		}
+		else if (!memcmp(chunk, "data", 4))
+		{
+			if (!fmt)
+				return -1;
+			ctx->remaining = size;
+			if (size == UINT32_MAX)
+				ctx->remaining = ds64size;
+			/// a stream without size is read until its end
+			else if (size == 0)
+				ctx->remaining = UINT64_MAX;
+			return 0;
+		}
+		/// the chunks are aligned on 16 bits
+		if (_decoder_skip(ctx, (uint64_t)size - len + (size & 1)) < 0)
+			return -1;
+	}
+	return -1;
+}
+
+static uint32_t _decoder_extended(const unsigned char *data)
+{
+	int exponent = ((data[0] & 0x7F) << 8 | data[1]) - 16383;
+	uint64_t mantissa = ((uint64_t)_be32(data + 2) << 32) | _be32(data + 6);
+	if (exponent < 0 || exponent > 63)
+		return 0;
+	return mantissa >> (63 - exponent);
+}
+
+static int _decoder_aiff(decoder_ctx_t *ctx, int aifc)
+{
+	unsigned char chunk[8];
+	int comm = 0;
+	ctx->bigendian = 1;
+	while (_decoder_read(ctx, chunk, 8) == 8)
+	{
+		uint32_t size = _be32(chunk + 4);
+		uint32_t len = 0;
+		if (!memcmp(chunk, "COMM", 4))
+		{
+			unsigned char data[22];
+			len = (size > sizeof(data))? sizeof(data): size;
+			if (len < 18 || _decoder_read(ctx, data, len) < len)
+				return -1;
+			ctx->nchannels = _be16(data);
+			ctx->blockalign = ctx->nchannels * ((_be16(data + 6) + 7) / 8);
+			ctx->samplerate = _decoder_extended(data + 8);
+			if (aifc && len >= 22)
+			{
+				/// "sowt" is the little endian variant of AIFF-C
+				if (!memcmp(data + 18, "sowt", 4))
+					ctx->bigendian = 0;
+				else if (memcmp(data + 18, "NONE", 4) && memcmp(data + 18, "twos", 4))
+				{
+					err("decoder: aifc compression %.4s not supported", data + 18);
+					return -1;
+				}
+			}
+			comm = 1;
+		}
+		else if (!memcmp(chunk, "SSND", 4))
+		{
+			unsigned char data[8];
+			if (!comm || size < 8 || _decoder_read(ctx, data, 8) < 8)
+				return -1;
+			uint32_t offset = _be32(data);
+			if (offset > size - 8)
+			{
+				err("decoder: aiff offset %u out of the data chunk", offset);
+				return -1;
+			}
+			if (_decoder_skip(ctx, offset) < 0)
+				return -1;
+			ctx->remaining = size - 8 - offset;
+			return 0;
+		}
+		if (_decoder_skip(ctx, (uint64_t)size - len + (size & 1)) < 0)
+			return -1;
+	}
+	return -1;
+}
+
+static jitter_format_t _decoder_format(decoder_ctx_t *ctx)
+{
+	if (ctx->unsignedsample)
+		return 0;
+	if (!ctx->bigendian && ctx->nchannels == 1 && ctx->samplesize == 2)
+		return PCM_16bits_LE_mono;
+	if (!ctx->bigendian && ctx->nchannels == 2 && ctx->samplesize == 2)
+		return PCM_16bits_LE_stereo;
+	if (!ctx->bigendian && ctx->nchannels == 2 && ctx->samplesize == 3)
+		return PCM_24bits3_LE_stereo;
+	if (!ctx->bigendian && ctx->nchannels == 2 && ctx->samplesize == 4)
+		return PCM_32bits_LE_stereo;
+	if (ctx->bigendian && ctx->nchannels == 2 && ctx->samplesize == 4)
+		return PCM_32bits_BE_stereo;
+	return 0;
+}
+
+/**
+ * a stream without known header (.pcm or pcm://) is already
+ * into the format of the output.
+ */
+static int _decoder_header(decoder_ctx_t *ctx)
+{
+	unsigned char *header = ctx->pending;
+	int ret = -1;
+	size_t len = _decoder_read(ctx, header, 12);
+	if (len == 12 && !memcmp(header + 8, "WAVE", 4) &&
+		(!memcmp(header, "RIFF", 4) || !memcmp(header, "RF64", 4)))
+		ret = _decoder_wav(ctx, !memcmp(header, "RF64", 4));
+	else if (len == 12 && !memcmp(header, "FORM", 4) &&
+		(!memcmp(header + 8, "AIFF", 4) || !memcmp(header + 8, "AIFC", 4)))
+		ret = _decoder_aiff(ctx, !memcmp(header + 8, "AIFC", 4));
+	else
+	{
+		ctx->pendinglength = len;
+		ctx->format = ctx->out->format;
+		ctx->samplerate = jitter_samplerate(ctx->out);
+		ctx->blockalign = 1;
+		return 0;
+	}
+	if (ret < 0 || ctx->nchannels == 0 || ctx->nchannels > MAXCHANNELS ||
+		ctx->blockalign < ctx->nchannels || ctx->samplerate == 0)
+	{
+		err("decoder: pcm header not supported");
+		return -1;
+	}
+	ctx->samplesize = ctx->blockalign / ctx->nchannels;
+	if (ctx->samplesize > 4)
+	{
+		err("decoder: pcm samples of %u bytes not supported", ctx->samplesize);
+		return -1;
+	}
+	ctx->format = _decoder_format(ctx);
+	uint32_t byterate = ctx->samplerate * ctx->blockalign;
+	if (ctx->remaining != UINT64_MAX)
+		ctx->duration = ctx->remaining / byterate;
+	dbg("decoder: pcm %u Hz, %u channels, %u bytes, duration %us",
+			ctx->samplerate, ctx->nchannels, ctx->samplesize, ctx->duration);
+	return 0;
+}
+
+static void _decoder_position(decoder_ctx_t *ctx, size_t length)
+{
+	uint32_t byterate = ctx->samplerate * ctx->blockalign;
+	if (byterate == 0)
+		return;
+	ctx->nbytes += length;
+	while (ctx->nbytes >= byterate)
+	{
+		ctx->position++;
+		ctx->nbytes -= byterate;
+	}
+}
+
+/**
+ * the output jitter reads the source directly, the producer
+ * only stops the stream at the end of the data chunk.
+ * It runs into the thread of the consumer, the decoder thread
+ * changes the state of the player.
+ */
+static int _decoder_produce(void *arg, unsigned char *buffer, size_t size)
+{
+	decoder_ctx_t *ctx = (decoder_ctx_t *)arg;
+	jitter_ctx_t *in = ctx->in->ctx;
+	if (size > ctx->remaining)
+		size = ctx->remaining;
+	int ret = 0;
+	if (size > 0)
+		ret = in->produce(in->producter, buffer, size);
+	if (ret > 0)
+	{
+		if (ctx->remaining != UINT64_MAX)
+			ctx->remaining -= ret;
+		_decoder_position(ctx, ret);
+		return ret;
+	}
+	/// the jitter may request again after the end of the stream
+	if (ctx->end)
+		return 0;
+	/// the source ends the stream after the trailing chunks
+	while (size == 0 && in->produce(in->producter, buffer, ctx->out->ctx->size) > 0);
+	dbg("decoder: end of pcm stream");
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->end = 1;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+	return 0;
+}
+
+static size_t _decoder_readdata(decoder_ctx_t *ctx, unsigned char *buffer, size_t length)
+{
+	size_t len = 0;
+	if (ctx->pendinglength > 0)
+	{
+		len = (ctx->pendinglength < length)? ctx->pendinglength: length;
+		memcpy(buffer, ctx->pending, len);
+		ctx->pendinglength -= len;
+		memmove(ctx->pending, ctx->pending + len, ctx->pendinglength);
+	}
+	if (length - len > ctx->remaining)
+		length = len + ctx->remaining;
+	size_t ret = _decoder_read(ctx, buffer + len, length - len);
+	if (ctx->remaining != UINT64_MAX)
+		ctx->remaining -= ret;
+	len += ret;
+	_decoder_position(ctx, len);
+	return len;
+}
+
+/**
+ * The first buffers are filled here with the bytes already read,
+ * then the output jitter becomes the consumer of the source.
+ * The producer is set before the last push, the consumer starts
+ * to read the source only when the filling is done.
+ */
+static int _decoder_handover(decoder_ctx_t *ctx)
+{
+	size_t length = ctx->out->ctx->size - (ctx->out->ctx->size % ctx->blockalign);
+	int nbuffers = ctx->out->ctx->thredhold;
+	size_t len;
+	do
+	{
+		unsigned char *buffer = ctx->out->ops->pull(ctx->out->ctx);
+		if (buffer == NULL)
+			return -1;
+		len = _decoder_readdata(ctx, buffer, length);
+		if (--nbuffers <= 0 || len < length)
+		{
+			ctx->out->ctx->producter = ctx;
+			ctx->out->ctx->produce = _decoder_produce;
+		}
+		if (len > 0)
+			ctx->out->ops->push(ctx->out->ctx, len, NULL);
+	} while (nbuffers > 0 && len == length);
+	return 0;
+}
+
+/**
+ * the same format from a source without producer is only copied.
+ */
+static int _decoder_copy(decoder_ctx_t *ctx)
+{
+	size_t length = ctx->out->ctx->size - (ctx->out->ctx->size % ctx->blockalign);
+	while (1)
+	{
+		unsigned char *buffer = ctx->out->ops->pull(ctx->out->ctx);
+		if (buffer == NULL)
+			return -1;
+		size_t len = _decoder_readdata(ctx, buffer, length);
+		if (len > 0)
+			ctx->out->ops->push(ctx->out->ctx, len, NULL);
+		if (len < length)
+			break;
+	}
+	return 0;
+}
+
+/**
+ * the samples are sign extended on the width of their container,
+ * the loops have a constant size to be vectorized.
+ */
+static void _decoder_unpack(decoder_ctx_t *ctx, const unsigned char *data, int nframes)
+{
+	unsigned int stride = ctx->blockalign;
+	for (int c = 0; c < ctx->nchannels; c++)
+	{
+		const unsigned char *in = data + c * ctx->samplesize;
+		sample_t *out = ctx->samples[c];
+		int i;
+		switch (ctx->samplesize * (ctx->bigendian? -1: 1))
+		{
+		case 1:
+		case -1:
+			if (ctx->unsignedsample)
+				for (i = 0; i < nframes; i++)
+					out[i] = (sample_t)in[i * stride] - 128;
+			else
+				for (i = 0; i < nframes; i++)
+					out[i] = (int8_t)in[i * stride];
+		break;
+		case 2:
+			for (i = 0; i < nframes; i++)
+				out[i] = (int16_t)(in[i * stride] | (in[i * stride + 1] << 8));
+		break;
+		case -2:
+			for (i = 0; i < nframes; i++)
+				out[i] = (int16_t)((in[i * stride] << 8) | in[i * stride + 1]);
+		break;
+		case 3:
+			for (i = 0; i < nframes; i++)
+				out[i] = (sample_t)(((uint32_t)in[i * stride] << 8) | ((uint32_t)in[i * stride + 1] << 16) |
+						((uint32_t)in[i * stride + 2] << 24)) >> 8;
+		break;
+		case -3:
+			for (i = 0; i < nframes; i++)
+				out[i] = (sample_t)(((uint32_t)in[i * stride] << 24) | ((uint32_t)in[i * stride + 1] << 16) |
+						((uint32_t)in[i * stride + 2] << 8)) >> 8;
+		break;
+		case 4:
+			for (i = 0; i < nframes; i++)
+				out[i] = (sample_t)_le32(in + i * stride);
+		break;
+		case -4:
+			for (i = 0; i < nframes; i++)
+				out[i] = (sample_t)_be32(in + i * stride);
+		break;
+		}
+	}
+}
+
+/**
+ * the conversion buffers depend on the header of the stream,
+ * they must be allocated before entering the realtime section.
+ */
+static int _decoder_buffers(decoder_ctx_t *ctx)
+{
+	ctx->staging = malloc(NFRAMES * ctx->blockalign);
+	if (ctx->staging == NULL)
+		return -1;
+	for (int c = 0; c < ctx->nchannels; c++)
+	{
+		ctx->samples[c] = malloc(NFRAMES * sizeof(sample_t));
+		if (ctx->samples[c] == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+static int _decoder_convert(decoder_ctx_t *ctx)
+{
+	size_t len;
+	do
+	{
+		len = _decoder_readdata(ctx, ctx->staging, NFRAMES * ctx->blockalign);
+		int nframes = len / ctx->blockalign;
+		_decoder_unpack(ctx, ctx->staging, nframes);
+
+		filter_audio_t audio = {0};
+		audio.samplerate = ctx->samplerate;
+		audio.nchannels = ctx->nchannels;
+		audio.nsamples = nframes;
+		audio.bitspersample = ctx->samplesize * 8;
+		for (int c = 0; c < ctx->nchannels; c++)
+			audio.samples[c] = ctx->samples[c];
+		while (audio.nsamples > 0)
+		{
+			if (filter_filloutput(ctx->filter, &audio, ctx->out) < 0)
+				return -1;
+		}
+	} while (len == NFRAMES * ctx->blockalign);
+	/**
+	 * push the last buffer to the encoder, otherwise the next
+	 * decoder will begins with a pull buffer
+	 */
+	if (ctx->filter->outbufferlen > 0)
+		ctx->out->ops->push(ctx->out->ctx, ctx->filter->outbufferlen, NULL);
+	return 0;
+}
+
+static void *_decoder_thread(void *arg)
+{
+	decoder_ctx_t *ctx = (decoder_ctx_t *)arg;
+	int ret;
+	dbg("decoder: start running");
+	ret = _decoder_header(ctx);
+	if (ret == 0)
+	{
+		if (jitter_samplerate(ctx->out) == 0)
+			ctx->out->ctx->frequence = ctx->samplerate;
+		else if (jitter_samplerate(ctx->out) != ctx->samplerate)
+		{
+			/// the filter doesn't resample, the stream is rejected
+			err("decoder: samplerate %d not supported", ctx->samplerate);
+			ret = -1;
+		}
+	}
+	/**
+	 * the consumer of the output reads the source only if the output
+	 * is pulled, a consumer of the pushed buffers (the mixer) is
+	 * never a producer.
+	 */
+	if (ret == 0 && ctx->copy && ctx->format == ctx->out->format &&
+		ctx->in->ctx->produce != NULL && ctx->out->ctx->consume == NULL)
+	{
+		dbg("decoder: pcm without copy");
+		ret = _decoder_handover(ctx);
+		/// the thread waits the end of the stream read by the consumer of the output
+		pthread_mutex_lock(&ctx->mutex);
+		while (ret == 0 && !ctx->end && !ctx->stop)
+			pthread_cond_wait(&ctx->cond, &ctx->mutex);
+		int stop = ctx->stop;
+		pthread_mutex_unlock(&ctx->mutex);
+		if (ret == 0 && !stop)
+			player_state(ctx->player, STATE_CHANGE);
+		return (void *)(intptr_t)ret;
+	}
+	int copy = ctx->copy && ctx->format == ctx->out->format;
+	if (ret == 0 && !copy && ctx->filter == NULL)
+	{
+		err("decoder: pcm conversion without filter");
+		ret = -1;
+	}
+	else if (ret == 0 && !copy)
+		ret = _decoder_buffers(ctx);
+	realtime_enter();
+	if (ret == 0 && copy)
+		ret = _decoder_copy(ctx);
+	else if (ret == 0)
+		ret = _decoder_convert(ctx);
+	if (ctx->in->ctx->produce == NULL)
+	{
+		/// flush the src jitter to break the stream
+		ctx->in->ops->flush(ctx->in->ctx);
+	}
+	dbg("decoder: stop running");
+	realtime_leave();
+	player_state(ctx->player, STATE_CHANGE);
+
+	return (void *)(intptr_t)ret;
+}
+
+static int _decoder_run(decoder_ctx_t *ctx, jitter_t *jitter)
+{
+	int ret = 0;
+	ctx->out = jitter;
+	if (ctx->in == NULL)
+		return -1;
+	/**
+	 * Initialization of the filter here.
+	 * Because we need the jitter out.
+	 */
+	/// the copy of the stream skips the sampled stages of the filter
+	ctx->copy = (ctx->filter == NULL || ctx->filter->ops->sampled == NULL ||
+			ctx->filter->ops->sampled(ctx->filter->ctx) == 0);
+	if (ctx->filter != NULL)
+	{
+		rescale_init(&ctx->rescale, 0, jitter->format);
+		ctx->filter->ops->set(ctx->filter->ctx, FILTER_SAMPLED, rescale_cb, &ctx->rescale, 0);
+		ret = ctx->filter->ops->set(ctx->filter->ctx, FILTER_FORMAT, jitter->format, FILTER_SAMPLERATE, jitter_samplerate(jitter), 0);
+	}
+	if (ret == 0)
+		realtime_thread(&ctx->thread, NULL, "decoder", _decoder_thread, ctx);
+	return ret;
+}
+
 static int _decoder_check(const char *path)
 {
 	if (!strncmp(path, "pcm://", 6))
@@ -83,6 +703,8 @@ static int _decoder_check(const char *path)
 		return 1;
 	if (ext && !strcmp(ext, ".pcm"))
 		return 1;
+	if (ext && (!strcmp(ext, ".aif") || !strcmp(ext, ".aiff") || !strcmp(ext, ".aifc")))
+		return 1;
 	return 0;
 }
 
@@ -91,8 +713,47 @@ static const char *_decoder_mime(decoder_ctx_t *ctx)
 	return mime_audiopcm;
 }
 
+static uint32_t _decoder_getposition(decoder_ctx_t *ctx)
+{
+	return ctx->position;
+}
+
+static uint32_t _decoder_duration(decoder_ctx_t *ctx)
+{
+	return ctx->duration;
+}
+
 static void _decoder_destroy(decoder_ctx_t *ctx)
 {
+	if (ctx->out)
+	{
+		/// the consumer of the output doesn't read the source anymore
+		if (ctx->out->ctx->produce == _decoder_produce)
+		{
+			ctx->out->ctx->produce = NULL;
+			ctx->out->ctx->producter = NULL;
+		}
+		else
+			ctx->out->ops->flush(ctx->out->ctx);
+	}
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->stop = 1;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+	if (ctx->thread > 0)
+		pthread_join(ctx->thread, NULL);
+	if (ctx->in)
+		jitter_destroy(ctx->in);
+	if (ctx->filter)
+	{
+		ctx->filter->ops->destroy(ctx->filter->ctx);
+		free(ctx->filter);
+	}
+	for (int c = 0; c < MAXCHANNELS; c++)
+		free(ctx->samples[c]);
+	free(ctx->staging);
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->mutex);
 	free(ctx);
 }
 
@@ -102,7 +763,10 @@ const decoder_ops_t *decoder_passthrough = &(decoder_ops_t)
 	.check = _decoder_check,
 	.init = _decoder_init,
 	.jitter = _decoder_jitter,
+	.prepare = _decoder_prepare,
 	.run = _decoder_run,
 	.mime = _decoder_mime,
+	.position = _decoder_getposition,
+	.duration = _decoder_duration,
 	.destroy = _decoder_destroy,
 };
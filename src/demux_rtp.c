@@ -39,6 +39,8 @@
 #include "player.h"
 #include "decoder.h"
 #include "event.h"
+#include "metrics.h"
+#include "realtime.h"
 typedef struct src_s demux_t;
 typedef struct src_ops_s demux_ops_t;
 
@@ -64,6 +66,12 @@ struct demux_out_s
 	char *data;
 	const char *mime;
 	short cc;
+	unsigned short seqnum;
+	unsigned short seqorig;
+	unsigned long missing;
+#ifdef METRICS
+	metrics_ssrc_t *metrics;
+#endif
 	demux_out_t *next;
 };
 
@@ -82,9 +90,6 @@ struct demux_ctx_s
 	demux_out_t *out;
 	jitter_t *in;
 	jitte_t jitte;
-	unsigned short seqnum;
-	unsigned short seqorig;
-	unsigned long missing;
 	demux_reorder_t reorder[NB_BUFFERS];
 	const char *mime;
 	pthread_t thread;
@@ -216,6 +221,9 @@ static int demux_parseheader(demux_ctx_t *ctx, unsigned char *input, size_t len)
 		out->mime = demux_profile(ctx, header->b.pt);
 		out->next = ctx->out;
 		ctx->out = out;
+#ifdef METRICS
+		out->metrics = metrics_ssrc(out->ssrc);
+#endif
 		warn("demux: new rtp substream %d %s(%d)", out->ssrc, out->mime, header->b.pt);
 		event_listener_t *listener = ctx->listener;
 		const src_t src = { .ops = demux_rtp, .ctx = ctx };
@@ -285,10 +293,13 @@ static int demux_parseheader(demux_ctx_t *ctx, unsigned char *input, size_t len)
 #else
 	if (out->jitter != NULL)
 	{
-		if (ctx->seqnum == 0)
-			ctx->seqorig = ctx->seqnum = header->b.seqnum - 1;
-		ctx->seqnum++;
-		while (ctx->seqnum < header->b.seqnum)
+		/**
+		 * each ssrc has its own sequence numbers
+		 */
+		if (out->seqnum == 0)
+			out->seqorig = out->seqnum = header->b.seqnum - 1;
+		out->seqnum++;
+		while (out->seqnum < header->b.seqnum)
 		{
 #if 0
 			/*
@@ -307,10 +318,18 @@ static int demux_parseheader(demux_ctx_t *ctx, unsigned char *input, size_t len)
 			out->jitter->ops->push(out->jitter->ctx, out->jitter->ctx->size, NULL);
 			out->data = NULL;
 #endif
-			ctx->missing++;
-			warn("demux: packet missing %ld/%d", ctx->missing, ctx->seqnum - ctx->seqorig);
-			ctx->seqnum++;
+			out->missing++;
+#ifdef METRICS
+			if (out->metrics)
+				METRICS_INC(out->metrics->missing, 1);
+#endif
+			warn("demux: packet missing on %u %ld/%d", out->ssrc, out->missing, out->seqnum - out->seqorig);
+			out->seqnum++;
 		}
+#ifdef METRICS
+		if (out->metrics)
+			METRICS_INC(out->metrics->received, 1);
+#endif
 		if (out->data == NULL)
 			out->data = out->jitter->ops->pull(out->jitter->ctx);
 #ifdef DEMUX_DUMP
@@ -410,7 +429,7 @@ static int demux_run(demux_ctx_t *ctx)
 	}
 	if (ret < 0)
 		err("setinheritsched error %s", strerror(errno));
-	pthread_create(&ctx->thread, &attr, demux_thread, ctx);
+	realtime_thread(&ctx->thread, &attr, "demux", demux_thread, ctx);
 	pthread_attr_destroy(&attr);
 #else
 	pthread_create(&ctx->thread, NULL, demux_thread, ctx);
@@ -486,6 +505,9 @@ static void demux_destroy(demux_ctx_t *ctx)
 		out = out->next;
 		if (old->estream != NULL)
 			old->estream->ops->destroy(old->estream->ctx);
+#ifdef METRICS
+		metrics_ssrcrelease(old->metrics);
+#endif
 		free(old);
 	}
 	event_listener_t *listener = ctx->listener;
@@ -49,14 +49,16 @@ const encoder_t *encoder_check(const char *path)
 	if (pathend == NULL)
 		len = strlen(path);
 	const char *ext = strrchr(path, '.');
-	if (ext != NULL)
+	if (ext != NULL && ext < path + len)
 	{
+		/// the options of the url follow the extension
+		int extlen = path + len - ext;
 #ifdef ENCODER_LAME
-		if (!strncmp(ext, ".mp3", len))
+		if (extlen == 4 && !strncmp(ext, ".mp3", extlen))
 			encoder = encoder_lame;
 #endif
 #ifdef ENCODER_FLAC
-		if (!strncmp(ext, ".flac", len))
+		if (extlen == 5 && !strncmp(ext, ".flac", extlen))
 			encoder = encoder_flac;
 #endif
 	}
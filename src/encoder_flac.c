@@ -41,6 +41,8 @@
 #include "jitter.h"
 #include "heartbeat.h"
 #include "media.h"
+#include "metrics.h"
+#include "realtime.h"
 
 typedef struct encoder_s encoder_t;
 typedef struct encoder_ctx_s encoder_ctx_t;
@@ -64,6 +66,9 @@ struct encoder_ctx_s
 	heartbeat_t heartbeat;
 	beat_bitrate_t beat;
 	size_t maxsize;
+#ifdef METRICS
+	metrics_stage_t *metrics;
+#endif
 };
 #define ENCODER_CTX
 #include "encoder.h"
@@ -173,6 +178,9 @@ static encoder_ctx_t *encoder_init(player_ctx_t *player)
 	encoder_ctx_t *ctx = calloc(1, sizeof(*ctx));
 	ctx->ops = encoder_flac;
 	ctx->player = player;
+#ifdef METRICS
+	ctx->metrics = metrics_stage("encoder_flac");
+#endif
 
 	jitter_format_t format = PCM_24bits4_LE_stereo;
 
@@ -248,6 +256,7 @@ static void *_encoder_thread(void *arg)
 #ifdef ENCODER_HEARTBEAT
 	ctx->heartbeat.ops->start(ctx->heartbeat.ctx);
 #endif
+	realtime_enter();
 	while (run)
 	{
 		int ret = 0;
@@ -259,6 +268,10 @@ static void *_encoder_thread(void *arg)
 			warn("encoder: flac frame too small %d %ld", inlength, ctx->in->ctx->size);
 		if (ctx->in->ctx->frequence != ctx->samplerate)
 		{
+			/**
+			 * the new configuration allocates the encoder's buffers
+			 */
+			realtime_leave();
 			ctx->samplerate = ctx->in->ctx->frequence;
 			encoder_flac_init(ctx);
 
@@ -269,11 +282,13 @@ static void *_encoder_thread(void *arg)
 				err("encoder: flac initializing encoder: %s\n", FLAC__StreamEncoderInitStatusString[init_status]);
 				ret = -1;
 			}
+			realtime_enter();
 		}
 		ctx->framescnt++;
 		if (ctx->maxframes && ctx->framescnt > ctx->maxframes)
 		{
 			warn("encoder: max flac frames");
+			realtime_leave();
 			encoder_flac_init(ctx);
 
 			FLAC__StreamEncoderInitStatus init_status;
@@ -282,12 +297,17 @@ static void *_encoder_thread(void *arg)
 				err("encoder: flac initializing encoder: %s\n", FLAC__StreamEncoderInitStatusString[init_status]);
 				ret = -1;
 			}
+			realtime_enter();
 		}
 
 		if (ctx->inbuffer)
 		{
+#ifdef METRICS
+			uint64_t encodestart = metrics_now();
+#endif
 			ret = FLAC__stream_encoder_process_interleaved(ctx->encoder,
 					(int *)ctx->inbuffer, inlength);
+			metrics_stagerun(ctx->metrics, encodestart);
 			ctx->in->ops->pop(ctx->in->ctx, ctx->in->ctx->size);
 		}
 		if (ret < 0)
@@ -339,7 +359,7 @@ static int encoder_run(encoder_ctx_t *ctx, jitter_t *jitter)
 	jitter->ops->heartbeat(jitter->ctx, &ctx->heartbeat);
 #endif
 	if (ret == 0)
-		pthread_create(&ctx->thread, NULL, _encoder_thread, ctx);
+		realtime_thread(&ctx->thread, NULL, "encoder", _encoder_thread, ctx);
 	return ret;
 }
 
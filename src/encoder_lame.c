@@ -41,6 +41,8 @@
 #include "jitter.h"
 #include "heartbeat.h"
 #include "media.h"
+#include "metrics.h"
+#include "realtime.h"
 
 typedef struct encoder_s encoder_t;
 typedef struct encoder_ctx_s encoder_ctx_t;
@@ -61,6 +63,9 @@ struct encoder_ctx_s
 	unsigned char *outbuffer;
 	heartbeat_t heartbeat;
 	beat_bitrate_t beat;
+#ifdef METRICS
+	metrics_stage_t *metrics;
+#endif
 };
 #define ENCODER_CTX
 #include "encoder.h"
@@ -143,6 +148,9 @@ static encoder_ctx_t *encoder_init(player_ctx_t *player)
 	encoder_ctx_t *ctx = calloc(1, sizeof(*ctx));
 	ctx->ops = encoder_lame;
 	ctx->player = player;
+#ifdef METRICS
+	ctx->metrics = metrics_stage("encoder_lame");
+#endif
 
 	encoder_lame_init(ctx, DEFAULT_SAMPLERATE, sizeof(signed short), 2);
 #ifdef ENCODER_DUMP
@@ -205,6 +213,7 @@ static void *lame_thread(void *arg)
 #ifdef ENCODER_HEARTBEAT
 	ctx->heartbeat.ops->start(ctx->heartbeat.ctx);
 #endif
+	realtime_enter();
 	while (run)
 	{
 		int ret = 0;
@@ -217,7 +226,12 @@ static void *lame_thread(void *arg)
 		if (ctx->in->ctx->frequence != ctx->samplerate)
 		{
 			warn("set lame samplerate %u",ctx->in->ctx->frequence);
+			/**
+			 * the new configuration allocates the encoder's buffers
+			 */
+			realtime_leave();
 			encoder_lame_init(ctx, ctx->in->ctx->frequence, ctx->samplesize, ctx->nchannels);
+			realtime_enter();
 		}
 		if (ctx->outbuffer == NULL)
 		{
@@ -225,9 +239,13 @@ static void *lame_thread(void *arg)
 		}
 		if (ctx->inbuffer)
 		{
+#ifdef METRICS
+			uint64_t encodestart = metrics_now();
+#endif
 			ret = lame_encode_buffer_interleaved(ctx->encoder,
 					(short int *)ctx->inbuffer, inlength,
 					ctx->outbuffer, ctx->out->ctx->size);
+			metrics_stagerun(ctx->metrics, encodestart);
 #ifdef ENCODER_DUMP
 			if (ctx->dumpfd > 0 && ret > 0)
 			{
@@ -291,7 +309,7 @@ static int encoder_run(encoder_ctx_t *ctx, jitter_t *jitter)
 	dbg("set heart %s %dms %dkbps", jitter->ctx->name, config.ms, config.bitrate);
 	jitter->ops->heartbeat(jitter->ctx, &ctx->heartbeat);
 #endif
-	pthread_create(&ctx->thread, NULL, lame_thread, ctx);
+	realtime_thread(&ctx->thread, NULL, "encoder", lame_thread, ctx);
 	return 0;
 }
 
@@ -2,8 +2,10 @@
 #define __FILTER_H__
 
 #include <stdint.h>
+#include <pthread.h>
 
 #include "jitter.h"
+#include "metrics.h"
 
 # define SIZEOF_INT 4
 
@@ -49,6 +51,8 @@ struct boost_s
 	int replaygain;
 	int rgshift;
 	float coef;
+	/** the gain in Q8.24 for the fixed point implementation */
+	int32_t fixedcoef;
 	sample_t max;
 	sample_t (*cb)(boost_t *ctx, sample_t sample, int bitspersample, int channel);
 };
@@ -82,29 +86,178 @@ sample_t mixed_cb(void *arg, sample_t sample, int bitspersample, int samplerate,
 
 /**
  * statistics filter sampled
+ * It measures the peak and the RMS of each channel and the spectrum
+ * of the mix of the channels. The measures are published on the
+ * meter page (meter.h) rate times per second.
  */
+#define STATS_FFTSIZE 1024
 typedef struct stats_s stats_t;
 struct stats_s
 {
+	int samplerate;
+	int outbits;
+	int rate;
+	int nchannels;
+	unsigned int period;
+	unsigned int nframes;
 	uint64_t nbs;
-	uint32_t rms;
-	uint32_t mean;
-	uint32_t peak;
-	int bitspersample;
-	int lapswindow;
+	double sqsum[MAXCHANNELS];
+	double peak[MAXCHANNELS];
+	/** the peak of the whole stream */
+	double maxpeak;
+	unsigned int position;
+	float input[STATS_FFTSIZE];
+	float window[STATS_FFTSIZE];
+	float cosines[STATS_FFTSIZE / 2];
+	float sines[STATS_FFTSIZE / 2];
+#ifdef FILTER_FIXEDPOINT
+	/** the measures on 16 bits, converted on the publication */
+	uint64_t fixedsqsum[MAXCHANNELS];
+	uint32_t fixedpeak[MAXCHANNELS];
+	int32_t fixedinput[STATS_FFTSIZE];
+#endif
 };
 
-stats_t *stats_init(stats_t *input);
+stats_t *stats_init(stats_t *input, jitter_format_t outformat, int rate);
 sample_t stats_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel);
 
+/**
+ * loudness filter sampled (EBU R128 / ITU BS.1770)
+ * The samples are K-weighted and the loudness of the blocks of 400ms
+ * is stored into a histogram of 0.1 LU, the integrated loudness is
+ * computed with the absolute and relative gates at the end of the track.
+ * The true peak is measured on the signal oversampled 4 times.
+ */
+#define LOUDNESS_NBINS 1000
+#define LOUDNESS_NTAPS 12
+#define LOUDNESS_NPHASES 4
+typedef struct loudness_s loudness_t;
+/**
+ * report of the analysis, called when the filter is destroyed.
+ * loudness in LUFS, truepeak in dBTP, duration in ms.
+ */
+typedef void (*loudness_report_t)(void *arg, int id, double loudness, double truepeak, unsigned int duration);
+struct loudness_s
+{
+	int samplerate;
+	/** the samples are already rescaled to the output when they are larger */
+	int outbits;
+	double shelf[5];
+	double highpass[5];
+	double state[MAXCHANNELS][4];
+	double history[MAXCHANNELS][LOUDNESS_NTAPS];
+	double taps[LOUDNESS_NPHASES][LOUDNESS_NTAPS];
+	double peak;
+	/** the energies of the 4 steps of 100ms of the current block */
+	double steps[4];
+	double energy;
+	unsigned int nframes;
+	unsigned int stepframes;
+	unsigned int nsteps;
+	uint64_t total;
+	uint32_t counts[LOUDNESS_NBINS];
+	double energies[LOUDNESS_NBINS];
+	loudness_report_t report;
+	void *reportarg;
+	int id;
+	/** the expected length in ms, a partial analysis is not reported */
+	unsigned int duration;
+};
+
+loudness_t *loudness_init(loudness_t *input, jitter_format_t outformat);
+sample_t loudness_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel);
+double loudness_integrated(loudness_t *ctx);
+double loudness_truepeak(loudness_t *ctx);
+
+/**
+ * equalizer filter sampled
+ * The bands are a cascade of biquads (peaking, low and high shelves).
+ * The settings "l100:3,1000:-2:1.4,h8000:4" give for each band its type
+ * ('l' low shelf, 'h' high shelf, peaking otherwise), its frequency in Hz,
+ * its gain in dB and its Q. They may change during the playback.
+ */
+#define EQ_MAXBANDS 10
+typedef struct eq_band_s eq_band_t;
+struct eq_band_s
+{
+	char type;
+	float frequency;
+	float gain;
+	float q;
+};
+
+typedef struct eq_s eq_t;
+struct eq_s
+{
+	int samplerate;
+	int outbits;
+	int nbands;
+	eq_band_t bands[EQ_MAXBANDS];
+	double coefs[EQ_MAXBANDS][5];
+	double state[MAXCHANNELS][EQ_MAXBANDS][2];
+	/** the new settings are taken by the filter on the next frame */
+	pthread_mutex_t mutex;
+	int changed;
+	int nnext;
+	eq_band_t next[EQ_MAXBANDS];
+};
+
+eq_t *eq_init(eq_t *input, jitter_format_t outformat, const char *settings);
+int eq_set(eq_t *ctx, const char *settings);
+sample_t eq_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel);
+
+/**
+ * dynamic range compressor filter sampled
+ * The settings "-20:4:10:200:0" give the threshold in dB, the ratio,
+ * the attack and the release times in ms and the makeup gain in dB.
+ * "-1:inf:0:50" is a limiter. The gain is the same on all channels.
+ */
+typedef struct drc_settings_s drc_settings_t;
+struct drc_settings_s
+{
+	float threshold;
+	float ratio;
+	float attack;
+	float release;
+	float makeup;
+};
+
+typedef struct drc_s drc_t;
+struct drc_s
+{
+	int samplerate;
+	int outbits;
+	drc_settings_t settings;
+	double attackcoef;
+	double releasecoef;
+	/** the peak of the current frame */
+	double peak;
+	/** the gain reduction in dB */
+	double reduction;
+	double gain;
+	pthread_mutex_t mutex;
+	int changed;
+	drc_settings_t next;
+};
+
+drc_t *drc_init(drc_t *input, jitter_format_t outformat, const char *settings);
+int drc_set(drc_t *ctx, const char *settings);
+sample_t drc_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel);
+
 #define FILTER_SAMPLED 1
 #define FILTER_FORMAT 2
 #define FILTER_SAMPLERATE 3
+/**
+ * FILTER_RELEASE, release_t cb, void *arg:
+ * cb is called once with arg when the filter is destroyed.
+ */
+#define FILTER_RELEASE 4
 
 #ifndef FILTER_CTX
 typedef void filter_ctx_t;
 #endif
 typedef sample_t (*sampled_t)(void * ctx, sample_t sample, int bitlength, int samplerate, int channel);
+typedef void (*release_t)(void *arg);
 
 typedef struct filter_ops_s filter_ops_t;
 struct filter_ops_s
@@ -113,6 +266,8 @@ struct filter_ops_s
 	filter_ctx_t *(*init)(jitter_format_t format, int samplerate);
 	int (*set)(filter_ctx_t *ctx,...);
 	int (*run)(filter_ctx_t *ctx, filter_audio_t *audio, unsigned char *buffer, size_t size);
+	/** optional: the number of sampled stages, 0 if the samples are not changed */
+	int (*sampled)(filter_ctx_t *ctx);
 	void (*destroy)(filter_ctx_t *);
 };
 
@@ -124,13 +279,33 @@ struct filter_s
 	boost_t boost;
 #ifdef FILTER_STATS
 	stats_t stats;
+#endif
+#ifdef FILTER_LOUDNESS
+	loudness_t loudness;
+#endif
+#ifdef FILTER_EQ
+	eq_t eq;
+#endif
+#ifdef FILTER_DRC
+	drc_t drc;
 #endif
 	mono_t mono;
 	mixed_t mixed;
+	unsigned char *outbuffer;
+	size_t outbufferlen;
+#ifdef METRICS
+	metrics_stage_t *metrics;
+#endif
 };
 
-filter_t *filter_build(const char *name, jitter_t *jitter, const char *info);
+typedef struct media_info_s media_info_t;
+filter_t *filter_build(const char *name, jitter_t *jitter, const media_info_t *info);
 int filter_filloutput(filter_t *filter, filter_audio_t *audio, jitter_t *out);
+/**
+ * change the settings of a stage during the playback: "eq=..." or "drc=..."
+ * The stage must be installed by the query of the filter ("pcm?eq&drc").
+ */
+int filter_settings(filter_t *filter, const char *settings);
 
 sample_t filter_minvalue(int bitspersample);
 sample_t filter_maxvalue(int bitspersample);
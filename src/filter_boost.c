@@ -28,8 +28,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #include "filter.h"
+#ifdef FILTER_FIXEDPOINT
+#include "fixedpoint.h"
+#endif
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -44,6 +48,12 @@
 static sample_t boost_increase(boost_t *ctx, sample_t sample, int bitspersample, int channel);
 static sample_t boost_decrease(boost_t *ctx, sample_t sample, int bitspersample, int channel);
 static sample_t boost_multi(boost_t *ctx, sample_t sample, int bitspersample, int channel);
+#ifdef FILTER_FIXEDPOINT
+static sample_t boost_fixed(boost_t *ctx, sample_t sample, int bitspersample, int channel);
+
+/// the largest gain of the Q8.24 format
+#define BOOST_MAXDB 42
+#endif
 
 boost_t *boost_init(boost_t *input, int db)
 {
@@ -51,8 +61,16 @@ boost_t *boost_init(boost_t *input, int db)
 		input = calloc(1, sizeof(*input));
 	input->replaygain = db;
 	input->rgshift = db / 3;
-	input->coef = db / 3.0;
+	/// the sample is increased by sample * coef
+	input->coef = powf(10.0f, db / 20.0f) - 1.0f;
 	input->cb = boost_multi;
+#ifdef FILTER_FIXEDPOINT
+	/// the conversion is done once, the samples are multiplied by an integer
+	if (db > BOOST_MAXDB)
+		db = BOOST_MAXDB;
+	input->fixedcoef = FIXED_FROMDOUBLE(pow(10.0, db / 20.0), FIXED_GAINSHIFT);
+	input->cb = boost_fixed;
+#endif
 	return input;
 }
 
@@ -102,3 +120,11 @@ static sample_t boost_multi(boost_t *ctx, sample_t sample, int bitspersample, in
 	}
 	return sample;
 }
+
+#ifdef FILTER_FIXEDPOINT
+static sample_t boost_fixed(boost_t *ctx, sample_t sample, int bitspersample, int channel)
+{
+	int64_t value = fixed_mul(sample, ctx->fixedcoef, FIXED_GAINSHIFT);
+	return fixed_saturate(value, bitspersample);
+}
+#endif
@@ -0,0 +1,171 @@
+/*****************************************************************************
+ * filter_drc.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "filter.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define filter_dbg(...)
+
+static const drc_settings_t drc_default =
+{
+	.threshold = -20,
+	.ratio = 4,
+	.attack = 10,
+	.release = 200,
+	.makeup = 0,
+};
+
+/**
+ * the missing values keep the default ones
+ */
+static void _drc_parse(const char *settings, drc_settings_t *out)
+{
+	*out = drc_default;
+	if (settings == NULL || *settings == '\0' || *settings == '&')
+		return;
+	if (sscanf(settings, "%f:%f:%f:%f:%f", &out->threshold, &out->ratio,
+			&out->attack, &out->release, &out->makeup) < 1)
+		err("filter: drc settings %.*s malformed", (int)strcspn(settings, "&"), settings);
+	if (out->ratio < 1)
+		out->ratio = 1;
+	if (out->attack < 0)
+		out->attack = 0;
+	if (out->release < 0)
+		out->release = 0;
+}
+
+drc_t *drc_init(drc_t *input, jitter_format_t outformat, const char *settings)
+{
+	if (input == NULL)
+		input = calloc(1, sizeof(*input));
+	rescale_t rescale = {0};
+	if (rescale_init(&rescale, 0, outformat) != NULL)
+		input->outbits = rescale.outbits;
+	if (input->outbits == 0)
+		input->outbits = 32;
+	pthread_mutex_init(&input->mutex, NULL);
+	_drc_parse(settings, &input->settings);
+	input->gain = 1.0;
+	return input;
+}
+
+int drc_set(drc_t *ctx, const char *settings)
+{
+	pthread_mutex_lock(&ctx->mutex);
+	_drc_parse(settings, &ctx->next);
+	__atomic_store_n(&ctx->changed, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ctx->mutex);
+	return 0;
+}
+
+/**
+ * the gain reduction follows the target with an exponential curve
+ * of the attack or release time.
+ */
+static double _drc_coef(float duration, int samplerate)
+{
+	if (duration <= 0)
+		return 0;
+	return exp(-1000.0 / (duration * samplerate));
+}
+
+static void _drc_coefs(drc_t *ctx, int samplerate)
+{
+	ctx->attackcoef = _drc_coef(ctx->settings.attack, samplerate);
+	ctx->releasecoef = _drc_coef(ctx->settings.release, samplerate);
+	ctx->samplerate = samplerate;
+	dbg("filter: drc %.1fdB ratio %.1f attack %.0fms release %.0fms makeup %.1fdB",
+		ctx->settings.threshold, ctx->settings.ratio, ctx->settings.attack,
+		ctx->settings.release, ctx->settings.makeup);
+}
+
+/**
+ * the gain is computed on the first channel of each frame from the peak
+ * of the previous frame, all the channels have the same gain.
+ */
+static void _drc_gain(drc_t *ctx)
+{
+	double target = 0;
+	if (ctx->peak > 0)
+	{
+		double over = 20 * log10(ctx->peak) - ctx->settings.threshold;
+		if (over > 0)
+			target = over * (1 - 1 / ctx->settings.ratio);
+	}
+	double coef = (target > ctx->reduction)? ctx->attackcoef: ctx->releasecoef;
+	ctx->reduction = target + coef * (ctx->reduction - target);
+	ctx->gain = pow(10.0, (ctx->settings.makeup - ctx->reduction) / 20);
+	ctx->peak = 0;
+}
+
+sample_t drc_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel)
+{
+	drc_t *ctx = (drc_t *)arg;
+	if (sample == INT32_MIN)
+	{
+		pthread_mutex_destroy(&ctx->mutex);
+		return sample;
+	}
+	if (channel == 0)
+	{
+		if (__atomic_load_n(&ctx->changed, __ATOMIC_ACQUIRE) &&
+			pthread_mutex_trylock(&ctx->mutex) == 0)
+		{
+			ctx->settings = ctx->next;
+			ctx->changed = 0;
+			ctx->samplerate = 0;
+			pthread_mutex_unlock(&ctx->mutex);
+		}
+		if (samplerate != ctx->samplerate)
+			_drc_coefs(ctx, samplerate);
+		_drc_gain(ctx);
+	}
+
+	int bits = (bitspersample < ctx->outbits)? bitspersample: ctx->outbits;
+	double scale = (double)((uint64_t)1 << (bits - 1));
+	double x = (double)sample / scale;
+	if (fabs(x) > ctx->peak)
+		ctx->peak = fabs(x);
+	x *= ctx->gain * scale;
+	if (x >= scale - 1)
+		return (sample_t)(scale - 1);
+	if (x <= -(scale - 1))
+		return (sample_t)-(scale - 1);
+	return (sample_t)lrint(x);
+}
@@ -0,0 +1,200 @@
+/*****************************************************************************
+ * filter_eq.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "filter.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define filter_dbg(...)
+
+/**
+ * the settings end with the end of the option into the query
+ */
+static int _eq_parse(const char *settings, eq_band_t *bands)
+{
+	int nbands = 0;
+	while (settings != NULL && *settings != '\0' && *settings != '&' && nbands < EQ_MAXBANDS)
+	{
+		eq_band_t *band = &bands[nbands];
+		band->type = 'p';
+		if (*settings == 'l' || *settings == 'h' || *settings == 'p')
+		{
+			band->type = *settings;
+			settings++;
+		}
+		band->q = (band->type == 'p')? 1.0: M_SQRT1_2;
+		if (sscanf(settings, "%f:%f:%f", &band->frequency, &band->gain, &band->q) >= 2 &&
+			band->frequency > 0 && band->q > 0)
+			nbands++;
+		else
+			err("filter: eq band %.*s malformed", (int)strcspn(settings, ",&"), settings);
+		settings += strcspn(settings, ",&");
+		if (*settings == ',')
+			settings++;
+	}
+	return nbands;
+}
+
+eq_t *eq_init(eq_t *input, jitter_format_t outformat, const char *settings)
+{
+	if (input == NULL)
+		input = calloc(1, sizeof(*input));
+	rescale_t rescale = {0};
+	if (rescale_init(&rescale, 0, outformat) != NULL)
+		input->outbits = rescale.outbits;
+	if (input->outbits == 0)
+		input->outbits = 32;
+	pthread_mutex_init(&input->mutex, NULL);
+	input->nbands = _eq_parse(settings, input->bands);
+	return input;
+}
+
+int eq_set(eq_t *ctx, const char *settings)
+{
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->nnext = _eq_parse(settings, ctx->next);
+	__atomic_store_n(&ctx->changed, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ctx->mutex);
+	return ctx->nnext;
+}
+
+/**
+ * the coefficients come from the "Audio EQ Cookbook" of R. Bristow-Johnson,
+ * they are normalized by a0: b0, b1, b2, a1, a2.
+ */
+static void _eq_coefs(eq_t *ctx, int samplerate)
+{
+	int i;
+	for (i = 0; i < ctx->nbands; i++)
+	{
+		eq_band_t *band = &ctx->bands[i];
+		double *coef = ctx->coefs[i];
+		double A = pow(10.0, band->gain / 40.0);
+		double w0 = 2 * M_PI * band->frequency / samplerate;
+		double cosw0 = cos(w0);
+		double alpha = sin(w0) / (2 * band->q);
+		double a0;
+		switch (band->type)
+		{
+		case 'l':
+			a0 = (A + 1) + (A - 1) * cosw0 + 2 * sqrt(A) * alpha;
+			coef[0] = A * ((A + 1) - (A - 1) * cosw0 + 2 * sqrt(A) * alpha);
+			coef[1] = 2 * A * ((A - 1) - (A + 1) * cosw0);
+			coef[2] = A * ((A + 1) - (A - 1) * cosw0 - 2 * sqrt(A) * alpha);
+			coef[3] = -2 * ((A - 1) + (A + 1) * cosw0);
+			coef[4] = (A + 1) + (A - 1) * cosw0 - 2 * sqrt(A) * alpha;
+		break;
+		case 'h':
+			a0 = (A + 1) - (A - 1) * cosw0 + 2 * sqrt(A) * alpha;
+			coef[0] = A * ((A + 1) + (A - 1) * cosw0 + 2 * sqrt(A) * alpha);
+			coef[1] = -2 * A * ((A - 1) + (A + 1) * cosw0);
+			coef[2] = A * ((A + 1) + (A - 1) * cosw0 - 2 * sqrt(A) * alpha);
+			coef[3] = 2 * ((A - 1) - (A + 1) * cosw0);
+			coef[4] = (A + 1) - (A - 1) * cosw0 - 2 * sqrt(A) * alpha;
+		break;
+		default:
+			a0 = 1 + alpha / A;
+			coef[0] = 1 + alpha * A;
+			coef[1] = -2 * cosw0;
+			coef[2] = 1 - alpha * A;
+			coef[3] = -2 * cosw0;
+			coef[4] = 1 - alpha / A;
+		}
+		int j;
+		for (j = 0; j < 5; j++)
+			coef[j] /= a0;
+		dbg("filter: eq band %c %.0fHz %.1fdB Q %.2f", band->type, band->frequency, band->gain, band->q);
+	}
+	ctx->samplerate = samplerate;
+}
+
+sample_t eq_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel)
+{
+	eq_t *ctx = (eq_t *)arg;
+	if (sample == INT32_MIN)
+	{
+		pthread_mutex_destroy(&ctx->mutex);
+		return sample;
+	}
+	if (channel == 0)
+	{
+		/// the states are kept to avoid a click on the change
+		if (__atomic_load_n(&ctx->changed, __ATOMIC_ACQUIRE) &&
+			pthread_mutex_trylock(&ctx->mutex) == 0)
+		{
+			memcpy(ctx->bands, ctx->next, sizeof(ctx->bands));
+			/// the added bands don't inherit the states of an old filter
+			int i;
+			for (i = ctx->nbands; i < ctx->nnext; i++)
+			{
+				int j;
+				for (j = 0; j < MAXCHANNELS; j++)
+					memset(ctx->state[j][i], 0, sizeof(ctx->state[j][i]));
+			}
+			ctx->nbands = ctx->nnext;
+			ctx->changed = 0;
+			ctx->samplerate = 0;
+			pthread_mutex_unlock(&ctx->mutex);
+		}
+		if (samplerate != ctx->samplerate)
+			_eq_coefs(ctx, samplerate);
+	}
+	if (ctx->nbands == 0 || channel >= MAXCHANNELS)
+		return sample;
+
+	int bits = (bitspersample < ctx->outbits)? bitspersample: ctx->outbits;
+	double scale = (double)((uint64_t)1 << (bits - 1));
+	double x = (double)sample / scale;
+	int i;
+	for (i = 0; i < ctx->nbands; i++)
+	{
+		const double *coef = ctx->coefs[i];
+		double *state = ctx->state[channel][i];
+		double y = coef[0] * x + state[0];
+		state[0] = coef[1] * x - coef[3] * y + state[1];
+		state[1] = coef[2] * x - coef[4] * y;
+		x = y;
+	}
+	/// the saturation is symmetric like the boost
+	x *= scale;
+	if (x >= scale - 1)
+		return (sample_t)(scale - 1);
+	if (x <= -(scale - 1))
+		return (sample_t)-(scale - 1);
+	return (sample_t)lrint(x);
+}
@@ -0,0 +1,238 @@
+/*****************************************************************************
+ * filter_loudness.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "filter.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define filter_dbg(...)
+
+/// the lowest loudness of the histogram, it is the absolute gate
+#define LOUDNESS_GATE -70.0
+#define LOUDNESS_RELATIVEGATE -10.0
+
+loudness_t *loudness_init(loudness_t *input, jitter_format_t outformat)
+{
+	if (input == NULL)
+		input = calloc(1, sizeof(*input));
+	rescale_t rescale = {0};
+	if (rescale_init(&rescale, 0, outformat) != NULL)
+		input->outbits = rescale.outbits;
+	if (input->outbits == 0)
+		input->outbits = 32;
+
+	/**
+	 * windowed sinc for the interpolation, the phase p
+	 * computes the sample between x[n-6] and x[n-5] at p/4.
+	 */
+	for (int p = 0; p < LOUDNESS_NPHASES; p++)
+	{
+		double sum = 0;
+		for (int k = 0; k < LOUDNESS_NTAPS; k++)
+		{
+			double u = LOUDNESS_NTAPS / 2 - k - (double)p / LOUDNESS_NPHASES;
+			double h = (u == 0)? 1: sin(M_PI * u) / (M_PI * u);
+			h *= 0.5 * (1 + cos(M_PI * u / (LOUDNESS_NTAPS / 2)));
+			input->taps[p][k] = h;
+			sum += h;
+		}
+		for (int k = 0; k < LOUDNESS_NTAPS; k++)
+			input->taps[p][k] /= sum;
+	}
+	return input;
+}
+
+/**
+ * the coefficients of the K-weighting depend on the samplerate,
+ * they are computed like the tables of BS.1770 for 48kHz.
+ */
+static void _loudness_setsamplerate(loudness_t *ctx, int samplerate)
+{
+	double K = tan(M_PI * 1681.974450955533 / samplerate);
+	double Q = 0.7071752369554196;
+	double Vh = pow(10.0, 3.999843853973347 / 20.0);
+	double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1.0 + K / Q + K * K;
+	ctx->shelf[0] = (Vh + Vb * K / Q + K * K) / a0;
+	ctx->shelf[1] = 2.0 * (K * K - Vh) / a0;
+	ctx->shelf[2] = (Vh - Vb * K / Q + K * K) / a0;
+	ctx->shelf[3] = 2.0 * (K * K - 1.0) / a0;
+	ctx->shelf[4] = (1.0 - K / Q + K * K) / a0;
+
+	K = tan(M_PI * 38.13547087602444 / samplerate);
+	Q = 0.5003270373238773;
+	a0 = 1.0 + K / Q + K * K;
+	ctx->highpass[0] = 1.0;
+	ctx->highpass[1] = -2.0;
+	ctx->highpass[2] = 1.0;
+	ctx->highpass[3] = 2.0 * (K * K - 1.0) / a0;
+	ctx->highpass[4] = (1.0 - K / Q + K * K) / a0;
+
+	ctx->samplerate = samplerate;
+	ctx->stepframes = samplerate / 10;
+	ctx->nframes = 0;
+	ctx->nsteps = 0;
+	ctx->energy = 0;
+	memset(ctx->state, 0, sizeof(ctx->state));
+}
+
+static double _loudness_biquad(const double *coef, double *state, double x)
+{
+	double y = coef[0] * x + state[0];
+	state[0] = coef[1] * x - coef[3] * y + state[1];
+	state[1] = coef[2] * x - coef[4] * y;
+	return y;
+}
+
+/**
+ * the blocks of 400ms overlap on 75%, a block is completed
+ * on each step of 100ms.
+ */
+static void _loudness_step(loudness_t *ctx)
+{
+	ctx->steps[ctx->nsteps % 4] = ctx->energy;
+	ctx->nsteps++;
+	ctx->energy = 0;
+	ctx->nframes = 0;
+	if (ctx->nsteps < 4)
+		return;
+	double energy = (ctx->steps[0] + ctx->steps[1] + ctx->steps[2] + ctx->steps[3]) / (4 * ctx->stepframes);
+	if (energy <= 0)
+		return;
+	double loudness = -0.691 + 10 * log10(energy);
+	if (loudness < LOUDNESS_GATE)
+		return;
+	int bin = (loudness - LOUDNESS_GATE) * 10;
+	if (bin >= LOUDNESS_NBINS)
+		bin = LOUDNESS_NBINS - 1;
+	ctx->counts[bin]++;
+	ctx->energies[bin] += energy;
+}
+
+static void _loudness_truepeak(loudness_t *ctx, double x, int channel)
+{
+	double *history = ctx->history[channel];
+	memmove(history + 1, history, (LOUDNESS_NTAPS - 1) * sizeof(*history));
+	history[0] = x;
+	for (int p = 0; p < LOUDNESS_NPHASES; p++)
+	{
+		double y = 0;
+		for (int k = 0; k < LOUDNESS_NTAPS; k++)
+			y += ctx->taps[p][k] * history[k];
+		y = fabs(y);
+		if (y > ctx->peak)
+			ctx->peak = y;
+	}
+}
+
+sample_t loudness_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel)
+{
+	loudness_t *ctx = (loudness_t *)arg;
+	if (sample == INT32_MIN)
+	{
+		uint64_t duration = (ctx->total > 0)? ctx->total * 1000 / ctx->samplerate: 0;
+		/// the track may be stopped before its end
+		if (ctx->duration > 0 && duration * 10 < (uint64_t)ctx->duration * 9)
+			duration = 0;
+		if (ctx->report != NULL && duration > 0)
+			ctx->report(ctx->reportarg, ctx->id, loudness_integrated(ctx),
+					loudness_truepeak(ctx), duration);
+		ctx->report = NULL;
+		return sample;
+	}
+	if (channel >= MAXCHANNELS || samplerate <= 0 || bitspersample <= 0)
+		return sample;
+	if (ctx->samplerate != samplerate)
+		_loudness_setsamplerate(ctx, samplerate);
+	if (channel == 0)
+	{
+		if (ctx->nframes == ctx->stepframes)
+			_loudness_step(ctx);
+		ctx->nframes++;
+		ctx->total++;
+	}
+
+	int bits = (bitspersample < ctx->outbits)? bitspersample: ctx->outbits;
+	double x = (double)sample / (double)((uint64_t)1 << (bits - 1));
+	_loudness_truepeak(ctx, x, channel);
+
+	double y = _loudness_biquad(ctx->shelf, &ctx->state[channel][0], x);
+	y = _loudness_biquad(ctx->highpass, &ctx->state[channel][2], y);
+	/// L, R, C and the surrounds with +1.5dB, the LFE is ignored
+	double weight = 1.0;
+	if (channel == 3)
+		weight = 0.0;
+	else if (channel > 3)
+		weight = 1.41;
+	ctx->energy += weight * y * y;
+	return sample;
+}
+
+double loudness_integrated(loudness_t *ctx)
+{
+	double energy = 0;
+	uint64_t count = 0;
+	for (int i = 0; i < LOUDNESS_NBINS; i++)
+	{
+		energy += ctx->energies[i];
+		count += ctx->counts[i];
+	}
+	if (count == 0)
+		return -HUGE_VAL;
+	double gate = -0.691 + 10 * log10(energy / count) + LOUDNESS_RELATIVEGATE;
+	int first = ceil((gate - LOUDNESS_GATE) * 10);
+	if (first < 0)
+		first = 0;
+	energy = 0;
+	count = 0;
+	for (int i = first; i < LOUDNESS_NBINS; i++)
+	{
+		energy += ctx->energies[i];
+		count += ctx->counts[i];
+	}
+	if (count == 0)
+		return -HUGE_VAL;
+	return -0.691 + 10 * log10(energy / count);
+}
+
+double loudness_truepeak(loudness_t *ctx)
+{
+	if (ctx->peak <= 0)
+		return -HUGE_VAL;
+	return 20 * log10(ctx->peak);
+}
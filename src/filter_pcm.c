@@ -46,6 +46,7 @@ typedef struct filter_ctx_s filter_ctx_t;
 typedef struct filter_audio_s filter_audio_t;
 typedef sample_t (*sample_get_t)(filter_ctx_t *ctx, filter_audio_t *audio, int channel, unsigned int index);
 typedef sample_t (*sampled_t)(void * ctx, sample_t sample, int bitlength, int samplerate, int channel);
+typedef void (*release_t)(void *arg);
 
 typedef struct sampled_ctx_s sampled_ctx_t;
 struct sampled_ctx_s
@@ -55,10 +56,20 @@ struct sampled_ctx_s
 	sampled_ctx_t *next;
 };
 
+#define FILTER_MAXSAMPLED 8
 struct filter_ctx_s
 {
 	sample_get_t get;
 	sampled_ctx_t *sampled;
+	/**
+	 * the sampled items are preallocated with the filter,
+	 * there is no allocation after the building of the pipeline.
+	 */
+	sampled_ctx_t sampledpool[FILTER_MAXSAMPLED];
+	unsigned char nsampled;
+	/** called once with the destruction, never on the samples */
+	release_t release;
+	void *releasearg;
 	unsigned int samplerate;
 	unsigned char samplesize;
 	unsigned char shift;
@@ -165,7 +176,14 @@ static int filter_setoptions(filter_ctx_t *ctx, va_list params)
 		switch(code)
 		{
 		case FILTER_SAMPLED:
-			sampleditem = calloc(1, sizeof(*ctx->sampled));
+			if (ctx->nsampled == FILTER_MAXSAMPLED)
+			{
+				err("filter: too many sampled filters");
+				va_arg(params, sampled_t);
+				va_arg(params, void *);
+				break;
+			}
+			sampleditem = &ctx->sampledpool[ctx->nsampled++];
 			sampleditem->next = ctx->sampled;
 			ctx->sampled = sampleditem;
 			ctx->sampled->cb = (sampled_t) va_arg(params, sampled_t);
@@ -177,12 +195,21 @@ static int filter_setoptions(filter_ctx_t *ctx, va_list params)
 		case FILTER_SAMPLERATE:
 			ctx->samplerate = (unsigned int) va_arg(params, unsigned int);
 		break;
+		case FILTER_RELEASE:
+			ctx->release = (release_t) va_arg(params, release_t);
+			ctx->releasearg = (void *) va_arg(params, void *);
+		break;
 		}
 		code = (int) va_arg(params, int);
 	}
 	return 0;
 }
 
+static int filter_sampled(filter_ctx_t *ctx)
+{
+	return ctx->nsampled;
+}
+
 static void filter_destroy(filter_ctx_t *ctx)
 {
 	sampled_ctx_t *sampleditem = ctx->sampled;
@@ -190,9 +217,10 @@ static void filter_destroy(filter_ctx_t *ctx)
 	{
 		ctx->sampled = sampleditem->next;
 		sampleditem->cb(sampleditem->arg, INT32_MIN, ctx->samplesize, ctx->samplerate, 0);
-		free(sampleditem);
 		sampleditem = ctx->sampled;
 	}
+	if (ctx->release != NULL)
+		ctx->release(ctx->releasearg);
 #ifdef FILTER_DUMP
 	close(ctx->dumpfd);
 #endif
@@ -287,10 +315,35 @@ const filter_ops_t *filter_pcm = &(filter_ops_t)
 	.init = filter_init,
 	.set = filter_set,
 	.run = filter_run,
+	.sampled = filter_sampled,
 	.destroy = filter_destroy,
 };
 
-static filter_t *_filter_build_pcm(const char *query, jitter_t *jitter, const char *info, const filter_ops_t *filterops)
+/**
+ * the option is at the beginning of the query or after a '&',
+ * the function returns its value or an empty string.
+ */
+static const char *_filter_option(const char *query, const char *name)
+{
+	size_t length = strlen(name);
+	while (query != NULL && *query != '\0')
+	{
+		if (!strncmp(query, name, length) &&
+			(query[length] == '\0' || query[length] == '&' || query[length] == '='))
+		{
+			query += length;
+			if (*query == '=')
+				query++;
+			return query;
+		}
+		query = strchr(query, '&');
+		if (query != NULL)
+			query++;
+	}
+	return NULL;
+}
+
+static filter_t *_filter_build_pcm(const char *query, jitter_t *jitter, const media_info_t *info, const filter_ops_t *filterops)
 {
 	filter_t *filter = calloc(1, sizeof (*filter));
 	jitter_format_t format = jitter->format;
@@ -298,29 +351,81 @@ static filter_t *_filter_build_pcm(const char *query, jitter_t *jitter, const ch
 
 	filter->ops = filterops;
 	filter->ctx = filter->ops->init(format, samplerate);
+#ifdef METRICS
+	filter->metrics = metrics_stage("filter");
+#endif
 
 	int replaygain = 0;
 	if (info != NULL)
-		replaygain = media_boost(info);
+		replaygain = info->replaygain;
+	/// "pcm?gain=album" keeps the relative levels of the tracks of an album
+	if (info != NULL && info->albumgain != 0 && query && strstr(query, "gain=album") != NULL)
+		replaygain = info->albumgain;
 	if (query)
 	{
 		const char *boostvalue = strstr(query, "boost=");
 		if (boostvalue != NULL)
 			sscanf(boostvalue, "boost=%d", &replaygain);
 	}
-	if (replaygain > 0)
+#ifdef FILTER_DRC
+	/**
+	 * "pcm?drc=-20:4:10:200:0" compresses the signal after the boost,
+	 * "pcm?drc" installs the stage with the default settings.
+	 */
+	const char *drcvalue = _filter_option(query, "drc");
+	if (drcvalue != NULL)
+	{
+		warn("filter: install compressor filter");
+		drc_t *drc = drc_init(&filter->drc, format, drcvalue);
+		filter->ops->set(filter->ctx, FILTER_SAMPLED, drc_cb, drc, 0);
+	}
+#endif
+	if (replaygain != 0)
 	{
 		warn("filter: install boost filter %ddB", replaygain);
 		boost_t *boost = boost_init(&filter->boost, replaygain);
 		filter->ops->set(filter->ctx, FILTER_SAMPLED, boost_cb, boost);
 	}
 
+#ifdef FILTER_EQ
+	/**
+	 * "pcm?eq=l100:3,1000:-2:1.4" equalizes the signal before the boost,
+	 * "pcm?eq" installs a flat equalizer to set during the playback.
+	 */
+	const char *eqvalue = _filter_option(query, "eq");
+	if (eqvalue != NULL)
+	{
+		warn("filter: install equalizer filter");
+		eq_t *eq = eq_init(&filter->eq, format, eqvalue);
+		filter->ops->set(filter->ctx, FILTER_SAMPLED, eq_cb, eq, 0);
+	}
+#endif
+
 #ifdef FILTER_STATS
-	if (query && strstr(query, "stats") != NULL)
+	/// "pcm?stats=25" publishes 25 measures per second
+	const char *statsvalue = NULL;
+	if (query)
+		statsvalue = strstr(query, "stats");
+	if (statsvalue != NULL)
 	{
+		int rate = 0;
+		sscanf(statsvalue, "stats=%d", &rate);
 		warn("filter: install statistics filter");
-		stats_t *stats = stats_init(&filter->stats);
-		filter->ops->set(filter->ctx, FILTER_SAMPLED, stats_cb, stats);
+		stats_t *stats = stats_init(&filter->stats, format, rate);
+		filter->ops->set(filter->ctx, FILTER_SAMPLED, stats_cb, stats, 0);
+	}
+#endif
+
+#ifdef FILTER_LOUDNESS
+	/**
+	 * the analysis runs until the media stores the result,
+	 * it is installed after the boost to measure the original level.
+	 */
+	if (query && strstr(query, "loudness") != NULL && (info == NULL || info->loudness == 0))
+	{
+		warn("filter: install loudness filter");
+		loudness_t *loudness = loudness_init(&filter->loudness, format);
+		filter->ops->set(filter->ctx, FILTER_SAMPLED, loudness_cb, loudness, 0);
 	}
 #endif
 
@@ -352,7 +457,20 @@ static filter_t *_filter_build_pcm(const char *query, jitter_t *jitter, const ch
 	return filter;
 }
 
-filter_t *filter_build(const char *name, jitter_t *jitter, const char *info)
+int filter_settings(filter_t *filter, const char *settings)
+{
+#ifdef FILTER_EQ
+	if (!strncmp(settings, "eq=", 3) && filter->eq.outbits != 0)
+		return eq_set(&filter->eq, settings + 3);
+#endif
+#ifdef FILTER_DRC
+	if (!strncmp(settings, "drc=", 4) && filter->drc.outbits != 0)
+		return drc_set(&filter->drc, settings + 4);
+#endif
+	return -1;
+}
+
+filter_t *filter_build(const char *name, jitter_t *jitter, const media_info_t *info)
 {
 	filter_t *filter = NULL;
 	const char *query = strchr(name, '?');
@@ -382,8 +500,6 @@ sample_t filter_maxvalue(int bitspersample)
 
 int filter_filloutput(filter_t *filter, filter_audio_t *audio, jitter_t *out)
 {
-	static char *outbuffer = NULL;
-	static int outbufferlen = 0;
 #ifdef DECODER_HEARTBEAT
 	static beat_samples_t beat;
 #endif
@@ -399,25 +515,29 @@ int filter_filloutput(filter_t *filter, filter_audio_t *audio, jitter_t *out)
 		err("filter: samplerate %d not supported", jitter_samplerate(out));
 	}
 
-	if (outbuffer == NULL)
+	if (filter->outbuffer == NULL)
 	{
-		outbuffer = out->ops->pull(out->ctx);
+		filter->outbuffer = out->ops->pull(out->ctx);
 		/**
 		 * the pipe is broken. close the src and the decoder
 		 */
-		if (outbuffer == NULL)
+		if (filter->outbuffer == NULL)
 		{
 			return -1;
 		}
 	}
 
-	outbufferlen += filter->ops->run(filter->ctx, audio,
-			outbuffer + outbufferlen, out->ctx->size - outbufferlen);
+#ifdef METRICS
+	uint64_t start = metrics_now();
+#endif
+	filter->outbufferlen += filter->ops->run(filter->ctx, audio,
+			filter->outbuffer + filter->outbufferlen, out->ctx->size - filter->outbufferlen);
+	metrics_stagerun(filter->metrics, start);
 
-	if (outbufferlen >= out->ctx->size)
+	if (filter->outbufferlen >= out->ctx->size)
 	{
-		if (outbufferlen > out->ctx->size)
-			err("decoder: out %d %ld", outbufferlen, out->ctx->size);
+		if (filter->outbufferlen > out->ctx->size)
+			err("decoder: out %ld %ld", filter->outbufferlen, out->ctx->size);
 #ifdef DECODER_HEARTBEAT
 		beat.nsamples += pcm_length - audio->nsamples;
 		beat.nloops++;
@@ -431,8 +551,8 @@ int filter_filloutput(filter_t *filter, filter_audio_t *audio, jitter_t *out)
 		else
 #endif
 			out->ops->push(out->ctx, out->ctx->size, NULL);
-		outbuffer = NULL;
-		outbufferlen = 0;
+		filter->outbuffer = NULL;
+		filter->outbufferlen = 0;
 	}
 #ifdef DECODER_HEARTBEAT
 	else
@@ -440,6 +560,6 @@ int filter_filloutput(filter_t *filter, filter_audio_t *audio, jitter_t *out)
 		beat->nsamples += pcm_length;
 	}
 #endif
-	return outbufferlen;
+	return filter->outbufferlen;
 }
 
@@ -84,7 +84,8 @@ rescale_t *rescale_init(rescale_t *input, int outbits, jitter_format_t outformat
 sample_t rescale_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel)
 {
 	rescale_t *ctx = (rescale_t *)arg;
-	if (bitspersample < ctx->outbits)
+	/// the integer samples of the same width are already quantized
+	if (bitspersample <= ctx->outbits)
 		return sample;
 
 	sample_t one = ((sample_t)1 << bitspersample);
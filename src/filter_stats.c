@@ -31,6 +31,7 @@
 #include <math.h>
 
 #include "filter.h"
+#include "meter.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -42,89 +43,243 @@
 
 #define filter_dbg(...)
 
-uint32_t filter_rms1(uint32_t rms, sample_t sample, uint64_t nbs);
-uint32_t filter_rms_sqappend(uint32_t sqrms, sample_t sample, int bitspersample);
-uint32_t filter_rms_finish(uint32_t sqrms, int bitspersample, int laps);
+#define STATS_DEFAULTRATE 10
+#define STATS_FLOOR -120.0f
+#define STATS_LOWFREQUENCY 20.0
 
-stats_t *stats_init(stats_t *input)
+stats_t *stats_init(stats_t *input, jitter_format_t outformat, int rate)
 {
 	if (input == NULL)
 		input = calloc(1, sizeof(*input));
+	rescale_t rescale = {0};
+	if (rescale_init(&rescale, 0, outformat) != NULL)
+		input->outbits = rescale.outbits;
+	if (input->outbits == 0)
+		input->outbits = 32;
+	if (rate <= 0)
+		rate = STATS_DEFAULTRATE;
+	input->rate = rate;
+
+	/// Hann window and the twiddle factors of the FFT
+	for (int i = 0; i < STATS_FFTSIZE; i++)
+		input->window[i] = 0.5f * (1.0f - cosf(2.0f * M_PI * i / STATS_FFTSIZE));
+	for (int i = 0; i < STATS_FFTSIZE / 2; i++)
+	{
+		input->cosines[i] = cosf(2.0f * M_PI * i / STATS_FFTSIZE);
+		input->sines[i] = sinf(2.0f * M_PI * i / STATS_FFTSIZE);
+	}
 	return input;
 }
 
-sample_t stats_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel)
+static void _stats_setsamplerate(stats_t *ctx, int samplerate)
 {
-	stats_t *ctx = (stats_t *)arg;
-	if (channel != 0)
-		return sample;
+	ctx->samplerate = samplerate;
+	ctx->period = samplerate / ctx->rate;
+	if (ctx->period == 0)
+		ctx->period = 1;
+	ctx->nframes = 0;
+	memset(ctx->sqsum, 0, sizeof(ctx->sqsum));
+	memset(ctx->peak, 0, sizeof(ctx->peak));
+#ifdef FILTER_FIXEDPOINT
+	memset(ctx->fixedsqsum, 0, sizeof(ctx->fixedsqsum));
+	memset(ctx->fixedpeak, 0, sizeof(ctx->fixedpeak));
+#endif
+}
 
-	if (ctx->lapswindow == 0)
-		ctx->lapswindow = samplerate * 10; // 10s
-	sample_t asample = 0;
-	asample = labs(sample);
-	if (sample == INT32_MIN)
+#ifdef FILTER_FIXEDPOINT
+/**
+ * the integer measures are converted once per publication
+ */
+static void _stats_fixed(stats_t *ctx)
+{
+	const double scale = 1 << 15;
+	for (int i = 0; i < ctx->nchannels && i < MAXCHANNELS; i++)
 	{
-		uint64_t max = filter_maxvalue(bitspersample);
-		fprintf(stdout, "peak %u / %ld\t", ctx->peak, max);
-		fprintf(stdout, "rms %u\t", ctx->rms);
-		fprintf(stdout, "boost %ld\t", ((max * 3) / ctx->peak) - 3);
-		fprintf(stdout, "\n");
+		ctx->peak[i] = ctx->fixedpeak[i] / scale;
+		ctx->sqsum[i] = ctx->fixedsqsum[i] / (scale * scale);
+		if (ctx->peak[i] > ctx->maxpeak)
+			ctx->maxpeak = ctx->peak[i];
 	}
-	else
+	for (int i = 0; i < STATS_FFTSIZE; i++)
+		ctx->input[i] = ctx->fixedinput[i] / scale;
+	memset(ctx->fixedsqsum, 0, sizeof(ctx->fixedsqsum));
+	memset(ctx->fixedpeak, 0, sizeof(ctx->fixedpeak));
+}
+#endif
+
+static float _stats_db(double power)
+{
+	if (power <= 0)
+		return STATS_FLOOR;
+	float db = 10 * log10(power);
+	return (db < STATS_FLOOR)? STATS_FLOOR: db;
+}
+
+/**
+ * radix 2 FFT in place, the real and imaginary parts are into
+ * separated arrays to let the compiler vectorize the butterflies.
+ */
+static void _stats_fft(stats_t *ctx, float *re, float *im)
+{
+	for (int i = 1, j = 0; i < STATS_FFTSIZE; i++)
 	{
-		ctx->nbs++;
-		if (ctx->peak < asample)
-			ctx->peak = asample;
-		if (ctx->bitspersample == 0)
-			ctx->bitspersample = bitspersample;
-/*
-		if (ctx->mean < UINT64_MAX)
+		int bit = STATS_FFTSIZE >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
 		{
-			uint64_t mean = ctx->mean;
-			mean *= (ctx->nbs - 1);
-			mean += asample + 1;
-			ctx->mean = mean / ctx->nbs;
+			float tmp = re[i];
+			re[i] = re[j];
+			re[j] = tmp;
 		}
-*/
-		//ctx->rms = filter_rms1(ctx->rms, ctx->nbs);
-		ctx->rms = filter_rms_sqappend(ctx->rms, sample, bitspersample);
-		if (ctx->nbs % ctx->lapswindow == 0)
+	}
+	for (int length = 2; length <= STATS_FFTSIZE; length <<= 1)
+	{
+		int half = length >> 1;
+		int step = STATS_FFTSIZE / length;
+		for (int i = 0; i < STATS_FFTSIZE; i += length)
 		{
-			uint32_t rms = filter_rms_finish(ctx->rms, bitspersample, ctx->lapswindow);
-			warn("filter: RMS on 10s %.010u peak %.010u sqRMS %.010u", rms, ctx->peak, ctx->rms);
-			ctx->rms = 0;
+			float *re0 = re + i, *im0 = im + i;
+			float *re1 = re0 + half, *im1 = im0 + half;
+			for (int k = 0; k < half; k++)
+			{
+				float wr = ctx->cosines[k * step];
+				float wi = -ctx->sines[k * step];
+				float tr = re1[k] * wr - im1[k] * wi;
+				float ti = re1[k] * wi + im1[k] * wr;
+				re1[k] = re0[k] - tr;
+				im1[k] = im0[k] - ti;
+				re0[k] += tr;
+				im0[k] += ti;
+			}
 		}
 	}
-	return sample;
 }
 
-uint32_t filter_rms1(uint32_t rms, sample_t sample, uint64_t nbs)
+/**
+ * the bands are spaced logarithmically, each one takes the
+ * maximum of its bins (0dB for a sine at the full scale).
+ */
+static void _stats_spectrum(stats_t *ctx, float *bands)
 {
-	uint64_t sqrms = ((uint64_t)rms * (uint64_t)rms);
-	if (rms < nbs)
+	float re[STATS_FFTSIZE];
+	float im[STATS_FFTSIZE] = {0};
+	float scale = 1.0f / ctx->nchannels;
+	for (int i = 0; i < STATS_FFTSIZE; i++)
 	{
-		sqrms *= (nbs - 1);
-		sqrms /= nbs;
+		/// the oldest sample is after the current position
+		int index = (ctx->position + 1 + i) % STATS_FFTSIZE;
+		re[i] = ctx->input[index] * ctx->window[i] * scale;
 	}
-	else
+	_stats_fft(ctx, re, im);
+
+	double resolution = (double)ctx->samplerate / STATS_FFTSIZE;
+	double ratio = (ctx->samplerate / 2.0) / STATS_LOWFREQUENCY;
+	double norm = (STATS_FFTSIZE / 4.0) * (STATS_FFTSIZE / 4.0);
+	for (int b = 0; b < METER_NBANDS; b++)
 	{
-		sqrms /= nbs;
-		sqrms *= (nbs - 1);
+		int first = STATS_LOWFREQUENCY * pow(ratio, (double)b / METER_NBANDS) / resolution;
+		int last = STATS_LOWFREQUENCY * pow(ratio, (double)(b + 1) / METER_NBANDS) / resolution;
+		if (first < 1)
+			first = 1;
+		if (last < first)
+			last = first;
+		if (last > STATS_FFTSIZE / 2)
+			last = STATS_FFTSIZE / 2;
+		double power = 0;
+		for (int k = first; k <= last; k++)
+		{
+			double p = (double)re[k] * re[k] + (double)im[k] * im[k];
+			if (p > power)
+				power = p;
+		}
+		bands[b] = _stats_db(power / norm);
 	}
-	uint64_t sqsample = ((uint64_t)sample * (uint64_t)sample);
-	sqsample /= nbs;
-	rms = sqrtl(sqrms + sqsample);
-	return rms;
 }
 
-uint32_t filter_rms_sqappend(uint32_t sqrms, sample_t sample, int bitspersample)
+static void _stats_publish(stats_t *ctx)
 {
-	sample_t samplescale = sample >> (bitspersample >> 1);
-	return sqrms + (samplescale * samplescale);
+#ifdef FILTER_FIXEDPOINT
+	_stats_fixed(ctx);
+#endif
+	meter_frame_t frame = {0};
+	frame.samplerate = ctx->samplerate;
+	frame.nchannels = (ctx->nchannels < METER_MAXCHANNELS)? ctx->nchannels: METER_MAXCHANNELS;
+	frame.duration = ctx->nframes * 1000 / ctx->samplerate;
+	for (int i = 0; i < frame.nchannels; i++)
+	{
+		frame.peak[i] = _stats_db(ctx->peak[i] * ctx->peak[i]);
+		frame.rms[i] = _stats_db(ctx->sqsum[i] / ctx->nframes);
+	}
+	if (ctx->nbs >= STATS_FFTSIZE)
+		_stats_spectrum(ctx, frame.bands);
+	else
+	{
+		for (int b = 0; b < METER_NBANDS; b++)
+			frame.bands[b] = STATS_FLOOR;
+	}
+	meter_publish(&frame);
+	filter_dbg("filter: peak %.1f rms %.1f dBFS", frame.peak[0], frame.rms[0]);
+
+	ctx->nframes = 0;
+	memset(ctx->sqsum, 0, sizeof(ctx->sqsum));
+	memset(ctx->peak, 0, sizeof(ctx->peak));
 }
 
-uint32_t filter_rms_finish(uint32_t sqrms, int bitspersample, int laps)
+sample_t stats_cb(void *arg, sample_t sample, int bitspersample, int samplerate, int channel)
 {
-	return ((sample_t)sqrt(sqrms / laps)) << (bitspersample >> 1);
+	stats_t *ctx = (stats_t *)arg;
+	if (sample == INT32_MIN)
+	{
+#ifdef FILTER_FIXEDPOINT
+		_stats_fixed(ctx);
+#endif
+		float peak = _stats_db(ctx->maxpeak * ctx->maxpeak);
+		fprintf(stdout, "peak %.1f dBFS\t", peak);
+		fprintf(stdout, "boost %d dB\t", (int)floor(-peak));
+		fprintf(stdout, "\n");
+		return sample;
+	}
+	if (channel >= MAXCHANNELS || samplerate <= 0 || bitspersample <= 0)
+		return sample;
+	if (ctx->samplerate != samplerate)
+		_stats_setsamplerate(ctx, samplerate);
+	if (channel == 0)
+	{
+		if (ctx->nframes == ctx->period)
+			_stats_publish(ctx);
+		ctx->nframes++;
+		ctx->nbs++;
+		ctx->position = (ctx->position + 1) % STATS_FFTSIZE;
+#ifdef FILTER_FIXEDPOINT
+		ctx->fixedinput[ctx->position] = 0;
+#else
+		ctx->input[ctx->position] = 0;
+#endif
+	}
+	if (channel >= ctx->nchannels)
+		ctx->nchannels = channel + 1;
+
+	/// the samples are already rescaled to the output when they are larger
+	int bits = (bitspersample < ctx->outbits)? bitspersample: ctx->outbits;
+#ifdef FILTER_FIXEDPOINT
+	/// the measures keep 16 bits, there isn't float operation per sample
+	int32_t x = (bits > 16)? sample >> (bits - 16): sample * (1 << (16 - bits));
+	uint32_t ax = (x < 0)? -x: x;
+	if (ax > ctx->fixedpeak[channel])
+		ctx->fixedpeak[channel] = ax;
+	ctx->fixedsqsum[channel] += (int64_t)x * x;
+	ctx->fixedinput[ctx->position] += x;
+#else
+	double x = (double)sample / (double)((uint64_t)1 << (bits - 1));
+	double ax = fabs(x);
+	if (ax > ctx->peak[channel])
+		ctx->peak[channel] = ax;
+	if (ax > ctx->maxpeak)
+		ctx->maxpeak = ax;
+	ctx->sqsum[channel] += x * x;
+	ctx->input[ctx->position] += x;
+#endif
+	return sample;
 }
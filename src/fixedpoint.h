@@ -0,0 +1,41 @@
+#ifndef __FIXEDPOINT_H__
+#define __FIXEDPOINT_H__
+
+#include <stdint.h>
+
+/**
+ * Q format arithmetic for the targets without FPU (FILTER_FIXEDPOINT).
+ * A coefficient in Qm.n is an integer with n bits of fraction.
+ * The products are computed on 64 bits and rounded to the nearest,
+ * the results are saturated to the range of the samples.
+ */
+/// the gains are Q8.24 (up to +42dB)
+#define FIXED_GAINSHIFT 24
+/// the curves of the ramps are Q2.30
+#define FIXED_RAMPSHIFT 30
+
+/**
+ * the conversion is used only during the initialization
+ */
+#define FIXED_FROMDOUBLE(value, shift) \
+	((int32_t)((value) * (double)((int64_t)1 << (shift)) + (((value) < 0)? -0.5: 0.5)))
+
+static inline int64_t fixed_mul(int64_t value, int32_t coef, int shift)
+{
+	return (value * coef + ((int64_t)1 << (shift - 1))) >> shift;
+}
+
+/**
+ * the saturation is symmetric: [-(2^(bits-1) - 1), 2^(bits-1) - 1]
+ */
+static inline int32_t fixed_saturate(int64_t value, int bits)
+{
+	int64_t max = ((int64_t)1 << (bits - 1)) - 1;
+	if (value > max)
+		return (int32_t)max;
+	if (value < -max)
+		return (int32_t)-max;
+	return (int32_t)value;
+}
+
+#endif
@@ -35,6 +35,8 @@
 #include <sys/types.h>
 
 #include "jitter.h"
+#include "metrics.h"
+#include "realtime.h"
 typedef struct heartbeat_ctx_s heartbeat_ctx_t;
 struct heartbeat_ctx_s
 {
@@ -97,6 +99,7 @@ static void *_heartbeat_thread(void *arg)
 	struct timespec rest;
 
 	ctx->run = 1;
+	realtime_enter();
 	while (ctx->run)
 	{
 		clock.tv_sec = 0;
@@ -138,7 +141,7 @@ static void heartbeat_start(heartbeat_ctx_t *ctx)
 	}
 	if (ret < 0)
 		err("setinheritsched error %s", strerror(errno));
-	pthread_create(&ctx->thread, &attr, _heartbeat_thread, ctx);
+	realtime_thread(&ctx->thread, &attr, "heartbeat", _heartbeat_thread, ctx);
 	pthread_attr_destroy(&attr);
 #else
 	pthread_create(&ctx->thread, NULL, _heartbeat_thread, ctx);
@@ -155,8 +158,25 @@ static int heartbeat_wait(heartbeat_ctx_t *ctx, void *arg)
 	if (ctx->length < ctx->thredhold)
 		return 0;
 	pthread_mutex_lock(&ctx->mutex);
+#ifdef METRICS
+	/**
+	 * the beat is late when the threshold is reached after its
+	 * deadline, one period after the previous beat.
+	 */
+	struct timespec current;
+	clock_gettime(CLOCK_REALTIME, &current);
+	int64_t lateness = 0;
+	if (ctx->clock.tv_sec > 0)
+		lateness = (int64_t)(current.tv_sec - ctx->clock.tv_sec) * 1000000000 +
+				(current.tv_nsec - ctx->clock.tv_nsec) -
+				(int64_t)ctx->ms * HEARTBEAT_COEF_1000 * 1000;
+	metrics_heartbeat((lateness > 0)? lateness : 0);
+#endif
 
 	pthread_cond_wait(&ctx->cond, &ctx->mutex);
+#ifdef METRICS
+	clock_gettime(CLOCK_REALTIME, &ctx->clock);
+#endif
 #ifdef DEBUG
 	clockid_t clockid = CLOCK_REALTIME;
 	struct timespec now;
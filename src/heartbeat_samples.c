@@ -34,6 +34,7 @@
 #include <errno.h>
 
 #include "jitter.h"
+#include "metrics.h"
 typedef struct heartbeat_ctx_s heartbeat_ctx_t;
 struct heartbeat_ctx_s
 {
@@ -143,6 +144,16 @@ static int heartbeat_wait(heartbeat_ctx_t *ctx, void *arg)
 		ctx->clock.tv_nsec -= 1000000000;
 		ctx->clock.tv_sec += 1;
 	}
+#ifdef METRICS
+	/**
+	 * the beat is late when the deadline is already passed
+	 */
+	struct timespec current;
+	clock_gettime(clockid, &current);
+	int64_t lateness = (int64_t)(current.tv_sec - ctx->clock.tv_sec) * 1000000000 +
+				(current.tv_nsec - ctx->clock.tv_nsec);
+	metrics_heartbeat((lateness > 0)? lateness : 0);
+#endif
 	int flags = TIMER_ABSTIME;
 	while (clock_nanosleep(clockid, flags, &ctx->clock, NULL) != 0)
 	{
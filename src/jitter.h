@@ -20,6 +20,7 @@ extern int __jitter_dbg__;
 typedef struct filter_audio_s filter_audio_t;
 typedef struct filter_s filter_t;
 typedef struct heartbeat_s heartbeat_t;
+typedef struct metrics_jitter_s metrics_jitter_t;
 
 typedef enum jitte_s {
 	JITTE_LOW,
@@ -29,6 +30,12 @@ typedef enum jitte_s {
 
 typedef int (*consume_t)(void *consumer, unsigned char *buffer, size_t size);
 typedef int (*produce_t)(void *producter, unsigned char *buffer, size_t size);
+/**
+ * reposition the stream of the producer with the lseek semantic.
+ * It is available only when the producer runs into the consumer thread,
+ * the consumer resets the jitter before to seek.
+ */
+typedef long (*seek_t)(void *producter, long offset, int whence);
 typedef struct jitter_ctx_s jitter_ctx_t;
 struct jitter_ctx_s
 {
@@ -41,8 +48,10 @@ struct jitter_ctx_s
 	void *consumer;
 	produce_t produce;
 	void *producter;
+	seek_t seek;
 	unsigned int frequence;
 	heartbeat_t *heartbeat;
+	metrics_jitter_t *metrics;
 	void *private;
 };
 
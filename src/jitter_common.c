@@ -30,13 +30,14 @@
 #include <pthread.h>
 
 #include "jitter.h"
+#include "metrics.h"
 
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
 
 extern jitter_t *jitter_scattergather_init(const char *name, unsigned count, size_t size);
 extern jitter_t *jitter_ringbuffer_init(const char *name, unsigned count, size_t size);
 
-#define MAXJITTERS 10
+#define MAXJITTERS 16
 static jitter_t *_jitters[MAXJITTERS] = {0};
 int __jitter_dbg__ = -1;
 
@@ -64,7 +65,12 @@ jitter_t *jitter_init(int type, const char *name, unsigned count, size_t size)
 	else if (type == JITTER_TYPE_RING)
 		jitter = jitter_ringbuffer_init(name, count, size);
 	if (jitter != NULL)
+	{
 		jitter->ctx->id = id;
+#ifdef METRICS
+		jitter->ctx->metrics = metrics_jitter(id, name, count, size);
+#endif
+	}
 	_jitters[id] = jitter;
 	pthread_mutex_unlock(&jitter_lock);
 	return jitter;
@@ -35,6 +35,7 @@
 #include <sys/mman.h>
 
 #include "jitter.h"
+#include "metrics.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -161,14 +162,18 @@ static unsigned char *jitter_pull(jitter_ctx_t *jitter)
 
 	pthread_mutex_lock(&private->mutex);
 	int state = private->state;
+	uint64_t wait = 0;
 	while ((private->in != NULL) &&
 		((private->level + jitter->size) > (jitter->size * jitter->count)))
 	{
 		if (private->state == JITTER_FLUSH)
 			break;
 		jitter_dbg(jitter, "pull block on %p (%d/%ld)", private->in, private->level, (jitter->size * jitter->count));
+		if (wait == 0)
+			wait = metrics_jitteroverflow(jitter->metrics);
 		pthread_cond_wait(&private->condpush, &private->mutex);
 	}
+	metrics_jitterpullwait(jitter->metrics, wait);
 	unsigned char *ret = NULL;
 	if ((private->state == JITTER_RUNNING || private->state == JITTER_FILLING) &&
 		((private->level + jitter->size) <= (jitter->size * jitter->count)))
@@ -211,6 +216,7 @@ static void jitter_push(jitter_ctx_t *jitter, size_t len, void *beat)
 		private->in = private->bufferstart + len;
 		jitter_dbg(jitter, "variatic move %ld",len);
 	}
+	metrics_jitterpush(jitter->metrics, private->level / jitter->size);
 	pthread_mutex_unlock(&private->mutex);
 
 	if (jitter->consume != NULL)
@@ -242,6 +248,8 @@ static void jitter_push(jitter_ctx_t *jitter, size_t len, void *beat)
 	{
 		jitter_dbg(jitter, "push B %ld/%d", len, private->level);
 		private->state = JITTER_RUNNING;
+		/// the consumer may already wait the end of the filling
+		pthread_cond_broadcast(&private->condpeer);
 	}
 	else
 	{
@@ -282,10 +290,17 @@ static unsigned char *jitter_peer(jitter_ctx_t *jitter, void **beat)
 				pthread_mutex_unlock(&private->mutex);
 				if (len > 0)
 					jitter_push(jitter, len, NULL);
-				else
+				else if (private->level == 0)
 				{
 					return NULL;
 				}
+				else
+				{
+					/// the end of the stream, the data already pushed are still available
+					pthread_mutex_lock(&private->mutex);
+					private->state = JITTER_RUNNING;
+					break;
+				}
 				pthread_mutex_lock(&private->mutex);
 			} while (private->state == JITTER_FILLING);
 		}
@@ -317,14 +332,18 @@ static unsigned char *jitter_peer(jitter_ctx_t *jitter, void **beat)
 	/**
 	 * The checking of produce should be useless, but it's a secure addon
 	 */
+	uint64_t wait = 0;
 	while (((private->state == JITTER_FILLING) &&
 			(private->in != NULL) &&
 			(jitter->produce == NULL)) ||
 			private->pause)
 	{
 		jitter_dbg(jitter, "peer block on %p %p %d", private->in, private->out + jitter->size, private->in <= private->out + jitter->size);
+		if (wait == 0)
+			wait = metrics_jitterunderrun(jitter->metrics, !private->pause);
 		pthread_cond_wait(&private->condpeer, &private->mutex);
 	}
+	metrics_jitterpeerwait(jitter->metrics, wait);
 
 	if (private->state == JITTER_STOP)
 	{
@@ -356,6 +375,7 @@ static void jitter_pop(jitter_ctx_t *jitter, size_t len)
 	pthread_mutex_lock(&private->mutex);
 	private->out += len;
 	private->level -= len;
+	metrics_jitterpop(jitter->metrics, private->level / jitter->size);
 	if (private->level <= jitter->size)
 	{
 		if (private->state == JITTER_RUNNING)
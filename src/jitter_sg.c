@@ -35,6 +35,7 @@
 
 #include "jitter.h"
 #include "heartbeat.h"
+#include "metrics.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -197,6 +198,7 @@ static unsigned char *jitter_pull(jitter_ctx_t *jitter)
 	pthread_mutex_lock(&private->mutex);
 	if (private->state == JITTER_STOP)
 		_jitter_init(jitter);
+	uint64_t wait = 0;
 	while (private->in->state != SCATTER_FREE)
 	{
 		if (private->state == JITTER_FLUSH)
@@ -207,9 +209,12 @@ static unsigned char *jitter_pull(jitter_ctx_t *jitter)
 		 */
 
 		jitter_dbg(jitter, "pull block on %p %d %d", private->in, private->state, private->level);
+		if (wait == 0)
+			wait = metrics_jitteroverflow(jitter->metrics);
 		pthread_cond_wait(&private->condpush, &private->mutex);
 
 	}
+	metrics_jitterpullwait(jitter->metrics, wait);
 	unsigned char *ret= NULL;
 	if (private->state != JITTER_FLUSH &&
 		private->state != JITTER_STOP &&
@@ -263,6 +268,7 @@ static void jitter_push(jitter_ctx_t *jitter, size_t len, void *beat)
 		private->in->state = SCATTER_READY;
 		private->level++;
 		private->in = private->in->next;
+		metrics_jitterpush(jitter->metrics, private->level);
 		pthread_mutex_unlock(&private->mutex);
 		/**
 		 * The standard case uses a thread to consume the buffers.
@@ -391,6 +397,7 @@ static unsigned char *jitter_peer(jitter_ctx_t *jitter, void **beat)
 		}
 	}
 	pthread_mutex_lock(&private->mutex);
+	uint64_t wait = 0;
 	while (((private->state == JITTER_FILLING) ||
 			(private->out->state != SCATTER_READY)) ||
 			private->pause)
@@ -400,8 +407,12 @@ static unsigned char *jitter_peer(jitter_ctx_t *jitter, void **beat)
 		 * The consumer is waiting that the thredhold is reached.
 		 */
 		jitter_dbg(jitter, "peer block on %p %d %d", private->out, private->state, private->out->state);
+		if (wait == 0)
+			wait = metrics_jitterunderrun(jitter->metrics,
+					private->state == JITTER_RUNNING && !private->pause);
 		pthread_cond_wait(&private->condpeer, &private->mutex);
 	}
+	metrics_jitterpeerwait(jitter->metrics, wait);
 	private->out->state = SCATTER_POP;
 	pthread_mutex_unlock(&private->mutex);
 #ifdef HEARTBEAT
@@ -463,6 +474,7 @@ static void jitter_pop(jitter_ctx_t *jitter, size_t len)
 	private->out->state = SCATTER_FREE;
 	private->level--;
 	private->out = private->out->next;
+	metrics_jitterpop(jitter->metrics, private->level);
 	if (private->level == 0 && jitter->thredhold > 0)
 	{
 		/**
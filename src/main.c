@@ -65,6 +65,9 @@
 #include "media.h"
 #include "cmds.h"
 #include "daemonize.h"
+#include "metrics.h"
+#include "meter.h"
+#include "realtime.h"
 
 #define STINGIFY(text) #text
 
@@ -124,7 +127,7 @@ void help(const char *name)
 	fprintf(stderr, "%s [-R <websocketdir>][-m <media>][-o <output>][-p <pidfile>]\n", name);
 	fprintf(stderr, "\t...[-f <filtername>][-x][-D][-a][-r][-l][-L <logfile>]\n");
 	fprintf(stderr, "\t...[-d <directory>][-R <directory>]\n");
-	fprintf(stderr, "\t...[-P [0-99]]\n");
+	fprintf(stderr, "\t...[-P [0-99]][-T <threads>]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "\t -m <media>\tSet the media supporting audio files\n");
 	fprintf(stderr, "\t -o <output>\tSet the sink URL (default: alsa:default)\n");
@@ -134,6 +137,9 @@ void help(const char *name)
 	fprintf(stderr, "\t -R <directory>\tSet the directory for command socket file\n");
 	fprintf(stderr, "\t -d <directory>\tSet the working directory\n");
 	fprintf(stderr, "\t -P <priority>\tSet the process priority\n");
+	fprintf(stderr, "\t -T <threads>\tSet the placement of the threads (file or string)\n");
+	fprintf(stderr, "\t\t\t<role>=[fifo|rr|other][:<priority>][@<cpus>];...\n");
+	fprintf(stderr, "\t\t\troles: src demux decoder encoder mux sink heartbeat server\n");
 	fprintf(stderr, "\t -f <filter>\tSet a filter and its features (default: pcm\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "\t filters:\n");
@@ -141,7 +147,7 @@ void help(const char *name)
 	fprintf(stderr, "\t pcm?mono=left\tmono stream with left channel\n");
 	fprintf(stderr, "\t pcm?mono=right\tmono stream with right channel\n");
 	fprintf(stderr, "\t pcm?mono=mixed\tmono stream with left+right channels\n");
-	fprintf(stderr, "\t pcm?stats\tprint statistics about the stream\n");
+	fprintf(stderr, "\t pcm?stats=<rate>\tpublish the levels and the spectrum on <root>/<name>.meter\n");
 
 }
 
@@ -163,13 +169,14 @@ int main(int argc, char **argv)
 	const char *user = NULL;
 	const char *pidfile = NULL;
 	const char *filtername = "pcm";
+	const char *threads = NULL;
 	const char *logfile = NULL;
 	const char *cwd = NULL;
 
 	int opt;
 	do
 	{
-		opt = getopt(argc, argv, "R:m:o:u:p:f:hDKVxalrL:d:P:");
+		opt = getopt(argc, argv, "R:m:o:u:p:f:hDKVxalrL:d:P:T:");
 		switch (opt)
 		{
 			case 'R':
@@ -221,6 +228,9 @@ int main(int argc, char **argv)
 			case 'P':
 				priority = strtol(optarg, NULL, 10);
 			break;
+			case 'T':
+				threads = optarg;
+			break;
 		}
 	} while(opt != -1);
 
@@ -272,8 +282,11 @@ int main(int argc, char **argv)
 		dbg("main: priority %d", params.sched_priority);
 		if (sched_setscheduler(0, REALTIME_SCHED, &params))
 			err("schedluder modification error %s", strerror(errno));
+		realtime_init(REALTIME_HEAPSIZE);
 #endif
 	}
+	if (threads != NULL && realtime_config(threads) < 0)
+		err("main: threads configuration error");
 
 	player_ctx_t *player = player_init(filtername);
 	if (player == NULL)
@@ -306,6 +319,19 @@ int main(int argc, char **argv)
 			err("the directory %s is not available", root);
 		}
 	}
+	char coverpath[256];
+	snprintf(coverpath, sizeof(coverpath) - 1, "%s/%s.covers", root, name);
+	media_coverdir(coverpath);
+#ifdef METRICS
+	char metricspath[256];
+	snprintf(metricspath, sizeof(metricspath) - 1, "%s/%s.metrics", root, name);
+	metrics_init(metricspath);
+#endif
+#ifdef FILTER_STATS
+	char meterpath[256];
+	snprintf(meterpath, sizeof(meterpath) - 1, "%s/%s.meter", root, name);
+	meter_init(meterpath);
+#endif
 
 	sink_t *sink = NULL;
 
@@ -313,7 +339,7 @@ int main(int argc, char **argv)
 	 * cmds_json must be initialize as soon as possible.
 	 * Other applications mays needs it "immediatly"
 	 */
-	cmds_t cmds[3];
+	cmds_t cmds[6];
 	int nbcmds = 0;
 #ifdef JSONRPC
 	char socketpath[256];
@@ -322,6 +348,13 @@ int main(int argc, char **argv)
 	cmds[nbcmds].ctx = cmds[nbcmds].ops->init(player, (void *)socketpath);
 	nbcmds++;
 #endif
+#ifdef CMDSTATUS
+	char statuspath[256];
+	snprintf(statuspath, sizeof(statuspath) - 1, "%s/%s.status", root, name);
+	cmds[nbcmds].ops = cmds_status;
+	cmds[nbcmds].ctx = cmds[nbcmds].ops->init(player, (void *)statuspath);
+	nbcmds++;
+#endif
 
 	sink = sink_build(player, outarg);
 
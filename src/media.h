@@ -22,6 +22,10 @@ extern const char const *str_year;
 extern const char const *str_genre;
 extern const char const *str_date;
 extern const char const *str_regain;
+extern const char const *str_duration;
+extern const char const *str_albumgain;
+extern const char const *str_loudness;
+extern const char const *str_truepeak;
 extern const char const *str_comment;
 extern const char const *str_cover;
 extern const char const *str_likes;
@@ -89,10 +93,29 @@ struct media_ops_s
 	 * optional
 	 */
 	int (*append)(media_ctx_t *ctx, const char *path, const char *info, const char *mime);
+	/**
+	 * optional
+	 * enable = 1 groups the next insertions until the call with enable = 0
+	 */
+	int (*batch)(media_ctx_t *ctx, int enable);
+	/**
+	 * optional
+	 * a context with its own connection for a writer thread,
+	 * its batch does not include the requests of the other threads.
+	 * It is released with destroy.
+	 */
+	media_ctx_t *(*writer)(media_ctx_t *ctx);
 	/**
 	 * optional
 	 */
 	int (*modify)(media_ctx_t *ctx, int id, const char *info);
+	/**
+	 * optional
+	 * store the result of the loudness analysis of the media id
+	 * (loudness in LUFS, truepeak in dBTP, duration in ms) and
+	 * update the gains of the track and of its album.
+	 */
+	int (*loudness)(media_ctx_t *ctx, int id, double loudness, double truepeak, unsigned int duration);
 	/**
 	 * mandatory
 	 */
@@ -109,6 +132,18 @@ struct media_ops_s
 	 * optional
 	 */
 	int (*list)(media_ctx_t *ctx, media_parse_t print, void *data);
+	/**
+	 * optional
+	 * list at most max entries with an id greater or equal to first,
+	 * ordered by id. The next page starts after the last id.
+	 */
+	int (*listpage)(media_ctx_t *ctx, int first, int max, media_parse_t print, void *data);
+	/**
+	 * optional
+	 * list the entries matching the words of keyword (as prefixes),
+	 * the best first. first is the offset into the result.
+	 */
+	int (*search)(media_ctx_t *ctx, const char *keyword, int first, int max, media_parse_t print, void *data);
 	/**
 	 * mandatory
 	 */
@@ -140,8 +175,32 @@ struct media_s
 
 media_t *media_build(player_ctx_t *player, const char *path);
 const char *media_path();
-const char *media_parseinfo(const char *info, const char *key);
-unsigned int media_boost(const char *info);
+
+/**
+ * the metadata of a track, parsed once from the JSON info of the media.
+ * The strings are interned and shared between the tracks.
+ */
+typedef struct media_info_s media_info_t;
+struct media_info_s
+{
+	const char *title;
+	const char *artist;
+	const char *album;
+	const char *genre;
+	const char *cover;
+	/** the gain to apply in dB */
+	int replaygain;
+	/** the gain of the album in dB */
+	int albumgain;
+	/** the integrated loudness in LUFS, 0 if not analyzed */
+	int loudness;
+	/** the length of the track in ms, 0 if unknown */
+	unsigned int duration;
+	int track;
+	int year;
+};
+int media_parseinfo(const char *info, media_info_t *trackinfo);
+void media_freeinfo(media_info_t *trackinfo);
 
 typedef struct json_t json_t;
 #ifdef USE_ID3TAG
@@ -151,6 +210,32 @@ int media_parseid3tag(const char *path, json_t *object);
 int media_parseoggmetadata(const char *path, json_t *object);
 #endif
 char *media_fillinfo(const char *url, const char *mime);
+/**
+ * set the directory of the store of the covers
+ */
+void media_coverdir(const char *path);
+/**
+ * store a cover picture by its content and return the path of the file
+ * (to free).
+ */
+char *media_cover(const char *mime, const unsigned char *data, unsigned long length);
+/**
+ * the callback returns 1 when a stored cover is still referenced
+ * by the media, the eviction keeps it.
+ */
+void media_coverused(int (*used)(void *arg, const char *path), void *arg);
+/**
+ * the covers stored before are referenced by committed media,
+ * they may be evicted.
+ */
+void media_coversync(void);
+#ifdef MEDIA_IMPORT
+/**
+ * insert all the audio files of a directory tree into the media.
+ * The metadata are parsed by several threads.
+ */
+int media_import(media_t *media, const char *path);
+#endif
 int media_parse_info(json_t *jinfo, char **ptitle, char **partist,
 		char **palbum, char **pgenre, char **pcover, char **pcomment,
 		int *plikes);
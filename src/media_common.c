@@ -37,6 +37,8 @@
 #include <sched.h>
 #include <limits.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <math.h>
 
 #ifdef USE_ID3TAG
 #include <id3tag.h>
@@ -83,6 +85,9 @@ const char const *str_date = "date";
 const char const *str_comment = "comment";
 const char const *str_cover = "cover";
 const char const *str_regain = "replaygain";
+const char const *str_albumgain = "albumgain";
+const char const *str_loudness = "loudness";
+const char const *str_truepeak = "truepeak";
 const char const *str_duration = "duration";
 const char const *str_likes = "likes";
 
@@ -301,26 +306,6 @@ const char *utils_format2mime(jitter_format_t format)
 	return mime_octetstream;
 }
 
-static char *media_regfile(char *path, const char *mime, const unsigned char *data, unsigned long length)
-{
-	int fd = -1;
-	char *ext = strrchr(path, '.');
-	if (!strcmp(mime, mime_imagepng))
-		strcpy(ext, ".png");
-	else if (!strcmp(mime, mime_imagejpg) ||
-		!strcmp(mime, "image/jpeg"))
-		strcpy(ext, ".jpg");
-	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
-	if (fd > 0)
-	{
-		int ret = write(fd, data, length);
-		if (ret != length)
-			err("media: write image file error");
-		close(fd);
-	}
-	return path;
-}
-
 static char *media_tmpfile(char *path, const char *mime, const unsigned char *data, unsigned long length)
 {
 	static int fd = -1;
@@ -509,17 +494,11 @@ int media_parseid3tag(const char *path, json_t *object)
 				break;
 				case ID3_FIELD_TYPE_BINARYDATA:
 				{
-					char coverpath[PATH_MAX];
 					data = id3_field_getbinarydata(field, &length);
-					strcpy(coverpath, path);
-					char *name = strrchr(coverpath, '/');
-					if (name != NULL)
-						name++;
-					else
-						name = coverpath;
-					strcpy(name, "cover.XXX");
-					char *latin1 = media_regfile(coverpath, mimetype, data, length);
-					value = json_string(latin1);
+					char *cover = media_cover(mimetype, data, length);
+					if (cover != NULL)
+						value = json_string(cover);
+					free(cover);
 				}
 				break;
 				}
@@ -610,18 +589,14 @@ int media_parseoggmetadata(const char *path, json_t *object)
 		FLAC__StreamMetadata_Picture *picture;
 		picture = &vorbispicture->data.picture;
 
-		char coverpath[PATH_MAX];
-		strncpy(coverpath, path, PATH_MAX - 10);
-		char *name = strrchr(coverpath, '/');
-		if (name != NULL)
-			name++;
-		else
-			name = coverpath;
-		strcpy(name, "cover.XXX");
-
-		json_t *value;
-		value = json_string(media_regfile(coverpath, picture->mime_type, picture->data, picture->data_length));
-		json_object_set(object, str_cover, value);
+		char *cover = media_cover(picture->mime_type, picture->data, picture->data_length);
+		if (cover != NULL)
+		{
+			json_t *value;
+			value = json_string(cover);
+			json_object_set(object, str_cover, value);
+			free(cover);
+		}
 
 		FLAC__metadata_object_delete(vorbispicture);
 	}
@@ -629,39 +604,140 @@ int media_parseoggmetadata(const char *path, json_t *object)
 }
 #endif
 
-static const char *_last_info = NULL;
-static json_t *_last_jinfo = NULL;
-const char *media_parseinfo(const char *info, const char *key)
+#define MEDIA_INTERNBUCKETS 256
+typedef struct media_intern_s media_intern_t;
+struct media_intern_s
 {
-	const char *value = NULL;
-	json_error_t error;
-	if (_last_info != NULL && info != _last_info)
+	media_intern_t *next;
+	unsigned int hash;
+	unsigned int refs;
+	char string[];
+};
+static media_intern_t *_interns[MEDIA_INTERNBUCKETS] = {0};
+static pthread_mutex_t _internmutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int _media_internhash(const char *string)
+{
+	/// FNV-1a
+	unsigned int hash = 2166136261U;
+	while (*string != '\0')
 	{
-		json_decref(_last_jinfo);
-		_last_jinfo = NULL;
+		hash ^= (unsigned char)*string++;
+		hash *= 16777619U;
 	}
-	if (_last_jinfo == NULL)
+	return hash;
+}
+
+/**
+ * the artist, album and genre are the same for a lot of tracks,
+ * one copy is kept for all of them.
+ */
+static const char *_media_intern(const char *string)
+{
+	unsigned int hash = _media_internhash(string);
+	media_intern_t *it;
+
+	pthread_mutex_lock(&_internmutex);
+	for (it = _interns[hash % MEDIA_INTERNBUCKETS]; it != NULL; it = it->next)
 	{
-		_last_jinfo = json_loads(info, 0, &error);
-		_last_info = info;
+		if (it->hash == hash && !strcmp(it->string, string))
+			break;
 	}
-	if (json_is_object(_last_jinfo))
+	if (it == NULL)
 	{
-		json_t *jvalue;
-		jvalue = json_object_get(_last_jinfo, key);
-		if (jvalue != NULL && json_is_string(jvalue))
-			value = json_string_value(jvalue);
+		size_t length = strlen(string) + 1;
+		it = malloc(sizeof(*it) + length);
+		if (it == NULL)
+		{
+			pthread_mutex_unlock(&_internmutex);
+			return NULL;
+		}
+		it->hash = hash;
+		it->refs = 0;
+		memcpy(it->string, string, length);
+		it->next = _interns[hash % MEDIA_INTERNBUCKETS];
+		_interns[hash % MEDIA_INTERNBUCKETS] = it;
 	}
-	return value;
+	it->refs++;
+	pthread_mutex_unlock(&_internmutex);
+	return it->string;
+}
+
+static void _media_unintern(const char *string)
+{
+	if (string == NULL)
+		return;
+	media_intern_t *intern = (media_intern_t *)(string - offsetof(media_intern_t, string));
+	pthread_mutex_lock(&_internmutex);
+	if (--intern->refs == 0)
+	{
+		media_intern_t **pit = &_interns[intern->hash % MEDIA_INTERNBUCKETS];
+		while (*pit != NULL && *pit != intern)
+			pit = &(*pit)->next;
+		if (*pit != NULL)
+			*pit = intern->next;
+		free(intern);
+	}
+	pthread_mutex_unlock(&_internmutex);
+}
+
+static const char *_media_infostring(json_t *jinfo, const char *key)
+{
+	json_t *value = json_object_get(jinfo, key);
+	if (value != NULL && json_is_string(value))
+		return _media_intern(json_string_value(value));
+	return NULL;
+}
+
+static long _media_infointeger(json_t *jinfo, const char *key)
+{
+	json_t *value = json_object_get(jinfo, key);
+	if (value != NULL && json_is_integer(value))
+		return json_integer_value(value);
+	if (value != NULL && json_is_real(value))
+		return lround(json_real_value(value));
+	/// the tags store the numbers as strings ("3/12" for the track)
+	if (value != NULL && json_is_string(value))
+		return strtol(json_string_value(value), NULL, 10);
+	return 0;
+}
+
+int media_parseinfo(const char *info, media_info_t *trackinfo)
+{
+	memset(trackinfo, 0, sizeof(*trackinfo));
+	if (info == NULL)
+		return -1;
+
+	json_error_t error;
+	json_t *jinfo = json_loads(info, 0, &error);
+	if (!json_is_object(jinfo))
+	{
+		json_decref(jinfo);
+		return -1;
+	}
+	trackinfo->title = _media_infostring(jinfo, str_title);
+	trackinfo->artist = _media_infostring(jinfo, str_artist);
+	trackinfo->album = _media_infostring(jinfo, str_album);
+	trackinfo->genre = _media_infostring(jinfo, str_genre);
+	trackinfo->cover = _media_infostring(jinfo, str_cover);
+	trackinfo->replaygain = _media_infointeger(jinfo, str_regain);
+	trackinfo->albumgain = _media_infointeger(jinfo, str_albumgain);
+	trackinfo->loudness = _media_infointeger(jinfo, str_loudness);
+	trackinfo->duration = _media_infointeger(jinfo, str_duration);
+	trackinfo->track = _media_infointeger(jinfo, str_track);
+	trackinfo->year = _media_infointeger(jinfo, str_year);
+	json_decref(jinfo);
+	return 0;
 }
 
-unsigned int media_boost(const char *info)
+void media_freeinfo(media_info_t *trackinfo)
 {
-	const char *sboost = media_parseinfo(info, str_regain);
-	unsigned int boost = 0;
-	if (sboost != NULL)
-		boost = strtol(sboost, NULL, 10);
-	return boost;
+	_media_unintern(trackinfo->title);
+	_media_unintern(trackinfo->artist);
+	_media_unintern(trackinfo->album);
+	_media_unintern(trackinfo->genre);
+	_media_unintern(trackinfo->cover);
+	memset(trackinfo, 0, sizeof(*trackinfo));
 }
 
 static char *current_path;
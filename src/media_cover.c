@@ -0,0 +1,255 @@
+/*****************************************************************************
+ * media_cover.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "media.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define cover_dbg(...)
+
+#ifndef MEDIA_COVER_DIR
+#define MEDIA_COVER_DIR "/tmp/putv_covers"
+#endif
+#ifndef MEDIA_COVER_MAXSIZE
+#define MEDIA_COVER_MAXSIZE (32 * 1024 * 1024)
+#endif
+
+/**
+ * The covers embedded into the files are stored once by content.
+ * The name of the file is the hash of the picture, the same cover
+ * of all the tracks of an album is written only one time.
+ * The modification time of the files is the date of the last store.
+ * When the store is larger than MEDIA_COVER_MAXSIZE, the oldest covers
+ * are removed, except the covers still referenced by the media and
+ * the covers stored since the last media_coversync.
+ */
+static char _cover_dir[PATH_MAX] = MEDIA_COVER_DIR;
+static long long _cover_size = -1;
+/** the size of the store after the last eviction */
+static long long _cover_limit = MEDIA_COVER_MAXSIZE;
+static time_t _cover_sync = 0;
+static int (*_cover_used)(void *arg, const char *path) = NULL;
+static void *_cover_usedarg = NULL;
+static pthread_mutex_t _cover_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct cover_entry_s cover_entry_t;
+struct cover_entry_s
+{
+	char name[32];
+	off_t size;
+	time_t mtime;
+};
+
+void media_coverdir(const char *path)
+{
+	pthread_mutex_lock(&_cover_mutex);
+	snprintf(_cover_dir, sizeof(_cover_dir), "%s", path);
+	_cover_size = -1;
+	pthread_mutex_unlock(&_cover_mutex);
+}
+
+void media_coverused(int (*used)(void *arg, const char *path), void *arg)
+{
+	pthread_mutex_lock(&_cover_mutex);
+	_cover_used = used;
+	_cover_usedarg = arg;
+	pthread_mutex_unlock(&_cover_mutex);
+}
+
+static uint64_t _cover_hash(const unsigned char *data, unsigned long length)
+{
+	/** FNV-1a 64 bits */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned long i;
+	for (i = 0; i < length; i++)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static int _cover_cmp(const void *a, const void *b)
+{
+	const cover_entry_t *entrya = (const cover_entry_t *)a;
+	const cover_entry_t *entryb = (const cover_entry_t *)b;
+	return (entrya->mtime > entryb->mtime) - (entrya->mtime < entryb->mtime);
+}
+
+/**
+ * read the store and remove the oldest covers until the store
+ * uses 3/4 of the maximum size.
+ * A store full of referenced covers is scanned again only after
+ * a quarter of the maximum size more.
+ */
+static void _cover_evict(int evict)
+{
+	DIR *dir = opendir(_cover_dir);
+	if (dir == NULL)
+		return;
+	cover_entry_t *entries = NULL;
+	int nentries = 0;
+	int maxentries = 0;
+	long long size = 0;
+	struct dirent *dirent;
+	while ((dirent = readdir(dir)) != NULL)
+	{
+		struct stat filestat;
+		if (dirent->d_name[0] == '.' ||
+			strlen(dirent->d_name) >= sizeof(entries->name) ||
+			fstatat(dirfd(dir), dirent->d_name, &filestat, 0) != 0 ||
+			!S_ISREG(filestat.st_mode))
+			continue;
+		size += filestat.st_size;
+		if (!evict)
+			continue;
+		if (nentries == maxentries)
+		{
+			maxentries += 64;
+			cover_entry_t *tmp = realloc(entries, maxentries * sizeof(*entries));
+			if (tmp == NULL)
+				break;
+			entries = tmp;
+		}
+		strcpy(entries[nentries].name, dirent->d_name);
+		entries[nentries].size = filestat.st_size;
+		entries[nentries].mtime = filestat.st_mtime;
+		nentries++;
+	}
+	if (evict && size > MEDIA_COVER_MAXSIZE)
+	{
+		qsort(entries, nentries, sizeof(*entries), _cover_cmp);
+		int i;
+		for (i = 0; i < nentries && size > MEDIA_COVER_MAXSIZE / 4 * 3; i++)
+		{
+			/// the media of the cover may not be committed yet
+			if (entries[i].mtime >= _cover_sync)
+				break;
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s/%s", _cover_dir, entries[i].name);
+			if (_cover_used != NULL && _cover_used(_cover_usedarg, path))
+				continue;
+			if (unlinkat(dirfd(dir), entries[i].name, 0) == 0)
+				size -= entries[i].size;
+			cover_dbg("media: cover %s removed", entries[i].name);
+		}
+	}
+	free(entries);
+	closedir(dir);
+	_cover_size = size;
+	_cover_limit = MEDIA_COVER_MAXSIZE;
+	if (size > _cover_limit - MEDIA_COVER_MAXSIZE / 4)
+		_cover_limit = size + MEDIA_COVER_MAXSIZE / 4;
+}
+
+void media_coversync(void)
+{
+	pthread_mutex_lock(&_cover_mutex);
+	_cover_sync = time(NULL);
+	if (_cover_size > MEDIA_COVER_MAXSIZE)
+		_cover_evict(1);
+	pthread_mutex_unlock(&_cover_mutex);
+}
+
+char *media_cover(const char *mime, const unsigned char *data, unsigned long length)
+{
+	const char *ext = ".jpg";
+	if (mime != NULL && strstr(mime, "png") != NULL)
+		ext = ".png";
+
+	char *path = NULL;
+	pthread_mutex_lock(&_cover_mutex);
+	if (_cover_size < 0)
+	{
+		mkdir(_cover_dir, 0755);
+		_cover_evict(0);
+		if (_cover_sync == 0)
+			_cover_sync = time(NULL);
+	}
+	if (asprintf(&path, "%s/%016llx%08lx%s", _cover_dir,
+			(unsigned long long)_cover_hash(data, length), length, ext) < 0)
+	{
+		pthread_mutex_unlock(&_cover_mutex);
+		return NULL;
+	}
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd >= 0)
+	{
+		int ret = write(fd, data, length);
+		close(fd);
+		if (ret != length)
+		{
+			err("media: write cover error %s", strerror(errno));
+			unlink(path);
+			free(path);
+			path = NULL;
+		}
+		else
+		{
+			_cover_size += length;
+			if (_cover_size > _cover_limit)
+				_cover_evict(1);
+		}
+	}
+	else if (errno == EEXIST)
+	{
+		/**
+		 * the cover is already into the store, it becomes the most recent
+		 * and the new media which uses it is protected until the next sync.
+		 */
+		utimensat(AT_FDCWD, path, NULL, 0);
+	}
+	else
+	{
+		err("media: cover %s error %s", path, strerror(errno));
+		free(path);
+		path = NULL;
+	}
+	pthread_mutex_unlock(&_cover_mutex);
+	return path;
+}
@@ -186,6 +186,28 @@ static int _find_count(void *arg, media_ctx_t *ctx, int mediaid, const char *pat
 	return 1;
 }
 
+typedef struct _find_page_s _find_page_t;
+struct _find_page_s
+{
+	_find_mediaid_t mdata;
+	int first;
+	int max;
+};
+
+/**
+ * the info of the files outside the page are not read,
+ * and the browsing stops after the last entry of the page.
+ */
+static int _find_page(void *arg, media_ctx_t *ctx, int mediaid, const char *path, const char *mime)
+{
+	_find_page_t *pdata = (_find_page_t *)arg;
+	if (mediaid < pdata->first)
+		return 1;
+	_run_cb(&pdata->mdata, mediaid, path, mime);
+	pdata->max--;
+	return (pdata->max > 0)? 1: 0;
+}
+
 static int _find(media_ctx_t *ctx, int level, media_dirlist_t **pit, int *pmediaid, _findcb_t cb, void *arg)
 {
 	int ret = -2;
@@ -345,6 +367,19 @@ static int media_list(media_ctx_t *ctx, media_parse_t cb, void *arg)
 	return ret;
 }
 
+static int media_listpage(media_ctx_t *ctx, int first, int max, media_parse_t cb, void *arg)
+{
+	int mediaid = 0;
+	media_dirlist_t *dir = NULL;
+	if (max <= 0)
+		return 0;
+	_find_page_t pdata = {{-1, cb, arg}, first, max};
+	_find(ctx, 0, &dir, &mediaid, _find_page, &pdata);
+	if (dir != NULL)
+		_free_medialist(dir, 0);
+	return max - pdata.max;
+}
+
 static int media_play(media_ctx_t *ctx, media_parse_t cb, void *arg)
 {
 	if (ctx->mediaid >= 0)
@@ -589,6 +624,7 @@ const media_ops_t *media_dir = &(const media_ops_t)
 	.next = media_next,
 	.play = media_play,
 	.list = media_list,
+	.listpage = media_listpage,
 	.find = media_find,
 	.remove = NULL,
 	.insert = NULL,
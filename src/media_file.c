@@ -206,6 +206,22 @@ static int media_list(media_ctx_t *ctx, media_parse_t cb, void *data)
 {
 	return media_find(ctx, -1, cb, data);
 }
+
+static int media_listpage(media_ctx_t *ctx, int first, int max, media_parse_t cb, void *data)
+{
+	int count = 0;
+	media_url_t *media = ctx->media;
+	while (media != NULL && media->id < first)
+		media = media->next;
+	while (media != NULL && count < max)
+	{
+		count++;
+		if (cb != NULL && cb(data, media->id, media->url, media->info, media->mime) < 0)
+			break;
+		media = media->next;
+	}
+	return count;
+}
 #else
 static int media_find(media_ctx_t *ctx, int id, media_parse_t cb, void *data)
 {
@@ -330,6 +346,7 @@ const media_ops_t *media_file = &(const media_ops_t)
 	.next = media_next,
 #ifdef MEDIA_FILE_LIST
 	.list = media_list,
+	.listpage = media_listpage,
 	.remove = media_remove,
 	.insert = media_insert,
 	.append = media_append,
@@ -0,0 +1,286 @@
+/*****************************************************************************
+ * media_import.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+
+#include "player.h"
+#include "media.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define import_dbg(...)
+
+#ifndef MEDIA_IMPORT_BATCH
+#define MEDIA_IMPORT_BATCH 2000
+#endif
+#define MEDIA_IMPORT_MAXWORKERS 8
+#define MEDIA_IMPORT_QUEUE 256
+#define MAX_LEVEL 10
+
+typedef struct import_item_s import_item_t;
+struct import_item_s
+{
+	char *url;
+	char *info;
+	const char *mime;
+};
+
+/**
+ * bounded queue between the stages of the import
+ */
+typedef struct import_queue_s import_queue_t;
+struct import_queue_s
+{
+	import_item_t items[MEDIA_IMPORT_QUEUE];
+	unsigned int head;
+	unsigned int tail;
+	int closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+typedef struct media_import_s media_import_t;
+struct media_import_s
+{
+	media_t *media;
+	import_queue_t paths;
+	import_queue_t results;
+	int count;
+};
+
+static void _queue_init(import_queue_t *queue)
+{
+	queue->head = 0;
+	queue->tail = 0;
+	queue->closed = 0;
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+}
+
+static void _queue_destroy(import_queue_t *queue)
+{
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->mutex);
+}
+
+static void _queue_push(import_queue_t *queue, import_item_t *item)
+{
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->tail - queue->head == MEDIA_IMPORT_QUEUE)
+		pthread_cond_wait(&queue->cond, &queue->mutex);
+	queue->items[queue->tail % MEDIA_IMPORT_QUEUE] = *item;
+	queue->tail++;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * return 0 when the queue is closed and empty
+ */
+static int _queue_pop(import_queue_t *queue, import_item_t *item)
+{
+	int ret = 1;
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->tail == queue->head && !queue->closed)
+		pthread_cond_wait(&queue->cond, &queue->mutex);
+	if (queue->tail == queue->head)
+		ret = 0;
+	else
+	{
+		*item = queue->items[queue->head % MEDIA_IMPORT_QUEUE];
+		queue->head++;
+		pthread_cond_broadcast(&queue->cond);
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	return ret;
+}
+
+static void _queue_close(import_queue_t *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->closed = 1;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * the workers parse the metadata of the files in parallel
+ */
+static void *_import_worker(void *arg)
+{
+	media_import_t *import = (media_import_t *)arg;
+	import_item_t item;
+
+	while (_queue_pop(&import->paths, &item))
+	{
+		item.info = media_fillinfo(item.url, item.mime);
+		_queue_push(&import->results, &item);
+	}
+	return NULL;
+}
+
+/**
+ * only one thread writes into the media, the insertions
+ * are grouped by MEDIA_IMPORT_BATCH into one transaction
+ * on the private context of the writer when the media offers it.
+ */
+static void *_import_writer(void *arg)
+{
+	media_import_t *import = (media_import_t *)arg;
+	const media_ops_t *ops = import->media->ops;
+	media_ctx_t *ctx = NULL;
+	import_item_t item;
+	int batch = 0;
+
+	if (ops->writer != NULL)
+		ctx = ops->writer(import->media->ctx);
+	if (ctx == NULL)
+		ctx = import->media->ctx;
+
+	if (ops->batch != NULL)
+		ops->batch(ctx, 1);
+	while (_queue_pop(&import->results, &item))
+	{
+		if (ops->insert(ctx, item.url, item.info, item.mime) >= 0)
+			import->count++;
+		free(item.url);
+		free(item.info);
+		batch++;
+		if (ops->batch != NULL && batch == MEDIA_IMPORT_BATCH)
+		{
+			ops->batch(ctx, 0);
+			ops->batch(ctx, 1);
+			import_dbg("media: import %d", import->count);
+			batch = 0;
+		}
+	}
+	if (ops->batch != NULL)
+		ops->batch(ctx, 0);
+	if (ctx != import->media->ctx)
+		ops->destroy(ctx);
+	/// the results waiting into the queue may use the covers stored before a commit
+	media_coversync();
+	return NULL;
+}
+
+static void _import_walk(media_import_t *import, const char *path, int level)
+{
+	DIR *dir = opendir(path);
+	if (dir == NULL)
+	{
+		err("media: import %s error %s", path, strerror(errno));
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		char filepath[PATH_MAX];
+		snprintf(filepath, sizeof(filepath), "%s/%s", path, entry->d_name);
+
+		int type = entry->d_type;
+		if (type == DT_LNK || type == DT_UNKNOWN)
+		{
+			struct stat filestat;
+			if (stat(filepath, &filestat) != 0)
+				continue;
+			type = S_ISDIR(filestat.st_mode)? DT_DIR: DT_REG;
+		}
+		if (type == DT_DIR && level < MAX_LEVEL)
+			_import_walk(import, filepath, level + 1);
+		else if (type == DT_REG)
+		{
+			const char *mime = utils_getmime(entry->d_name);
+			if (!strcmp(mime, mime_octetstream))
+				continue;
+			import_item_t item = {0};
+			item.mime = mime;
+			if (asprintf(&item.url, "file://%s", filepath) < 0)
+				continue;
+			_queue_push(&import->paths, &item);
+		}
+	}
+	closedir(dir);
+}
+
+int media_import(media_t *media, const char *path)
+{
+	if (media->ops->insert == NULL)
+		return -1;
+	if (!strncmp(path, "file://", 7))
+		path += 7;
+
+	media_import_t import = {0};
+	import.media = media;
+	_queue_init(&import.paths);
+	_queue_init(&import.results);
+
+	int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > MEDIA_IMPORT_MAXWORKERS)
+		nworkers = MEDIA_IMPORT_MAXWORKERS;
+
+	pthread_t workers[MEDIA_IMPORT_MAXWORKERS];
+	pthread_t writer;
+	int i;
+	for (i = 0; i < nworkers; i++)
+		pthread_create(&workers[i], NULL, _import_worker, &import);
+	pthread_create(&writer, NULL, _import_writer, &import);
+
+	_import_walk(&import, path, 0);
+
+	_queue_close(&import.paths);
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	_queue_close(&import.results);
+	pthread_join(writer, NULL);
+
+	_queue_destroy(&import.paths);
+	_queue_destroy(&import.results);
+	warn("media: %d media imported from %s", import.count, path);
+	return import.count;
+}
@@ -35,6 +35,7 @@
 #include <sys/stat.h>
 
 #include <pwd.h>
+#include <math.h>
 
 #include <sqlite3.h>
 #include <jansson.h>
@@ -42,6 +43,35 @@
 #include "player.h"
 #include "media.h"
 
+/**
+ * the info of the opus resolved by opus_get, by opus id.
+ * The entries are dropped when the database changes, on this
+ * connection or on another one.
+ */
+#ifndef MEDIA_SQLITE_INFOCACHE
+#define MEDIA_SQLITE_INFOCACHE 256
+#endif
+typedef struct media_infoentry_s media_infoentry_t;
+struct media_infoentry_s
+{
+	int opusid;
+	/** the info of the media row */
+	char *info;
+	/** the info completed with the names of the opus */
+	char *resolved;
+};
+
+typedef struct media_infocache_s media_infocache_t;
+struct media_infocache_s
+{
+	pthread_mutex_t mutex;
+	int version;
+	int changes;
+	/** the entries resolved before a change are not stored */
+	unsigned int generation;
+	media_infoentry_t entries[MEDIA_SQLITE_INFOCACHE];
+};
+
 struct media_ctx_s
 {
 	sqlite3 *db;
@@ -53,11 +83,18 @@ struct media_ctx_s
 	int listid;
 	int oldlistid;
 	int fill;
+	int search;
+	/** the context of media_writer shares the playlists of its parent */
+	int writer;
+	media_infocache_t *infocache;
 };
 
 #define OPTION_LOOP 0x0001
 #define OPTION_RANDOM 0x0002
 
+/// the connections wait the end of a transaction of the other one
+#define MEDIA_BUSYTIMEOUT 5000
+
 #define PROTOCOLNAME "file://"
 #define PROTOCOLNAME_LENGTH 7
 
@@ -96,6 +133,10 @@ static int media_count(media_ctx_t *ctx);
 static int media_insert(media_ctx_t *ctx, const char *path, const char *info, const char *mime);
 static int media_find(media_ctx_t *ctx, int id,  media_parse_t cb, void *data);
 static int media_list(media_ctx_t *ctx, media_parse_t cb, void *data);
+static int media_listpage(media_ctx_t *ctx, int first, int max, media_parse_t cb, void *data);
+#ifdef MEDIA_SQLITE_SEARCH
+static int media_search(media_ctx_t *ctx, const char *keyword, int first, int max, media_parse_t cb, void *data);
+#endif
 static int media_play(media_ctx_t *ctx, media_parse_t cb, void *data);
 static int media_next(media_ctx_t *ctx);
 static int media_end(media_ctx_t *ctx);
@@ -473,192 +514,260 @@ char *opus_getcover(media_ctx_t *ctx, int coverid)
 	return cover;
 }
 
-static json_t *opus_getjson(media_ctx_t *ctx, int opusid, int coverid)
+/**
+ * the store of the covers keeps the covers referenced by an opus or an album
+ */
+static int _media_coverused(void *arg, const char *path)
 {
-
+	media_ctx_t *ctx = (media_ctx_t *)arg;
 	sqlite3 *db = ctx->db;
-	const char sql[] = "SELECT titleid, artistid, albumid, genreid, coverid FROM opus WHERE id=@ID";
-	sqlite3_stmt *st_select;
 	int ret;
+	int used = 1;
+
+	const char *sql = "SELECT cover.id FROM cover "
+		"WHERE cover.name=@NAME "
+		"AND (EXISTS (SELECT 1 FROM opus WHERE opus.coverid=cover.id) "
+		"OR EXISTS (SELECT 1 FROM album WHERE album.coverid=cover.id))";
+	sqlite3_stmt *st_select;
 	ret = sqlite3_prepare_v2(db, sql, -1, &st_select, NULL);
-	SQLITE3_CHECK(db, ret, NULL, sql);
+	if (ret != SQLITE_OK)
+		return used;
 
-	int index;
-	json_t *json_info = json_object();
+	int index = sqlite3_bind_parameter_index(st_select, "@NAME");
+	ret = sqlite3_bind_text(st_select, index, path, -1, SQLITE_STATIC);
+	if (ret == SQLITE_OK)
+	{
+		ret = sqlite3_step(st_select);
+		if (ret == SQLITE_DONE)
+			used = 0;
+	}
+	sqlite3_finalize(st_select);
+	return used;
+}
 
-	index = sqlite3_bind_parameter_index(st_select, "@ID");
-	ret = sqlite3_bind_int(st_select, index, opusid);
-	SQLITE3_CHECK(db, ret, NULL, sql);
+static media_infocache_t *_media_infocacheinit(void)
+{
+	media_infocache_t *cache = calloc(1, sizeof(*cache));
+	pthread_mutex_init(&cache->mutex, NULL);
+	cache->version = -1;
+	return cache;
+}
 
-	media_dbgsql(st_select, __LINE__);
-	ret = sqlite3_step(st_select);
-	if (ret == SQLITE_ROW)
+static void _media_infocacheflush(media_infocache_t *cache)
+{
+	for (int i = 0; i < MEDIA_SQLITE_INFOCACHE; i++)
 	{
-		int type;
-		int wordid = -1;
-		type = sqlite3_column_type(st_select, 0);
-		if (type == SQLITE_INTEGER)
-		{
-			wordid = sqlite3_column_int(st_select, 0);
-			const char sql[] = "SELECT name FROM word WHERE id=@ID";
-			sqlite3_stmt *st_select;
-			ret = sqlite3_prepare_v2(db, sql, -1, &st_select, NULL);
-			SQLITE3_CHECK(db, ret, NULL, sql);
+		free(cache->entries[i].info);
+		free(cache->entries[i].resolved);
+		cache->entries[i].info = NULL;
+		cache->entries[i].resolved = NULL;
+	}
+	cache->generation++;
+}
 
-			int index;
+static void _media_infocachedestroy(media_infocache_t *cache)
+{
+	if (cache == NULL)
+		return;
+	_media_infocacheflush(cache);
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache);
+}
+
+/**
+ * data_version changes on the commits of the other connections,
+ * total_changes on the writes of this one.
+ * It returns the generation of the entries to store.
+ */
+static unsigned int _media_infocachecheck(media_ctx_t *ctx)
+{
+	media_infocache_t *cache = ctx->infocache;
+	int version = -1;
+	sqlite3_stmt *statement;
+	if (sqlite3_prepare_v2(ctx->db, "PRAGMA data_version;", -1, &statement, NULL) == SQLITE_OK)
+	{
+		if (sqlite3_step(statement) == SQLITE_ROW)
+			version = sqlite3_column_int(statement, 0);
+		sqlite3_finalize(statement);
+	}
+	int changes = sqlite3_total_changes(ctx->db);
 
-			index = sqlite3_bind_parameter_index(st_select, "@ID");
-			ret = sqlite3_bind_int(st_select, index, wordid);
-			SQLITE3_CHECK(db, ret, NULL, sql);
+	pthread_mutex_lock(&cache->mutex);
+	if (version == -1 || version != cache->version || changes != cache->changes)
+	{
+		_media_infocacheflush(cache);
+		cache->version = version;
+		cache->changes = changes;
+	}
+	unsigned int generation = cache->generation;
+	pthread_mutex_unlock(&cache->mutex);
+	return generation;
+}
 
-			media_dbgsql(st_select, __LINE__);
-			ret = sqlite3_step(st_select);
-			if (ret == SQLITE_ROW)
-			{
-				int type;
-				type = sqlite3_column_type(st_select, 0);
-				if (type == SQLITE_TEXT)
-				{
-					const char *string = sqlite3_column_text(st_select, 0);
-					json_t *jstring = json_string(string);
-					json_object_set_new(json_info, str_title, jstring);
-				}
-			}
-			sqlite3_finalize(st_select);
-		}
-		type = sqlite3_column_type(st_select, 1);
-		if (type == SQLITE_INTEGER)
-		{
-			wordid = sqlite3_column_int(st_select, 1);
-			const char sql[] = "SELECT name FROM word INNER JOIN artist ON word.id=artist.wordid WHERE artist.id=@ID";
-			sqlite3_stmt *st_select;
-			ret = sqlite3_prepare_v2(db, sql, -1, &st_select, NULL);
-			SQLITE3_CHECK(db, ret, NULL, sql);
+static int _media_infocmp(const char *info1, const char *info2)
+{
+	if (info1 == NULL || info2 == NULL)
+		return (info1 != info2);
+	return strcmp(info1, info2);
+}
 
-			int index;
+/**
+ * The metadata of the opus are resolved by the query of the list
+ * (see MEDIA_SELECT), the columns from index contain the names of
+ * the title, the artist, the album, the genre and the cover.
+ * The result is cached, the caller frees its copy.
+ */
+static char *opus_get(media_ctx_t *ctx, unsigned int generation, int opusid,
+		sqlite3_stmt *statement, int index, const char *info)
+{
+	media_infocache_t *cache = ctx->infocache;
+	media_infoentry_t *entry = &cache->entries[(unsigned int)opusid % MEDIA_SQLITE_INFOCACHE];
+	char *newinfo = NULL;
 
-			index = sqlite3_bind_parameter_index(st_select, "@ID");
-			ret = sqlite3_bind_int(st_select, index, wordid);
-			SQLITE3_CHECK(db, ret, NULL, sql);
+	pthread_mutex_lock(&cache->mutex);
+	if (entry->resolved != NULL && entry->opusid == opusid &&
+		!_media_infocmp(entry->info, info))
+		newinfo = strdup(entry->resolved);
+	pthread_mutex_unlock(&cache->mutex);
+	if (newinfo != NULL)
+		return newinfo;
 
-			media_dbgsql(st_select, __LINE__);
-			ret = sqlite3_step(st_select);
-			if (ret == SQLITE_ROW)
-			{
-				int type;
-				type = sqlite3_column_type(st_select, 0);
-				if (type == SQLITE_TEXT)
-				{
-					const char *string = sqlite3_column_text(st_select, 0);
-					json_t *jstring = json_string(string);
-					json_object_set_new(json_info, str_artist, jstring);
-				}
-			}
-			sqlite3_finalize(st_select);
-		}
-		type = sqlite3_column_type(st_select, 2);
-		if (type == SQLITE_INTEGER)
+	const char *fields[] = {str_title, str_artist, str_album, str_genre, str_cover};
+	json_t *jnewinfo = json_object();
+	int i;
+	for (i = 0; i < sizeof(fields) / sizeof(*fields); i++, index++)
+	{
+		if (sqlite3_column_type(statement, index) == SQLITE_TEXT)
 		{
-			wordid = sqlite3_column_int(st_select, 2);
-			//char *sql = "select name from word inner join album on word.id=album.wordid where album.id=@ID";
-			const char sql[] = "SELECT word.name, album.coverid FROM word INNER JOIN album ON word.id=album.wordid WHERE album.id=@ID";
-			sqlite3_stmt *st_select;
-			ret = sqlite3_prepare_v2(db, sql, -1, &st_select, NULL);
-			SQLITE3_CHECK(db, ret, NULL, sql);
+			const char *string = sqlite3_column_text(statement, index);
+			json_object_set_new(jnewinfo, fields[i], json_string(string));
+		}
+	}
+	if (info != NULL)
+	{
+		json_error_t error;
+		json_t *jinfo = json_loads(info, 0, &error);
+		json_object_update_missing(jnewinfo, jinfo);
+		json_decref(jinfo);
+	}
+	newinfo = json_dumps(jnewinfo, JSON_INDENT(2));
+	json_decref(jnewinfo);
+	if (newinfo == NULL)
+		return NULL;
 
-			int index;
+	pthread_mutex_lock(&cache->mutex);
+	if (generation == cache->generation)
+	{
+		free(entry->info);
+		free(entry->resolved);
+		entry->opusid = opusid;
+		entry->info = (info != NULL)? strdup(info): NULL;
+		entry->resolved = strdup(newinfo);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	return newinfo;
+}
 
-			index = sqlite3_bind_parameter_index(st_select, "@ID");
-			ret = sqlite3_bind_int(st_select, index, wordid);
-			SQLITE3_CHECK(db, ret, NULL, sql);
+#ifdef MEDIA_SQLITE_SEARCH
+/**
+ * The full text index contains the names of the opus.
+ * The rowid of the index is the id of the opus.
+ */
+#define SEARCH_SELECT "SELECT opus.id, title.name, artistword.name, albumword.name, " \
+			"genreword.name, opus.comment " \
+		"FROM opus " \
+		"LEFT JOIN word AS title ON title.id=opus.titleid " \
+		"LEFT JOIN artist ON artist.id=opus.artistid " \
+		"LEFT JOIN word AS artistword ON artistword.id=artist.wordid " \
+		"LEFT JOIN album ON album.id=opus.albumid " \
+		"LEFT JOIN word AS albumword ON albumword.id=album.wordid " \
+		"LEFT JOIN genre ON genre.id=opus.genreid " \
+		"LEFT JOIN word AS genreword ON genreword.id=genre.wordid "
+
+static const char *searchquery[] = {
+"CREATE VIRTUAL TABLE IF NOT EXISTS search USING fts5(title, artist, album, genre, comment, " \
+	"tokenize=\"unicode61 remove_diacritics 2\", prefix=\"2 3\");",
+"INSERT INTO search (rowid, title, artist, album, genre, comment) " SEARCH_SELECT \
+	"WHERE opus.id NOT IN (SELECT rowid FROM search);",
+				NULL,
+			};
 
-			media_dbgsql(st_select, __LINE__);
-			ret = sqlite3_step(st_select);
-			if (ret == SQLITE_ROW)
-			{
-				int type;
-				type = sqlite3_column_type(st_select, 0);
-				if (type == SQLITE_TEXT)
-				{
-					const char *string = sqlite3_column_text(st_select, 0);
-					json_t *jstring = json_string(string);
-					json_object_set_new(json_info, str_album, jstring);
-				}
-				type = sqlite3_column_type(st_select, 1);
-				if (type == SQLITE_INTEGER)
-				{
-					coverid = sqlite3_column_int(st_select, 1);
-				}
-			}
-			sqlite3_finalize(st_select);
-		}
-		type = sqlite3_column_type(st_select, 3);
-		if (type == SQLITE_INTEGER)
-		{
-			wordid = sqlite3_column_int(st_select, 3);
-			const char sql[] = "SELECT name FROM word INNER JOIN genre ON word.id=genre.wordid WHERE genre.id=@ID";
-			sqlite3_stmt *st_select;
-			ret = sqlite3_prepare_v2(db, sql, -1, &st_select, NULL);
-			SQLITE3_CHECK(db, ret, NULL, sql);
+static int _search_execute(media_ctx_t *ctx, const char *sql, int opusid)
+{
+	int ret;
+	sqlite3 *db = ctx->db;
+	sqlite3_stmt *statement;
 
-			int index;
+	ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+	SQLITE3_CHECK(db, ret, -1, sql);
 
-			index = sqlite3_bind_parameter_index(st_select, "@ID");
-			ret = sqlite3_bind_int(st_select, index, wordid);
-			SQLITE3_CHECK(db, ret, NULL, sql);
+	int index = sqlite3_bind_parameter_index(statement, "@ID");
+	ret = sqlite3_bind_int(statement, index, opusid);
+	SQLITE3_CHECK(db, ret, -1, sql);
 
-			media_dbgsql(st_select, __LINE__);
-			ret = sqlite3_step(st_select);
-			if (ret == SQLITE_ROW)
-			{
-				int type;
-				type = sqlite3_column_type(st_select, 0);
-				if (type == SQLITE_TEXT)
-				{
-					const char *string = sqlite3_column_text(st_select, 0);
-					json_t *jstring = json_string(string);
-					json_object_set_new(json_info, str_genre, jstring);
-				}
-			}
-			sqlite3_finalize(st_select);
-		}
-		if (coverid == -1)
-		{
-			type = sqlite3_column_type(st_select, 4);
-			if (type == SQLITE_INTEGER)
-			{
-				coverid = sqlite3_column_int(st_select, 4);
-			}
-		}
-		if(coverid != -1)
-		{
-			char *cover = opus_getcover(ctx, coverid);
-			if (cover != NULL)
-			{
-				json_t *jstring = json_string(cover);
-				json_object_set_new(json_info, str_cover, jstring);
-				free(cover);
-			}
-		}
+	media_dbgsql(statement, __LINE__);
+	ret = sqlite3_step(statement);
+	sqlite3_finalize(statement);
+	if (ret != SQLITE_DONE)
+	{
+		err("media sqlite: search index error %d on %d\n\t%s", ret, opusid, sqlite3_errmsg(db));
+		return -1;
 	}
-	sqlite3_finalize(st_select);
+	return 0;
+}
 
-	return json_info;
+static int _search_remove(media_ctx_t *ctx, int opusid)
+{
+	if (!ctx->search)
+		return 0;
+	return _search_execute(ctx, "DELETE FROM search WHERE rowid=@ID;", opusid);
 }
 
+static int _search_update(media_ctx_t *ctx, int opusid)
+{
+	if (!ctx->search)
+		return 0;
+	_search_remove(ctx, opusid);
+	return _search_execute(ctx, "INSERT INTO search (rowid, title, artist, album, genre, comment) " \
+			SEARCH_SELECT "WHERE opus.id=@ID;", opusid);
+}
 
-static char *opus_get(media_ctx_t *ctx, int opusid, int coverid, const char *info)
+/**
+ * each word of the keyword becomes a prefix query,
+ * the words are quoted to escape the syntax of fts5.
+ */
+static int _search_match(const char *keyword, char *match, size_t length)
 {
-	char *newinfo = NULL;
-	json_t *jnewinfo = opus_getjson(ctx, opusid, coverid);
-	json_error_t error;
-	json_t *jinfo = json_loads(info, 0, &error);
-	json_object_update_missing(jnewinfo, jinfo);
-	newinfo = json_dumps(jnewinfo, JSON_INDENT(2));
-	json_decref(jinfo);
-	json_decref(jnewinfo);
-	return newinfo;
+	size_t len = 0;
+	while (*keyword != '\0')
+	{
+		while (*keyword == ' ' || *keyword == '\t')
+			keyword++;
+		if (*keyword == '\0')
+			break;
+		if (len + 4 > length)
+			return -1;
+		if (len > 0)
+			match[len++] = ' ';
+		match[len++] = '"';
+		while (*keyword != '\0' && *keyword != ' ' && *keyword != '\t')
+		{
+			if (len + 4 > length)
+				return -1;
+			if (*keyword == '"')
+				match[len++] = '"';
+			match[len++] = *keyword++;
+		}
+		match[len++] = '"';
+		match[len++] = '*';
+	}
+	match[len] = '\0';
+	return len;
 }
+#else
+#define _search_remove(...)
+#define _search_update(...)
+#endif
 
 static int opus_updatefield(media_ctx_t *ctx, int opusid, const char *field, int fieldid)
 {
@@ -782,6 +891,8 @@ static int opus_insert(media_ctx_t *ctx, json_t *jinfo, int *palbumid,
 		}
 	}
 	sqlite3_finalize(st_select);
+	if (opusid != -1)
+		_search_update(ctx, opusid);
 	return opusid;
 }
 static int _media_updateopusid(media_ctx_t *ctx, int id, int opusid)
@@ -867,6 +978,196 @@ static int _media_updateinfo(media_ctx_t *ctx, int id, const char *info, int lik
 	return (ret != SQLITE_DONE);
 }
 
+/**
+ * the reference level of ReplayGain 2.0, the gain keeps
+ * the true peak 1dB under the full scale.
+ */
+#define MEDIA_LOUDNESS_TARGET -18.0
+#define MEDIA_LOUDNESS_CEILING -1.0
+
+static int _media_gain(double loudness, double truepeak)
+{
+	double gain = MEDIA_LOUDNESS_TARGET - loudness;
+	if (truepeak + gain > MEDIA_LOUDNESS_CEILING)
+		gain = MEDIA_LOUDNESS_CEILING - truepeak;
+	/// the gain is rounded down to never clip
+	return floor(gain);
+}
+
+static double _media_infodouble(json_t *jinfo, const char *key, double value)
+{
+	json_t *jvalue = json_object_get(jinfo, key);
+	if (json_is_number(jvalue))
+		value = json_number_value(jvalue);
+	return value;
+}
+
+/**
+ * the loudness of the album is the mean of the energies of its
+ * analyzed tracks weighted by their durations.
+ */
+static int _media_albumgain(media_ctx_t *ctx, int albumid)
+{
+	sqlite3 *db = ctx->db;
+	const char sql[] = "SELECT id, info FROM media WHERE albumid=@ID";
+	sqlite3_stmt *statement;
+	int ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	int index = sqlite3_bind_parameter_index(statement, "@ID");
+	ret = sqlite3_bind_int(statement, index, albumid);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	int *ids = NULL;
+	json_t **jinfos = NULL;
+	int count = 0;
+	double energy = 0;
+	double length = 0;
+	double truepeak = -HUGE_VAL;
+	media_dbgsql(statement, __LINE__);
+	while (sqlite3_step(statement) == SQLITE_ROW)
+	{
+		if (sqlite3_column_type(statement, 1) != SQLITE_TEXT)
+			continue;
+		json_error_t error;
+		json_t *jinfo = json_loads((const char *)sqlite3_column_text(statement, 1), 0, &error);
+		if (!json_is_object(jinfo) || json_object_get(jinfo, str_loudness) == NULL)
+		{
+			json_decref(jinfo);
+			continue;
+		}
+		double duration = _media_infodouble(jinfo, str_duration, 1);
+		energy += duration * pow(10, _media_infodouble(jinfo, str_loudness, 0) / 10);
+		length += duration;
+		double peak = _media_infodouble(jinfo, str_truepeak, 0);
+		if (peak > truepeak)
+			truepeak = peak;
+		ids = realloc(ids, (count + 1) * sizeof(*ids));
+		jinfos = realloc(jinfos, (count + 1) * sizeof(*jinfos));
+		ids[count] = sqlite3_column_int(statement, 0);
+		jinfos[count] = jinfo;
+		count++;
+	}
+	sqlite3_finalize(statement);
+
+	int albumgain = 0;
+	if (length > 0)
+		albumgain = _media_gain(10 * log10(energy / length), truepeak);
+	for (int i = 0; i < count; i++)
+	{
+		json_object_set_new(jinfos[i], str_albumgain, json_integer(albumgain));
+		char *info = json_dumps(jinfos[i], 0);
+		_media_updateinfo(ctx, ids[i], info, 0);
+		free(info);
+		json_decref(jinfos[i]);
+	}
+	free(ids);
+	free(jinfos);
+	return count;
+}
+
+static int media_loudness(media_ctx_t *ctx, int id, double loudness, double truepeak, unsigned int duration)
+{
+	/// the silence doesn't have loudness
+	if (!isfinite(loudness) || !isfinite(truepeak))
+		return -1;
+
+	sqlite3 *db = ctx->db;
+	const char sql[] = "SELECT id, info, albumid FROM media WHERE opusid=@ID";
+	sqlite3_stmt *statement;
+	int ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	int index = sqlite3_bind_parameter_index(statement, "@ID");
+	ret = sqlite3_bind_int(statement, index, id);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	media_dbgsql(statement, __LINE__);
+	ret = sqlite3_step(statement);
+	if (ret != SQLITE_ROW)
+	{
+		sqlite3_finalize(statement);
+		return -1;
+	}
+	int mediaid = sqlite3_column_int(statement, 0);
+	json_t *jinfo = NULL;
+	if (sqlite3_column_type(statement, 1) == SQLITE_TEXT)
+	{
+		json_error_t error;
+		jinfo = json_loads((const char *)sqlite3_column_text(statement, 1), 0, &error);
+	}
+	if (!json_is_object(jinfo))
+	{
+		json_decref(jinfo);
+		jinfo = json_object();
+	}
+	int albumid = sqlite3_column_int(statement, 2);
+	sqlite3_finalize(statement);
+
+	json_object_set_new(jinfo, str_loudness, json_real(round(loudness * 10) / 10));
+	json_object_set_new(jinfo, str_truepeak, json_real(round(truepeak * 10) / 10));
+	json_object_set_new(jinfo, str_regain, json_integer(_media_gain(loudness, truepeak)));
+	if (json_object_get(jinfo, str_duration) == NULL)
+		json_object_set_new(jinfo, str_duration, json_integer(duration));
+	char *info = json_dumps(jinfo, 0);
+	ret = _media_updateinfo(ctx, mediaid, info, 0);
+	free(info);
+	json_decref(jinfo);
+
+	/// the default album groups the tracks without album
+	if (ret == 0 && albumid > 1)
+		_media_albumgain(ctx, albumid);
+	return ret;
+}
+
+static int media_batch(media_ctx_t *ctx, int enable)
+{
+	char *error = NULL;
+	const char *sql = enable? "BEGIN TRANSACTION;": "COMMIT;";
+	if (sqlite3_exec(ctx->db, sql, NULL, NULL, &error) != SQLITE_OK)
+	{
+		err("media: %s error %s", sql, error);
+		sqlite3_free(error);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * the import writes on its own connection, the statements of the player
+ * and of the commands are not into its transaction.
+ */
+static media_ctx_t *media_writer(media_ctx_t *ctx)
+{
+	if (sqlite3_db_readonly(ctx->db, "main"))
+		return NULL;
+	media_ctx_t *writer = calloc(1, sizeof(*writer));
+	*writer = *ctx;
+	writer->writer = 1;
+	writer->query = NULL;
+	writer->db = NULL;
+	writer->infocache = NULL;
+	writer->path = strdup(ctx->path);
+	int ret = sqlite3_open_v2(writer->path, &writer->db, SQLITE_OPEN_READWRITE, NULL);
+	if (ret != SQLITE_OK)
+	{
+		err("media: writer open error %s", sqlite3_errstr(ret));
+		sqlite3_close_v2(writer->db);
+		free(writer->path);
+		free(writer);
+		return NULL;
+	}
+	sqlite3_busy_timeout(writer->db, MEDIA_BUSYTIMEOUT);
+	char *error = NULL;
+	if (sqlite3_exec(writer->db, "PRAGMA synchronous=NORMAL;", NULL, NULL, &error))
+	{
+		warn("sqlite pragma error: %s", error);
+		sqlite3_free(error);
+	}
+	writer->infocache = _media_infocacheinit();
+	return writer;
+}
+
 static int media_insert(media_ctx_t *ctx, const char *path, const char *info, const char *mime)
 {
 	int id;
@@ -1050,6 +1351,7 @@ static int media_modify(media_ctx_t *ctx, int opusid, const char *info)
 
 			}
 			sqlite3_finalize(statememt);
+			_search_update(ctx, opusid);
 			ret = 0;
 		}
 		if (ret == 0)
@@ -1106,9 +1408,30 @@ static const char *_media_getmime(media_ctx_t *ctx, int mimeid)
 	}
 }
 
+/**
+ * one query resolves all the metadata of the media,
+ * the cover comes from the album of the opus, then from the album
+ * of the media, then from the opus.
+ */
+#define MEDIA_SELECT "SELECT media.url, mimes.name, media.opusid, media.info, " \
+			"title.name, artistword.name, albumword.name, genreword.name, cover.name " \
+		"FROM media " \
+		"INNER JOIN album AS mediaalbum ON mediaalbum.id=media.albumid " \
+		"INNER JOIN mimes ON media.mimeid=mimes.id " \
+		"LEFT JOIN opus ON opus.id=media.opusid " \
+		"LEFT JOIN word AS title ON title.id=opus.titleid " \
+		"LEFT JOIN artist ON artist.id=opus.artistid " \
+		"LEFT JOIN word AS artistword ON artistword.id=artist.wordid " \
+		"LEFT JOIN album ON album.id=opus.albumid " \
+		"LEFT JOIN word AS albumword ON albumword.id=album.wordid " \
+		"LEFT JOIN genre ON genre.id=opus.genreid " \
+		"LEFT JOIN word AS genreword ON genreword.id=genre.wordid " \
+		"LEFT JOIN cover ON cover.id=COALESCE(album.coverid, mediaalbum.coverid, opus.coverid) "
+
 static int _media_execute(media_ctx_t *ctx, sqlite3_stmt *statement, media_parse_t cb, void *data)
 {
 	int count = 0;
+	unsigned int generation = _media_infocachecheck(ctx);
 	int ret = sqlite3_step(statement);
 
 	while (ret == SQLITE_ROW)
@@ -1146,23 +1469,16 @@ static int _media_execute(media_ctx_t *ctx, sqlite3_stmt *statement, media_parse
 		if (type == SQLITE_INTEGER)
 			id = sqlite3_column_int(statement, index);
 
-		/**
-		 * retreive cover if requested
-		 */
-		int coverid = -1;
-		index++;
-		type = sqlite3_column_type(statement, index);
-		if (type == SQLITE_INTEGER)
-			coverid = sqlite3_column_int(statement, index);
-
 		index++;
 		type = sqlite3_column_type(statement, index);
 		if (type == SQLITE_TEXT)
 			info = sqlite3_column_blob(statement, index);
 		if (id != -1)
 		{
-			info = opus_get(ctx, id, coverid, info);
+			info = opus_get(ctx, generation, id, statement, index + 1, info);
 		}
+		else
+			info = NULL;
 
 		media_dbg("media: %d %s", id, url);
 		if (cb != NULL && id > -1)
@@ -1192,9 +1508,8 @@ static int media_find(media_ctx_t *ctx, int id, media_parse_t cb, void *data)
 		return 0;
 
 	int count;
-	const char sql[] = "SELECT url, mimes.name, opusid, album.coverid, \"info\" FROM media " \
-			"INNER JOIN album ON album.id=media.albumid, mimes ON media.mimeid=mimes.id " \
-			"WHERE opusid=@ID";
+	const char sql[] = MEDIA_SELECT \
+			"WHERE media.opusid=@ID";
 	ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
 	SQLITE3_CHECK(db, ret, -1, sql);
 
@@ -1216,9 +1531,8 @@ static int media_list(media_ctx_t *ctx, media_parse_t cb, void *data)
 	sqlite3_stmt *statement;
 	int index;
 
-	const char sql[] = "SELECT url, mimes.name, opusid, album.coverid, info FROM media " \
-			"INNER JOIN playlist ON media.id=playlist.id, album ON album.id=media.albumid, " \
-			"mimes ON media.mimeid=mimes.id " \
+	const char sql[] = MEDIA_SELECT \
+			"INNER JOIN playlist ON media.id=playlist.id " \
 			"WHERE playlist.listid=@LISTID;";
 	ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
 	SQLITE3_CHECK(db, ret, -1, sql);
@@ -1234,6 +1548,42 @@ static int media_list(media_ctx_t *ctx, media_parse_t cb, void *data)
 	return count;
 }
 
+static int media_listpage(media_ctx_t *ctx, int first, int max, media_parse_t cb, void *data)
+{
+	int ret = 0;
+	sqlite3 *db = ctx->db;
+	int count = 0;
+	sqlite3_stmt *statement;
+	int index;
+
+	/**
+	 * the indexes on media.opusid and playlist(listid, id)
+	 * allow to read only the rows of the page.
+	 */
+	const char sql[] = MEDIA_SELECT \
+			"INNER JOIN playlist ON media.id=playlist.id " \
+			"WHERE playlist.listid=@LISTID AND media.opusid>=@FIRST " \
+			"ORDER BY media.opusid LIMIT @MAX;";
+	ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	index = sqlite3_bind_parameter_index(statement, "@LISTID");
+	ret = sqlite3_bind_int(statement, index, ctx->listid);
+	SQLITE3_CHECK(db, ret, -1, sql);
+	index = sqlite3_bind_parameter_index(statement, "@FIRST");
+	ret = sqlite3_bind_int(statement, index, first);
+	SQLITE3_CHECK(db, ret, -1, sql);
+	index = sqlite3_bind_parameter_index(statement, "@MAX");
+	ret = sqlite3_bind_int(statement, index, max);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	media_dbgsql(statement, __LINE__);
+	count = _media_execute(ctx, statement, cb, data);
+	sqlite3_finalize(statement);
+
+	return count;
+}
+
 static int media_play(media_ctx_t *ctx, media_parse_t cb, void *data)
 {
 	media_find(ctx, ctx->mediaid, cb, data);
@@ -1335,7 +1685,10 @@ static int _media_remove(media_ctx_t *ctx, int id)
 	if (ret != SQLITE_DONE)
 		ret = -1;
 	else
+	{
 		playlist_remove(ctx, ctx->listid, id);
+		_search_remove(ctx, id);
+	}
 	sqlite3_finalize(statement);
 
 	return ret;
@@ -1739,6 +2092,81 @@ static int _media_filter(media_ctx_t *ctx, int table, const char *word)
 	return count;
 }
 
+#ifdef MEDIA_SQLITE_SEARCH
+static int _media_searchfilter(media_ctx_t *ctx, const char *keyword)
+{
+	int ret = 0;
+	sqlite3 *db = ctx->db;
+	sqlite3_stmt *statement;
+	int count = 0;
+	char match[256];
+
+	if (_search_match(keyword, match, sizeof(match)) <= 0)
+		return 0;
+
+	const char sql[] = "SELECT opusid, likes FROM media " \
+			"WHERE opusid IN (SELECT rowid FROM search WHERE search MATCH @MATCH);";
+	ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	int index = sqlite3_bind_parameter_index(statement, "@MATCH");
+	ret = sqlite3_bind_text(statement, index, match, -1, SQLITE_STATIC);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	media_dbgsql(statement, __LINE__);
+	ret = sqlite3_step(statement);
+	while (ret == SQLITE_ROW)
+	{
+		int id = sqlite3_column_int(statement, 0);
+		int likes = sqlite3_column_int(statement, 1);
+		_media_setlist(ctx, id, likes);
+		count++;
+		ret = sqlite3_step(statement);
+	}
+	sqlite3_finalize(statement);
+	return count;
+}
+
+/**
+ * the result is read directly from the index, ordered by rank,
+ * without building a playlist.
+ */
+static int media_search(media_ctx_t *ctx, const char *keyword, int first, int max, media_parse_t cb, void *data)
+{
+	int ret = 0;
+	sqlite3 *db = ctx->db;
+	sqlite3_stmt *statement;
+	int count = 0;
+	int index;
+	char match[256];
+
+	if (!ctx->search || _search_match(keyword, match, sizeof(match)) <= 0)
+		return 0;
+
+	const char sql[] = MEDIA_SELECT \
+			"INNER JOIN search ON search.rowid=media.opusid " \
+			"WHERE search MATCH @MATCH " \
+			"ORDER BY search.rank LIMIT @MAX OFFSET @FIRST;";
+	ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	index = sqlite3_bind_parameter_index(statement, "@MATCH");
+	ret = sqlite3_bind_text(statement, index, match, -1, SQLITE_STATIC);
+	SQLITE3_CHECK(db, ret, -1, sql);
+	index = sqlite3_bind_parameter_index(statement, "@MAX");
+	ret = sqlite3_bind_int(statement, index, max);
+	SQLITE3_CHECK(db, ret, -1, sql);
+	index = sqlite3_bind_parameter_index(statement, "@FIRST");
+	ret = sqlite3_bind_int(statement, index, first);
+	SQLITE3_CHECK(db, ret, -1, sql);
+
+	media_dbgsql(statement, __LINE__);
+	count = _media_execute(ctx, statement, cb, data);
+	sqlite3_finalize(statement);
+	return count;
+}
+#endif
+
 static int media_filter(media_ctx_t *ctx, media_filter_t *filter)
 {
 	int listid = playlist_create(ctx, "filter", 0);
@@ -1778,6 +2206,13 @@ static int media_filter(media_ctx_t *ctx, media_filter_t *filter)
 	{
 		count += _media_filter(ctx, TABLE_GENRE, filter->genre);
 	}
+#ifdef MEDIA_SQLITE_SEARCH
+	if (filter->keyword != NULL && ctx->search)
+	{
+		count += _media_searchfilter(ctx, filter->keyword);
+	}
+	else
+#endif
 	if (filter->keyword != NULL)
 	{
 		count += _media_filter(ctx, TABLE_ALBUM, filter->keyword);
@@ -1954,6 +2389,17 @@ static const char *playlistquery[] = {
 				NULL,
 			};
 
+/**
+ * the indexes are created on the old databases too
+ */
+static const char *indexquery[] = {
+"CREATE INDEX IF NOT EXISTS media_opusid ON media(opusid);",
+"CREATE INDEX IF NOT EXISTS playlist_listid ON playlist(listid, id);",
+"CREATE INDEX IF NOT EXISTS opus_coverid ON opus(coverid);",
+"CREATE INDEX IF NOT EXISTS album_coverid ON album(coverid);",
+				NULL,
+			};
+
 static int _media_initdb(sqlite3 *db, const char *query[])
 {
 	char *error = NULL;
@@ -1987,6 +2433,7 @@ static media_ctx_t *media_init(player_ctx_t *player, const char *url, ...)
 	ret = _media_opendb(ctx, url);
 	if (ret != -1 && ctx->db)
 	{
+		ctx->infocache = _media_infocacheinit();
 		char *error = NULL;
 		if (sqlite3_exec(ctx->db, "PRAGMA encoding=\"UTF-8\";", NULL, NULL, &error))
 			warn("sqlite pragma error: %s", error);
@@ -2028,6 +2475,34 @@ static media_ctx_t *media_init(player_ctx_t *player, const char *url, ...)
 				ctx->listid = _media_changelist(ctx, tempo);
 			}
 		}
+		if (ret == SQLITE_OK && !sqlite3_db_readonly(ctx->db, "main"))
+		{
+			/**
+			 * the readers are not blocked during the insertions
+			 */
+			if (sqlite3_exec(ctx->db, "PRAGMA journal_mode=WAL;PRAGMA synchronous=NORMAL;", NULL, NULL, &error))
+				warn("sqlite pragma error: %s", error);
+			sqlite3_busy_timeout(ctx->db, MEDIA_BUSYTIMEOUT);
+			_media_initdb(ctx->db, indexquery);
+#ifdef MEDIA_SQLITE_SEARCH
+			_media_initdb(ctx->db, searchquery);
+#endif
+			media_coverused(_media_coverused, ctx);
+		}
+#ifdef MEDIA_SQLITE_SEARCH
+		if (ret == SQLITE_OK)
+		{
+			sqlite3_stmt *statement;
+			/**
+			 * the index may be unavailable on a read only database
+			 */
+			if (sqlite3_prepare_v2(ctx->db, "SELECT rowid FROM search LIMIT 1;", -1, &statement, NULL) == SQLITE_OK)
+			{
+				ctx->search = 1;
+				sqlite3_finalize(statement);
+			}
+		}
+#endif
 		if (ret == SQLITE_OK)
 		{
 			warn("media: db %s", url);
@@ -2050,12 +2525,15 @@ static media_ctx_t *media_init(player_ctx_t *player, const char *url, ...)
 
 static void media_destroy(media_ctx_t *ctx)
 {
+	if (!ctx->writer)
+		media_coverused(NULL, NULL);
 	if (ctx->db)
 	{
 		int ret = sqlite3_close_v2(ctx->db);
 		if (ret != SQLITE_OK)
 			err("media: DB close error %s", sqlite3_errstr(ret));
 	}
+	_media_infocachedestroy(ctx->infocache);
 	free(ctx->path);
 	free(ctx);
 }
@@ -2068,11 +2546,18 @@ const media_ops_t *media_sqlite = &(const media_ops_t)
 	.next = media_next,
 	.play = media_play,
 	.list = media_list,
+	.listpage = media_listpage,
+#ifdef MEDIA_SQLITE_SEARCH
+	.search = media_search,
+#endif
 	.find = media_find,
 	.filter = media_filter,
 	.insert = media_insert,
 	.append = media_insert,
+	.batch = media_batch,
+	.writer = media_writer,
 	.modify = media_modify,
+	.loudness = media_loudness,
 	.remove = media_remove,
 	.count = media_count,
 	.end = media_end,
@@ -0,0 +1,107 @@
+/*****************************************************************************
+ * meter.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "meter.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+/**
+ * The page is static until meter_init maps it into a file.
+ * Several filters may publish together (the streams of the mixer),
+ * each one reserves its frame number before to write the slot.
+ */
+static meter_t _meter = {
+	.magic = METER_MAGIC,
+	.version = METER_VERSION,
+	.nframes = METER_NFRAMES,
+	.nbands = METER_NBANDS,
+};
+static meter_t *g_meter = &_meter;
+static uint64_t g_next = 0;
+
+int meter_init(const char *path)
+{
+	if (path == NULL)
+		return 0;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		warn("meter: unable to open %s %s", path, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, sizeof(meter_t)) < 0)
+	{
+		warn("meter: unable to size %s %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	meter_t *meter = mmap(NULL, sizeof(meter_t), PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, 0);
+	close(fd);
+	if (meter == MAP_FAILED)
+	{
+		warn("meter: unable to map %s %s", path, strerror(errno));
+		return -1;
+	}
+	memcpy(meter, g_meter, sizeof(*meter));
+	__atomic_store_n(&g_meter, meter, __ATOMIC_RELEASE);
+	dbg("meter: mapped on %s", path);
+	return 0;
+}
+
+void meter_publish(const meter_frame_t *frame)
+{
+	meter_t *meter = __atomic_load_n(&g_meter, __ATOMIC_ACQUIRE);
+	uint64_t index = __atomic_add_fetch(&g_next, 1, __ATOMIC_RELAXED);
+	meter_frame_t *slot = &meter->frames[index % METER_NFRAMES];
+	uint32_t sequence = (uint32_t)(index / METER_NFRAMES + 1) << 1;
+
+	__atomic_store_n(&slot->sequence, sequence - 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((char *)slot + sizeof(slot->sequence), (const char *)frame + sizeof(frame->sequence),
+			sizeof(*slot) - sizeof(slot->sequence));
+	__atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELEASE);
+
+	uint64_t head = __atomic_load_n(&meter->head, __ATOMIC_RELAXED);
+	while (index > head &&
+		!__atomic_compare_exchange_n(&meter->head, &head, index, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,83 @@
+#ifndef __METER_H__
+#define __METER_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define METER_MAGIC 0x70757477
+#define METER_VERSION 1
+
+#define METER_MAXCHANNELS 8
+#define METER_NBANDS 32
+#define METER_NFRAMES 16
+
+/**
+ * The meter page is a file mapped read-only by the displays.
+ * The stats filter publishes a frame at a fixed rate into a ring
+ * of METER_NFRAMES slots. Each slot is protected by its own sequence:
+ * it is odd during the writing, and a copy is valid when it is even
+ * and unchanged after the copy. The head is the number of the last
+ * frame published, the frame n is into the slot n % METER_NFRAMES.
+ *
+ * The levels are in dBFS, the bands of the spectrum are spaced
+ * logarithmically from 20Hz to the half of the samplerate.
+ */
+typedef struct meter_frame_s meter_frame_t;
+struct meter_frame_s
+{
+	uint32_t sequence;
+	uint32_t samplerate;
+	uint32_t nchannels;
+	/** the length of the measure in ms */
+	uint32_t duration;
+	float peak[METER_MAXCHANNELS];
+	float rms[METER_MAXCHANNELS];
+	float bands[METER_NBANDS];
+};
+
+typedef struct meter_s meter_t;
+struct meter_s
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nframes;
+	uint32_t nbands;
+	uint64_t head;
+	meter_frame_t frames[METER_NFRAMES];
+};
+
+/**
+ * copy the frame number index.
+ * @return 0 on success, -1 if the frame is already overwritten.
+ */
+static inline int meter_read(const meter_t *page, uint64_t index, meter_frame_t *copy)
+{
+	const meter_frame_t *frame = &page->frames[index % METER_NFRAMES];
+	uint32_t expected = (uint32_t)(index / METER_NFRAMES + 1) << 1;
+	uint32_t sequence;
+	do
+	{
+		do
+			sequence = __atomic_load_n(&frame->sequence, __ATOMIC_ACQUIRE);
+		while (sequence & 1);
+		if (sequence != expected)
+			return -1;
+		memcpy(copy, frame, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&frame->sequence, __ATOMIC_RELAXED) != sequence);
+	copy->sequence = sequence;
+	return 0;
+}
+
+#ifdef FILTER_STATS
+int meter_init(const char *path);
+/**
+ * publish a new frame, the sequence of the frame is set by the meter.
+ */
+void meter_publish(const meter_frame_t *frame);
+#else
+#define meter_init(...) 0
+#define meter_publish(...)
+#endif
+
+#endif
@@ -0,0 +1,224 @@
+/*****************************************************************************
+ * metrics.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "metrics.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+/**
+ * The block is mapped once, anonymous until metrics_init maps the file
+ * at the same address: the slots already given to the jitters and the
+ * stages stay valid.
+ * The slots are allocated under the lock, the counters are only
+ * updated with atomic operations.
+ */
+static metrics_t _metrics;
+static metrics_t *g_metrics = &_metrics;
+static pthread_once_t metrics_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _metrics_map(void)
+{
+	metrics_t *metrics = mmap(NULL, sizeof(metrics_t), PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	/// the static block is not able to be mapped into a file
+	if (metrics == MAP_FAILED)
+		warn("metrics: unable to map the block %s", strerror(errno));
+	else
+		g_metrics = metrics;
+	g_metrics->magic = METRICS_MAGIC;
+	g_metrics->version = METRICS_VERSION;
+}
+
+static metrics_t *_metrics_block()
+{
+	pthread_once(&metrics_once, _metrics_map);
+	return g_metrics;
+}
+
+int metrics_init(const char *path)
+{
+	metrics_t *block = _metrics_block();
+	block->start = metrics_now();
+	if (path == NULL)
+		return 0;
+	if (block == &_metrics)
+		return -1;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		warn("metrics: unable to open %s %s", path, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, sizeof(metrics_t)) < 0)
+	{
+		warn("metrics: unable to size %s %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	metrics_t *metrics = MAP_FAILED;
+	pthread_mutex_lock(&metrics_lock);
+	/// the counters updated between the copy and the mapping are lost
+	if (pwrite(fd, block, sizeof(*block), 0) == sizeof(*block))
+		metrics = mmap(block, sizeof(metrics_t), PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_FIXED, fd, 0);
+	pthread_mutex_unlock(&metrics_lock);
+	close(fd);
+	if (metrics == MAP_FAILED)
+	{
+		warn("metrics: unable to map %s %s", path, strerror(errno));
+		return -1;
+	}
+	dbg("metrics: mapped on %s", path);
+	return 0;
+}
+
+metrics_t *metrics_get()
+{
+	return _metrics_block();
+}
+
+void metrics_max(uint32_t *field, uint32_t value)
+{
+	uint32_t old = __atomic_load_n(field, __ATOMIC_RELAXED);
+	while (value > old &&
+		!__atomic_compare_exchange_n(field, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void metrics_max64(uint64_t *field, uint64_t value)
+{
+	uint64_t old = __atomic_load_n(field, __ATOMIC_RELAXED);
+	while (value > old &&
+		!__atomic_compare_exchange_n(field, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+metrics_jitter_t *metrics_jitter(int id, const char *name, unsigned int count, size_t size)
+{
+	metrics_t *metrics = _metrics_block();
+	if (id < 0 || id >= METRICS_MAXJITTERS)
+		return NULL;
+	pthread_mutex_lock(&metrics_lock);
+	/**
+	 * the slot follows the id of the jitter and is reset when
+	 * a new jitter takes the id.
+	 */
+	metrics_jitter_t *jitter = &metrics->jitters[id];
+	memset(jitter, 0, sizeof(*jitter));
+	strncpy(jitter->name, name, METRICS_NAMELENGTH - 1);
+	jitter->count = count;
+	jitter->size = size;
+	pthread_mutex_unlock(&metrics_lock);
+	return jitter;
+}
+
+metrics_stage_t *metrics_stage(const char *name)
+{
+	metrics_t *metrics = _metrics_block();
+	metrics_stage_t *stage = NULL;
+	int i;
+
+	pthread_mutex_lock(&metrics_lock);
+	for (i = 0; i < METRICS_MAXSTAGES; i++)
+	{
+		if (metrics->stages[i].name[0] == '\0')
+		{
+			strncpy(metrics->stages[i].name, name, METRICS_NAMELENGTH - 1);
+			stage = &metrics->stages[i];
+			break;
+		}
+		if (!strncmp(metrics->stages[i].name, name, METRICS_NAMELENGTH - 1))
+		{
+			stage = &metrics->stages[i];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&metrics_lock);
+	return stage;
+}
+
+metrics_ssrc_t *metrics_ssrc(uint32_t ssrc)
+{
+	metrics_t *metrics = _metrics_block();
+	metrics_ssrc_t *slot = NULL;
+	int i;
+
+	pthread_mutex_lock(&metrics_lock);
+	for (i = 0; i < METRICS_MAXSSRC; i++)
+	{
+		if (metrics->ssrc[i].used && metrics->ssrc[i].ssrc == ssrc)
+		{
+			slot = &metrics->ssrc[i];
+			break;
+		}
+		if (slot == NULL && !metrics->ssrc[i].used)
+			slot = &metrics->ssrc[i];
+	}
+	if (slot != NULL && !slot->used)
+	{
+		memset(slot, 0, sizeof(*slot));
+		slot->ssrc = ssrc;
+		slot->used = 1;
+	}
+	pthread_mutex_unlock(&metrics_lock);
+	return slot;
+}
+
+void metrics_ssrcrelease(metrics_ssrc_t *ssrc)
+{
+	if (ssrc == NULL)
+		return;
+	METRICS_SET(ssrc->used, 0);
+}
+
+void metrics_heartbeat(uint64_t lateness)
+{
+	metrics_t *metrics = _metrics_block();
+	metrics_heartbeat_t *heartbeat = &metrics->heartbeat;
+	METRICS_INC(heartbeat->nbeats, 1);
+	if (lateness > 0)
+	{
+		METRICS_INC(heartbeat->late, 1);
+		METRICS_INC(heartbeat->lateness, lateness);
+		metrics_max64(&heartbeat->latemax, lateness);
+	}
+}
@@ -0,0 +1,168 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define METRICS_MAGIC 0x70757476
+#define METRICS_VERSION 1
+
+#define METRICS_MAXJITTERS 16
+#define METRICS_MAXSTAGES 16
+#define METRICS_MAXSSRC 8
+#define METRICS_NAMELENGTH 24
+
+/**
+ * The metrics are counters updated without lock by the audio threads.
+ * The block may be mapped into a file to be read by another process.
+ * All times are in nanoseconds.
+ */
+typedef struct metrics_jitter_s metrics_jitter_t;
+struct metrics_jitter_s
+{
+	char name[METRICS_NAMELENGTH];
+	uint32_t count;
+	uint32_t size;
+	/** the number of buffers into the jitter */
+	uint32_t level;
+	uint32_t levelmax;
+	uint64_t npush;
+	uint64_t npop;
+	/** the producer waited a free buffer */
+	uint64_t overflow;
+	uint64_t pullwait;
+	/** the consumer waited a buffer during the running */
+	uint64_t underrun;
+	uint64_t peerwait;
+};
+
+typedef struct metrics_stage_s metrics_stage_t;
+struct metrics_stage_s
+{
+	char name[METRICS_NAMELENGTH];
+	uint64_t nruns;
+	uint64_t time;
+	uint64_t timemax;
+};
+
+typedef struct metrics_heartbeat_s metrics_heartbeat_t;
+struct metrics_heartbeat_s
+{
+	uint64_t nbeats;
+	uint64_t late;
+	uint64_t lateness;
+	uint64_t latemax;
+};
+
+typedef struct metrics_ssrc_s metrics_ssrc_t;
+struct metrics_ssrc_s
+{
+	uint32_t ssrc;
+	uint32_t used;
+	uint64_t received;
+	uint64_t missing;
+};
+
+typedef struct metrics_s metrics_t;
+struct metrics_s
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t start;
+	metrics_jitter_t jitters[METRICS_MAXJITTERS];
+	metrics_stage_t stages[METRICS_MAXSTAGES];
+	metrics_heartbeat_t heartbeat;
+	metrics_ssrc_t ssrc[METRICS_MAXSSRC];
+};
+
+#ifdef METRICS
+#define METRICS_INC(field, value) __atomic_add_fetch(&(field), (value), __ATOMIC_RELAXED)
+#define METRICS_SET(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define METRICS_GET(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+int metrics_init(const char *path);
+metrics_t *metrics_get();
+metrics_jitter_t *metrics_jitter(int id, const char *name, unsigned int count, size_t size);
+metrics_stage_t *metrics_stage(const char *name);
+metrics_ssrc_t *metrics_ssrc(uint32_t ssrc);
+void metrics_ssrcrelease(metrics_ssrc_t *ssrc);
+void metrics_heartbeat(uint64_t lateness);
+void metrics_max(uint32_t *field, uint32_t value);
+void metrics_max64(uint64_t *field, uint64_t value);
+
+static inline uint64_t metrics_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline void metrics_stagerun(metrics_stage_t *stage, uint64_t start)
+{
+	if (stage == NULL)
+		return;
+	uint64_t duration = metrics_now() - start;
+	METRICS_INC(stage->nruns, 1);
+	METRICS_INC(stage->time, duration);
+	metrics_max64(&stage->timemax, duration);
+}
+
+static inline void metrics_jitterpush(metrics_jitter_t *jitter, unsigned int level)
+{
+	if (jitter == NULL)
+		return;
+	METRICS_INC(jitter->npush, 1);
+	METRICS_SET(jitter->level, level);
+	metrics_max(&jitter->levelmax, level);
+}
+
+static inline void metrics_jitterpop(metrics_jitter_t *jitter, unsigned int level)
+{
+	if (jitter == NULL)
+		return;
+	METRICS_INC(jitter->npop, 1);
+	METRICS_SET(jitter->level, level);
+}
+
+static inline uint64_t metrics_jitteroverflow(metrics_jitter_t *jitter)
+{
+	if (jitter == NULL)
+		return 0;
+	METRICS_INC(jitter->overflow, 1);
+	return metrics_now();
+}
+
+static inline void metrics_jitterpullwait(metrics_jitter_t *jitter, uint64_t start)
+{
+	if (jitter == NULL || start == 0)
+		return;
+	METRICS_INC(jitter->pullwait, metrics_now() - start);
+}
+
+static inline uint64_t metrics_jitterunderrun(metrics_jitter_t *jitter, int running)
+{
+	if (jitter == NULL)
+		return 0;
+	if (running)
+		METRICS_INC(jitter->underrun, 1);
+	return metrics_now();
+}
+
+static inline void metrics_jitterpeerwait(metrics_jitter_t *jitter, uint64_t start)
+{
+	if (jitter == NULL || start == 0)
+		return;
+	METRICS_INC(jitter->peerwait, metrics_now() - start);
+}
+#else
+#define metrics_stagerun(...)
+#define metrics_jitterpush(...)
+#define metrics_jitterpop(...)
+#define metrics_jitteroverflow(...) 0
+#define metrics_jitterpullwait(...)
+#define metrics_jitterunderrun(...) 0
+#define metrics_jitterpeerwait(...)
+#endif
+
+#endif
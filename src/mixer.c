@@ -0,0 +1,645 @@
+/*****************************************************************************
+ * mixer.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+
+#include <pthread.h>
+
+#include "jitter.h"
+#ifdef FILTER_FIXEDPOINT
+#include "fixedpoint.h"
+#endif
+
+typedef struct mixer_input_s mixer_input_t;
+typedef struct mixer_ctx_s mixer_ctx_t;
+struct mixer_input_s
+{
+	mixer_ctx_t *mixer;
+	jitter_t *jitter;
+	void *key;
+	int gain;
+	int32_t coef;
+	enum
+	{
+		INPUT_IDLE,
+		INPUT_RUNNING,
+	} state;
+	int contributed;
+	/** the stream waits the detachment of the others */
+	int queued;
+	/** the samples of the stream are not mixed anymore */
+	int dropped;
+	/** the gain ramp of the crossfade */
+	int fadein;
+	unsigned int fadeposition;
+	unsigned int fadelength;
+#ifdef FILTER_FIXEDPOINT
+	/** the curves and the rotation of one frame in Q2.30 */
+	int64_t fadesin;
+	int64_t fadecos;
+	int32_t sinstep;
+	int32_t cosstep;
+#endif
+	mixer_input_t *next;
+};
+
+struct mixer_ctx_s
+{
+	jitter_t *out;
+	mixer_input_t *inputs;
+	int64_t *accu;
+	/** the accumulator of the frame during its emission */
+	int64_t *spare;
+	/** the number of the frame into the accumulator */
+	unsigned int frame;
+	int emitting;
+	/** the coefficients of one buffer during a gain ramp */
+	int32_t *ramp;
+	size_t length;
+	unsigned int nsamples;
+	unsigned char samplesize;
+	unsigned char bitspersample;
+	unsigned char nchannels;
+	int gain;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+#define MIXER_CTX
+#include "mixer.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define mixer_dbg(...)
+
+#define MIXER_SHIFT 16
+#define MIXER_NBBUFFERS 2
+
+static const char *jitter_name = "mixer input";
+
+static int32_t _mixer_coef(int db)
+{
+	return (int32_t)lround((1 << MIXER_SHIFT) * pow(10.0, db / 20.0));
+}
+
+mixer_ctx_t *mixer_init(jitter_t *out, int gain)
+{
+	unsigned char samplesize;
+	unsigned char bitspersample;
+	unsigned char nchannels = 2;
+	switch (out->format)
+	{
+	case PCM_16bits_LE_mono:
+		nchannels = 1;
+	case PCM_16bits_LE_stereo:
+		samplesize = 2;
+		bitspersample = 16;
+	break;
+	case PCM_24bits3_LE_stereo:
+		samplesize = 3;
+		bitspersample = 24;
+	break;
+	case PCM_24bits4_LE_stereo:
+		samplesize = 4;
+		bitspersample = 24;
+	break;
+	case PCM_32bits_LE_stereo:
+		samplesize = 4;
+		bitspersample = 32;
+	break;
+	default:
+		err("mixer: format %#x not supported", out->format);
+		return NULL;
+	}
+
+	mixer_ctx_t *ctx = calloc(1, sizeof(*ctx));
+	ctx->out = out;
+	ctx->samplesize = samplesize;
+	ctx->bitspersample = bitspersample;
+	ctx->nchannels = nchannels;
+	ctx->nsamples = out->ctx->size / samplesize;
+	ctx->accu = calloc(ctx->nsamples, sizeof(*ctx->accu));
+	ctx->spare = calloc(ctx->nsamples, sizeof(*ctx->spare));
+	ctx->ramp = calloc(ctx->nsamples / nchannels, sizeof(*ctx->ramp));
+	ctx->gain = gain;
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	warn("mixer: install mixer on %s (%ddB)", out->ctx->name, gain);
+	return ctx;
+}
+
+static int32_t _mixer_read(mixer_ctx_t *ctx, const unsigned char *buffer)
+{
+	int32_t sample = 0;
+	switch (ctx->samplesize)
+	{
+	case 2:
+		sample = (int16_t)(buffer[0] | (buffer[1] << 8));
+	break;
+	case 3:
+		sample = buffer[0] | (buffer[1] << 8) | (buffer[2] << 16);
+		/* sign extension */
+		sample = (int32_t)((uint32_t)sample << 8) >> 8;
+	break;
+	case 4:
+		sample = (int32_t)(buffer[0] | (buffer[1] << 8) |
+				(buffer[2] << 16) | ((uint32_t)buffer[3] << 24));
+	break;
+	}
+	return sample;
+}
+
+/**
+ * the equal power curves: the fade in follows sin(t) and the fade out
+ * cos(t) with t from 0 to pi/2, the sum of the powers stays constant.
+ * The curve is computed by rotation for each frame of the buffer.
+ */
+#ifdef FILTER_FIXEDPOINT
+static void _mixer_curve(mixer_ctx_t *ctx, mixer_input_t *input, unsigned int nframes)
+{
+	int64_t s = input->fadesin;
+	int64_t c = input->fadecos;
+	unsigned int i;
+
+	for (i = 0; i < nframes; i++)
+	{
+		int64_t level = input->fadein? s: c;
+		if (input->fadeposition + i >= input->fadelength)
+			level = input->fadein? ((int64_t)1 << FIXED_RAMPSHIFT): 0;
+		ctx->ramp[i] = (int32_t)fixed_mul(level, input->coef, FIXED_RAMPSHIFT);
+		int64_t tmp = fixed_mul(s, input->cosstep, FIXED_RAMPSHIFT) +
+				fixed_mul(c, input->sinstep, FIXED_RAMPSHIFT);
+		c = fixed_mul(c, input->cosstep, FIXED_RAMPSHIFT) -
+				fixed_mul(s, input->sinstep, FIXED_RAMPSHIFT);
+		s = tmp;
+	}
+	input->fadesin = s;
+	input->fadecos = c;
+}
+#else
+static void _mixer_curve(mixer_ctx_t *ctx, mixer_input_t *input, unsigned int nframes)
+{
+	double step = M_PI_2 / input->fadelength;
+	double angle = step * input->fadeposition;
+	double s = sin(angle);
+	double c = cos(angle);
+	double sinstep = sin(step);
+	double cosstep = cos(step);
+	unsigned int i;
+
+	for (i = 0; i < nframes; i++)
+	{
+		double level = input->fadein? s: c;
+		if (input->fadeposition + i >= input->fadelength)
+			level = input->fadein? 1.0: 0.0;
+		ctx->ramp[i] = (int32_t)lround(input->coef * level);
+		double tmp = s * cosstep + c * sinstep;
+		c = c * cosstep - s * sinstep;
+		s = tmp;
+	}
+}
+#endif
+
+static void _mixer_ramp(mixer_ctx_t *ctx, mixer_input_t *input, unsigned int nframes)
+{
+	_mixer_curve(ctx, input, nframes);
+	input->fadeposition += nframes;
+	if (input->fadeposition >= input->fadelength)
+	{
+		/// the end of the ramp, the gain is the new one
+		if (!input->fadein)
+			input->coef = 0;
+		input->fadelength = 0;
+	}
+}
+
+static void _mixer_accumulate(mixer_ctx_t *ctx, mixer_input_t *input,
+			const unsigned char *buffer, size_t length)
+{
+	unsigned int nsamples = length / ctx->samplesize;
+	unsigned int i;
+
+	if (nsamples > ctx->nsamples)
+		nsamples = ctx->nsamples;
+	if (input->fadelength > 0)
+	{
+		unsigned int nframes = nsamples / ctx->nchannels;
+		_mixer_ramp(ctx, input, nframes);
+		nsamples = nframes * ctx->nchannels;
+		for (i = 0; i < nsamples; i++)
+		{
+			int64_t sample = _mixer_read(ctx, buffer);
+			ctx->accu[i] += sample * ctx->ramp[i / ctx->nchannels];
+			buffer += ctx->samplesize;
+		}
+	}
+	else
+	{
+		for (i = 0; i < nsamples; i++)
+		{
+			int64_t sample = _mixer_read(ctx, buffer);
+			ctx->accu[i] += sample * input->coef;
+			buffer += ctx->samplesize;
+		}
+	}
+	length = nsamples * ctx->samplesize;
+	if (length > ctx->length)
+		ctx->length = length;
+}
+
+static void _mixer_store(mixer_ctx_t *ctx, const int64_t *accu, unsigned char *buffer, size_t length)
+{
+	int64_t max = ((int64_t)1 << (ctx->bitspersample - 1)) - 1;
+	int64_t min = -max - 1;
+	unsigned int nsamples = length / ctx->samplesize;
+	unsigned int i;
+
+	for (i = 0; i < nsamples; i++)
+	{
+		int64_t sample = accu[i] >> MIXER_SHIFT;
+		/* saturation */
+		if (sample > max)
+			sample = max;
+		else if (sample < min)
+			sample = min;
+		int j;
+		for (j = 0; j < ctx->samplesize; j++)
+			buffer[j] = sample >> (j * 8);
+		buffer += ctx->samplesize;
+	}
+}
+
+/**
+ * the frame is complete when all running inputs sent their buffer
+ */
+static int _mixer_complete(mixer_ctx_t *ctx)
+{
+	int contributed = 0;
+	mixer_input_t *it = ctx->inputs;
+	for (; it != NULL; it = it->next)
+	{
+		if (it->state == INPUT_RUNNING && !it->contributed)
+			return 0;
+		contributed |= it->contributed;
+	}
+	return contributed;
+}
+
+/**
+ * must be called with the lock.
+ * The frame is stored and sent out of the lock, the pull of the output
+ * may block and the inputs accumulate the next frame meanwhile.
+ */
+static void _mixer_emit(mixer_ctx_t *ctx)
+{
+	unsigned int frame = ctx->frame;
+	while (ctx->emitting)
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+	/// another stream sent the frame during the wait
+	if (frame != ctx->frame)
+		return;
+
+	mixer_input_t *it = ctx->inputs;
+	for (; it != NULL; it = it->next)
+	{
+		if (it->state == INPUT_RUNNING && !it->contributed)
+		{
+			/**
+			 * the stream is late (packets lost, sender stopped...)
+			 * it doesn't drive the frame until its next buffer.
+			 */
+			mixer_dbg("mixer: input %p late", it->key);
+			it->state = INPUT_IDLE;
+		}
+		it->contributed = 0;
+	}
+
+	int64_t *accu = ctx->accu;
+	size_t length = ctx->length;
+	ctx->accu = ctx->spare;
+	ctx->spare = accu;
+	ctx->length = 0;
+	ctx->frame++;
+	ctx->emitting = 1;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	unsigned char *buffer = ctx->out->ops->pull(ctx->out->ctx);
+	/**
+	 * the output may be flushed, the frame is dropped
+	 */
+	if (buffer != NULL)
+	{
+		_mixer_store(ctx, accu, buffer, length);
+		ctx->out->ops->push(ctx->out->ctx, length, NULL);
+	}
+	memset(accu, 0, ctx->nsamples * sizeof(*accu));
+
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->emitting = 0;
+	pthread_cond_broadcast(&ctx->cond);
+}
+
+static void _mixer_timeout(mixer_ctx_t *ctx, struct timespec *timeout)
+{
+	unsigned long period = 100000000;
+	int samplerate = jitter_samplerate(ctx->out);
+	if (samplerate > 0)
+	{
+		unsigned long long nframes = ctx->nsamples / ctx->nchannels;
+		period = nframes * 1000000000ULL / samplerate;
+	}
+	clock_gettime(CLOCK_REALTIME, timeout);
+	timeout->tv_nsec += period % 1000000000;
+	timeout->tv_sec += period / 1000000000 + timeout->tv_nsec / 1000000000;
+	timeout->tv_nsec %= 1000000000;
+}
+
+/**
+ * a queued stream is mixed when it's the last one
+ */
+static int _mixer_alone(mixer_ctx_t *ctx, mixer_input_t *input)
+{
+	mixer_input_t *it = ctx->inputs;
+	for (; it != NULL; it = it->next)
+	{
+		if (it != input && !it->dropped && !it->queued)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * the consumer of each input jitter. It runs inside the decoder thread
+ * of the stream.
+ */
+static int _mixer_consume(void *arg, unsigned char *buffer, size_t size)
+{
+	mixer_input_t *input = (mixer_input_t *)arg;
+	mixer_ctx_t *ctx = input->mixer;
+
+	pthread_mutex_lock(&ctx->mutex);
+	while (input->queued && !input->dropped && !_mixer_alone(ctx, input))
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+	input->queued = 0;
+	if (input->dropped)
+	{
+		pthread_mutex_unlock(&ctx->mutex);
+		return size;
+	}
+	int samplerate = jitter_samplerate(input->jitter);
+	if (jitter_samplerate(ctx->out) == 0)
+	{
+		mixer_dbg("mixer: change samplerate to %u", samplerate);
+		ctx->out->ctx->frequence = samplerate;
+	}
+	else if (jitter_samplerate(ctx->out) != samplerate)
+	{
+		err("mixer: samplerate %d not supported", samplerate);
+		pthread_mutex_unlock(&ctx->mutex);
+		return size;
+	}
+	if (input->contributed)
+	{
+		/**
+		 * this stream is ahead of the others, they have
+		 * one frame period to send their buffers.
+		 */
+		struct timespec timeout;
+		_mixer_timeout(ctx, &timeout);
+		int ret = 0;
+		while (input->contributed && ret != ETIMEDOUT)
+			ret = pthread_cond_timedwait(&ctx->cond, &ctx->mutex, &timeout);
+		if (input->contributed)
+			_mixer_emit(ctx);
+	}
+	input->state = INPUT_RUNNING;
+	_mixer_accumulate(ctx, input, buffer, size);
+	input->contributed = 1;
+	if (_mixer_complete(ctx))
+		_mixer_emit(ctx);
+	pthread_mutex_unlock(&ctx->mutex);
+	return size;
+}
+
+mixer_input_t *mixer_attach(mixer_ctx_t *ctx, void *key)
+{
+	mixer_input_t *input = calloc(1, sizeof(*input));
+	input->jitter = jitter_init(JITTER_TYPE_SG, jitter_name,
+				MIXER_NBBUFFERS, ctx->out->ctx->size);
+	if (input->jitter == NULL)
+	{
+		err("mixer: too many streams");
+		free(input);
+		return NULL;
+	}
+	input->jitter->format = ctx->out->format;
+	input->jitter->ctx->frequence = ctx->out->ctx->frequence;
+	input->jitter->ctx->consume = _mixer_consume;
+	input->jitter->ctx->consumer = input;
+	input->mixer = ctx;
+	input->key = key;
+	input->state = INPUT_IDLE;
+
+	pthread_mutex_lock(&ctx->mutex);
+	/**
+	 * the first stream is the main stream, the others are mixed
+	 * with the default gain.
+	 */
+	if (ctx->inputs == NULL)
+		input->gain = 0;
+	else
+		input->gain = ctx->gain;
+	input->coef = _mixer_coef(input->gain);
+	input->next = ctx->inputs;
+	ctx->inputs = input;
+	pthread_mutex_unlock(&ctx->mutex);
+	dbg("mixer: attach %p %ddB", key, input->gain);
+	return input;
+}
+
+static mixer_input_t *_mixer_input(mixer_ctx_t *ctx, void *key)
+{
+	mixer_input_t *it = ctx->inputs;
+	while (it != NULL && it->key != key)
+		it = it->next;
+	return it;
+}
+
+jitter_t *mixer_jitter(mixer_ctx_t *ctx, void *key)
+{
+	jitter_t *jitter = NULL;
+	pthread_mutex_lock(&ctx->mutex);
+	mixer_input_t *input = _mixer_input(ctx, key);
+	if (input != NULL)
+		jitter = input->jitter;
+	pthread_mutex_unlock(&ctx->mutex);
+	return jitter;
+}
+
+int mixer_gain(mixer_ctx_t *ctx, void *key, int db)
+{
+	int ret = -1;
+	pthread_mutex_lock(&ctx->mutex);
+	mixer_input_t *input = _mixer_input(ctx, key);
+	if (input != NULL)
+	{
+		input->gain = db;
+		input->coef = _mixer_coef(db);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	return ret;
+}
+
+int mixer_fade(mixer_ctx_t *ctx, void *key, int fadein, unsigned int duration)
+{
+	int ret = -1;
+	pthread_mutex_lock(&ctx->mutex);
+	mixer_input_t *input = _mixer_input(ctx, key);
+	int samplerate = jitter_samplerate(ctx->out);
+	if (samplerate == 0)
+		samplerate = 44100;
+	if (input != NULL)
+	{
+		input->coef = _mixer_coef(input->gain);
+		input->fadein = fadein;
+		input->fadeposition = 0;
+		input->fadelength = (uint64_t)duration * samplerate / 1000;
+		if (input->fadelength == 0)
+			input->fadelength = 1;
+#ifdef FILTER_FIXEDPOINT
+		double step = M_PI_2 / input->fadelength;
+		input->fadesin = 0;
+		input->fadecos = (int64_t)1 << FIXED_RAMPSHIFT;
+		input->sinstep = FIXED_FROMDOUBLE(sin(step), FIXED_RAMPSHIFT);
+		input->cosstep = FIXED_FROMDOUBLE(cos(step), FIXED_RAMPSHIFT);
+#endif
+		dbg("mixer: fade %s %p %u frames", fadein? "in": "out", key, input->fadelength);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	return ret;
+}
+
+int mixer_queue(mixer_ctx_t *ctx, void *key)
+{
+	int ret = -1;
+	pthread_mutex_lock(&ctx->mutex);
+	mixer_input_t *input = _mixer_input(ctx, key);
+	if (input != NULL && input->state == INPUT_IDLE)
+	{
+		input->queued = 1;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	return ret;
+}
+
+int mixer_drop(mixer_ctx_t *ctx, void *key)
+{
+	int ret = -1;
+	pthread_mutex_lock(&ctx->mutex);
+	mixer_input_t *input = _mixer_input(ctx, key);
+	if (input != NULL)
+	{
+		input->dropped = 1;
+		input->state = INPUT_IDLE;
+		/// the frame doesn't wait this stream anymore
+		if (input->contributed)
+			_mixer_emit(ctx);
+		pthread_cond_broadcast(&ctx->cond);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	return ret;
+}
+
+static void _mixer_detach(mixer_input_t *input)
+{
+	mixer_ctx_t *ctx = input->mixer;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (ctx->inputs == input)
+		ctx->inputs = input->next;
+	else
+	{
+		mixer_input_t *it = ctx->inputs;
+		while (it != NULL && it->next != input)
+			it = it->next;
+		if (it != NULL)
+			it->next = input->next;
+	}
+	/**
+	 * the other streams may wait this one to complete the frame
+	 */
+	if (_mixer_complete(ctx))
+		_mixer_emit(ctx);
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+	dbg("mixer: detach %p", input->key);
+
+	jitter_destroy(input->jitter);
+	free(input);
+}
+
+void mixer_release(void *arg)
+{
+	/**
+	 * the filter is destroyed with the decoder, the input is not used anymore.
+	 */
+	_mixer_detach((mixer_input_t *)arg);
+}
+
+void mixer_destroy(mixer_ctx_t *ctx)
+{
+	/// the streams still attached are not released by their filter
+	while (ctx->inputs != NULL)
+	{
+		mixer_input_t *input = ctx->inputs;
+		ctx->inputs = input->next;
+		jitter_destroy(input->jitter);
+		free(input);
+	}
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx->accu);
+	free(ctx->spare);
+	free(ctx->ramp);
+	free(ctx);
+}
@@ -0,0 +1,52 @@
+#ifndef __MIXER_H__
+#define __MIXER_H__
+
+#include "jitter.h"
+#include "filter.h"
+
+#ifndef MIXER_CTX
+typedef void mixer_ctx_t;
+#endif
+typedef struct mixer_input_s mixer_input_t;
+
+/**
+ * the mixer sums several decoded streams into one output jitter.
+ * Each stream writes into its own input jitter, the buffers of
+ * the inputs are added sample by sample with a gain per stream.
+ * @param out	the output jitter (the encoder jitter)
+ * @param gain	the default gain in dB of the streams after the first one
+ */
+mixer_ctx_t *mixer_init(jitter_t *out, int gain);
+/**
+ * create a new input for the stream identified by key
+ * (the decoder of the stream)
+ */
+mixer_input_t *mixer_attach(mixer_ctx_t *ctx, void *key);
+jitter_t *mixer_jitter(mixer_ctx_t *ctx, void *key);
+int mixer_gain(mixer_ctx_t *ctx, void *key, int db);
+/**
+ * ramp the gain of the stream with an equal power curve
+ * @param fadein	1 from silence to the gain of the stream, 0 to silence
+ * @param duration	the duration of the ramp in ms
+ */
+int mixer_fade(mixer_ctx_t *ctx, void *key, int fadein, unsigned int duration);
+/**
+ * the stream is mixed after the detachment of the other streams.
+ * The stream follows the previous one without gap or overlap.
+ * It must be called before the first buffer of the stream.
+ */
+int mixer_queue(mixer_ctx_t *ctx, void *key);
+/**
+ * the samples of the stream are dropped until its detachment
+ */
+int mixer_drop(mixer_ctx_t *ctx, void *key);
+void mixer_destroy(mixer_ctx_t *ctx);
+
+/**
+ * the release callback of an input to install into the filter
+ * of the stream (FILTER_RELEASE).
+ * It detaches the input when the filter is destroyed.
+ */
+void mixer_release(void *arg);
+
+#endif
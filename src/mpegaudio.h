@@ -0,0 +1,41 @@
+#ifndef __MPEGAUDIO_H__
+#define __MPEGAUDIO_H__
+
+#include <stdint.h>
+
+/**
+ * parse the 4 bytes of the header of a MPEG layer III frame.
+ * @param samplerate	set to the samplerate of the frame, may be NULL
+ * @param nsamples	set to the number of samples of the frame, may be NULL
+ * @return the length of the frame, 0 if the header is wrong
+ */
+static inline uint32_t mpegaudio_frame(const unsigned char *head, uint32_t *samplerate, uint32_t *nsamples)
+{
+	static const uint16_t bitrates[2][16] =
+	{
+		{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+	};
+	static const uint32_t samplerates[4] = {44100, 48000, 32000, 0};
+
+	if (head[0] != 0xFF || (head[1] & 0xE0) != 0xE0)
+		return 0;
+	int version = (head[1] >> 3) & 0x03;
+	int layer = (head[1] >> 1) & 0x03;
+	int bitrate = (head[2] >> 4) & 0x0F;
+	int padding = (head[2] >> 1) & 0x01;
+	uint32_t rate = samplerates[(head[2] >> 2) & 0x03];
+	if (version == 1 || layer != 1 || rate == 0 ||
+		bitrates[0][bitrate] == 0)
+		return 0;
+	/// MPEG1 is version 3, MPEG2 is version 2 and MPEG2.5 is version 0
+	int lsf = (version != 3);
+	rate >>= (version == 3)? 0: (version == 2)? 1: 2;
+	if (samplerate)
+		*samplerate = rate;
+	if (nsamples)
+		*nsamples = lsf? 576: 1152;
+	return (lsf? 72000: 144000) * bitrates[lsf][bitrate] / rate + padding;
+}
+
+#endif
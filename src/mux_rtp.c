@@ -59,6 +59,7 @@ struct mux_ctx_s
 #include "mux.h"
 #include "media.h"
 #include "jitter.h"
+#include "realtime.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -196,7 +197,7 @@ static void *mux_thread(void *arg)
 static int mux_run(mux_ctx_t *ctx, jitter_t *sink_jitter)
 {
 	ctx->out = sink_jitter;
-	pthread_create(&ctx->thread, NULL, mux_thread, ctx);
+	realtime_thread(&ctx->thread, NULL, "mux", mux_thread, ctx);
 	return 0;
 }
 
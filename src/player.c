@@ -29,6 +29,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 
 #define __USE_GNU
 #include <pthread.h>
@@ -41,6 +43,9 @@
 #include "encoder.h"
 #include "sink.h"
 #include "filter.h"
+#ifdef MIXER
+#include "mixer.h"
+#endif
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -52,6 +57,11 @@
 
 #define player_dbg dbg
 
+/// the period of the check of the transition to the next src in ns
+#define PLAYER_TRANSITIONPERIOD 250000000
+/// the gapless transition runs the next src 2 seconds before the end
+#define PLAYER_GAPLESSLEAD 2
+
 static void _player_autonext(void *arg, event_t event, void *eventarg);
 
 struct player_ctx_s
@@ -65,6 +75,8 @@ struct player_ctx_s
 
 	src_t *src;
 	src_t *nextsrc;
+	/** the src and the nextsrc are replaced and destroyed under this lock */
+	pthread_mutex_t mutexsrc;
 
 	pthread_cond_t cond;
 	pthread_cond_t cond_int;
@@ -72,7 +84,18 @@ struct player_ctx_s
 
 	jitter_t *outstream[MAX_ESTREAM];
 	int noutstreams;
-
+	/** the settings of the filters changed during the playback */
+	char *eq;
+	char *drc;
+	pthread_mutex_t mutexsettings;
+#ifdef MIXER
+	mixer_ctx_t *mixer;
+	/** the duration of the crossfade in seconds */
+	int crossfade;
+	int gapless;
+	/** the next src runs already into the mixer */
+	src_t *early;
+#endif
 };
 
 player_ctx_t *player_init(const char *filtername)
@@ -81,6 +104,8 @@ player_ctx_t *player_init(const char *filtername)
 	pthread_mutex_init(&ctx->mutex, NULL);
 	pthread_cond_init(&ctx->cond, NULL);
 	pthread_cond_init(&ctx->cond_int, NULL);
+	pthread_mutex_init(&ctx->mutexsettings, NULL);
+	pthread_mutex_init(&ctx->mutexsrc, NULL);
 	ctx->state = STATE_STOP;
 	ctx->filtername = filtername;
 	return ctx;
@@ -115,8 +140,10 @@ int player_change(player_ctx_t *ctx, const char *mediapath, int random, int loop
 int player_next(player_ctx_t *ctx, int change)
 {
 	int nextid = -1;
+	pthread_mutex_lock(&ctx->mutexsrc);
 	if (ctx->nextsrc != NULL)
 		nextid = ctx->nextsrc->mediaid;
+	pthread_mutex_unlock(&ctx->mutexsrc);
 	if (ctx->media != NULL && change)
 	{
 		/**
@@ -146,6 +173,14 @@ void player_destroy(player_ctx_t *ctx)
 	pthread_cond_destroy(&ctx->cond);
 	pthread_cond_destroy(&ctx->cond_int);
 	pthread_mutex_destroy(&ctx->mutex);
+	pthread_mutex_destroy(&ctx->mutexsettings);
+	pthread_mutex_destroy(&ctx->mutexsrc);
+	free(ctx->eq);
+	free(ctx->drc);
+#ifdef MIXER
+	if (ctx->mixer)
+		mixer_destroy(ctx->mixer);
+#endif
 	free(ctx);
 }
 
@@ -186,11 +221,55 @@ int player_eventlistener(player_ctx_t *ctx, event_listener_cb_t callback, void *
 
 int player_mediaid(player_ctx_t *ctx)
 {
+	int id = -1;
+	pthread_mutex_lock(&ctx->mutexsrc);
 	if (ctx->src != NULL)
+		id = ctx->src->mediaid;
+	pthread_mutex_unlock(&ctx->mutexsrc);
+	return id;
+}
+
+int player_position(player_ctx_t *ctx, unsigned int *position, unsigned int *duration)
+{
+	int id = -1;
+	*position = 0;
+	*duration = 0;
+	/// the decoder is destroyed with the change of the source
+	pthread_mutex_lock(&ctx->mutexsrc);
+	src_t *src = ctx->src;
+	decoder_t *decoder = NULL;
+	if (src != NULL)
 	{
-		return ctx->src->mediaid;
+		id = src->mediaid;
+		*duration = src->info.duration / 1000;
+		if (src->ops->estream != NULL)
+			decoder = src->ops->estream(src->ctx, 0);
 	}
-	return -1;
+	if (decoder != NULL && decoder->ops->position != NULL)
+		*position = decoder->ops->position(decoder->ctx);
+	if (decoder != NULL && decoder->ops->duration != NULL &&
+		decoder->ops->duration(decoder->ctx) > 0)
+		*duration = decoder->ops->duration(decoder->ctx);
+	pthread_mutex_unlock(&ctx->mutexsrc);
+	return id;
+}
+
+int player_title(player_ctx_t *ctx, char *text, size_t size)
+{
+	int length = 0;
+	pthread_mutex_lock(&ctx->mutexsrc);
+	src_t *src = ctx->src;
+	if (src != NULL && src->info.title != NULL)
+	{
+		if (src->info.artist != NULL)
+			length = snprintf(text, size, "%s - %s", src->info.artist, src->info.title);
+		else
+			length = snprintf(text, size, "%s", src->info.title);
+	}
+	pthread_mutex_unlock(&ctx->mutexsrc);
+	if (length > (int)size - 1)
+		length = size - 1;
+	return length;
 }
 
 state_t player_state(player_ctx_t *ctx, state_t state)
@@ -228,6 +307,17 @@ int player_waiton(player_ctx_t *ctx, int state)
 	return 1;
 }
 
+#ifdef FILTER_LOUDNESS
+static void _player_loudness(void *arg, int id, double loudness, double truepeak, unsigned int duration)
+{
+	player_ctx_t *ctx = (player_ctx_t *)arg;
+	warn("player: media %d loudness %.1f LUFS true peak %.1f dBTP", id, loudness, truepeak);
+	media_t *media = ctx->media;
+	if (id >= 0 && media != NULL && media->ops->loudness != NULL)
+		media->ops->loudness(media->ctx, id, loudness, truepeak, duration);
+}
+#endif
+
 static void _player_new_es(player_ctx_t *ctx, void *eventarg)
 {
 	event_new_es_t *event_data = (event_new_es_t *)eventarg;
@@ -250,12 +340,46 @@ static void _player_new_es(player_ctx_t *ctx, void *eventarg)
 				break;
 		}
 		filter_t *filter = NULL;
+#ifdef MIXER
+		mixer_input_t *input = NULL;
+		/**
+		 * each stream has its own input into the mixer
+		 * and the filter writes into it.
+		 */
+		if (i < ctx->noutstreams && ctx->mixer != NULL && decoder->ops->prepare)
+			input = mixer_attach(ctx->mixer, decoder);
+		if (input != NULL)
+		{
+			filter = filter_build(ctx->filtername, mixer_jitter(ctx->mixer, decoder), &src->info);
+			if (filter != NULL)
+				filter->ops->set(filter->ctx, FILTER_RELEASE, mixer_release, input, 0);
+			else
+				mixer_release(input);
+		}
+		else
+#endif
 		if (i < ctx->noutstreams)
-			filter = filter_build(ctx->filtername, outstream, src->info);
+			filter = filter_build(ctx->filtername, outstream, &src->info);
 		decoder->filter = filter;
+		pthread_mutex_lock(&ctx->mutexsettings);
+		if (filter != NULL && ctx->eq != NULL)
+			filter_settings(filter, ctx->eq);
+		if (filter != NULL && ctx->drc != NULL)
+			filter_settings(filter, ctx->drc);
+		pthread_mutex_unlock(&ctx->mutexsettings);
+#ifdef FILTER_LOUDNESS
+		/// the loudness filter is installed only for the media not analyzed yet
+		if (filter != NULL && filter->loudness.outbits != 0)
+		{
+			filter->loudness.report = _player_loudness;
+			filter->loudness.reportarg = ctx;
+			filter->loudness.id = src->mediaid;
+			filter->loudness.duration = src->info.duration;
+		}
+#endif
 		if (decoder->ops->prepare)
 		{
-			decoder->ops->prepare(decoder->ctx, filter, src->info);
+			decoder->ops->prepare(decoder->ctx, filter, &src->info);
 		}
 	}
 }
@@ -265,6 +389,16 @@ static void _player_decode_es(player_ctx_t *ctx, void *eventarg)
 	event_decode_es_t *event_data = (event_decode_es_t *)eventarg;
 	if (event_data->decoder != NULL && ctx->noutstreams < MAX_ESTREAM)
 	{
+#ifdef MIXER
+		jitter_t *input = NULL;
+		if (ctx->mixer != NULL)
+			input = mixer_jitter(ctx->mixer, event_data->decoder);
+		if (input != NULL)
+		{
+			event_data->decoder->ops->run(event_data->decoder->ctx, input);
+			return;
+		}
+#endif
 		int i;
 		for ( i = 0; i < ctx->noutstreams; i++)
 		{
@@ -289,6 +423,128 @@ static void _player_listener(void *arg, event_t event, void *eventarg)
 	}
 }
 
+#ifdef MIXER
+static decoder_t *_player_decoder(src_t *src)
+{
+	if (src->ops->estream == NULL)
+		return NULL;
+	return src->ops->estream(src->ctx, 0);
+}
+
+/**
+ * must be called with mutexsrc
+ * the next src may run already, its stream is removed from the mixer
+ * before the destruction.
+ */
+static void _player_cancel(player_ctx_t *ctx, src_t *src)
+{
+	if (ctx->early != src)
+		return;
+	decoder_t *decoder = _player_decoder(src);
+	if (decoder != NULL)
+		mixer_drop(ctx->mixer, decoder);
+	ctx->early = NULL;
+}
+
+/**
+ * the next src runs before the end of the current one:
+ *  - the crossfade mixes the both streams during the end of the current one
+ *  - the gapless transition queues the next stream after the current one
+ * The switch from src to nextsrc stays on the STATE_CHANGE.
+ */
+static void _player_transitionsrc(player_ctx_t *ctx, src_t *src, src_t *nextsrc)
+{
+	if (src == NULL || nextsrc == NULL || ctx->early != NULL)
+		return;
+	decoder_t *decoder = _player_decoder(src);
+	decoder_t *nextdecoder = _player_decoder(nextsrc);
+	if (decoder == NULL || nextdecoder == NULL ||
+		decoder->ops->position == NULL ||
+		mixer_jitter(ctx->mixer, nextdecoder) == NULL)
+		return;
+
+	uint32_t duration = 0;
+	if (decoder->ops->duration != NULL)
+		duration = decoder->ops->duration(decoder->ctx);
+	if (duration == 0)
+		duration = src->info.duration / 1000;
+	uint32_t position = decoder->ops->position(decoder->ctx);
+	int lead = (ctx->crossfade > 0)? ctx->crossfade: PLAYER_GAPLESSLEAD;
+	if (duration == 0 || position + lead < duration)
+		return;
+
+	/// the next stream replaces the current one, it is the main stream
+	mixer_gain(ctx->mixer, nextdecoder, 0);
+	if (ctx->crossfade > 0)
+	{
+		/**
+		 * the position is truncated to the second, the fade out
+		 * must be complete before the end of the stream.
+		 */
+		unsigned int fade = (duration > position + 1)? duration - position - 1: 1;
+		dbg("player: crossfade %us", fade);
+		mixer_fade(ctx->mixer, nextdecoder, 1, fade * 1000);
+		mixer_fade(ctx->mixer, decoder, 0, fade * 1000);
+	}
+	else
+	{
+		dbg("player: gapless transition");
+		mixer_queue(ctx->mixer, nextdecoder);
+	}
+	ctx->early = nextsrc;
+	nextsrc->ops->run(nextsrc->ctx);
+}
+
+/**
+ * the srcs may not be destroyed by another thread during the transition.
+ */
+static void _player_transition(player_ctx_t *ctx)
+{
+	pthread_mutex_lock(&ctx->mutexsrc);
+	_player_transitionsrc(ctx, ctx->src, ctx->nextsrc);
+	pthread_mutex_unlock(&ctx->mutexsrc);
+}
+#endif
+
+/**
+ * the player checks periodically the position of the stream during
+ * the playback for the transition to the next src.
+ */
+static int _player_wait(player_ctx_t *ctx)
+{
+#ifdef MIXER
+	/**
+	 * the srcs are destroyed under mutexsrc and their threads may wait
+	 * on ctx->mutex, then the lock is only tried. A src under replacement
+	 * keeps the periodic check, the transition takes the lock.
+	 */
+	int next = 1;
+	if (pthread_mutex_trylock(&ctx->mutexsrc) == 0)
+	{
+		next = (ctx->nextsrc != NULL && ctx->early == NULL);
+		pthread_mutex_unlock(&ctx->mutexsrc);
+	}
+	if (ctx->mixer != NULL && (ctx->crossfade > 0 || ctx->gapless) &&
+		ctx->state == STATE_PLAY && next)
+	{
+		struct timespec timeout;
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += PLAYER_TRANSITIONPERIOD;
+		timeout.tv_sec += timeout.tv_nsec / 1000000000;
+		timeout.tv_nsec %= 1000000000;
+		int ret = pthread_cond_timedwait(&ctx->cond_int, &ctx->mutex, &timeout);
+		if (ret == ETIMEDOUT)
+		{
+			pthread_mutex_unlock(&ctx->mutex);
+			_player_transition(ctx);
+			pthread_mutex_lock(&ctx->mutex);
+		}
+		return ret;
+	}
+#endif
+	return pthread_cond_wait(&ctx->cond_int, &ctx->mutex);
+}
+
 static int _player_play(void* arg, int id, const char *url, const char *info, const char *mime)
 {
 	player_ctx_t *ctx = (player_ctx_t *)arg;
@@ -296,10 +552,15 @@ static int _player_play(void* arg, int id, const char *url, const char *info, co
 
 	dbg("player: prepare %d %s %s", id, url, mime);
 	src = src_build(ctx, url, mime, id, info);
+	/// the play command runs on another thread than the player loop
+	pthread_mutex_lock(&ctx->mutexsrc);
 	if (src != NULL)
 	{
 		if (ctx->nextsrc != NULL && ctx->nextsrc != src)
 		{
+#ifdef MIXER
+			_player_cancel(ctx, ctx->nextsrc);
+#endif
 			src_destroy(ctx->nextsrc);
 			ctx->nextsrc = NULL;
 		}
@@ -309,7 +570,7 @@ static int _player_play(void* arg, int id, const char *url, const char *info, co
 		{
 			src->ops->eventlistener(src->ctx, _player_listener, ctx);
 			if (src->ops->prepare != NULL)
-				src->ops->prepare(src->ctx, src->info);
+				src->ops->prepare(src->ctx, &src->info);
 		}
 		else
 		{
@@ -318,6 +579,7 @@ static int _player_play(void* arg, int id, const char *url, const char *info, co
 			const event_decode_es_t event_decode = {.pid = 0, .src = src, .decoder = event_new.decoder};
 			_player_listener(ctx, SRC_EVENT_DECODE_ES, (void *)&event_decode);
 		}
+		pthread_mutex_unlock(&ctx->mutexsrc);
 		return 0;
 	}
 	else
@@ -325,6 +587,7 @@ static int _player_play(void* arg, int id, const char *url, const char *info, co
 		err("player: src not found for %s", url);
 		ctx->nextsrc = NULL;
 	}
+	pthread_mutex_unlock(&ctx->mutexsrc);
 	return -1;
 }
 
@@ -345,6 +608,32 @@ int player_subscribe(player_ctx_t *ctx, estream_t type, jitter_t *encoder_jitter
 	{
 		ctx->outstream[ctx->noutstreams] = encoder_jitter;
 		ctx->noutstreams++;
+#ifdef MIXER
+		/**
+		 * the mixer is enabled by the filter options:
+		 * "pcm?mixer&mixgain=-6" mixes the concurrent streams
+		 * with -6dB on the streams after the first one.
+		 * "pcm?crossfade=5" overlaps the end of each media with
+		 * the beginning of the next one during 5 seconds.
+		 * "pcm?gapless" chains the medias without gap.
+		 */
+		const char *query = strchr(ctx->filtername, '?');
+		if (ctx->mixer == NULL && query != NULL &&
+			(strstr(query, "mixer") != NULL ||
+			strstr(query, "crossfade=") != NULL ||
+			strstr(query, "gapless") != NULL))
+		{
+			int gain = 0;
+			const char *gainvalue = strstr(query, "mixgain=");
+			if (gainvalue != NULL)
+				sscanf(gainvalue, "mixgain=%d", &gain);
+			const char *crossfade = strstr(query, "crossfade=");
+			if (crossfade != NULL)
+				sscanf(crossfade, "crossfade=%d", &ctx->crossfade);
+			ctx->gapless = (strstr(query, "gapless") != NULL);
+			ctx->mixer = mixer_init(encoder_jitter, gain);
+		}
+#endif
 	}
 	return 0;
 }
@@ -358,6 +647,7 @@ static int _player_stateengine(player_ctx_t *ctx, int state, int pause)
 			dbg("player: stoping");
 			for (i = 0; i < ctx->noutstreams; i++)
 				ctx->outstream[i]->ops->flush(ctx->outstream[i]->ctx);
+			pthread_mutex_lock(&ctx->mutexsrc);
 			if (ctx->src != NULL)
 			{
 				src_destroy(ctx->src);
@@ -365,9 +655,13 @@ static int _player_stateengine(player_ctx_t *ctx, int state, int pause)
 			}
 			if (ctx->nextsrc != NULL)
 			{
+#ifdef MIXER
+				_player_cancel(ctx, ctx->nextsrc);
+#endif
 				src_destroy(ctx->nextsrc);
 				ctx->nextsrc = NULL;
 			}
+			pthread_mutex_unlock(&ctx->mutexsrc);
 
 			if (ctx->media->ops->end)
 				ctx->media->ops->end(ctx->media->ctx);
@@ -400,6 +694,7 @@ static int _player_stateengine(player_ctx_t *ctx, int state, int pause)
 				state = STATE_CHANGE | pause;
 		break;
 		case STATE_CHANGE:
+			pthread_mutex_lock(&ctx->mutexsrc);
 			if (ctx->src != NULL)
 			{
 				dbg("player: wait");
@@ -418,6 +713,12 @@ static int _player_stateengine(player_ctx_t *ctx, int state, int pause)
 				 * the src needs to be ready before the decoder
 				 * to set a producer if it's needed
 				 */
+#ifdef MIXER
+				/// the transition runs already the src
+				if (ctx->early == ctx->src)
+					ctx->early = NULL;
+				else
+#endif
 				ctx->src->ops->run(ctx->src->ctx);
 				state = STATE_PLAY | pause;
 			}
@@ -425,6 +726,7 @@ static int _player_stateengine(player_ctx_t *ctx, int state, int pause)
 			{
 				state = STATE_STOP;
 			}
+			pthread_mutex_unlock(&ctx->mutexsrc);
 		break;
 	}
 	return state;
@@ -459,7 +761,8 @@ int player_run(player_ctx_t *ctx)
 		pthread_mutex_lock(&ctx->mutex);
 		while (last_state == (ctx->state & ~STATE_PAUSE_MASK))
 		{
-			pthread_cond_wait(&ctx->cond_int, &ctx->mutex);
+			if (_player_wait(ctx) == ETIMEDOUT)
+				continue;
 			if (last_state == (ctx->state & ~STATE_PAUSE_MASK))
 				pthread_cond_broadcast(&ctx->cond);
 			for (int i = 0; i < ctx->noutstreams; i++)
@@ -506,3 +809,34 @@ src_t *player_source(player_ctx_t *ctx)
 {
 	return ctx->src;
 }
+
+static int _player_filtersettings(src_t *src, const char *settings)
+{
+	if (src == NULL || src->ops->estream == NULL)
+		return 0;
+	decoder_t *decoder = src->ops->estream(src->ctx, 0);
+	if (decoder == NULL || decoder->filter == NULL)
+		return 0;
+	return filter_settings(decoder->filter, settings);
+}
+
+int player_filter(player_ctx_t *ctx, const char *settings)
+{
+	char **stored = NULL;
+	if (!strncmp(settings, "eq=", 3))
+		stored = &ctx->eq;
+	else if (!strncmp(settings, "drc=", 4))
+		stored = &ctx->drc;
+	else
+		return -1;
+	pthread_mutex_lock(&ctx->mutexsettings);
+	free(*stored);
+	*stored = strdup(settings);
+	pthread_mutex_unlock(&ctx->mutexsettings);
+	/// the next src may be already decoding
+	pthread_mutex_lock(&ctx->mutexsrc);
+	_player_filtersettings(ctx->nextsrc, settings);
+	int ret = _player_filtersettings(ctx->src, settings);
+	pthread_mutex_unlock(&ctx->mutexsrc);
+	return ret;
+}
@@ -50,7 +50,24 @@ int player_next(player_ctx_t *ctx, int change);
 void player_removeevent(player_ctx_t *ctx, int id);
 int player_eventlistener(player_ctx_t *ctx, event_listener_cb_t callback, void *cbctx, char *name);
 int player_mediaid(player_ctx_t *ctx);
+/**
+ * the position and the duration of the current stream,
+ * same units as the getposition method.
+ * @return the mediaid of the stream or -1
+ */
+int player_position(player_ctx_t *ctx, unsigned int *position, unsigned int *duration);
+/**
+ * copy the title of the current stream, "<artist> - <title>"
+ * or only "<title>".
+ * @return the length of the text, 0 without title
+ */
+int player_title(player_ctx_t *ctx, char *text, size_t size);
 src_t *player_source(player_ctx_t *ctx);
+/**
+ * change the settings of a stage of the filters ("eq=...", "drc=...")
+ * of the current stream and of the next ones.
+ */
+int player_filter(player_ctx_t *ctx, const char *settings);
 void player_sendevent(player_ctx_t *ctx, event_t event, void *data);
 int player_play(player_ctx_t *ctx, int id);
 
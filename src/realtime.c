@@ -0,0 +1,367 @@
+/*****************************************************************************
+ * realtime.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define REALTIME_MAXROLES 8
+
+typedef struct realtime_role_s realtime_role_t;
+struct realtime_role_s
+{
+	char name[16];
+	int policy;
+	int priority;
+	int ncpus;
+	cpu_set_t cpus;
+};
+
+static realtime_role_t _realtime_roles[REALTIME_MAXROLES];
+static int _realtime_nroles = 0;
+
+static __thread int _realtime_thread = 0;
+
+static void _realtime_prefaultstack(void)
+{
+	volatile unsigned char stack[REALTIME_STACKSIZE / 2];
+	int i;
+	for (i = 0; i < sizeof(stack); i += 1024)
+		stack[i] = 0;
+}
+
+int realtime_init(size_t heapsize)
+{
+	/**
+	 * the freed memory stays into the heap and the large allocations
+	 * don't use mmap, then the heap is prefaulted only one time.
+	 */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+	{
+		err("realtime: memory lock error %s", strerror(errno));
+		return -1;
+	}
+
+	unsigned char *heap = malloc(heapsize);
+	if (heap != NULL)
+	{
+		size_t i;
+		for (i = 0; i < heapsize; i += sysconf(_SC_PAGESIZE))
+			heap[i] = 0;
+		free(heap);
+	}
+
+	/**
+	 * with MCL_FUTURE the stacks are locked during the thread creation,
+	 * the default stack size must be reduced.
+	 */
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, REALTIME_STACKSIZE);
+	if (pthread_setattr_default_np(&attr) != 0)
+		warn("realtime: unable to set the stack size");
+	pthread_attr_destroy(&attr);
+
+	_realtime_prefaultstack();
+	dbg("realtime: memory locked, heap %lu", heapsize);
+	return 0;
+}
+
+void realtime_enter(void)
+{
+	_realtime_prefaultstack();
+	_realtime_thread = 1;
+}
+
+void realtime_leave(void)
+{
+	_realtime_thread = 0;
+}
+
+static realtime_role_t *_realtime_role(const char *name, int create)
+{
+	int i;
+	for (i = 0; i < _realtime_nroles; i++)
+	{
+		if (!strcmp(_realtime_roles[i].name, name))
+			return &_realtime_roles[i];
+	}
+	if (!create)
+		return NULL;
+	if (_realtime_nroles == REALTIME_MAXROLES)
+	{
+		err("realtime: too many roles for %s", name);
+		return NULL;
+	}
+	realtime_role_t *role = &_realtime_roles[_realtime_nroles++];
+	strncpy(role->name, name, sizeof(role->name) - 1);
+	return role;
+}
+
+/**
+ * the cpu list is the format of taskset: "0,2-3"
+ */
+static int _realtime_cpus(const char *string, cpu_set_t *cpus)
+{
+	int ncpus = 0;
+	CPU_ZERO(cpus);
+	while (*string >= '0' && *string <= '9')
+	{
+		char *end;
+		int first = strtol(string, &end, 10);
+		int last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (; first <= last && first < CPU_SETSIZE; first++, ncpus++)
+			CPU_SET(first, cpus);
+		string = end;
+		if (*string == ',')
+			string++;
+	}
+	return ncpus;
+}
+
+static int _realtime_entry(const char *entry, int length)
+{
+	char string[128];
+
+	while (length > 0 && (*entry == ' ' || *entry == '\t'))
+	{
+		entry++;
+		length--;
+	}
+	while (length > 0 && (entry[length - 1] == ' ' || entry[length - 1] == '\t' ||
+				entry[length - 1] == '\r'))
+		length--;
+	if (length == 0 || entry[0] == '#')
+		return 0;
+	if (length >= sizeof(string))
+		length = sizeof(string) - 1;
+	memcpy(string, entry, length);
+	string[length] = '\0';
+
+	char *value = strchr(string, '=');
+	if (value == NULL)
+	{
+		err("realtime: bad thread configuration %s", string);
+		return -1;
+	}
+	*value = '\0';
+	value++;
+	realtime_role_t *role = _realtime_role(string, 1);
+	if (role == NULL)
+		return -1;
+	role->policy = -1;
+	role->priority = -1;
+	role->ncpus = 0;
+
+	char *cpus = strchr(value, '@');
+	if (cpus != NULL)
+	{
+		*cpus = '\0';
+		role->ncpus = _realtime_cpus(cpus + 1, &role->cpus);
+		/**
+		 * the thread creation fails if no cpu of the set is available
+		 */
+		cpu_set_t online;
+		if (sched_getaffinity(0, sizeof(online), &online) == 0)
+		{
+			CPU_AND(&role->cpus, &role->cpus, &online);
+			role->ncpus = CPU_COUNT(&role->cpus);
+		}
+		if (role->ncpus == 0)
+			warn("realtime: no cpu available for %s", role->name);
+	}
+	char *priority = strchr(value, ':');
+	if (priority != NULL)
+	{
+		*priority = '\0';
+		role->priority = strtol(priority + 1, NULL, 10);
+	}
+	if (!strcmp(value, "fifo"))
+		role->policy = SCHED_FIFO;
+	else if (!strcmp(value, "rr"))
+		role->policy = SCHED_RR;
+	else if (!strcmp(value, "other"))
+		role->policy = SCHED_OTHER;
+	else if (value[0] != '\0')
+		warn("realtime: unknown policy %s for %s", value, role->name);
+	dbg("realtime: %s policy %d priority %d on %d cpus",
+		role->name, role->policy, role->priority, role->ncpus);
+	return 0;
+}
+
+int realtime_config(const char *config)
+{
+	int ret = 0;
+	if (config == NULL)
+		return 0;
+	FILE *file = fopen(config, "r");
+	if (file != NULL)
+	{
+		char line[128];
+		while (fgets(line, sizeof(line), file) != NULL)
+		{
+			if (_realtime_entry(line, strcspn(line, "\n")) < 0)
+				ret = -1;
+		}
+		fclose(file);
+		return ret;
+	}
+	while (*config != '\0')
+	{
+		int length = strcspn(config, ";\n");
+		if (_realtime_entry(config, length) < 0)
+			ret = -1;
+		config += length;
+		if (*config != '\0')
+			config++;
+	}
+	return ret;
+}
+
+int realtime_thread(pthread_t *thread, pthread_attr_t *attr, const char *role,
+		void *(*routine)(void *), void *arg)
+{
+	int ret;
+	realtime_role_t *config = _realtime_role(role, 0);
+	if (config == NULL)
+		return pthread_create(thread, attr, routine, arg);
+
+	pthread_attr_t defaultattr;
+	struct sched_param params;
+	int policy;
+	if (attr == NULL)
+	{
+		/**
+		 * the stage inherits the scheduling of the main thread
+		 */
+		pthread_attr_init(&defaultattr);
+		pthread_getschedparam(pthread_self(), &policy, &params);
+		attr = &defaultattr;
+	}
+	else
+	{
+		pthread_attr_getschedpolicy(attr, &policy);
+		pthread_attr_getschedparam(attr, &params);
+	}
+
+	if (config->policy != -1 || config->priority != -1)
+	{
+		if (config->policy != -1)
+			policy = config->policy;
+		if (config->priority != -1)
+			params.sched_priority = config->priority;
+		if (params.sched_priority > sched_get_priority_max(policy))
+			params.sched_priority = sched_get_priority_max(policy);
+		if (params.sched_priority < sched_get_priority_min(policy))
+			params.sched_priority = sched_get_priority_min(policy);
+		pthread_attr_setschedpolicy(attr, policy);
+		pthread_attr_setschedparam(attr, &params);
+		if (getuid() == 0)
+			pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+		else
+			warn("run server as root to use realtime");
+	}
+	if (config->ncpus > 0)
+	{
+		ret = pthread_attr_setaffinity_np(attr, sizeof(config->cpus), &config->cpus);
+		if (ret != 0)
+			err("realtime: %s affinity error %s", role, strerror(ret));
+	}
+	ret = pthread_create(thread, attr, routine, arg);
+	if (ret != 0)
+		err("realtime: %s thread error %s", role, strerror(ret));
+	else
+		dbg("realtime: %s thread policy %d priority %d", role, policy, params.sched_priority);
+	if (attr == &defaultattr)
+		pthread_attr_destroy(attr);
+	return ret;
+}
+
+#ifdef REALTIME_TRAP
+/**
+ * debug hook to find the allocations from the audio threads.
+ * The allocator of the libc is always used, the functions only check
+ * the thread.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static void _realtime_trap(const char *function, size_t size)
+{
+	/**
+	 * the trap must not allocate
+	 */
+	_realtime_thread = 0;
+	err("realtime: %s(%lu) from an audio thread", function, size);
+	raise(SIGTRAP);
+}
+
+void *malloc(size_t size)
+{
+	if (_realtime_thread)
+		_realtime_trap("malloc", size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (_realtime_thread)
+		_realtime_trap("calloc", nmemb * size);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (_realtime_thread)
+		_realtime_trap("realloc", size);
+	return __libc_realloc(ptr, size);
+}
+#endif
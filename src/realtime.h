@@ -0,0 +1,51 @@
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#ifndef REALTIME_STACKSIZE
+#define REALTIME_STACKSIZE (256 * 1024)
+#endif
+#ifndef REALTIME_HEAPSIZE
+#define REALTIME_HEAPSIZE (16 * 1024 * 1024)
+#endif
+
+#ifdef USE_REALTIME
+#include <pthread.h>
+
+/**
+ * lock the memory of the process and prefault the heap.
+ * The heap is never returned to the system, it becomes the arena
+ * of the allocations of the pipelines.
+ * The stack of the new threads is set to REALTIME_STACKSIZE.
+ */
+int realtime_init(size_t heapsize);
+/**
+ * to call at the beginning of an audio thread.
+ * It prefaults the stack of the thread and with REALTIME_TRAP
+ * any allocation from this thread raises SIGTRAP.
+ */
+void realtime_enter(void);
+void realtime_leave(void);
+/**
+ * set the placement of the threads of the pipeline.
+ * config is a file or a string of entries separated by ';' or lines:
+ *   <role>=[fifo|rr|other][:<priority>][@<cpu list>]
+ * The roles are src, demux, decoder, encoder, mux, sink, heartbeat
+ * and server. ie: "decoder=@2;encoder=fifo:60@2-3;sink=rr:70@3"
+ */
+int realtime_config(const char *config);
+/**
+ * create the thread of a stage of the pipeline.
+ * attr contains the default scheduling of the stage (it may be NULL),
+ * the configuration of the role overrides it.
+ */
+int realtime_thread(pthread_t *thread, pthread_attr_t *attr, const char *role,
+		void *(*routine)(void *), void *arg);
+#else
+#define realtime_init(...) 0
+#define realtime_enter()
+#define realtime_leave()
+#define realtime_config(...) 0
+#define realtime_thread(thread, attr, role, routine, arg) pthread_create(thread, attr, routine, arg)
+#endif
+
+#endif
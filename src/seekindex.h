@@ -0,0 +1,54 @@
+#ifndef __SEEKINDEX_H__
+#define __SEEKINDEX_H__
+
+#include <stdint.h>
+
+#define SEEKINDEX_LENGTH 512
+
+/**
+ * the seek index of a stream: the offset into the stream of the
+ * first frame of each step of seconds. The index is filled in order
+ * during the decoding, and the step doubles when the index is full.
+ */
+typedef struct seekindex_s seekindex_t;
+struct seekindex_s
+{
+	unsigned int step;
+	unsigned int length;
+	long offset[SEEKINDEX_LENGTH];
+};
+
+static inline void seekindex_add(seekindex_t *index, uint32_t position, long offset)
+{
+	if (index->step == 0)
+		index->step = 1;
+	if (index->length == SEEKINDEX_LENGTH &&
+		position / index->step >= SEEKINDEX_LENGTH)
+	{
+		int i;
+		for (i = 0; i < SEEKINDEX_LENGTH / 2; i++)
+			index->offset[i] = index->offset[i * 2];
+		index->length = SEEKINDEX_LENGTH / 2;
+		index->step *= 2;
+	}
+	if (position / index->step != index->length)
+		return;
+	index->offset[index->length++] = offset;
+}
+
+/**
+ * @return the indexed position before position and its offset
+ */
+static inline uint32_t seekindex_find(const seekindex_t *index, uint32_t position, long *offset)
+{
+	*offset = 0;
+	if (index->length == 0)
+		return 0;
+	unsigned int i = position / index->step;
+	if (i >= index->length)
+		i = index->length - 1;
+	*offset = index->offset[i];
+	return i * index->step;
+}
+
+#endif
@@ -36,6 +36,7 @@
 #include "player.h"
 #include "jitter.h"
 #include "encoder.h"
+#include "realtime.h"
 typedef struct sink_s sink_t;
 typedef struct sink_ctx_s sink_ctx_t;
 struct sink_ctx_s
@@ -436,6 +437,10 @@ static int _alsa_checksamplerate(sink_ctx_t *ctx)
 	int ret = 0;
 	if(ctx->in->ctx->frequence && (ctx->in->ctx->frequence != ctx->samplerate))
 	{
+		/**
+		 * reopening the device allocates into alsa-lib
+		 */
+		realtime_leave();
 		_pcm_close(ctx);
 		int size = ctx->buffersize;
 		ctx->samplerate = ctx->in->ctx->frequence;
@@ -447,6 +452,7 @@ static int _alsa_checksamplerate(sink_ctx_t *ctx)
 		{
 			ctx->noise[i] = (char)random();
 		}
+		realtime_enter();
 	}
 #ifdef SAMPLERATE_AUTO
 	ctx->in->ctx->frequence = 0;
@@ -472,6 +478,7 @@ static void *sink_thread(void *arg)
 		sched_yield();
 		usleep(LATENCE_MS * 1000);
 	}
+	realtime_enter();
 	while (ctx->state != STATE_ERROR)
 	{
 		unsigned char *buff = NULL;
@@ -551,6 +558,7 @@ static void *sink_thread(void *arg)
 			sink_dbg("sink: play %d", ret);
 		}
 	}
+	realtime_leave();
 	dbg("sink: thread end");
 #ifdef SINK_DUMP
 	close(ctx->dumpfd);
@@ -607,7 +615,7 @@ static int alsa_run(sink_ctx_t *ctx)
 			(SINK_POLICY == SCHED_RR)?"rr_sched":"fifo", params.sched_priority);
 #endif
 	warn("sink: alsa start thread");
-	ret = pthread_create(&ctx->thread, &attr, sink_thread, ctx);
+	ret = realtime_thread(&ctx->thread, &attr, "sink", sink_thread, ctx);
 	pthread_attr_destroy(&attr);
 	if (ret < 0)
 		err("pthread error %s", strerror(errno));
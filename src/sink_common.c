@@ -21,6 +21,8 @@ extern const sink_ops_t *sink_file;
 extern const sink_ops_t *sink_udp;
 extern const sink_ops_t *sink_rtp;
 extern const sink_ops_t *sink_unix;
+extern const sink_ops_t *sink_http;
+extern const sink_ops_t *sink_hls;
 extern const sink_ops_t *sink_pulse;
 
 static sink_t _sink = {0};
@@ -43,6 +45,12 @@ sink_t *sink_build(player_ctx_t *player, const char *arg)
 #ifdef SINK_UNIX
 		sink_unix,
 #endif
+#ifdef SINK_HTTP
+		sink_http,
+#endif
+#ifdef SINK_HLS
+		sink_hls,
+#endif
 #ifdef SINK_PULSE
 		sink_pulse,
 #endif
@@ -28,14 +28,18 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 
 #include "player.h"
 #include "encoder.h"
+#include "seekindex.h"
+#include "mpegaudio.h"
 typedef struct sink_s sink_t;
 typedef struct sink_ctx_s sink_ctx_t;
 struct sink_ctx_s
@@ -44,10 +48,30 @@ struct sink_ctx_s
 	player_ctx_t *player;
 	jitter_t *in;
 	const encoder_t *encoder;
+	int offline;
+	/** the offline mode batches the writings */
+	unsigned char *batch;
+	size_t batchlen;
+	/** the number of bytes written into the file */
+	uint64_t length;
+	/** the description of the stream for the header and the trailer */
+	int container;
+	uint64_t nsamples;
+	uint32_t nframes;
+	uint32_t minframe;
+	uint32_t maxframe;
+	int bitrate;
+	uint64_t first;
+	uint64_t next;
+	unsigned char head[4];
+	int headlen;
+	seekindex_t index;
 };
 #define SINK_CTX
 #include "sink.h"
 #include "jitter.h"
+#include "media.h"
+#include "realtime.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -60,11 +84,374 @@ struct sink_ctx_s
 
 #define BUFFERSIZE ENCODER_FRAME_SIZE
 
+#ifndef SINK_FILE_BATCHSIZE
+#define SINK_FILE_BATCHSIZE (256 * 1024)
+#endif
+/**
+ * the offline mode transcodes as fast as possible,
+ * the threads of the pipeline leave the realtime scheduling.
+ */
+#define SINK_FILE_OFFLINETHREADS "src=other;demux=other;decoder=other;encoder=other;mux=other;sink=other;heartbeat=other"
+
+#define CONTAINER_NONE 0
+#define CONTAINER_WAV 1
+#define CONTAINER_MP3 2
+#define CONTAINER_FLAC 3
+
+#define WAV_HEADERSIZE 80
+#define MP3_MAXFRAMESIZE 1441
+
 static const char *jitter_name = "file output";
 
+static void _sink_le16(unsigned char *data, uint16_t value)
+{
+	data[0] = value;
+	data[1] = value >> 8;
+}
+
+static void _sink_le32(unsigned char *data, uint32_t value)
+{
+	_sink_le16(data, value);
+	_sink_le16(data + 2, value >> 16);
+}
+
+static void _sink_le64(unsigned char *data, uint64_t value)
+{
+	_sink_le32(data, value);
+	_sink_le32(data + 4, value >> 32);
+}
+
+static void _sink_be32(unsigned char *data, uint32_t value)
+{
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+static int _sink_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0)
+	{
+		ssize_t ret = writev(fd, iov, iovcnt);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		while (iovcnt > 0 && ret >= iov->iov_len)
+		{
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * the data are copied into the batch buffer, when it is full
+ * the buffer and the new data are written with the same call.
+ */
+static int _sink_batch(sink_ctx_t *ctx, const unsigned char *buff, size_t len)
+{
+	if (ctx->batchlen + len <= SINK_FILE_BATCHSIZE)
+	{
+		memcpy(ctx->batch + ctx->batchlen, buff, len);
+		ctx->batchlen += len;
+	}
+	else
+	{
+		struct iovec iov[2] = {
+			{.iov_base = ctx->batch, .iov_len = ctx->batchlen},
+			{.iov_base = (void *)buff, .iov_len = len},
+		};
+		if (_sink_writev(ctx->fd, iov, 2) < 0)
+		{
+			err("sink file %d error: %s", ctx->fd, strerror(errno));
+			return -1;
+		}
+		ctx->batchlen = 0;
+	}
+	ctx->length += len;
+	return len;
+}
+
+static int _sink_flush(sink_ctx_t *ctx)
+{
+	struct iovec iov = {.iov_base = ctx->batch, .iov_len = ctx->batchlen};
+	ctx->batchlen = 0;
+	if (_sink_writev(ctx->fd, &iov, 1) < 0)
+	{
+		err("sink file %d error: %s", ctx->fd, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * The WAV header reserves a JUNK chunk, it becomes the ds64 chunk
+ * of a RF64 file when the data are larger than 4GB.
+ */
+static void _sink_wavheader(sink_ctx_t *ctx, unsigned char *header, uint64_t datalen)
+{
+	jitter_format_t format = ctx->in->format;
+	uint16_t nchannels = (format & JITTER_AUDIO_INTERLEAVED)? 2: 1;
+	uint16_t samplesize = (format & 0x0F00) >> 8;
+	if (format == PCM_24bits4_LE_stereo)
+		samplesize = 4;
+	uint32_t samplerate = jitter_samplerate(ctx->in);
+	uint64_t riff = datalen + WAV_HEADERSIZE - 8;
+	int rf64 = (riff > UINT32_MAX);
+
+	memset(header, 0, WAV_HEADERSIZE);
+	memcpy(header, rf64? "RF64": "RIFF", 4);
+	_sink_le32(header + 4, rf64? UINT32_MAX: riff);
+	memcpy(header + 8, "WAVE", 4);
+	memcpy(header + 12, rf64? "ds64": "JUNK", 4);
+	_sink_le32(header + 16, 28);
+	if (rf64)
+	{
+		_sink_le64(header + 20, riff);
+		_sink_le64(header + 28, datalen);
+		_sink_le64(header + 36, datalen / (nchannels * samplesize));
+	}
+	memcpy(header + 48, "fmt ", 4);
+	_sink_le32(header + 52, 16);
+	_sink_le16(header + 56, 1);
+	_sink_le16(header + 58, nchannels);
+	_sink_le32(header + 60, samplerate);
+	_sink_le32(header + 64, samplerate * nchannels * samplesize);
+	_sink_le16(header + 68, nchannels * samplesize);
+	_sink_le16(header + 70, samplesize * 8);
+	memcpy(header + 72, "data", 4);
+	_sink_le32(header + 76, rf64? UINT32_MAX: datalen);
+}
+
+/**
+ * The MP3 stream is split on the frame headers to index the frames.
+ * The header of a frame may be cut between two buffers.
+ */
+static void _sink_mp3frames(sink_ctx_t *ctx, const unsigned char *buff, size_t len)
+{
+	uint64_t start = ctx->length;
+	uint64_t pos = ctx->next + ctx->headlen - start;
+	while (pos < len)
+	{
+		ctx->head[ctx->headlen++] = buff[pos++];
+		if (ctx->headlen < 4)
+			continue;
+		ctx->headlen = 0;
+		uint32_t length = mpegaudio_frame(ctx->head, NULL, NULL);
+		if (length == 0)
+		{
+			warn("sink: mp3 stream without sync at %llu", (unsigned long long)ctx->next);
+			ctx->container = CONTAINER_NONE;
+			return;
+		}
+		if (ctx->nframes == 0)
+			ctx->first = ctx->next;
+		else if (ctx->nframes == 1)
+			ctx->bitrate = ctx->head[2] >> 4;
+		else if (ctx->bitrate != (ctx->head[2] >> 4))
+			ctx->bitrate = -1;
+		seekindex_add(&ctx->index, ctx->nframes, ctx->next - ctx->first);
+		ctx->nframes++;
+		ctx->next += length;
+		pos = ctx->next - start;
+	}
+}
+
+/**
+ * The encoder starts the stream with an empty frame, it is replaced
+ * by a Xing (or Info for CBR) frame with the table of contents.
+ */
+static void _sink_mp3trailer(sink_ctx_t *ctx)
+{
+	unsigned char frame[MP3_MAXFRAMESIZE];
+	if (ctx->nframes < 2 || pread(ctx->fd, frame, 4, ctx->first) != 4)
+		return;
+	uint32_t length = mpegaudio_frame(frame, NULL, NULL);
+	if (length == 0 || length > sizeof(frame) ||
+		pread(ctx->fd, frame, length, ctx->first) != length)
+		return;
+
+	int mono = ((frame[3] >> 6) == 3);
+	size_t offset = 4;
+	if (!(frame[1] & 0x01))
+		offset += 2;
+	if (((frame[1] >> 3) & 0x03) == 3)
+		offset += mono? 17: 32;
+	else
+		offset += mono? 9: 17;
+	if (offset + 120 > length)
+		return;
+	unsigned char *tag = frame + offset;
+	int i;
+	for (i = 0; i < 120; i++)
+	{
+		if (tag[i] != 0)
+		{
+			dbg("sink: mp3 first frame is not empty");
+			return;
+		}
+	}
+
+	uint32_t nframes = ctx->nframes - 1;
+	uint64_t nbytes = ctx->length - ctx->first;
+	if (nbytes > UINT32_MAX)
+		nbytes = UINT32_MAX;
+	memcpy(tag, (ctx->bitrate < 0)? "Xing": "Info", 4);
+	/// frames, bytes, toc and quality fields
+	_sink_be32(tag + 4, 0x0F);
+	_sink_be32(tag + 8, nframes);
+	_sink_be32(tag + 12, nbytes);
+	for (i = 0; i < 100; i++)
+	{
+		long frameoffset = 0;
+		seekindex_find(&ctx->index, 1 + (uint64_t)i * nframes / 100, &frameoffset);
+		uint64_t value = (uint64_t)frameoffset * 256 / nbytes;
+		tag[16 + i] = (value > 255)? 255: value;
+	}
+	if (pwrite(ctx->fd, frame, length, ctx->first) != length)
+		err("sink file %d error: %s", ctx->fd, strerror(errno));
+}
+
+static uint32_t _sink_flacblocksize(const unsigned char *frame, size_t len)
+{
+	int code = frame[2] >> 4;
+	if (code == 1)
+		return 192;
+	if (code >= 2 && code <= 5)
+		return 576 << (code - 2);
+	if (code >= 8)
+		return 256 << (code - 8);
+	if (code != 6 && code != 7)
+		return 0;
+	/// the blocksize follows the UTF-8 coded number of the frame
+	size_t offset = 4;
+	unsigned char c = frame[offset];
+	int n = 0;
+	while (c & 0x80)
+	{
+		n++;
+		c <<= 1;
+	}
+	offset += (n == 0)? 1: n;
+	if (code == 6 && offset + 1 <= len)
+		return frame[offset] + 1;
+	if (code == 7 && offset + 2 <= len)
+		return ((frame[offset] << 8) | frame[offset + 1]) + 1;
+	return 0;
+}
+
+/**
+ * the FLAC encoder pushes one frame into each buffer
+ */
+static void _sink_flacframe(sink_ctx_t *ctx, const unsigned char *buff, size_t len)
+{
+	if (ctx->length == 0 && (len < 4 || memcmp(buff, "fLaC", 4)))
+	{
+		ctx->container = CONTAINER_NONE;
+		return;
+	}
+	if (len < 5 || buff[0] != 0xFF || (buff[1] & 0xFE) != 0xF8)
+		return;
+	uint32_t blocksize = _sink_flacblocksize(buff, len);
+	if (blocksize == 0)
+		return;
+	ctx->nsamples += blocksize;
+	if (ctx->nframes == 0 || len < ctx->minframe)
+		ctx->minframe = len;
+	if (len > ctx->maxframe)
+		ctx->maxframe = len;
+	ctx->nframes++;
+}
+
+/**
+ * the encoder writes the STREAMINFO without the number of samples
+ */
+static void _sink_flactrailer(sink_ctx_t *ctx)
+{
+	unsigned char streaminfo[18];
+	if (ctx->nframes == 0 || pread(ctx->fd, streaminfo, sizeof(streaminfo), 8) != sizeof(streaminfo))
+		return;
+	streaminfo[4] = ctx->minframe >> 16;
+	streaminfo[5] = ctx->minframe >> 8;
+	streaminfo[6] = ctx->minframe;
+	streaminfo[7] = ctx->maxframe >> 16;
+	streaminfo[8] = ctx->maxframe >> 8;
+	streaminfo[9] = ctx->maxframe;
+	streaminfo[13] = (streaminfo[13] & 0xF0) | ((ctx->nsamples >> 32) & 0x0F);
+	_sink_be32(streaminfo + 14, ctx->nsamples);
+	if (pwrite(ctx->fd, streaminfo, sizeof(streaminfo), 8) != sizeof(streaminfo))
+		err("sink file %d error: %s", ctx->fd, strerror(errno));
+}
+
+static int _sink_container(sink_ctx_t *ctx, unsigned char *buff, int len)
+{
+	switch (ctx->container)
+	{
+	case CONTAINER_WAV:
+		if (ctx->length == 0)
+		{
+			unsigned char header[WAV_HEADERSIZE];
+			/// the length is unknown until the trailer
+			_sink_wavheader(ctx, header, UINT32_MAX - WAV_HEADERSIZE);
+			return _sink_batch(ctx, header, sizeof(header));
+		}
+	break;
+	case CONTAINER_MP3:
+		_sink_mp3frames(ctx, buff, len);
+	break;
+	case CONTAINER_FLAC:
+		_sink_flacframe(ctx, buff, len);
+	break;
+	}
+	return 0;
+}
+
+static void _sink_trailer(sink_ctx_t *ctx)
+{
+	if (lseek(ctx->fd, 0, SEEK_CUR) < 0)
+		return;
+	switch (ctx->container)
+	{
+	case CONTAINER_WAV:
+		if (ctx->length > WAV_HEADERSIZE)
+		{
+			unsigned char header[WAV_HEADERSIZE];
+			_sink_wavheader(ctx, header, ctx->length - WAV_HEADERSIZE);
+			if (pwrite(ctx->fd, header, sizeof(header), 0) != sizeof(header))
+				err("sink file %d error: %s", ctx->fd, strerror(errno));
+		}
+	break;
+	case CONTAINER_MP3:
+		_sink_mp3trailer(ctx);
+	break;
+	case CONTAINER_FLAC:
+		_sink_flactrailer(ctx);
+	break;
+	}
+}
+
 static int sink_write(sink_ctx_t *ctx, unsigned char *buff, int len)
 {
 	int ret;
+	if (ctx->offline && len > 0)
+	{
+		ret = _sink_container(ctx, buff, len);
+		if (ret >= 0)
+			ret = _sink_batch(ctx, buff, len);
+		sink_dbg("sink: batch %d", ret);
+		return ret;
+	}
+	if (ctx->offline && _sink_flush(ctx) < 0)
+		return -1;
 	ret = write(ctx->fd, buff, len);
 	sink_dbg("sink: write %d", ret);
 	if (ret < 0)
@@ -74,15 +461,25 @@ static int sink_write(sink_ctx_t *ctx, unsigned char *buff, int len)
 	return ret;
 }
 
-static sink_ctx_t *sink_init(player_ctx_t *player, const char *path)
+static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
 {
 	int fd;
+	const char *path = url;
 	if (!strncmp(path, "file://", 7))
 		path += 7;
-	if (!strcmp(path, "-"))
+	/**
+	 * "file:///out.flac?offline" transcodes the stream without pacing
+	 */
+	const char *options = strchr(path, '?');
+	int offline = (options != NULL && strstr(options, "offline") != NULL);
+	char *filepath = strndup(path, (options != NULL)? options - path: strlen(path));
+	if (!strcmp(filepath, "-"))
 		fd = 1;
+	else if (offline)
+		fd = open(filepath, O_RDWR | O_CREAT | O_TRUNC, 0644);
 	else
-		fd = open(path, O_RDWR | O_CREAT, 0644);
+		fd = open(filepath, O_RDWR | O_CREAT, 0644);
+	free(filepath);
 
 	if (fd >= 0)
 	{
@@ -98,6 +495,17 @@ static sink_ctx_t *sink_init(player_ctx_t *player, const char *path)
 		jitter->format = SINK_BITSSTREAM;
 		ctx->in = jitter;
 
+		if (offline)
+		{
+			/**
+			 * the ring jitter calls sink_write from the encoder thread,
+			 * it never waits the heartbeat of the encoder.
+			 */
+			ctx->offline = 1;
+			ctx->batch = malloc(SINK_FILE_BATCHSIZE);
+			realtime_config(SINK_FILE_OFFLINETHREADS);
+			dbg("sink: offline transcoding");
+		}
 		return ctx;
 	}
 	err("sink file error: %s", strerror(errno));
@@ -118,6 +526,18 @@ static jitter_t *sink_jitter(sink_ctx_t *ctx, unsigned int index)
 
 static unsigned int sink_attach(sink_ctx_t *ctx, const char *mime)
 {
+	if (!ctx->offline || mime == NULL)
+		return 0;
+	if (!strcmp(mime, mime_audiopcm))
+	{
+		/// the decoders write the samples into the jitter
+		ctx->in->format = PCM_16bits_LE_stereo;
+		ctx->container = CONTAINER_WAV;
+	}
+	else if (!strcmp(mime, mime_audiomp3))
+		ctx->container = CONTAINER_MP3;
+	else if (!strcmp(mime, mime_audioflac))
+		ctx->container = CONTAINER_FLAC;
 	return 0;
 }
 
@@ -128,6 +548,12 @@ static const encoder_t *sink_encoder(sink_ctx_t *ctx)
 
 static void sink_destroy(sink_ctx_t *sink)
 {
+	if (sink->offline)
+	{
+		_sink_flush(sink);
+		_sink_trailer(sink);
+		free(sink->batch);
+	}
 	jitter_destroy(sink->in);
 	close(sink->fd);
 	free(sink);
@@ -0,0 +1,440 @@
+/*****************************************************************************
+ * sink_hls.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <pthread.h>
+
+#include "player.h"
+#include "encoder.h"
+#include "mpegaudio.h"
+
+/** the default duration of a segment in seconds */
+#ifndef SINK_HLS_DURATION
+#define SINK_HLS_DURATION 4
+#endif
+/** the default number of segments into the playlist */
+#ifndef SINK_HLS_SEGMENTS
+#define SINK_HLS_SEGMENTS 6
+#endif
+/**
+ * the segments out of the playlist stay on the disk during
+ * SINK_HLS_GRACE durations for the slow clients.
+ */
+#define SINK_HLS_GRACE 2
+#define SINK_HLS_MAXSEGMENTS 32
+/** the longest segment in seconds, the buffer of the segment depends on it */
+#define SINK_HLS_MAXDURATION 60
+#define SINK_HLS_MAXBITRATE 320000
+
+/**
+ * the HLS packed audio starts each segment with an ID3 PRIV frame
+ * containing the MPEG-2 timestamp (90kHz) of the first sample.
+ */
+#define SINK_HLS_ID3OWNER "com.apple.streaming.transportStreamTimestamp"
+#define SINK_HLS_ID3SIZE (10 + 10 + sizeof(SINK_HLS_ID3OWNER) + 8)
+
+typedef struct sink_s sink_t;
+typedef struct sink_segment_s sink_segment_t;
+struct sink_segment_s
+{
+	unsigned int sequence;
+	uint32_t nsamples;
+	uint32_t samplerate;
+};
+
+typedef struct sink_ctx_s sink_ctx_t;
+struct sink_ctx_s
+{
+	player_ctx_t *player;
+	jitter_t *in;
+	const encoder_t *encoder;
+	pthread_t thread;
+	int mp3;
+	/** the playlist and the directory of the segments */
+	char *playlist;
+	char *directory;
+	char *prefix;
+	unsigned int duration;
+	unsigned int nsegments;
+	unsigned int nslots;
+	/** the segments on the disk, the slot is the sequence modulo nslots */
+	sink_segment_t segments[SINK_HLS_MAXSEGMENTS];
+	unsigned int sequence;
+	/** the segment in progress */
+	unsigned char *buffer;
+	size_t size;
+	size_t length;
+	/** the offset of the next frame into the buffer */
+	size_t frame;
+	uint32_t nsamples;
+	uint32_t samplerate;
+	/** the number of samples before the segment */
+	uint64_t position;
+};
+#define SINK_CTX
+#include "sink.h"
+#include "jitter.h"
+#include "media.h"
+#include "realtime.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define sink_dbg(...)
+
+#define BUFFERSIZE ENCODER_FRAME_SIZE
+
+static const char *jitter_name = "hls segmenter";
+
+static void _sink_id3(unsigned char *tag, uint64_t pts)
+{
+	/// all the sizes are lower than 128, the synchsafe integers are simple
+	memset(tag, 0, SINK_HLS_ID3SIZE);
+	memcpy(tag, "ID3\x04", 4);
+	tag[9] = SINK_HLS_ID3SIZE - 10;
+	memcpy(tag + 10, "PRIV", 4);
+	tag[17] = sizeof(SINK_HLS_ID3OWNER) + 8;
+	memcpy(tag + 20, SINK_HLS_ID3OWNER, sizeof(SINK_HLS_ID3OWNER));
+	unsigned char *timestamp = tag + 20 + sizeof(SINK_HLS_ID3OWNER);
+	pts &= 0x1FFFFFFFFULL;
+	for (int i = 7; i >= 0; i--, pts >>= 8)
+		timestamp[i] = pts & 0xFF;
+}
+
+static void _sink_segmentpath(sink_ctx_t *ctx, char *path, unsigned int sequence)
+{
+	snprintf(path, PATH_MAX, "%s/%s-%u.mp3", ctx->directory, ctx->prefix, sequence);
+}
+
+/**
+ * the playlist is replaced atomically, the web server never
+ * serves a partial file.
+ */
+static int _sink_playlist(sink_ctx_t *ctx, int end)
+{
+	char tmppath[PATH_MAX];
+	snprintf(tmppath, PATH_MAX, "%s.tmp", ctx->playlist);
+	FILE *playlist = fopen(tmppath, "w");
+	if (playlist == NULL)
+	{
+		err("sink: playlist error %s", strerror(errno));
+		return -1;
+	}
+	unsigned int first = 0;
+	if (ctx->sequence > ctx->nsegments)
+		first = ctx->sequence - ctx->nsegments;
+	fprintf(playlist, "#EXTM3U\n");
+	fprintf(playlist, "#EXT-X-VERSION:3\n");
+	fprintf(playlist, "#EXT-X-TARGETDURATION:%u\n", ctx->duration);
+	fprintf(playlist, "#EXT-X-MEDIA-SEQUENCE:%u\n", first);
+	for (unsigned int sequence = first; sequence < ctx->sequence; sequence++)
+	{
+		sink_segment_t *segment = &ctx->segments[sequence % ctx->nslots];
+		fprintf(playlist, "#EXTINF:%.3f,\n", (double)segment->nsamples / segment->samplerate);
+		fprintf(playlist, "%s-%u.mp3\n", ctx->prefix, sequence);
+	}
+	if (end)
+		fprintf(playlist, "#EXT-X-ENDLIST\n");
+	fclose(playlist);
+	if (rename(tmppath, ctx->playlist) < 0)
+	{
+		err("sink: playlist error %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * the file of the segment out of the grace period is renamed and rewritten
+ * for the new segment. The segment appears into the playlist after the writing.
+ */
+static int _sink_publish(sink_ctx_t *ctx, size_t length)
+{
+	char path[PATH_MAX];
+	_sink_segmentpath(ctx, path, ctx->sequence);
+	if (ctx->sequence >= ctx->nslots)
+	{
+		char oldpath[PATH_MAX];
+		_sink_segmentpath(ctx, oldpath, ctx->sequence - ctx->nslots);
+		rename(oldpath, path);
+	}
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		err("sink: segment %s error %s", path, strerror(errno));
+		return -1;
+	}
+	size_t offset = 0;
+	while (offset < length)
+	{
+		ssize_t ret = write(fd, ctx->buffer + offset, length - offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+		{
+			err("sink: segment %s error %s", path, strerror(errno));
+			close(fd);
+			return -1;
+		}
+		offset += ret;
+	}
+	if (ftruncate(fd, length) < 0)
+		err("sink: segment %s error %s", path, strerror(errno));
+	close(fd);
+
+	sink_segment_t *segment = &ctx->segments[ctx->sequence % ctx->nslots];
+	segment->sequence = ctx->sequence;
+	segment->nsamples = ctx->nsamples;
+	segment->samplerate = ctx->samplerate;
+	ctx->sequence++;
+	sink_dbg("sink: segment %u %u samples", segment->sequence, segment->nsamples);
+	return _sink_playlist(ctx, 0);
+}
+
+/**
+ * the segment is closed before the frame at ctx->frame,
+ * the rest of the buffer starts the next segment.
+ */
+static void _sink_cut(sink_ctx_t *ctx)
+{
+	if (ctx->samplerate > 0)
+		_sink_id3(ctx->buffer, ctx->position * 90000 / ctx->samplerate);
+	if (ctx->nsamples > 0)
+		_sink_publish(ctx, ctx->frame);
+	ctx->position += ctx->nsamples;
+	memmove(ctx->buffer + SINK_HLS_ID3SIZE, ctx->buffer + ctx->frame, ctx->length - ctx->frame);
+	ctx->length = SINK_HLS_ID3SIZE + ctx->length - ctx->frame;
+	ctx->frame = SINK_HLS_ID3SIZE;
+	ctx->nsamples = 0;
+}
+
+static void _sink_segment(sink_ctx_t *ctx, const unsigned char *buff, size_t length)
+{
+	if (ctx->length + length > ctx->size)
+	{
+		warn("sink: segment overflow");
+		ctx->frame = ctx->length;
+		_sink_cut(ctx);
+	}
+	memcpy(ctx->buffer + ctx->length, buff, length);
+	ctx->length += length;
+	while (ctx->frame + 4 <= ctx->length)
+	{
+		uint32_t samplerate;
+		uint32_t nsamples;
+		uint32_t framelength = mpegaudio_frame(ctx->buffer + ctx->frame, &samplerate, &nsamples);
+		if (framelength == 0)
+		{
+			/// resynchronize on the next frame
+			ctx->frame++;
+			continue;
+		}
+		if (ctx->samplerate > 0 && ctx->nsamples >= ctx->duration * ctx->samplerate)
+			_sink_cut(ctx);
+		ctx->samplerate = samplerate;
+		ctx->nsamples += nsamples;
+		ctx->frame += framelength;
+	}
+}
+
+static void *sink_thread(void *arg)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)arg;
+
+	warn("sink: running");
+	while (1)
+	{
+		unsigned char *buff = ctx->in->ops->peer(ctx->in->ctx, NULL);
+		if (buff == NULL)
+			break;
+		size_t length = ctx->in->ops->length(ctx->in->ctx);
+		if (ctx->mp3)
+			_sink_segment(ctx, buff, length);
+		ctx->in->ops->pop(ctx->in->ctx, length);
+	}
+	dbg("sink: thread end");
+	return NULL;
+}
+
+/**
+ * parse the numeric option "<name>=<value>" and check its range.
+ * It returns 0 if the option is absent and -1 on an invalid value.
+ */
+static int _sink_option(const char *options, const char *name, long min, long max, unsigned int *value)
+{
+	const char *string = strstr(options, name);
+	if (string == NULL)
+		return 0;
+	string += strlen(name);
+	char *end = NULL;
+	errno = 0;
+	long number = strtol(string, &end, 10);
+	if (errno != 0 || end == string || (*end != '\0' && *end != '&') || number <= 0)
+	{
+		err("sink: hls invalid option %s%s", name, string);
+		return -1;
+	}
+	if (number < min)
+		number = min;
+	if (number > max)
+		number = max;
+	*value = number;
+	return 0;
+}
+
+static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
+{
+	const char *path = url;
+	if (!strncmp(path, "hls://", 6))
+		path += 6;
+	/**
+	 * "hls:///tmp/putv/live.m3u8?duration=4&segments=6"
+	 * the segments are live-<sequence>.mp3 beside the playlist.
+	 */
+	const char *options = strchr(path, '?');
+	char *playlist = strndup(path, (options != NULL)? options - path: strlen(path));
+	const char *name = strrchr(playlist, '/');
+	if (name == NULL || name[1] == '\0')
+	{
+		err("sink: hls playlist path %s", playlist);
+		free(playlist);
+		return NULL;
+	}
+	unsigned int duration = SINK_HLS_DURATION;
+	unsigned int nsegments = SINK_HLS_SEGMENTS;
+	if (options != NULL &&
+		(_sink_option(options, "duration=", 1, SINK_HLS_MAXDURATION, &duration) < 0 ||
+		_sink_option(options, "segments=", 3, SINK_HLS_MAXSEGMENTS - SINK_HLS_GRACE, &nsegments) < 0))
+	{
+		free(playlist);
+		return NULL;
+	}
+
+	sink_ctx_t *ctx = calloc(1, sizeof(*ctx));
+	ctx->player = player;
+	ctx->playlist = playlist;
+	ctx->directory = strndup(playlist, name - playlist);
+	if (ctx->directory[0] == '\0')
+	{
+		free(ctx->directory);
+		ctx->directory = strdup("/");
+	}
+	name++;
+	ctx->prefix = strndup(name, strcspn(name, "."));
+	ctx->duration = duration;
+	ctx->nsegments = nsegments;
+	ctx->nslots = ctx->nsegments + SINK_HLS_GRACE;
+
+	/// the buffer of the segment is allocated once for the longest segment
+	ctx->size = SINK_HLS_ID3SIZE + (SINK_HLS_MAXBITRATE / 8) * (ctx->duration + 1) + BUFFERSIZE;
+	ctx->buffer = malloc(ctx->size);
+	ctx->length = SINK_HLS_ID3SIZE;
+	ctx->frame = SINK_HLS_ID3SIZE;
+
+	ctx->encoder = encoder_check(mime_audiomp3);
+
+	jitter_t *jitter = jitter_init(JITTER_TYPE_SG, jitter_name, 6, BUFFERSIZE);
+	jitter->ctx->frequence = 0;
+	jitter->ctx->thredhold = 2;
+	jitter->format = SINK_BITSSTREAM;
+	ctx->in = jitter;
+
+	return ctx;
+}
+
+static unsigned int sink_attach(sink_ctx_t *ctx, const char *mime)
+{
+	if (mime != NULL && !strcmp(mime, mime_audiomp3))
+		ctx->mp3 = 1;
+	else
+		err("sink: hls segments only mp3 stream");
+	return 0;
+}
+
+static jitter_t *sink_jitter(sink_ctx_t *ctx, unsigned int index)
+{
+	if (index == 0)
+		return ctx->in;
+	return NULL;
+}
+
+static const encoder_t *sink_encoder(sink_ctx_t *ctx)
+{
+	return ctx->encoder;
+}
+
+static int sink_run(sink_ctx_t *ctx)
+{
+	realtime_thread(&ctx->thread, NULL, "sink", sink_thread, ctx);
+	return 0;
+}
+
+static void sink_destroy(sink_ctx_t *ctx)
+{
+	if (ctx->thread)
+		pthread_join(ctx->thread, NULL);
+	if (ctx->mp3)
+	{
+		/// the last segment closes the playlist
+		ctx->frame = ctx->length;
+		_sink_cut(ctx);
+		_sink_playlist(ctx, 1);
+	}
+	jitter_destroy(ctx->in);
+	free(ctx->buffer);
+	free(ctx->prefix);
+	free(ctx->directory);
+	free(ctx->playlist);
+	free(ctx);
+}
+
+const sink_ops_t *sink_hls = &(sink_ops_t)
+{
+	.name = "hls",
+	.default_ = "hls:///tmp/putv/live.m3u8",
+	.init = sink_init,
+	.jitter = sink_jitter,
+	.attach = sink_attach,
+	.encoder = sink_encoder,
+	.run = sink_run,
+	.destroy = sink_destroy,
+};
@@ -0,0 +1,851 @@
+/*****************************************************************************
+ * sink_http.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netdb.h>
+
+#include <pthread.h>
+
+#include <unistd.h>
+
+#include "player.h"
+#include "jitter.h"
+#include "encoder.h"
+#include "event.h"
+#include "media.h"
+#include "realtime.h"
+
+#ifndef SINK_HTTP_RINGSIZE
+#define SINK_HTTP_RINGSIZE (1024 * 1024)
+#endif
+/** the stream already sent to a new client */
+#ifndef SINK_HTTP_BURSTSIZE
+#define SINK_HTTP_BURSTSIZE (64 * 1024)
+#endif
+/** the listeners of the stream, independent of the clients of the commands */
+#ifndef SINK_HTTP_MAXCLIENTS
+#define SINK_HTTP_MAXCLIENTS MAX_CLIENTS
+#endif
+/** the client is disconnected after too many drops */
+#define SINK_HTTP_MAXDROPS 4
+#define SINK_HTTP_METAINT 16000
+#define SINK_HTTP_METALENGTH (1 + 16 * 16)
+#define SINK_HTTP_HEADERSIZE (8 * 1024)
+#define SINK_HTTP_REQUESTSIZE 1024
+/** the search of the first frame of the burst */
+#define SINK_HTTP_SYNCLENGTH 4096
+/** the room of the writer into the ring while the server sends out of the lock */
+#define SINK_HTTP_GUARD (64 * 1024)
+
+typedef struct sink_s sink_t;
+typedef struct sink_client_s sink_client_t;
+struct sink_client_s
+{
+	int sock;
+	enum
+	{
+		CLIENT_FREE,
+		CLIENT_REQUEST,
+		CLIENT_RESPONSE,
+		CLIENT_STREAM,
+	} state;
+	int icy;
+	int drops;
+	/** the absolute position into the ring of the next byte to send */
+	uint64_t position;
+	/** the bytes of the stream sent since the last metadata block */
+	size_t metacount;
+	unsigned int metaseq;
+	unsigned char meta[SINK_HTTP_METALENGTH];
+	size_t metaoffset;
+	size_t metalength;
+	/** the request, then the response and the stream header */
+	char *out;
+	size_t offset;
+	size_t pending;
+};
+
+/**
+ * the state of the stream read under the lock,
+ * the clients are sent out of the lock with it.
+ */
+typedef struct sink_snapshot_s sink_snapshot_t;
+struct sink_snapshot_s
+{
+	uint64_t wposition;
+	unsigned char meta[SINK_HTTP_METALENGTH];
+	size_t metalength;
+	unsigned int metaseq;
+};
+
+typedef struct sink_ctx_s sink_ctx_t;
+struct sink_ctx_s
+{
+	player_ctx_t *player;
+	const encoder_t *encoder;
+	char *url;
+	const char *host;
+	const char *port;
+	const char *path;
+	const char *contenttype;
+	int sock;
+	int epollfd;
+	int eventfd;
+	int run;
+	int eventid;
+	pthread_t thread;
+	pthread_t thread2;
+	jitter_t *in;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/** the stream of the encoder shared by all the clients */
+	unsigned char *ring;
+	uint64_t wposition;
+	/** the oldest position of the ring sent out of the lock */
+	uint64_t rposition;
+	int reading;
+	/** the first bytes of a frame to start a client */
+	unsigned char syncmask;
+	/** the FLAC stream header: the marker and the metadata blocks */
+	unsigned char header[SINK_HTTP_HEADERSIZE];
+	size_t headerfill;
+	size_t headerlength;
+	int headerdone;
+	/** the ICY metadata block of the current media */
+	int icy;
+	unsigned char meta[SINK_HTTP_METALENGTH];
+	size_t metalength;
+	unsigned int metaseq;
+	sink_client_t clients[SINK_HTTP_MAXCLIENTS];
+	int nbclients;
+};
+#define SINK_CTX
+#include "sink.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define sink_dbg(...)
+
+#define BUFFERSIZE ENCODER_FRAME_SIZE
+
+static const char *jitter_name = "http socket";
+
+static void sink_onchange(void *arg, event_t event, void *eventarg);
+
+static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
+{
+	char *protocol = NULL;
+	char *host = NULL;
+	char *port = NULL;
+	char *path = NULL;
+	char *search = NULL;
+
+	char *value = utils_parseurl(url, &protocol, &host, &port, &path, &search);
+	if (protocol == NULL || strcmp(protocol, "http"))
+	{
+		free(value);
+		return NULL;
+	}
+
+	sink_ctx_t *ctx = calloc(1, sizeof(*ctx));
+	ctx->url = value;
+	ctx->host = host;
+	ctx->port = (port != NULL)? port: "8000";
+	ctx->path = path;
+	ctx->sock = -1;
+	ctx->encoder = ENCODER;
+	if (path != NULL)
+		ctx->encoder = encoder_check(path);
+
+	jitter_t *jitter = jitter_init(JITTER_TYPE_SG, jitter_name, 6, BUFFERSIZE);
+	jitter->ctx->frequence = 0;
+	jitter->ctx->thredhold = 2;
+	jitter->format = SINK_BITSSTREAM;
+	ctx->in = jitter;
+
+	ctx->ring = malloc(SINK_HTTP_RINGSIZE);
+	ctx->headerdone = 1;
+	ctx->meta[0] = 0;
+	ctx->metalength = 1;
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+
+	ctx->player = player;
+	ctx->eventid = player_eventlistener(player, sink_onchange, ctx, "sink_http");
+
+	return ctx;
+}
+
+static unsigned int sink_attach(sink_ctx_t *ctx, const char *mime)
+{
+	ctx->contenttype = mime;
+	if (mime == NULL)
+		ctx->contenttype = "application/octet-stream";
+	else if (!strcmp(mime, mime_audiomp3))
+	{
+		/// the ICY metadata are available only between the MPEG frames
+		ctx->contenttype = "audio/mpeg";
+		ctx->syncmask = 0xE0;
+		ctx->icy = 1;
+	}
+	else if (!strcmp(mime, mime_audioflac))
+	{
+		/// the decoder of the client needs the STREAMINFO
+		ctx->syncmask = 0xF8;
+		ctx->headerdone = 0;
+	}
+	return 0;
+}
+
+static jitter_t *sink_jitter(sink_ctx_t *ctx, unsigned int index)
+{
+	if (index == 0)
+		return ctx->in;
+	return NULL;
+}
+
+static const encoder_t *sink_encoder(sink_ctx_t *ctx)
+{
+	return ctx->encoder;
+}
+
+/**
+ * the metadata block is the length of the text divided by 16
+ * followed by the text padded with zeros.
+ */
+static void sink_onchange(void *arg, event_t event, void *eventarg)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)arg;
+
+	if (event != PLAYER_EVENT_CHANGE)
+		return;
+
+	char title[SINK_HTTP_METALENGTH];
+	char text[SINK_HTTP_METALENGTH];
+	int length = 0;
+	if (player_title(ctx->player, title, sizeof(title)) > 0)
+	{
+		/// ICY has no escape, a quote would end the title
+		int j = 0;
+		for (int i = 0; title[i] != '\0'; i++)
+		{
+			if (title[i] != '\'')
+				title[j++] = title[i];
+		}
+		title[j] = '\0';
+		/// the title is truncated to keep the end of the field
+		int max = sizeof(text) - 1 - (sizeof("StreamTitle='';") - 1);
+		length = snprintf(text, sizeof(text), "StreamTitle='%.*s';", max, title);
+	}
+
+	unsigned char meta[SINK_HTTP_METALENGTH] = {0};
+	meta[0] = (length + 15) / 16;
+	memcpy(meta + 1, text, length);
+	size_t metalength = 1 + meta[0] * 16;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (metalength != ctx->metalength || memcmp(meta, ctx->meta, metalength))
+	{
+		memcpy(ctx->meta, meta, metalength);
+		ctx->metalength = metalength;
+		ctx->metaseq++;
+		dbg("sink: metadata %.*s", length, text);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+/**
+ * the clients receive an empty block while the media doesn't change.
+ */
+static void _sink_metablock(const sink_snapshot_t *snapshot, sink_client_t *client)
+{
+	client->metaoffset = 0;
+	if (client->metaseq != snapshot->metaseq)
+	{
+		memcpy(client->meta, snapshot->meta, snapshot->metalength);
+		client->metalength = snapshot->metalength;
+		client->metaseq = snapshot->metaseq;
+	}
+	else
+	{
+		client->meta[0] = 0;
+		client->metalength = 1;
+	}
+}
+
+static void _sink_header(sink_ctx_t *ctx, const unsigned char *buff, size_t length)
+{
+	size_t copy = SINK_HTTP_HEADERSIZE - ctx->headerfill;
+	if (copy > length)
+		copy = length;
+	memcpy(ctx->header + ctx->headerfill, buff, copy);
+	ctx->headerfill += copy;
+	if (ctx->headerfill >= 4 && memcmp(ctx->header, "fLaC", 4))
+	{
+		ctx->headerdone = 1;
+		return;
+	}
+	size_t offset = 4;
+	while (offset + 4 <= ctx->headerfill)
+	{
+		int last = ctx->header[offset] & 0x80;
+		offset += 4 + ((ctx->header[offset + 1] << 16) |
+					(ctx->header[offset + 2] << 8) |
+					ctx->header[offset + 3]);
+		if (last)
+		{
+			if (offset <= ctx->headerfill)
+			{
+				ctx->headerlength = offset;
+				ctx->headerdone = 1;
+			}
+			break;
+		}
+	}
+	if (!ctx->headerdone && ctx->headerfill == SINK_HTTP_HEADERSIZE)
+	{
+		warn("sink: stream header too large for the new clients");
+		ctx->headerdone = 1;
+	}
+}
+
+/**
+ * must be called with the lock
+ * the bytes sent out of the lock are not overwritten.
+ */
+static void _sink_ringwrite(sink_ctx_t *ctx, const unsigned char *buff, size_t length)
+{
+	while (ctx->reading && ctx->wposition + length > ctx->rposition + SINK_HTTP_RINGSIZE)
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+	size_t offset = ctx->wposition % SINK_HTTP_RINGSIZE;
+	size_t first = SINK_HTTP_RINGSIZE - offset;
+	if (first > length)
+		first = length;
+	memcpy(ctx->ring + offset, buff, first);
+	memcpy(ctx->ring, buff + first, length - first);
+	ctx->wposition += length;
+}
+
+/**
+ * the new clients and the late clients restart on a frame
+ * SINK_HTTP_BURSTSIZE bytes before the end of the ring.
+ */
+static uint64_t _sink_burst(sink_ctx_t *ctx)
+{
+	if (!ctx->headerdone)
+		return 0;
+	uint64_t position = 0;
+	if (ctx->wposition > SINK_HTTP_BURSTSIZE)
+		position = ctx->wposition - SINK_HTTP_BURSTSIZE;
+	/// the stream header is sent with the response
+	if (position < ctx->headerlength)
+		position = ctx->headerlength;
+	if (ctx->syncmask == 0)
+		return position;
+	uint64_t pos;
+	for (pos = position; pos + 1 < ctx->wposition && pos < position + SINK_HTTP_SYNCLENGTH; pos++)
+	{
+		if (ctx->ring[pos % SINK_HTTP_RINGSIZE] == 0xFF &&
+			(ctx->ring[(pos + 1) % SINK_HTTP_RINGSIZE] & ctx->syncmask) == ctx->syncmask)
+			return pos;
+	}
+	return position;
+}
+
+/**
+ * must be called with the lock
+ * the too slow clients restart from the burst before the sending.
+ */
+static int _sink_prepareclient(sink_ctx_t *ctx, sink_client_t *client)
+{
+	if (ctx->wposition - client->position > SINK_HTTP_RINGSIZE - SINK_HTTP_GUARD)
+	{
+		/// the ring may overwrite the stream of the client during the sending
+		client->drops++;
+		warn("sink: client %d too slow", client->sock);
+		if (client->drops > SINK_HTTP_MAXDROPS)
+		{
+			errno = ENOBUFS;
+			return -1;
+		}
+		client->position = _sink_burst(ctx);
+	}
+	return 0;
+}
+
+/**
+ * the socket is never blocking the server:
+ * one sendmsg sends the pending metadata block and the stream
+ * until the next block, directly from the ring.
+ * It runs out of the lock, the stream is read until the snapshot.
+ */
+static int _sink_sendclient(sink_ctx_t *ctx, sink_client_t *client, const sink_snapshot_t *snapshot)
+{
+	ssize_t ret;
+	if (client->state == CLIENT_RESPONSE)
+	{
+		ret = send(client->sock, client->out + client->offset, client->pending, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		if (ret > 0)
+		{
+			client->offset += ret;
+			client->pending -= ret;
+		}
+		if (client->pending > 0)
+			return 0;
+		client->state = CLIENT_STREAM;
+	}
+	if (client->state != CLIENT_STREAM)
+		return 0;
+	while (1)
+	{
+		struct iovec iov[3];
+		int iovcnt = 0;
+		size_t metalength = client->metalength - client->metaoffset;
+		if (metalength > 0)
+		{
+			iov[iovcnt].iov_base = client->meta + client->metaoffset;
+			iov[iovcnt].iov_len = metalength;
+			iovcnt++;
+		}
+		size_t length = snapshot->wposition - client->position;
+		if (length == 0)
+			client->drops = 0;
+		if (client->icy && length > SINK_HTTP_METAINT - client->metacount)
+			length = SINK_HTTP_METAINT - client->metacount;
+		if (length > 0)
+		{
+			size_t offset = client->position % SINK_HTTP_RINGSIZE;
+			size_t first = SINK_HTTP_RINGSIZE - offset;
+			if (first > length)
+				first = length;
+			iov[iovcnt].iov_base = ctx->ring + offset;
+			iov[iovcnt].iov_len = first;
+			iovcnt++;
+			if (first < length)
+			{
+				iov[iovcnt].iov_base = ctx->ring;
+				iov[iovcnt].iov_len = length - first;
+				iovcnt++;
+			}
+		}
+		if (iovcnt == 0)
+			break;
+		struct msghdr msg = {
+			.msg_iov = iov,
+			.msg_iovlen = iovcnt,
+		};
+		ret = sendmsg(client->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (ret < 0)
+			return -1;
+		size_t sent = ret;
+		if (metalength > 0)
+		{
+			size_t metasent = (sent < metalength)? sent: metalength;
+			client->metaoffset += metasent;
+			sent -= metasent;
+			if (client->metaoffset == client->metalength)
+				client->metaoffset = client->metalength = 0;
+		}
+		client->position += sent;
+		client->metacount += sent;
+		if (client->icy && client->metacount == SINK_HTTP_METAINT)
+		{
+			client->metacount = 0;
+			_sink_metablock(snapshot, client);
+		}
+		if (ret < metalength + length)
+			break;
+	}
+	return 0;
+}
+
+static int _sink_request(sink_ctx_t *ctx, sink_client_t *client)
+{
+	ssize_t ret;
+	while ((ret = recv(client->sock, client->out + client->pending,
+				SINK_HTTP_REQUESTSIZE - 1 - client->pending, MSG_DONTWAIT)) > 0)
+		client->pending += ret;
+	if (ret == 0 && client->pending < SINK_HTTP_REQUESTSIZE - 1)
+		return -1;
+	if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		return -1;
+	client->out[client->pending] = '\0';
+	if (strstr(client->out, "\r\n\r\n") == NULL)
+		return (client->pending < SINK_HTTP_REQUESTSIZE - 1)? 0: -1;
+
+	const char *status = "200 OK";
+	const char *uri = client->out + 4;
+	size_t urilength = strcspn(uri, " ?");
+	if (strncmp(client->out, "GET ", 4))
+		status = "405 Method Not Allowed";
+	else if (ctx->path != NULL &&
+		(urilength != strlen(ctx->path) || strncmp(uri, ctx->path, urilength)))
+		status = "404 Not Found";
+	client->icy = ctx->icy && (strcasestr(client->out, "icy-metadata: 1") != NULL);
+
+	int length = snprintf(client->out, SINK_HTTP_REQUESTSIZE,
+				"HTTP/1.0 %s\r\n"
+				"Content-Type: %s\r\n"
+				"Cache-Control: no-cache\r\n"
+				"icy-name: putv\r\n",
+				status, ctx->contenttype);
+	if (client->icy)
+		length += snprintf(client->out + length, SINK_HTTP_REQUESTSIZE - length,
+				"icy-metaint: %d\r\n", SINK_HTTP_METAINT);
+	length += snprintf(client->out + length, SINK_HTTP_REQUESTSIZE - length, "\r\n");
+	if (strcmp(status, "200 OK"))
+	{
+		send(client->sock, client->out, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+		return -1;
+	}
+	memcpy(client->out + length, ctx->header, ctx->headerlength);
+	length += ctx->headerlength;
+
+	client->offset = 0;
+	client->pending = length;
+	client->position = _sink_burst(ctx);
+	client->metacount = 0;
+	/// the first block contains the title
+	client->metaseq = ctx->metaseq - 1;
+	client->state = CLIENT_RESPONSE;
+	dbg("sink: client %d starts %lu bytes late", client->sock,
+				(unsigned long)(ctx->wposition - client->position));
+	return 0;
+}
+
+static void _sink_close(sink_ctx_t *ctx, sink_client_t *client)
+{
+	epoll_ctl(ctx->epollfd, EPOLL_CTL_DEL, client->sock, NULL);
+	close(client->sock);
+	free(client->out);
+	memset(client, 0, sizeof(*client));
+	ctx->nbclients--;
+}
+
+static int _sink_accept(sink_ctx_t *ctx)
+{
+	int sock = accept4(ctx->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (sock < 0)
+		return -1;
+	int i;
+	for (i = 0; i < SINK_HTTP_MAXCLIENTS; i++)
+	{
+		if (ctx->clients[i].state == CLIENT_FREE)
+			break;
+	}
+	if (i == SINK_HTTP_MAXCLIENTS)
+	{
+		warn("sink: too many clients");
+		close(sock);
+		return -1;
+	}
+	sink_client_t *client = &ctx->clients[i];
+	client->sock = sock;
+	client->state = CLIENT_REQUEST;
+	client->out = malloc(SINK_HTTP_REQUESTSIZE + SINK_HTTP_HEADERSIZE);
+	client->offset = 0;
+	client->pending = 0;
+	/// the edge trigger wakes up the server only when the socket becomes writable
+	struct epoll_event event = {
+		.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+		.data.ptr = client,
+	};
+	epoll_ctl(ctx->epollfd, EPOLL_CTL_ADD, sock, &event);
+	ctx->nbclients++;
+	return 0;
+}
+
+/**
+ * must be called with the lock
+ * @return 1 if the client is writable, -1 on error
+ */
+static int _sink_clientevent(sink_ctx_t *ctx, sink_client_t *client, uint32_t events)
+{
+	if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+		return -1;
+	if (client->state == CLIENT_REQUEST)
+	{
+		if (_sink_request(ctx, client) < 0)
+			return -1;
+		return (client->state == CLIENT_RESPONSE);
+	}
+	if (events & EPOLLIN)
+	{
+		char trash[256];
+		ssize_t ret;
+		while ((ret = recv(client->sock, trash, sizeof(trash), MSG_DONTWAIT)) > 0);
+		if (ret == 0)
+			return -1;
+	}
+	return (events & EPOLLOUT)? 1: 0;
+}
+
+static void *sink_thread(void *arg)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)arg;
+
+	warn("sink: running");
+	while (1)
+	{
+		unsigned char *buff = ctx->in->ops->peer(ctx->in->ctx, NULL);
+		if (buff == NULL)
+			break;
+		size_t length = ctx->in->ops->length(ctx->in->ctx);
+
+		pthread_mutex_lock(&ctx->mutex);
+		if (!ctx->headerdone)
+			_sink_header(ctx, buff, length);
+		_sink_ringwrite(ctx, buff, length);
+		pthread_mutex_unlock(&ctx->mutex);
+
+		uint64_t one = 1;
+		if (write(ctx->eventfd, &one, sizeof(one)) < 0)
+			err("sink: eventfd error %s", strerror(errno));
+		sink_dbg("sink: boom %lu", (unsigned long)ctx->wposition);
+		ctx->in->ops->pop(ctx->in->ctx, length);
+	}
+	dbg("sink: thread end");
+	return NULL;
+}
+
+static void *server_thread(void *arg)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)arg;
+	struct epoll_event events[SINK_HTTP_MAXCLIENTS + 2];
+
+	warn("server running on port %s", ctx->port);
+	while (ctx->run)
+	{
+		int nfds = epoll_wait(ctx->epollfd, events, SINK_HTTP_MAXCLIENTS + 2, -1);
+		if (nfds < 0 && errno == EINTR)
+			continue;
+		if (nfds < 0)
+		{
+			err("sink: epoll error %s", strerror(errno));
+			break;
+		}
+		int fanout = 0;
+		/// the clients to send, the writable ones or all of them with new data
+		int writable[SINK_HTTP_MAXCLIENTS] = {0};
+		pthread_mutex_lock(&ctx->mutex);
+		for (int i = 0; i < nfds; i++)
+		{
+			if (events[i].data.ptr == &ctx->sock)
+				_sink_accept(ctx);
+			else if (events[i].data.ptr == &ctx->eventfd)
+			{
+				uint64_t value;
+				if (read(ctx->eventfd, &value, sizeof(value)) > 0)
+					fanout = 1;
+			}
+			else
+			{
+				sink_client_t *client = (sink_client_t *)events[i].data.ptr;
+				if (client->state == CLIENT_FREE)
+					continue;
+				int ret = _sink_clientevent(ctx, client, events[i].events);
+				if (ret < 0)
+					_sink_close(ctx, client);
+				else if (ret > 0)
+					writable[client - ctx->clients] = 1;
+			}
+		}
+		sink_snapshot_t snapshot;
+		snapshot.wposition = ctx->wposition;
+		snapshot.metalength = ctx->metalength;
+		snapshot.metaseq = ctx->metaseq;
+		memcpy(snapshot.meta, ctx->meta, ctx->metalength);
+		ctx->rposition = ctx->wposition;
+		for (int i = 0; i < SINK_HTTP_MAXCLIENTS; i++)
+		{
+			sink_client_t *client = &ctx->clients[i];
+			if (client->state != CLIENT_STREAM && client->state != CLIENT_RESPONSE)
+				writable[i] = 0;
+			else if (fanout && client->state == CLIENT_STREAM)
+				writable[i] = 1;
+			if (!writable[i])
+				continue;
+			if (_sink_prepareclient(ctx, client) < 0)
+			{
+				err("sink: send error %s", strerror(errno));
+				_sink_close(ctx, client);
+				writable[i] = 0;
+			}
+			else if (client->position < ctx->rposition)
+				ctx->rposition = client->position;
+		}
+		ctx->reading = 1;
+		pthread_mutex_unlock(&ctx->mutex);
+
+		/// the writer fills the ring during the sending
+		for (int i = 0; i < SINK_HTTP_MAXCLIENTS; i++)
+		{
+			if (writable[i] && _sink_sendclient(ctx, &ctx->clients[i], &snapshot) < 0)
+			{
+				err("sink: send error %s", strerror(errno));
+				writable[i] = -1;
+			}
+		}
+
+		pthread_mutex_lock(&ctx->mutex);
+		ctx->reading = 0;
+		pthread_cond_broadcast(&ctx->cond);
+		for (int i = 0; i < SINK_HTTP_MAXCLIENTS; i++)
+		{
+			if (writable[i] < 0)
+				_sink_close(ctx, &ctx->clients[i]);
+		}
+		pthread_mutex_unlock(&ctx->mutex);
+	}
+	for (int i = 0; i < SINK_HTTP_MAXCLIENTS; i++)
+	{
+		if (ctx->clients[i].state != CLIENT_FREE)
+			_sink_close(ctx, &ctx->clients[i]);
+	}
+	dbg("sink: server end");
+	return NULL;
+}
+
+static int _sink_listen(sink_ctx_t *ctx)
+{
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+	};
+	struct addrinfo *result, *rp;
+	const char *host = ctx->host;
+	if (host != NULL && host[0] == '\0')
+		host = NULL;
+	int ret = getaddrinfo(host, ctx->port, &hints, &result);
+	if (ret != 0)
+	{
+		err("sink: address error %s", gai_strerror(ret));
+		return -1;
+	}
+	int sock = -1;
+	for (rp = result; rp != NULL; rp = rp->ai_next)
+	{
+		sock = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+		if (sock < 0)
+			continue;
+		int on = 1;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(sock, rp->ai_addr, rp->ai_addrlen) == 0 &&
+			listen(sock, SINK_HTTP_MAXCLIENTS) == 0)
+			break;
+		close(sock);
+		sock = -1;
+	}
+	freeaddrinfo(result);
+	if (sock < 0)
+		err("sink: listen error %s", strerror(errno));
+	return sock;
+}
+
+static int sink_run(sink_ctx_t *ctx)
+{
+	ctx->sock = _sink_listen(ctx);
+	if (ctx->sock < 0)
+		return -1;
+	ctx->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ctx->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = &ctx->sock,
+	};
+	epoll_ctl(ctx->epollfd, EPOLL_CTL_ADD, ctx->sock, &event);
+	event.data.ptr = &ctx->eventfd;
+	epoll_ctl(ctx->epollfd, EPOLL_CTL_ADD, ctx->eventfd, &event);
+
+	ctx->run = 1;
+	realtime_thread(&ctx->thread, NULL, "sink", sink_thread, ctx);
+	realtime_thread(&ctx->thread2, NULL, "server", server_thread, ctx);
+
+	return 0;
+}
+
+static void sink_destroy(sink_ctx_t *ctx)
+{
+	player_removeevent(ctx->player, ctx->eventid);
+	if (ctx->thread2)
+	{
+		ctx->run = 0;
+		uint64_t one = 1;
+		if (write(ctx->eventfd, &one, sizeof(one)) < 0)
+			err("sink: eventfd error %s", strerror(errno));
+		pthread_join(ctx->thread2, NULL);
+	}
+	if (ctx->thread)
+	{
+		pthread_join(ctx->thread, NULL);
+	}
+	if (ctx->sock >= 0)
+	{
+		close(ctx->epollfd);
+		close(ctx->eventfd);
+		close(ctx->sock);
+	}
+	jitter_destroy(ctx->in);
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx->ring);
+	free(ctx->url);
+	free(ctx);
+}
+
+const sink_ops_t *sink_http = &(sink_ops_t)
+{
+	.name = "http",
+	.default_ = "http://0.0.0.0:8000/stream.mp3",
+	.init = sink_init,
+	.jitter = sink_jitter,
+	.attach = sink_attach,
+	.encoder = sink_encoder,
+	.run = sink_run,
+	.destroy = sink_destroy,
+};
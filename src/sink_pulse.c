@@ -37,6 +37,7 @@
 #include "player.h"
 #include "encoder.h"
 #include "jitter.h"
+#include "realtime.h"
 typedef struct sink_s sink_t;
 typedef struct sink_ctx_s sink_ctx_t;
 struct sink_ctx_s
@@ -293,7 +294,7 @@ static int sink_run(sink_ctx_t *ctx)
 	}
 	if (ret < 0)
 		err("setinheritsched error %s", strerror(errno));
-	pthread_create(&ctx->thread, &attr, sink_thread, ctx);
+	realtime_thread(&ctx->thread, &attr, "sink", sink_thread, ctx);
 	pthread_attr_destroy(&attr);
 #else
 	pthread_create(&ctx->thread, NULL, sink_thread, ctx);
@@ -35,6 +35,7 @@
 #include "player.h"
 #include "encoder.h"
 #include "jitter.h"
+#include "realtime.h"
 typedef struct sink_s sink_t;
 typedef struct sink_ctx_s sink_ctx_t;
 struct sink_ctx_s
@@ -158,7 +159,7 @@ static void *alsa_thread(void *arg)
 
 static int alsa_run(sink_ctx_t *ctx)
 {
-	pthread_create(&ctx->thread, NULL, alsa_thread, ctx);
+	realtime_thread(&ctx->thread, NULL, "sink", alsa_thread, ctx);
 	return 0;
 }
 
@@ -50,6 +50,7 @@
 #include "encoder.h"
 #include "jitter.h"
 #include "unix_server.h"
+#include "realtime.h"
 typedef struct sink_s sink_t;
 typedef struct sink_ctx_s sink_ctx_t;
 struct sink_ctx_s
@@ -327,16 +328,6 @@ static void *sink_thread(void *arg)
 	/* start decoding */
 	dbg("sink: thread run");
 	int ret;
-#ifdef USE_REALTIME
-	cpu_set_t cpuset;
-	pthread_t self = pthread_self();
-	CPU_ZERO(&cpuset);
-	CPU_SET(0, &cpuset);
-
-	ret = pthread_setaffinity_np(self, 1, &cpuset);
-	if (ret != 0)
-		err("src: CPUC affinity error: %s", strerror(errno));
-#endif
 #ifdef UDP_MARKER
 	warn("sink: udp marker is ON");
 #endif
@@ -441,7 +432,7 @@ static int sink_run(sink_ctx_t *ctx)
 	}
 	if (ret < 0)
 		err("setinheritsched error %s", strerror(errno));
-	pthread_create(&ctx->thread, &attr, sink_thread, ctx);
+	realtime_thread(&ctx->thread, &attr, "sink", sink_thread, ctx);
 	pthread_attr_destroy(&attr);
 #else
 	pthread_create(&ctx->thread, NULL, sink_thread, ctx);
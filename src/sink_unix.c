@@ -44,7 +44,19 @@
 #include "jitter.h"
 #include "encoder.h"
 #include "unix_server.h"
+#include "realtime.h"
 typedef struct sink_s sink_t;
+typedef struct sink_client_s sink_client_t;
+struct sink_client_s
+{
+	int sock;
+	int error;
+	/** the end of a frame not yet accepted by the socket */
+	unsigned char *out;
+	size_t offset;
+	size_t pending;
+};
+
 typedef struct sink_ctx_s sink_ctx_t;
 struct sink_ctx_s
 {
@@ -52,23 +64,16 @@ struct sink_ctx_s
 	const char *filepath;
 	pthread_t thread;
 	pthread_t thread2;
+	thread_server_t *server;
 	jitter_t *in;
 	state_t state;
-#ifdef SINK_UNIX_ASYNC
-	char *out;
-	size_t length;
-	pthread_cond_t ack;
-	pthread_cond_t event;
 	pthread_mutex_t mutex;
-#else
-	thread_info_t *clients[MAX_CLIENTS];
-#endif
+	sink_client_t clients[MAX_CLIENTS];
 	int counter;
 	unsigned int samplerate;
 	char samplesize;
 	char nchannels;
 	char nbclients;
-	char ackstate;
 };
 #define SINK_CTX
 #include "sink.h"
@@ -134,12 +139,7 @@ static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
 	jitter->format = SINK_BITSSTREAM;
 	ctx->in = jitter;
 
-#ifdef SINK_UNIX_ASYNC
 	pthread_mutex_init(&ctx->mutex, NULL);
-	pthread_cond_init(&ctx->event, NULL);
-	pthread_cond_init(&ctx->ack, NULL);
-	ctx->out = calloc(1, BUFFERSIZE);
-#endif
 
 	ctx->player = player;
 
@@ -163,76 +163,99 @@ static const encoder_t *sink_encoder(sink_ctx_t *ctx)
 	return ENCODER;
 }
 
-static int sink_unxiclient(thread_info_t *info)
+static int sink_unixconnect(thread_info_t *info)
 {
 	sink_ctx_t *ctx = (sink_ctx_t *)info->userctx;
-	int ret;
-	int run = 1;
-
-#ifdef SINK_UNIX_WAITCLIENT
-	if ( ctx->nbclients == 0)
-	{
-		player_state(ctx->player, STATE_PLAY);
-	}
-#endif
-	if (ctx->nbclients == MAX_CLIENTS)
-		return -1;
-	ctx->nbclients++;
 
-#ifdef SINK_UNIX_ASYNC
-	int counter = ctx->counter;
-	while (run)
-	{
-		pthread_mutex_lock(&ctx->mutex);
-		while (ctx->counter <= counter)
-		{
-			pthread_cond_wait(&ctx->event, &ctx->mutex);
-		}
-		sink_dbg("send %ld %d %d", ctx->length, ctx->counter, counter);
-		if (ctx->length > 0)
-		{
-			ret = send(info->sock, ctx->out, ctx->length, MSG_NOSIGNAL| MSG_DONTWAIT);
-			if (ret < 0)
-				run = 0;
-		}
-		counter = ctx->counter;
-		ctx->ackstate = 1;
-		pthread_mutex_unlock(&ctx->mutex);
-		pthread_cond_broadcast(&ctx->ack);
-	}
-#else
+	pthread_mutex_lock(&ctx->mutex);
 	int i;
 	for (i = 0; i < MAX_CLIENTS; i++)
 	{
-		if (ctx->clients[i] == NULL)
-		{
-			ctx->clients[i] = info;
+		if (ctx->clients[i].sock <= 0)
 			break;
-		}
 	}
-	if (i < MAX_CLIENTS)
+	if (i == MAX_CLIENTS)
 	{
-		while (run)
-		{
-			struct pollfd poll_set[1];
-			int numfds = 0;
-			poll_set[0].fd = info->sock;
-			numfds++;
-			ret = poll(poll_set, numfds, -1);
-			if (poll_set[0].revents & POLLHUP)
-				run = 0;
-		}
+		pthread_mutex_unlock(&ctx->mutex);
+		warn("sink: too many clients");
+		return -1;
+	}
+	sink_client_t *client = &ctx->clients[i];
+	client->out = malloc(BUFFERSIZE);
+	client->sock = info->sock;
+	client->error = 0;
+	client->offset = 0;
+	client->pending = 0;
+	info->data = client;
+	ctx->nbclients++;
+#ifdef SINK_UNIX_WAITCLIENT
+	if (ctx->nbclients == 1)
+	{
+		player_state(ctx->player, STATE_PLAY);
 	}
 #endif
+	pthread_mutex_unlock(&ctx->mutex);
+	return 0;
+}
+
+static void sink_unixdisconnect(thread_info_t *info)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)info->userctx;
+	sink_client_t *client = (sink_client_t *)info->data;
+
+	pthread_mutex_lock(&ctx->mutex);
+	client->sock = 0;
+	free(client->out);
+	client->out = NULL;
 	ctx->nbclients--;
 #ifdef SINK_UNIX_WAITCLIENT
-	if ( ctx->nbclients == 0)
+	if (ctx->nbclients == 0)
 	{
 		player_state(ctx->player, STATE_STOP);
 	}
 #endif
-	return ret;
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+static const unixserver_ops_t sink_unixserver = {
+	.connect = sink_unixconnect,
+	.disconnect = sink_unixdisconnect,
+};
+
+/**
+ * the socket is never blocking the sink:
+ * a frame is dropped when the client didn't read the previous one.
+ */
+static int sink_sendclient(sink_client_t *client, unsigned char *buff, size_t length)
+{
+	ssize_t ret;
+	if (client->pending > 0)
+	{
+		ret = send(client->sock, client->out + client->offset, client->pending, MSG_NOSIGNAL| MSG_DONTWAIT);
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		if (ret > 0)
+		{
+			client->offset += ret;
+			client->pending -= ret;
+		}
+		if (client->pending > 0)
+			return 0;
+	}
+	ret = send(client->sock, buff, length, MSG_NOSIGNAL| MSG_DONTWAIT);
+	if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		return -1;
+	if (ret < 0)
+		return 0;
+	if (ret < length)
+	{
+		client->offset = 0;
+		client->pending = length - ret;
+		memcpy(client->out, buff + ret, client->pending);
+	}
+	return 0;
 }
+
 #ifdef DEBUG
 static void
 display_sched_attr(int policy, struct sched_param *param)
@@ -270,44 +293,22 @@ static void *sink_thread(void *arg)
 		ctx->counter++;
 		int length = ctx->in->ops->length(ctx->in->ctx);
 
-#ifdef SINK_UNIX_ASYNC
-		pthread_mutex_lock(&ctx->mutex);
-		memcpy(ctx->out, buff, length);
-		ctx->length = length;
-		pthread_mutex_unlock(&ctx->mutex);
-		pthread_cond_broadcast(&ctx->event);
-		pthread_mutex_lock(&ctx->mutex);
-		while (ctx->ackstate == 0)
-			pthread_cond_wait(&ctx->ack, &ctx->mutex);
-		ctx->ackstate = 0;
-		pthread_mutex_unlock(&ctx->mutex);
-		sched_yield();
-#else
 		int i;
-		int ret;
-		for (i = 0; i < MAX_CLIENTS; i++)
+		pthread_mutex_lock(&ctx->mutex);
+		for (i = 0; i < MAX_CLIENTS && length > 0; i++)
 		{
-			thread_info_t *info = ctx->clients[i];
-			if (length > 0 && info && info->sock != 0)
+			sink_client_t *client = &ctx->clients[i];
+			if (client->sock <= 0 || client->error)
+				continue;
+			if (sink_sendclient(client, buff, length) < 0)
 			{
-				fd_set wfds;
-				int maxfd = info->sock;
-				FD_ZERO(&wfds);
-				FD_SET(info->sock, &wfds);
-				ret = select(maxfd + 1, NULL, &wfds, NULL,NULL);
-				if (ret > 0 && FD_ISSET(info->sock, &wfds))
-				{
-					ret = send(info->sock, buff, length, MSG_NOSIGNAL| MSG_DONTWAIT);
-					if (ret < 0 && errno != EAGAIN)
-					{
-						err("send errot %s", strerror(errno));
-						close(info->sock);
-						ctx->clients[i] = NULL;
-					}
-				}
+				err("sink: send error %s", strerror(errno));
+				/// the server loop releases the client
+				client->error = 1;
+				shutdown(client->sock, SHUT_RDWR);
 			}
 		}
-#endif
+		pthread_mutex_unlock(&ctx->mutex);
 		sink_dbg("sink: boom %d", ctx->counter);
 		ctx->in->ops->pop(ctx->in->ctx, length);
 		sched_yield();
@@ -326,12 +327,15 @@ static void *server_thread(void *arg)
 	pthread_getschedparam(pthread_self(), &policy, &param);
 	display_sched_attr(policy, &param);
 #endif
-	unixserver_run(sink_unxiclient, ctx, ctx->filepath);
+	unixserver_run(ctx->server);
 	return NULL;
 }
 
 static int sink_run(sink_ctx_t *ctx)
 {
+	ctx->server = unixserver_init(&sink_unixserver, ctx, ctx->filepath);
+	if (ctx->server == NULL)
+		return -1;
 #ifdef USE_REALTIME
 	int ret;
 
@@ -362,7 +366,7 @@ static int sink_run(sink_ctx_t *ctx)
 	}
 	if (ret < 0)
 		err("setinheritsched error %s", strerror(errno));
-	pthread_create(&ctx->thread, &attr, sink_thread, ctx);
+	realtime_thread(&ctx->thread, &attr, "sink", sink_thread, ctx);
 	pthread_attr_destroy(&attr);
 
 	pthread_attr_init(&attr);
@@ -388,7 +392,7 @@ static int sink_run(sink_ctx_t *ctx)
 	}
 	if (ret < 0)
 		err("setinheritsched error %s", strerror(errno));
-	pthread_create(&ctx->thread2, &attr, server_thread, ctx);
+	realtime_thread(&ctx->thread2, &attr, "server", server_thread, ctx);
 	pthread_attr_destroy(&attr);
 
 #else
@@ -403,19 +407,16 @@ static void sink_destroy(sink_ctx_t *ctx)
 {
 	if (ctx->thread2)
 	{
+		unixserver_kill(ctx->server);
 		pthread_join(ctx->thread2, NULL);
+		unixserver_destroy(ctx->server);
 	}
 	if (ctx->thread)
 	{
 		pthread_join(ctx->thread, NULL);
 	}
 	jitter_destroy(ctx->in);
-#ifdef SINK_UNIX_ASYNC
 	pthread_mutex_destroy(&ctx->mutex);
-	pthread_cond_destroy(&ctx->event);
-	pthread_cond_destroy(&ctx->ack);
-	free(ctx->out);
-#endif
 	free(ctx);
 }
 
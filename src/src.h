@@ -2,6 +2,7 @@
 #define __SRC_H__
 
 #include "event.h"
+#include "media.h"
 
 #define MAX_ESTREAM 4
 
@@ -21,13 +22,18 @@ struct src_ops_s
 	const char *name;
 	const char *protocol;
 	src_ctx_t *(*init)(player_ctx_t *, const char *path, const char *mime);
-	int (*prepare)(src_ctx_t *, const char *info);
+	int (*prepare)(src_ctx_t *, const media_info_t *info);
 	int (*run)(src_ctx_t *);
 	const char *(*mime)(src_ctx_t *ctx, int index);
 	void (*eventlistener)(src_ctx_t *ctx, event_listener_cb_t listener, void *arg);
 	int (*attach)(src_ctx_t *ctx, long index, decoder_t *decoder);
 	decoder_t *(*estream)(src_ctx_t *ctx, long index);
 	void(*mdns)(src_ctx_t *ctx, const char *host, struct rr_entry *entry);
+	/**
+	 * optional: request to play the stream from position
+	 * (same units as the decoder position)
+	 */
+	int (*seek)(src_ctx_t *ctx, uint32_t position);
 	void (*destroy)(src_ctx_t *);
 	/**
 	 * for demux only
@@ -41,7 +47,7 @@ struct src_s
 	const src_ops_t *ops;
 	src_ctx_t *ctx;
 	int mediaid;
-	char *info;
+	media_info_t info;
 };
 
 src_t *src_build(player_ctx_t *player, const char *url, const char *mime, int id, const char *info);
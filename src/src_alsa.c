@@ -36,6 +36,7 @@
 #include "jitter.h"
 #include "filter.h"
 #include "event.h"
+#include "realtime.h"
 typedef struct src_s src_t;
 typedef struct src_ops_s src_ops_t;
 typedef struct src_ctx_s src_ctx_t;
@@ -292,7 +293,7 @@ static void *_src_thread(void *arg)
 	return NULL;
 }
 
-static int _src_prepare(src_ctx_t *ctx, const char *info)
+static int _src_prepare(src_ctx_t *ctx, const media_info_t *info)
 {
 	const src_t src = { .ops = src_alsa, .ctx = ctx};
 	event_new_es_t event = {.pid = ctx->pid, .src = &src, .mime = mime_audiopcm, .jitte = JITTE_LOW};
@@ -317,7 +318,7 @@ static int _src_run(src_ctx_t *ctx)
 		listener->cb(listener->arg, SRC_EVENT_DECODE_ES, (void *)&event_decode);
 		listener = listener->next;
 	}
-	pthread_create(&ctx->thread, NULL, _src_thread, ctx);
+	realtime_thread(&ctx->thread, NULL, "src", _src_thread, ctx);
 	return 0;
 }
 
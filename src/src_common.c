@@ -97,7 +97,7 @@ static src_t *_src_build(const src_ops_t *const src_list[],
 	src->ctx = src_ctx;
 	src->mediaid = -1;
 	if (info)
-		src->info = strdup(info);
+		media_parseinfo(info, &src->info);
 
 	return src;
 }
@@ -132,8 +132,7 @@ src_t *src_build(player_ctx_t *player, const char *url, const char *mime, int id
 void src_destroy(src_t *src)
 {
 	src->ops->destroy(src->ctx);
-	if (src->info != NULL)
-		free(src->info);
+	media_freeinfo(&src->info);
 	free(src);
 }
 
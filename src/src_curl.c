@@ -38,6 +38,7 @@
 
 #include "player.h"
 #include "event.h"
+#include "realtime.h"
 typedef struct src_ops_s src_ops_t;
 typedef struct src_ctx_s src_ctx_t;
 struct src_ctx_s
@@ -186,7 +187,7 @@ static void *_src_thread(void *arg)
 	return 0;
 }
 
-static int _src_prepare(src_ctx_t *ctx, const char *info)
+static int _src_prepare(src_ctx_t *ctx, const media_info_t *info)
 {
 	src_dbg("src: prepare");
 	/**
@@ -194,13 +195,15 @@ static int _src_prepare(src_ctx_t *ctx, const char *info)
 	 * The thread starts for the preparation and
 	 * will be waiting until the running state
 	 */
-	int ret = pthread_create(&ctx->thread, NULL, _src_thread, ctx);
+	int ret = realtime_thread(&ctx->thread, NULL, "src", _src_thread, ctx);
 	pthread_mutex_lock(&ctx->mutex);
 	ctx->state = SRC_RUN;
 	pthread_cond_broadcast(&ctx->cond);
 	pthread_mutex_unlock(&ctx->mutex);
 
-	const src_t src = { .ops = src_curl, .ctx = ctx};
+	src_t src = { .ops = src_curl, .ctx = ctx};
+	if (info != NULL)
+		src.info = *info;
 	event_new_es_t event = {.pid = ctx->pid, .src = &src, .mime = ctx->mime, .jitte = JITTE_HIGH};
 	event_listener_t *listener = ctx->listener;
 	while (listener)
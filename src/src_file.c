@@ -103,6 +103,14 @@ static int _src_read(src_ctx_t *ctx, unsigned char *buff, int len)
 	return ret;
 }
 
+static long _src_lseek(src_ctx_t *ctx, long offset, int whence)
+{
+	off_t ret = lseek(ctx->fd, offset, whence);
+	if (ret < 0)
+		err("src file %d seek error: %s", ctx->fd, strerror(errno));
+	return ret;
+}
+
 static src_ctx_t *_src_init(player_ctx_t *player, const char *url, const char *mime)
 {
 	int fd = -1;
@@ -151,10 +159,12 @@ static src_ctx_t *_src_init(player_ctx_t *player, const char *url, const char *m
 	return NULL;
 }
 
-static int _src_prepare(src_ctx_t *ctx, const char *info)
+static int _src_prepare(src_ctx_t *ctx, const media_info_t *info)
 {
 	src_dbg("src: prepare");
-	const src_t src = { .ops = src_file, .ctx = ctx, .info = info, .mediaid = player_mediaid(ctx->player)};
+	src_t src = { .ops = src_file, .ctx = ctx, .mediaid = player_mediaid(ctx->player)};
+	if (info != NULL)
+		src.info = *info;
 	event_new_es_t event = {.pid = ctx->pid, .src = &src, .mime = ctx->mime, .jitte = JITTE_LOW};
 	event_listener_t *listener = ctx->listener;
 	while (listener)
@@ -218,6 +228,12 @@ static int _src_attach(src_ctx_t *ctx, long index, decoder_t *decoder)
 		src_dbg("src: add producter to %s", ctx->out->ctx->name);
 		ctx->out->ctx->produce = (produce_t)_src_read;
 		ctx->out->ctx->producter = (void *)ctx;
+		/**
+		 * the decoder seeks into the file from its own thread,
+		 * a pipe (stdin) is not seekable.
+		 */
+		if (lseek(ctx->fd, 0, SEEK_CUR) >= 0)
+			ctx->out->ctx->seek = (seek_t)_src_lseek;
 	}
 	else
 		return -1;
@@ -236,6 +252,13 @@ const char *_src_mime(src_ctx_t *ctx, int index)
 	return ctx->mime;
 }
 
+static int _src_seek(src_ctx_t *ctx, uint32_t position)
+{
+	if (ctx->estream == NULL || ctx->estream->ops->seek == NULL)
+		return -1;
+	return ctx->estream->ops->seek(ctx->estream->ctx, position);
+}
+
 static void _src_destroy(src_ctx_t *ctx)
 {
 	if (ctx->estream != NULL)
@@ -261,6 +284,7 @@ const src_ops_t *src_file = &(src_ops_t)
 	.eventlistener = _src_eventlistener,
 	.attach = _src_attach,
 	.estream = _src_estream,
+	.seek = _src_seek,
 	.destroy = _src_destroy,
 	.mime = _src_mime,
 };
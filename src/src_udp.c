@@ -44,6 +44,7 @@
 #include "player.h"
 #include "jitter.h"
 #include "event.h"
+#include "realtime.h"
 typedef struct src_ops_s src_ops_t;
 typedef struct src_ctx_s src_ctx_t;
 typedef struct src_s demux_t;
@@ -341,16 +342,6 @@ static void *_src_thread(void *arg)
 	src_ctx_t *ctx = (src_ctx_t *)arg;
 
 	int ret;
-#ifdef USE_REALTIME
-	cpu_set_t cpuset;
-	pthread_t self = pthread_self();
-	CPU_ZERO(&cpuset);
-	CPU_SET(0, &cpuset);
-
-	ret = pthread_setaffinity_np(self, 1, &cpuset);
-	if (ret != 0)
-		err("src: CPUC affinity error: %s", strerror(errno));
-#endif
 #ifdef UDP_MARKER
 	warn("src: udp marker is ON");
 #endif
@@ -437,7 +428,7 @@ static int _src_start(src_ctx_t *ctx)
 	}
 	if (ret < 0)
 		err("setinheritsched error %s", strerror(errno));
-	pthread_create(&ctx->thread, &attr, _src_thread, ctx);
+	realtime_thread(&ctx->thread, &attr, "src", _src_thread, ctx);
 	pthread_attr_destroy(&attr);
 #else
 	pthread_create(&ctx->thread, NULL, _src_thread, ctx);
@@ -40,6 +40,7 @@
 #include "player.h"
 #include "jitter.h"
 #include "event.h"
+#include "realtime.h"
 typedef struct src_ops_s src_ops_t;
 typedef struct src_ctx_s src_ctx_t;
 struct src_ctx_s
@@ -207,7 +208,7 @@ static int _src_run(src_ctx_t *ctx)
 		listener->cb(listener->arg, SRC_EVENT_DECODE_ES, (void *)&event_decode);
 		listener = listener->next;
 	}
-	pthread_create(&ctx->thread, NULL, _src_thread, ctx);
+	realtime_thread(&ctx->thread, NULL, "src", _src_thread, ctx);
 	return 0;
 }
 
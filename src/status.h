@@ -0,0 +1,57 @@
+#ifndef __STATUS_H__
+#define __STATUS_H__
+
+#include <stdint.h>
+
+#define STATUS_MAGIC 0x70757473
+#define STATUS_VERSION 1
+
+/**
+ * The status page is a file mapped read-only by the local clients.
+ * The daemon updates it under a sequence lock: the sequence is odd
+ * during an update, and a copy is valid when the sequence is even
+ * and unchanged after the copy.
+ *
+ * A client connected on the unix socket "<page>.event" receives
+ * an eventfd (SCM_RIGHTS) signaled on each change of state or media.
+ * The position and the volume are refreshed without notification.
+ */
+typedef struct status_s status_t;
+struct status_s
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sequence;
+	/** the state_t of the player */
+	int32_t state;
+	int32_t mediaid;
+	/** same units as the getposition method */
+	uint32_t position;
+	uint32_t duration;
+	uint32_t volume;
+	/** the number of changes of state or media */
+	uint32_t changes;
+};
+
+static inline void status_read(const status_t *page, status_t *copy)
+{
+	uint32_t sequence;
+	do
+	{
+		do
+			sequence = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+		while (sequence & 1);
+		copy->magic = __atomic_load_n(&page->magic, __ATOMIC_RELAXED);
+		copy->version = __atomic_load_n(&page->version, __ATOMIC_RELAXED);
+		copy->state = __atomic_load_n(&page->state, __ATOMIC_RELAXED);
+		copy->mediaid = __atomic_load_n(&page->mediaid, __ATOMIC_RELAXED);
+		copy->position = __atomic_load_n(&page->position, __ATOMIC_RELAXED);
+		copy->duration = __atomic_load_n(&page->duration, __ATOMIC_RELAXED);
+		copy->volume = __atomic_load_n(&page->volume, __ATOMIC_RELAXED);
+		copy->changes = __atomic_load_n(&page->changes, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) != sequence);
+	copy->sequence = sequence;
+}
+
+#endif
@@ -25,15 +25,19 @@
  * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  *****************************************************************************/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <errno.h>
 #include <libgen.h>
 
@@ -48,129 +52,204 @@
 #define dbg(...)
 #endif
 
+#define UNIXSERVER_MAXEVENTS 32
+
 typedef struct thread_server_s
 {
-	void *ctx;
+	const unixserver_ops_t *ops;
+	void *userctx;
 	int sock;
-	thread_info_t firstinfo;
-	pthread_mutex_t lock;
+	int epollfd;
+	int wakeup;
+	int run;
+	thread_info_t *clients;
 } thread_server_t;
 
+thread_server_t *unixserver_init(const unixserver_ops_t *ops, void *userctx, const char *socketpath)
+{
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+	{
+		err("Unix server %s error : %s", socketpath, strerror(errno));
+		return NULL;
+	}
 
-typedef int (*client_routine_t)(struct thread_info_s *info);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketpath, sizeof(addr.sun_path) - 1);
+	char *path = strdup(socketpath);
+	char *directory = dirname(path);
+	umask(0);
+	mkdir(directory, 0777);
+	free(path);
+	unlink(addr.sun_path);
 
-typedef void *(*start_routine_t)(void*);
-int start(client_routine_t service, thread_info_t *info)
-{
-	pthread_t thread;
-	pthread_create(&thread, NULL, (start_routine_t)service, (void *)info);
-	pthread_detach(thread);
+	int ret = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+	if (ret == 0)
+		ret = listen(sock, 64);
+	if (ret != 0)
+	{
+		err("Unix server %s error : %s", socketpath, strerror(errno));
+		close(sock);
+		return NULL;
+	}
+	fprintf(stderr, "Unix server on : %s\n", socketpath);
+
+	thread_server_t *server = calloc(1, sizeof(*server));
+	server->ops = ops;
+	server->userctx = userctx;
+	server->sock = sock;
+	server->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	server->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+	epoll_ctl(server->epollfd, EPOLL_CTL_ADD, server->sock, &event);
+	event.data.ptr = server;
+	epoll_ctl(server->epollfd, EPOLL_CTL_ADD, server->wakeup, &event);
+	server->run = 1;
+	return server;
 }
 
-void unixserver_remove(thread_info_t *info)
+static void _unixserver_accept(thread_server_t *server)
 {
-	thread_info_t *it = &info->server->firstinfo;
-	if (it == info)
-	{
-		err("the list must be never empty when removing");
-		return;
-	}
-	/**
-	 * firstinfo is an empty client socket
-	 */
-	thread_server_t *server = info->server;
-	pthread_mutex_lock(&server->lock);
-	while (it != NULL && info != it->next)
+	int newsock;
+	while ((newsock = accept4(server->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
 	{
-		it = it->next;
+		thread_info_t *info = calloc(1, sizeof(*info));
+		info->sock = newsock;
+		info->userctx = server->userctx;
+		info->server = server;
+		if (server->ops->connect != NULL && server->ops->connect(info) < 0)
+		{
+			close(newsock);
+			free(info);
+			continue;
+		}
+		struct epoll_event event = {
+			.events = EPOLLIN | EPOLLRDHUP,
+			.data.ptr = info,
+		};
+		epoll_ctl(server->epollfd, EPOLL_CTL_ADD, newsock, &event);
+		info->next = server->clients;
+		server->clients = info;
 	}
-	if (it != NULL)
-		it->next = info->next;
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		err("Unix server accept error : %s", strerror(errno));
+}
+
+static void _unixserver_remove(thread_server_t *server, thread_info_t *info)
+{
+	if (server->ops->disconnect != NULL)
+		server->ops->disconnect(info);
+	epoll_ctl(server->epollfd, EPOLL_CTL_DEL, info->sock, NULL);
 	close(info->sock);
+
+	thread_info_t **pit = &server->clients;
+	while (*pit != NULL && *pit != info)
+		pit = &(*pit)->next;
+	if (*pit != NULL)
+		*pit = info->next;
 	free(info);
-	pthread_mutex_unlock(&server->lock);
 }
 
-void unixserver_kill(thread_info_t *info)
+/**
+ * a half closed client sends its last requests before the hangup,
+ * all of them are read before the close.
+ */
+static int _unixserver_drain(thread_server_t *server, thread_info_t *info)
 {
-	thread_server_t *server = info->server;
-	pthread_mutex_lock(&server->lock);
-	thread_info_t *it = &info->server->firstinfo;
-	while (it->next) {
-		thread_info_t *old = it->next;
-		if (old->sock == info->sock) {
-			close(info->sock);
-			it->next = old->next;
-			free(old);
-		}
-		it = it->next;
-		if (it == NULL)
+	int ret = 0;
+	int length = 0;
+	while (ret >= 0 && ioctl(info->sock, FIONREAD, &length) == 0 && length > 0)
+	{
+		ret = server->ops->recv(info);
+		int rest = 0;
+		/// the handler may wait more data, as the end of a partial request
+		if (ioctl(info->sock, FIONREAD, &rest) < 0 || rest == length)
 			break;
 	}
-	pthread_mutex_unlock(&server->lock);
-	close(server->sock);
-	free(server);
+	return ret;
 }
 
-int unixserver_run(client_routine_t routine, void *userctx, const char *socketpath)
+int unixserver_run(thread_server_t *server)
 {
-	int sock;
-	int ret = -1;
-
-	sock = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sock > 0)
+	struct epoll_event events[UNIXSERVER_MAXEVENTS];
+	while (server->run)
 	{
-		thread_server_t *server = calloc(1, sizeof(*server));
-		server->sock = sock;
-		pthread_mutex_init(&server->lock, NULL);
-
-		struct sockaddr_un addr;
-		memset(&addr, 0, sizeof(struct sockaddr_un));
-		addr.sun_family = AF_UNIX;
-		strncpy(addr.sun_path, socketpath, sizeof(addr.sun_path));
-		char *directory = dirname((char *)socketpath);
-		umask(0);
-		mkdir(directory, 0777);
-		unlink(addr.sun_path);
-
-		ret = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
-		if (ret == 0) {
-			ret = listen(sock, 10);
-			fprintf(stderr, "Unix server on : %s\n", socketpath);
-		}
-		if (ret == 0) {
-			int newsock = 0;
-			do {
-				newsock = accept(sock, NULL, NULL);
-				if (newsock > 0) {
-					struct thread_info_s *info = calloc(1, sizeof(*info));
-					info->sock = newsock;
-					info->userctx = userctx;
-					info->server = server;
-					pthread_mutex_lock(&server->lock);
-					struct thread_info_s *it = &server->firstinfo;
-					while (it->next != NULL) it = it->next;
-					it->next = info;
-					pthread_mutex_unlock(&server->lock);
-					start(routine, info);
-				}
-			} while(newsock > 0);
+		int nevents = epoll_wait(server->epollfd, events, UNIXSERVER_MAXEVENTS, -1);
+		if (nevents < 0 && errno != EINTR)
+		{
+			err("Unix server error : %s", strerror(errno));
+			return -1;
 		}
-		close(sock);
-		pthread_mutex_lock(&server->lock);
-		struct thread_info_s *info = server->firstinfo.next;
-		while (info != NULL)
+		int i;
+		for (i = 0; i < nevents; i++)
 		{
-			struct thread_info_s *next = info->next;
-			free(info);
-			info = next;
+			thread_info_t *info = events[i].data.ptr;
+			if (info == NULL)
+				_unixserver_accept(server);
+			else if (events[i].data.ptr == server)
+				continue;
+			else
+			{
+				int ret = 0;
+				if ((events[i].events & EPOLLRDHUP) && server->ops->recv != NULL)
+					ret = _unixserver_drain(server, info);
+				else if ((events[i].events & EPOLLIN) && server->ops->recv != NULL)
+					ret = server->ops->recv(info);
+				else if (events[i].events & EPOLLIN)
+				{
+					/// the data are not used by the handler
+					char buffer[256];
+					while (recv(info->sock, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+				}
+				if (ret >= 0 && !(events[i].events & (EPOLLHUP | EPOLLERR)) &&
+					(events[i].events & EPOLLRDHUP) &&
+					server->ops->hangup != NULL && server->ops->hangup(info) > 0)
+				{
+					/// only the errors and the shutdown of the handler are reported now
+					struct epoll_event event = { .events = 0, .data.ptr = info };
+					epoll_ctl(server->epollfd, EPOLL_CTL_MOD, info->sock, &event);
+				}
+				else if (ret < 0 || (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)))
+				{
+					dbg("Unix server: client %d leave", info->sock);
+					_unixserver_remove(server, info);
+				}
+			}
 		}
-		pthread_mutex_unlock(&server->lock);
-		pthread_mutex_destroy(&server->lock);
-		free(server);
-	}
-	if (ret) {
-		fprintf(stderr, "Unix server %s error : %s\n", socketpath, strerror(errno));
 	}
-	return ret;
+	return 0;
+}
+
+void unixserver_pause(thread_info_t *info, int pause)
+{
+	struct epoll_event event = {
+		.events = (pause)? EPOLLRDHUP: EPOLLIN | EPOLLRDHUP,
+		.data.ptr = info,
+	};
+	if (epoll_ctl(info->server->epollfd, EPOLL_CTL_MOD, info->sock, &event) < 0)
+		err("Unix server pause error : %s", strerror(errno));
+}
+
+void unixserver_kill(thread_server_t *server)
+{
+	uint64_t value = 1;
+	server->run = 0;
+	if (write(server->wakeup, &value, sizeof(value)) < 0)
+		err("Unix server kill error : %s", strerror(errno));
+}
+
+/**
+ * the event loop must be stopped before
+ */
+void unixserver_destroy(thread_server_t *server)
+{
+	while (server->clients != NULL)
+		_unixserver_remove(server, server->clients);
+	close(server->sock);
+	close(server->wakeup);
+	close(server->epollfd);
+	free(server);
 }
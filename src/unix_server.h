@@ -8,13 +8,54 @@ struct thread_info_s
 {
 	int sock;
 	void *userctx;
+	/** the state of the connection for the handler */
+	void *data;
 	thread_server_t *server;
 	thread_info_t *next;
 };
 
-typedef int (*client_routine_t)(thread_info_t *info);
-int unixserver_run(client_routine_t routine, void *userctx, const char *socketpath);
-void unixserver_remove(thread_info_t *info);
-void unixserver_kill(thread_info_t *info);
+/**
+ * All the connections are served by the thread of unixserver_run.
+ * The handlers must never block, the sockets are non blocking.
+ */
+typedef struct unixserver_ops_s unixserver_ops_t;
+struct unixserver_ops_s
+{
+	/**
+	 * optional
+	 * a negative value refuses the connection
+	 */
+	int (*connect)(thread_info_t *info);
+	/**
+	 * optional
+	 * the socket is readable, a negative value closes the connection
+	 */
+	int (*recv)(thread_info_t *info);
+	/**
+	 * optional
+	 * the peer doesn't write anymore and its data are read.
+	 * A positive value keeps the connection open to answer,
+	 * the handler shuts the socket down to close it.
+	 */
+	int (*hangup)(thread_info_t *info);
+	/**
+	 * optional
+	 * the connection is closed, the info is freed after the call
+	 */
+	void (*disconnect)(thread_info_t *info);
+};
+
+thread_server_t *unixserver_init(const unixserver_ops_t *ops, void *userctx, const char *socketpath);
+/**
+ * the event loop of all the connections, it returns after unixserver_kill
+ */
+int unixserver_run(thread_server_t *server);
+void unixserver_kill(thread_server_t *server);
+/**
+ * stop or restart the reading of a connection, the hangup is still reported.
+ * It may be called from another thread than the event loop.
+ */
+void unixserver_pause(thread_info_t *info, int pause);
+void unixserver_destroy(thread_server_t *server);
 
 #endif
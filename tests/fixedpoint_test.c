@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "filter.h"
+#include "fixedpoint.h"
+#include "jitter.h"
+#include "mixer.h"
+
+#ifndef FILTER_FIXEDPOINT
+#error "fixedpoint_test requires FILTER_FIXEDPOINT into the configuration"
+#endif
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+/**
+ * the fixed point implementation (FILTER_FIXEDPOINT) is compared
+ * to the float reference. The objects of src/ are shared with the
+ * daemon, then the test is built only when the configuration enables
+ * the flag. The difference must stay under 1 LSB
+ * for the gains and 2 LSB for the ramps of the mixer.
+ */
+
+static uint32_t seed = 1;
+static int32_t test_random(int bits)
+{
+	seed = seed * 1103515245 + 12345;
+	int32_t value = (int32_t)seed >> (32 - bits);
+	return value;
+}
+
+static int test_saturate(void)
+{
+	int ret = 0;
+	if (fixed_saturate(40000, 16) != 32767 || fixed_saturate(-40000, 16) != -32767)
+		ret = -1;
+	if (fixed_saturate((int64_t)1 << 40, 24) != 8388607 || fixed_saturate(-1234, 24) != -1234)
+		ret = -1;
+	int32_t half = FIXED_FROMDOUBLE(0.5, FIXED_GAINSHIFT);
+	if (fixed_mul(3, half, FIXED_GAINSHIFT) != 2 || fixed_mul(-3, half, FIXED_GAINSHIFT) != -1)
+		ret = -1;
+	if (ret < 0)
+		err("saturate: failed");
+	else
+		warn("saturate: ok");
+	return ret;
+}
+
+static int test_boost(int bits)
+{
+	int ret = 0;
+	int db;
+	for (db = -20; db <= 20; db++)
+	{
+		boost_t boost = {0};
+		boost_init(&boost, db);
+		double gain = pow(10.0, db / 20.0);
+		double max = (double)((int64_t)1 << (bits - 1)) - 1;
+		int i;
+		for (i = 0; i < 10000; i++)
+		{
+			sample_t sample = test_random(bits);
+			double reference = round(sample * gain);
+			if (reference > max)
+				reference = max;
+			if (reference < -max)
+				reference = -max;
+			sample_t out = boost_cb(&boost, sample, bits, 44100, i & 1);
+			if (fabs(out - reference) > 1)
+			{
+				err("boost %d bits %ddB: %d => %d expected %.0f", bits, db, sample, out, reference);
+				ret = -1;
+				break;
+			}
+		}
+	}
+	if (ret == 0)
+		warn("boost %d bits: ok", bits);
+	return ret;
+}
+
+#define TEST_NFRAMES 1152
+#define TEST_LEVEL 20000
+
+static int test_ramp(int fadein)
+{
+	int ret = 0;
+	jitter_t *out = jitter_init(JITTER_TYPE_RING, "test out", 32, TEST_NFRAMES * 4);
+	out->format = PCM_16bits_LE_stereo;
+	out->ctx->frequence = 44100;
+	out->ctx->thredhold = 1;
+	mixer_ctx_t *mixer = mixer_init(out, 0);
+	static int key;
+	mixer_input_t *input = mixer_attach(mixer, &key);
+	/// 100ms is 4410 frames, the ramp ends inside the 4th buffer
+	mixer_fade(mixer, &key, fadein, 100);
+	unsigned int length = 4410;
+
+	jitter_t *in = mixer_jitter(mixer, &key);
+	int n;
+	for (n = 0; n < 8; n++)
+	{
+		unsigned char *buffer = in->ops->pull(in->ctx);
+		int i;
+		for (i = 0; i < TEST_NFRAMES * 2; i++)
+		{
+			buffer[2 * i] = TEST_LEVEL & 0xFF;
+			buffer[2 * i + 1] = TEST_LEVEL >> 8;
+		}
+		in->ops->push(in->ctx, TEST_NFRAMES * 4, NULL);
+	}
+	mixer_release(input);
+
+	unsigned int frame = 0;
+	while (frame < 6 * TEST_NFRAMES && ret == 0)
+	{
+		unsigned char *buffer = out->ops->peer(out->ctx, NULL);
+		size_t size = out->ops->length(out->ctx);
+		size_t i;
+		for (i = 0; i + 4 <= size; i += 4, frame++)
+		{
+			int16_t sample = buffer[i] | (buffer[i + 1] << 8);
+			double angle = M_PI_2 * frame / length;
+			double level = fadein? sin(angle): cos(angle);
+			if (frame >= length)
+				level = fadein? 1.0: 0.0;
+			double reference = TEST_LEVEL * level;
+			if (fabs(sample - reference) > 2)
+			{
+				err("ramp %s: frame %u %d expected %.1f", fadein? "in": "out", frame, sample, reference);
+				ret = -1;
+				break;
+			}
+		}
+		out->ops->pop(out->ctx, size);
+	}
+	mixer_destroy(mixer);
+	jitter_destroy(out);
+	if (ret == 0)
+		warn("ramp %s: ok", fadein? "in": "out");
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+	if (test_saturate() < 0)
+		ret = 1;
+	if (test_boost(16) < 0)
+		ret = 1;
+	if (test_boost(24) < 0)
+		ret = 1;
+	if (test_ramp(1) < 0)
+		ret = 1;
+	if (test_ramp(0) < 0)
+		ret = 1;
+	return ret;
+}
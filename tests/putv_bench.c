@@ -0,0 +1,479 @@
+/*****************************************************************************
+ * putv_bench.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "player.h"
+#include "jitter.h"
+#include "filter.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "media.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#ifndef DEFAULT_SAMPLERATE
+#define DEFAULT_SAMPLERATE 44100
+#endif
+
+#define BENCH_NBUFFERS 2000
+#define BENCH_BUFFERSIZE 4608
+#define BENCH_FRAMESAMPLES 1152
+#define BENCH_OUTSIZE 16384
+
+/**
+ * The allocations are counted with the linker option
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+ * Only the calls from putv's objects are counted, not the calls
+ * from the codec libraries.
+ */
+static unsigned long g_allocs = 0;
+
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+}
+
+/**
+ * The decoders and the filter need some functions of the player.
+ * The benchmark replaces them.
+ */
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static int g_decoderend = 0;
+
+state_t player_state(player_ctx_t *ctx, state_t state)
+{
+	pthread_mutex_lock(&g_mutex);
+	g_decoderend = 1;
+	pthread_cond_broadcast(&g_cond);
+	pthread_mutex_unlock(&g_mutex);
+	return state;
+}
+
+typedef struct bench_s bench_t;
+struct bench_s
+{
+	const char *name;
+	struct timespec start;
+	struct rusage usage;
+	unsigned long allocs;
+	unsigned long nbuffers;
+	unsigned long nsamples;
+};
+
+static void bench_start(bench_t *bench, const char *name)
+{
+	memset(bench, 0, sizeof(*bench));
+	bench->name = name;
+	bench->allocs = __atomic_load_n(&g_allocs, __ATOMIC_RELAXED);
+	getrusage(RUSAGE_SELF, &bench->usage);
+	clock_gettime(CLOCK_MONOTONIC, &bench->start);
+}
+
+static void bench_stop(bench_t *bench)
+{
+	struct timespec stop;
+	struct rusage usage;
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	getrusage(RUSAGE_SELF, &usage);
+	unsigned long allocs = __atomic_load_n(&g_allocs, __ATOMIC_RELAXED) - bench->allocs;
+	double duration = (stop.tv_sec - bench->start.tv_sec) * 1000000000.0 +
+				(stop.tv_nsec - bench->start.tv_nsec);
+	long ctxsw = (usage.ru_nvcsw - bench->usage.ru_nvcsw) +
+				(usage.ru_nivcsw - bench->usage.ru_nivcsw);
+
+	double samplesrate = 0;
+	if (bench->nsamples > 0)
+		samplesrate = bench->nsamples * 1000000000.0 / duration;
+	double bufferns = 0;
+	if (bench->nbuffers > 0)
+		bufferns = duration / bench->nbuffers;
+	printf("%-24s %8lu buffers %12.0f samples/s %10.0f ns/buffer %8lu allocs %8ld ctxsw\n",
+			bench->name, bench->nbuffers, samplesrate, bufferns, allocs, ctxsw);
+}
+
+/**
+ * null sink: the buffers are dropped by the producer thread
+ */
+static int _bench_consume(void *arg, unsigned char *buffer, size_t size)
+{
+	bench_t *bench = (bench_t *)arg;
+	bench->nbuffers++;
+	return size;
+}
+
+typedef struct bench_jitter_s bench_jitter_t;
+struct bench_jitter_s
+{
+	jitter_t *jitter;
+	unsigned long nbuffers;
+};
+
+static void *_bench_producer(void *arg)
+{
+	bench_jitter_t *data = (bench_jitter_t *)arg;
+	jitter_t *jitter = data->jitter;
+	unsigned long i;
+	for (i = 0; i < data->nbuffers; i++)
+	{
+		unsigned char *buffer = jitter->ops->pull(jitter->ctx);
+		if (buffer == NULL)
+			break;
+		memset(buffer, i, jitter->ctx->size);
+		jitter->ops->push(jitter->ctx, jitter->ctx->size, NULL);
+	}
+	jitter->ops->pull(jitter->ctx);
+	jitter->ops->push(jitter->ctx, 0, NULL);
+	return NULL;
+}
+
+static void bench_jitter(int type, const char *name, unsigned long nbuffers)
+{
+	bench_t bench;
+	bench_jitter_t data;
+	pthread_t thread;
+
+	bench_start(&bench, name);
+	data.jitter = jitter_init(type, name, 6, BENCH_BUFFERSIZE);
+	data.jitter->format = PCM_16bits_LE_stereo;
+	/**
+	 * without thredhold the consumer runs until the last buffer
+	 */
+	if (type == JITTER_TYPE_SG)
+		data.jitter->ctx->thredhold = 0;
+	data.nbuffers = nbuffers;
+	pthread_create(&thread, NULL, _bench_producer, &data);
+
+	jitter_t *jitter = data.jitter;
+	while (bench.nbuffers < nbuffers)
+	{
+		unsigned char *buffer = jitter->ops->peer(jitter->ctx, NULL);
+		if (buffer == NULL)
+			break;
+		jitter->ops->pop(jitter->ctx, jitter->ctx->size);
+		bench.nbuffers++;
+	}
+	bench.nsamples = bench.nbuffers * BENCH_BUFFERSIZE / 4;
+	bench_stop(&bench);
+	pthread_join(thread, NULL);
+	jitter_destroy(jitter);
+}
+
+static void bench_filter(const char *query, unsigned long nbuffers)
+{
+	bench_t bench;
+	static sample_t samples[2][BENCH_FRAMESAMPLES];
+	int i;
+
+	/**
+	 * a stereo ramp of 24 bits samples as a decoder generates
+	 */
+	for (i = 0; i < BENCH_FRAMESAMPLES; i++)
+	{
+		samples[0][i] = (sample_t)((i * 7919) % 0x1000000) - 0x800000;
+		samples[1][i] = -samples[0][i];
+	}
+
+	jitter_t *out = jitter_init(JITTER_TYPE_SG, "bench filter", 6, BENCH_BUFFERSIZE);
+	out->format = PCM_16bits_LE_stereo;
+	out->ctx->frequence = DEFAULT_SAMPLERATE;
+	out->ctx->consume = _bench_consume;
+	out->ctx->consumer = &bench;
+
+	bench_start(&bench, query);
+	filter_t *filter = filter_build(query, out, NULL);
+	if (filter == NULL)
+	{
+		err("bench: filter %s not available", query);
+		jitter_destroy(out);
+		return;
+	}
+	rescale_t rescale;
+	rescale_init(&rescale, 0, out->format);
+	filter->ops->set(filter->ctx, FILTER_SAMPLED, rescale_cb, &rescale, 0);
+
+	while (bench.nbuffers < nbuffers)
+	{
+		filter_audio_t audio = {
+			.samples = {samples[0], samples[1]},
+			.nsamples = BENCH_FRAMESAMPLES,
+			.samplerate = DEFAULT_SAMPLERATE,
+			.bitspersample = 24,
+			.nchannels = 2,
+			.mode = 0,
+		};
+		bench.nsamples += audio.nsamples;
+		while (audio.nsamples > 0)
+		{
+			if (filter_filloutput(filter, &audio, out) < 0)
+				break;
+		}
+	}
+	bench_stop(&bench);
+	filter->ops->destroy(filter->ctx);
+	free(filter);
+	jitter_destroy(out);
+}
+
+static void bench_decoder(const decoder_ops_t *ops, const char *path)
+{
+	bench_t bench;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		err("bench: %s %s", path, strerror(errno));
+		return;
+	}
+	struct stat filestat;
+	fstat(fd, &filestat);
+	unsigned char *stream = malloc(filestat.st_size);
+	size_t length = read(fd, stream, filestat.st_size);
+	close(fd);
+
+	jitter_t *out = jitter_init(JITTER_TYPE_SG, "bench decoder", 6, BENCH_BUFFERSIZE);
+	out->format = PCM_16bits_LE_stereo;
+	out->ctx->frequence = 0;
+	out->ctx->consume = _bench_consume;
+	out->ctx->consumer = &bench;
+
+	bench_start(&bench, ops->name);
+	g_decoderend = 0;
+	decoder_ctx_t *ctx = ops->init(NULL);
+	jitter_t *in = ops->jitter(ctx, JITTE_HIGH);
+	filter_t *filter = filter_build("pcm", out, NULL);
+	ops->prepare(ctx, filter, NULL);
+	ops->run(ctx, out);
+
+	size_t offset = 0;
+	while (offset < length)
+	{
+		unsigned char *buffer = in->ops->pull(in->ctx);
+		if (buffer == NULL)
+			break;
+		size_t len = in->ctx->size;
+		if (len > length - offset)
+			len = length - offset;
+		memcpy(buffer, stream + offset, len);
+		in->ops->push(in->ctx, len, NULL);
+		offset += len;
+	}
+	in->ops->pull(in->ctx);
+	in->ops->push(in->ctx, 0, NULL);
+
+	pthread_mutex_lock(&g_mutex);
+	while (!g_decoderend)
+		pthread_cond_wait(&g_cond, &g_mutex);
+	pthread_mutex_unlock(&g_mutex);
+
+	bench.nsamples = bench.nbuffers * BENCH_BUFFERSIZE / 4;
+	bench_stop(&bench);
+	ops->destroy(ctx);
+	jitter_destroy(out);
+	free(stream);
+}
+
+static void *_bench_sink(void *arg)
+{
+	bench_jitter_t *data = (bench_jitter_t *)arg;
+	jitter_t *jitter = data->jitter;
+	while (1)
+	{
+		void *beat = NULL;
+		/**
+		 * the beat is requested to not wait the heartbeat
+		 */
+		unsigned char *buffer = jitter->ops->peer(jitter->ctx, &beat);
+		if (buffer == NULL)
+			break;
+		jitter->ops->pop(jitter->ctx, jitter->ops->length(jitter->ctx));
+		data->nbuffers++;
+	}
+	return NULL;
+}
+
+static void bench_encoder(const encoder_t *ops, const char *name, unsigned long nbuffers)
+{
+	bench_t bench;
+	bench_jitter_t data = {0};
+	pthread_t thread;
+
+	jitter_t *out = jitter_init(JITTER_TYPE_SG, "bench encoder", 6, BENCH_OUTSIZE);
+	out->format = SINK_BITSSTREAM;
+	out->ctx->frequence = 0;
+	data.jitter = out;
+	pthread_create(&thread, NULL, _bench_sink, &data);
+
+	bench_start(&bench, name);
+	encoder_ctx_t *ctx = ops->init(NULL);
+	jitter_t *in = ops->jitter(ctx);
+	in->ctx->frequence = DEFAULT_SAMPLERATE;
+	ops->run(ctx, out);
+
+	unsigned long i;
+	for (i = 0; i < nbuffers; i++)
+	{
+		short *buffer = (short *)in->ops->pull(in->ctx);
+		if (buffer == NULL)
+			break;
+		int j;
+		for (j = 0; j < in->ctx->size / sizeof(*buffer); j++)
+			buffer[j] = (short)((i * in->ctx->size + j) * 7919);
+		in->ops->push(in->ctx, in->ctx->size, NULL);
+		bench.nsamples += in->ctx->size / 4;
+	}
+	while (!in->ops->empty(in->ctx))
+		usleep(100);
+	bench.nbuffers = nbuffers;
+	bench_stop(&bench);
+	/**
+	 * the encoder thread runs until the end of the player,
+	 * it is released with the process.
+	 */
+}
+
+static const decoder_ops_t *bench_decodercheck(const char *path)
+{
+#ifdef DECODER_MAD
+	if (decoder_mad->check(path))
+		return decoder_mad;
+#endif
+#ifdef DECODER_FLAC
+	if (decoder_flac->check(path))
+		return decoder_flac;
+#endif
+#ifdef DECODER_FAAD2
+	if (decoder_faad2->check(path))
+		return decoder_faad2;
+#endif
+	return NULL;
+}
+
+#define OPTS "n:h"
+static void help(const char *name)
+{
+	fprintf(stderr, "%s [-n <nbbuffers>] [<file> ...]\n", name);
+	fprintf(stderr, "\t-n <nbbuffers>\tnumber of buffers for the synthetic streams (default %d)\n", BENCH_NBUFFERS);
+	fprintf(stderr, "\t<file>\tmp3, flac or aac file to benchmark the decoder\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long nbuffers = BENCH_NBUFFERS;
+	int opt;
+
+	do
+	{
+		opt = getopt(argc, argv, OPTS);
+		switch (opt)
+		{
+			case 'n':
+				nbuffers = strtoul(optarg, NULL, 10);
+			break;
+			case 'h':
+				help(argv[0]);
+				return -1;
+			break;
+		}
+	} while(opt != -1);
+
+	bench_jitter(JITTER_TYPE_SG, "jitter_sg", nbuffers);
+	bench_jitter(JITTER_TYPE_RING, "jitter_ring", nbuffers);
+
+	bench_filter("pcm", nbuffers);
+	bench_filter("pcm?boost=6", nbuffers);
+#ifdef FILTER_STATS
+	bench_filter("pcm?stats", nbuffers);
+#endif
+#ifdef FILTER_ONECHANNEL
+	bench_filter("pcm?mono=left", nbuffers);
+#endif
+#ifdef FILTER_MIXED
+	bench_filter("pcm?mono=mixed", nbuffers);
+#endif
+#ifdef FILTER_EQ
+	bench_filter("pcm?eq=l100:3,1000:-2:1.4", nbuffers);
+#endif
+#ifdef FILTER_DRC
+	bench_filter("pcm?drc", nbuffers);
+#endif
+
+	for (; optind < argc; optind++)
+	{
+		const decoder_ops_t *ops = bench_decodercheck(argv[optind]);
+		if (ops != NULL)
+			bench_decoder(ops, argv[optind]);
+		else
+			warn("bench: no decoder for %s", argv[optind]);
+	}
+
+	/**
+	 * the encoders are the last ones, their threads are never stopped
+	 */
+#ifdef ENCODER_LAME
+	bench_encoder(encoder_lame, "encoder_lame", nbuffers);
+#endif
+#ifdef ENCODER_FLAC
+	bench_encoder(encoder_flac, "encoder_flac", nbuffers);
+#endif
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*****************************************************************************
+ * status_client.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+
+#include "status.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+/// period of the display of the position in ms
+#define STATUS_PERIOD 1000
+
+static const status_t *_map(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		err("status: unable to open %s %s", path, strerror(errno));
+		return NULL;
+	}
+	const status_t *page = mmap(NULL, sizeof(status_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+	{
+		err("status: unable to map %s %s", path, strerror(errno));
+		return NULL;
+	}
+	if (page->magic != STATUS_MAGIC || page->version != STATUS_VERSION)
+	{
+		err("status: %s is not a status page", path);
+		munmap((void *)page, sizeof(status_t));
+		return NULL;
+	}
+	return page;
+}
+
+/**
+ * the daemon sends the eventfd of the notifications
+ * on the connection of "<page>.event".
+ */
+static int _subscribe(const char *path, int *sock)
+{
+	*sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (*sock < 0)
+		return -1;
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.event", path);
+	if (connect(*sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	{
+		err("status: socket %s error %s", addr.sun_path, strerror(errno));
+		close(*sock);
+		return -1;
+	}
+
+	char data = 0;
+	struct iovec iov = { .iov_base = &data, .iov_len = sizeof(data) };
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	int efd = -1;
+	if (recvmsg(*sock, &msg, MSG_CMSG_CLOEXEC) > 0)
+	{
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+			cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&efd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if (efd < 0)
+	{
+		err("status: client refused");
+		close(*sock);
+	}
+	return efd;
+}
+
+static void _print(const status_t *status)
+{
+	printf("state %d media %d position %u/%u volume %u changes %u\n",
+		status->state, status->mediaid, status->position,
+		status->duration, status->volume, status->changes);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		err("usage: %s <status page>", argv[0]);
+		return -1;
+	}
+	const status_t *page = _map(argv[1]);
+	if (page == NULL)
+		return -1;
+	int sock = -1;
+	int efd = _subscribe(argv[1], &sock);
+	if (efd < 0)
+		return -1;
+
+	status_t status;
+	status_read(page, &status);
+	_print(&status);
+	while (1)
+	{
+		struct pollfd fds[2] = {
+			{ .fd = efd, .events = POLLIN },
+			{ .fd = sock, .events = POLLIN },
+		};
+		int ret = poll(fds, 2, STATUS_PERIOD);
+		if (ret < 0 && errno != EINTR)
+			break;
+		/// the daemon closes the socket when it stops
+		if (ret > 0 && fds[1].revents)
+			break;
+		if (ret > 0 && (fds[0].revents & POLLIN))
+		{
+			uint64_t value;
+			if (read(efd, &value, sizeof(value)) < 0)
+				warn("status: event error %s", strerror(errno));
+		}
+		status_t copy;
+		status_read(page, &copy);
+		if (ret > 0 || copy.position != status.position ||
+			copy.volume != status.volume)
+			_print(&copy);
+		status = copy;
+	}
+	close(efd);
+	close(sock);
+	munmap((void *)page, sizeof(status_t));
+	return 0;
+}